@@ -15,3 +15,10 @@ linux64:
     ADDON_LIBS = libs/Vimba/lib/linux64/libVimbaC.so
     ADDON_LIBS += libs/Vimba/lib/linux64/libVimbaCPP.so
     ADDON_CPPFLAGS += -D_LINUX
+    ADDON_LDFLAGS = -lrt
+    # Compressed recording, needs liblz4-dev and libzstd-dev
+    # ADDON_CPPFLAGS += -DOOSVIM_LZ4 -DOOSVIM_ZSTD
+    # ADDON_LDFLAGS += -llz4 -lzstd
+    # JPEG and PNG previews, needs libturbojpeg0-dev and libpng-dev
+    # ADDON_CPPFLAGS += -DOOSVIM_TURBOJPEG -DOOSVIM_PNG
+    # ADDON_LDFLAGS += -lturbojpeg -lpng
@@ -0,0 +1,776 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Standalone benchmark of the OosVim acquisition pipeline. A synthetic source
+// injects frames into a Stream, the frame callback copies them through a
+// Handoff like ofxVimba::Grabber does, and a consumer thread picks them up
+// like a render loop. No camera or openFrameworks is needed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#include "OosVim/Change.h"
+#include "OosVim/Color.h"
+#include "OosVim/Correction.h"
+#include "OosVim/Device.h"
+#include "OosVim/Downsample.h"
+#include "OosVim/Event.h"
+#include "OosVim/Handoff.h"
+#include "OosVim/Hdr.h"
+#include "OosVim/Recorder.h"
+#include "OosVim/Remap.h"
+#include "OosVim/Stream.h"
+#include "OosVim/Trace.h"
+#include "OosVim/Trigger.h"
+#include "OosVim/Unpack.h"
+
+// -- ALLOCATIONS --------------------------------------------------------------
+
+static std::atomic<uint64_t> allocationCount(0);
+
+// Every form of new and delete is replaced, so array, nothrow and aligned
+// allocations are counted and always freed by their own allocator. They are
+// kept out of line, GCC would otherwise pair an inlined delete with the
+// built-in new and warn about a mismatch.
+#if defined(__GNUC__)
+#define REPLACEMENT __attribute__((noinline))
+#else
+#define REPLACEMENT
+#endif
+
+static void* allocate(size_t size) noexcept {
+  allocationCount++;
+  return std::malloc(size ? size : 1);
+}
+
+// Types aligned beyond the default of new take these, they are counted as well
+static void* allocate(size_t size, std::align_val_t alignment) noexcept {
+  allocationCount++;
+  size_t bytes = static_cast<size_t>(alignment);
+  void* ptr = nullptr;
+#if defined(_WIN32)
+  ptr = _aligned_malloc(size ? size : 1, bytes);
+#else
+  if (posix_memalign(&ptr, (std::max)(bytes, sizeof(void*)), size ? size : 1) != 0) ptr = nullptr;
+#endif
+  return ptr;
+}
+
+static void release(void* ptr) noexcept { std::free(ptr); }
+
+static void release(void* ptr, std::align_val_t) noexcept {
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+REPLACEMENT void* operator new(size_t size) {
+  if (void* ptr = allocate(size)) return ptr;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new[](size_t size) {
+  if (void* ptr = allocate(size)) return ptr;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+REPLACEMENT void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+
+REPLACEMENT void operator delete(void* ptr) noexcept { release(ptr); }
+REPLACEMENT void operator delete[](void* ptr) noexcept { release(ptr); }
+REPLACEMENT void operator delete(void* ptr, size_t) noexcept { release(ptr); }
+REPLACEMENT void operator delete[](void* ptr, size_t) noexcept { release(ptr); }
+REPLACEMENT void operator delete(void* ptr, const std::nothrow_t&) noexcept { release(ptr); }
+REPLACEMENT void operator delete[](void* ptr, const std::nothrow_t&) noexcept { release(ptr); }
+
+REPLACEMENT void* operator new(size_t size, std::align_val_t alignment) {
+  if (void* ptr = allocate(size, alignment)) return ptr;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new[](size_t size, std::align_val_t alignment) {
+  if (void* ptr = allocate(size, alignment)) return ptr;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return allocate(size, alignment);
+}
+REPLACEMENT void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return allocate(size, alignment);
+}
+
+REPLACEMENT void operator delete(void* ptr, std::align_val_t alignment) noexcept { release(ptr, alignment); }
+REPLACEMENT void operator delete[](void* ptr, std::align_val_t alignment) noexcept { release(ptr, alignment); }
+REPLACEMENT void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { release(ptr, alignment); }
+REPLACEMENT void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept {
+  release(ptr, alignment);
+}
+REPLACEMENT void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  release(ptr, alignment);
+}
+REPLACEMENT void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  release(ptr, alignment);
+}
+
+// -- SETTINGS -----------------------------------------------------------------
+
+struct Settings {
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  std::string format = "Mono8";
+  double rate = 0;             // frames per second, 0 is as fast as possible
+  double consumerRate = 60;    // pickups per second, 0 is as fast as possible
+  size_t frames = 2000;
+  size_t warmup = 100;
+  unsigned int decimation = 1;  // deliver every nth frame
+  unsigned int downsample = 1;  // box filter factor of the copy, 1, 2 or 4
+  std::string label = "";
+  std::string trace = "";       // Chrome trace file, needs a build with TRACE=1
+  std::string record = "";      // recording file, empty does not record
+  std::string codec = "lz4";    // none, lz4 or zstd, needs a build with LZ4=1 or ZSTD=1
+  std::string correction = "";  // path prefix of synthetic calibration maps, empty copies uncorrected
+  size_t remap = 0;             // threads that undistort the copy, 0 copies as is
+  std::string color = "";       // .cube file or "identity" for a color pipeline with a 3D LUT, "gamma" without
+  size_t colorThreads = 1;      // threads of the color pipeline
+  double change = 0;            // threshold of a change detector that skips unchanged frames, 0 delivers all
+  size_t hdr = 0;               // threads that merge pairs of bracketed frames, 0 does not merge
+  double trigger = 0;           // rate of a trigger scheduler without cameras next to the stream, 0 does not trigger
+  bool events = false;          // inject an ExposureEnd event before every frame and match them
+  bool verify = false;          // compare the packed unpack kernels with a scalar reference instead of measuring
+  std::string output = "benchmark.json";
+};
+
+struct Format {
+  std::string name;
+  VmbPixelFormatType type;
+  uint32_t bitsPerPixel;
+};
+
+static const Format FORMATS[] = {
+    {"Mono8", VmbPixelFormatMono8, 8},
+    {"Mono12", VmbPixelFormatMono12, 16},
+    {"Mono12p", VmbPixelFormatMono12p, 12},
+    {"Mono16", VmbPixelFormatMono16, 16},
+    {"RGB8", VmbPixelFormatRgb8, 24},
+    {"BGR8", VmbPixelFormatBgr8, 24},
+    {"BayerRG8", VmbPixelFormatBayerRG8, 8},
+};
+
+static bool parse(int argc, char** argv, Settings& settings) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string key = argv[i];
+    std::string value = argv[i + 1];
+    try {
+      if (key == "--width") settings.width = std::stoul(value);
+      else if (key == "--height") settings.height = std::stoul(value);
+      else if (key == "--format") settings.format = value;
+      else if (key == "--rate") settings.rate = std::stod(value);
+      else if (key == "--consumer-rate") settings.consumerRate = std::stod(value);
+      else if (key == "--frames") settings.frames = std::stoul(value);
+      else if (key == "--warmup") settings.warmup = std::stoul(value);
+      else if (key == "--decimation") settings.decimation = std::stoul(value);
+      else if (key == "--downsample") settings.downsample = std::stoul(value);
+      else if (key == "--label") settings.label = value;
+      else if (key == "--trace") settings.trace = value;
+      else if (key == "--record") settings.record = value;
+      else if (key == "--codec") settings.codec = value;
+      else if (key == "--correction") settings.correction = value;
+      else if (key == "--remap") settings.remap = std::stoul(value);
+      else if (key == "--color") settings.color = value;
+      else if (key == "--color-threads") settings.colorThreads = std::stoul(value);
+      else if (key == "--change") settings.change = std::stod(value);
+      else if (key == "--hdr") settings.hdr = std::stoul(value);
+      else if (key == "--trigger") settings.trigger = std::stod(value);
+      else if (key == "--events") settings.events = value == "1" || value == "true";
+      else if (key == "--verify") settings.verify = value == "1" || value == "true";
+      else if (key == "--output") settings.output = value;
+      else return false;
+    } catch (const std::exception&) {
+      std::cerr << "Invalid value " << value << " for " << key << std::endl;
+      return false;
+    }
+  }
+  return argc % 2 == 1;
+}
+
+static void usage() {
+  std::cout << "usage: benchmark [--width 1920] [--height 1080] [--format Mono8|Mono12|Mono12p|Mono16|RGB8|BGR8|BayerRG8]" << std::endl
+            << "                 [--rate 0] [--consumer-rate 60] [--frames 2000] [--warmup 100]" << std::endl
+            << "                 [--decimation 1] [--downsample 1|2|4] [--label name] [--output benchmark.json]" << std::endl
+            << "                 [--trace trace.json] [--record record.oos] [--codec none|lz4|zstd]" << std::endl
+            << "                 [--correction /tmp/calibration] [--remap 0] (8 bit without downsample)" << std::endl
+            << "                 [--color gamma|identity|lut.cube] [--color-threads 1] (BayerRG8, RGB8 or BGR8)" << std::endl
+            << "                 [--change 0] (the scene changes every 10th frame)" << std::endl
+            << "                 [--hdr 0] (Mono8, Mono12, Mono16, BayerRG8, RGB8 or BGR8)" << std::endl
+            << "                 [--trigger 0] (timer jitter only, no cameras are triggered)" << std::endl
+            << "                 [--events 0|1]" << std::endl
+            << "       benchmark --verify 1" << std::endl;
+}
+
+// -- MEASUREMENT --------------------------------------------------------------
+
+static uint64_t now() {
+  auto time = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+struct Stage {
+  std::string name;
+  std::vector<uint64_t> samples;
+
+  Stage(std::string name, size_t capacity) : name(name) { samples.reserve(capacity); }
+  void add(uint64_t duration) {
+    if (samples.size() < samples.capacity()) samples.push_back(duration);
+  }
+};
+
+static double percentile(const std::vector<uint64_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[index] / 1e3;
+}
+
+static std::string summarize(const Stage& stage) {
+  auto sorted = stage.samples;
+  std::sort(sorted.begin(), sorted.end());
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2) << "{\"samples\": " << sorted.size()
+      << ", \"p50\": " << percentile(sorted, 0.5) << ", \"p90\": " << percentile(sorted, 0.9)
+      << ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << percentile(sorted, 1.0) << "}";
+  return out.str();
+}
+
+// The stages that need a particular format or exclude each other
+static bool validate(const Settings& settings, const Format& format) {
+  uint32_t channels = OosVim::getDownsampleChannels(format.type);
+  if (settings.downsample > 1 && (channels == 0 || (settings.downsample != 2 && settings.downsample != 4))) {
+    return false;
+  }
+  if (!settings.correction.empty() && (format.type != VmbPixelFormatMono8 || settings.downsample > 1)) return false;
+  if (settings.remap > 0 && (channels == 0 || settings.downsample > 1)) return false;
+  if (!settings.color.empty() && (!OosVim::ColorPipeline::isSupported(format.type) || settings.downsample > 1)) {
+    return false;
+  }
+  if (settings.hdr > 0 && !OosVim::HdrMerger::isSupported(format.type)) return false;
+  return true;
+}
+
+// -- REPORT -------------------------------------------------------------------
+
+// Fields of the JSON report in the order they are added
+class Report {
+ public:
+  template <typename T>
+  void add(const std::string& key, const T& value) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << value;
+    fields.emplace_back(key, out.str());
+  }
+  void addText(const std::string& key, const std::string& value) { fields.emplace_back(key, "\"" + value + "\""); }
+  void addFlag(const std::string& key, bool value) { fields.emplace_back(key, value ? "true" : "false"); }
+  void addJson(const std::string& key, const std::string& json) { fields.emplace_back(key, json); }
+
+  std::string str() const {
+    std::ostringstream out;
+    out << "{" << std::endl;
+    for (size_t i = 0; i < fields.size(); i++) {
+      out << "  \"" << fields[i].first << "\": " << fields[i].second << (i + 1 < fields.size() ? "," : "")
+          << std::endl;
+    }
+    out << "}" << std::endl;
+    return out.str();
+  }
+
+ private:
+  std::vector<std::pair<std::string, std::string>> fields;
+};
+
+// -- PIPELINE -----------------------------------------------------------------
+
+struct Image {
+  std::vector<unsigned char> data;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint64_t injectedAt = 0;
+};
+
+// The optional stages next to the copy, as the grabber runs them
+struct Pipeline {
+  std::shared_ptr<OosVim::ChangeDetector> changeDetector;
+  std::shared_ptr<OosVim::Recorder> recorder;
+  std::shared_ptr<OosVim::Correction> correction;
+  std::shared_ptr<OosVim::Remapper> remapper;
+  std::shared_ptr<OosVim::ColorPipeline> colorPipeline;
+  std::shared_ptr<OosVim::HdrMerger> hdrMerger;
+  std::shared_ptr<OosVim::TriggerScheduler> scheduler;
+  std::shared_ptr<OosVim::EventChannel> eventChannel;
+};
+
+static bool createPipeline(const Settings& settings, Pipeline& pipeline) {
+  if (settings.change > 0) {
+    OosVim::ChangeSettings changeSettings;
+    changeSettings.threshold = static_cast<float>(settings.change);
+    changeSettings.skipUnchanged = true;
+    pipeline.changeDetector = std::make_shared<OosVim::ChangeDetector>(changeSettings);
+  }
+
+  if (!settings.record.empty()) {
+    OosVim::RecordSettings recordSettings;
+    if (settings.codec == "none") recordSettings.codec = OosVim::RecordCodec::None;
+    else if (settings.codec == "zstd") recordSettings.codec = OosVim::RecordCodec::Zstd;
+    pipeline.recorder = std::make_shared<OosVim::Recorder>(settings.record, recordSettings);
+  }
+
+  // Synthetic calibration maps, the corrected copy replaces the plain copy
+  if (!settings.correction.empty()) {
+    const uint32_t pixels = settings.width * settings.height;
+    std::vector<uint16_t> dark(pixels), gain(pixels);
+    std::vector<uint32_t> defects;
+    for (uint32_t i = 0; i < pixels; i++) {
+      dark[i] = static_cast<uint16_t>(i * 13 % 8);
+      gain[i] = static_cast<uint16_t>(OosVim::CORRECTION_GAIN_ONE - 256 + i * 29 % 512);
+      if (i % 997 == 0) defects.push_back(i);
+    }
+    using OosVim::CalibrationMap;
+    using OosVim::CalibrationType;
+    auto correction = std::make_shared<OosVim::Correction>();
+    bool valid = CalibrationMap::save(settings.correction + ".dark", CalibrationType::Dark, settings.width,
+                                      settings.height, dark.data(), pixels) &&
+                 CalibrationMap::save(settings.correction + ".gain", CalibrationType::Gain, settings.width,
+                                      settings.height, gain.data(), pixels) &&
+                 CalibrationMap::save(settings.correction + ".defects", CalibrationType::Defects, settings.width,
+                                      settings.height, defects.data(), static_cast<uint32_t>(defects.size())) &&
+                 correction->loadDark(settings.correction + ".dark") &&
+                 correction->loadGain(settings.correction + ".gain") &&
+                 correction->loadDefects(settings.correction + ".defects");
+    if (!valid) {
+      std::cerr << "Failed to write the calibration maps" << std::endl;
+      return false;
+    }
+    pipeline.correction = correction;
+  }
+
+  // A synthetic lens, the remap replaces the plain copy like in ofxVimba
+  if (settings.remap > 0) {
+    OosVim::LensModel lens;
+    lens.width = settings.width;
+    lens.height = settings.height;
+    lens.fx = lens.fy = settings.width * 0.75;
+    lens.cx = settings.width / 2.0;
+    lens.cy = settings.height / 2.0;
+    lens.k1 = -0.2;
+    lens.k2 = 0.05;
+    pipeline.remapper = std::make_shared<OosVim::Remapper>(settings.remap);
+    pipeline.remapper->setLens(lens);
+  }
+
+  // The color conversion replaces the plain copy like in ofxVimba
+  if (!settings.color.empty()) {
+    OosVim::ColorSettings colorSettings;
+    colorSettings.whiteBalance = {{1.4f, 1.0f, 1.6f}};
+    colorSettings.matrix = {{1.6f, -0.4f, -0.2f, -0.3f, 1.5f, -0.2f, -0.1f, -0.5f, 1.6f}};
+    colorSettings.gamma = 2.2f;
+    pipeline.colorPipeline = std::make_shared<OosVim::ColorPipeline>(colorSettings, settings.colorThreads);
+    if (settings.color == "identity") {
+      pipeline.colorPipeline->setLut(std::make_shared<OosVim::ColorLut>());
+    } else if (settings.color != "gamma" && !pipeline.colorPipeline->loadLut(settings.color)) {
+      std::cerr << "Failed to load " << settings.color << std::endl;
+      return false;
+    }
+  }
+
+  // Frames alternate between two exposures, the merge runs next to the copy
+  // like in Grabber::receiveFrame
+  if (settings.hdr > 0) {
+    OosVim::HdrSettings hdrSettings;
+    hdrSettings.exposures = {4000, 1000};
+    hdrSettings.threads = settings.hdr;
+    pipeline.hdrMerger = std::make_shared<OosVim::HdrMerger>(hdrSettings);
+  }
+
+  // The timer competes with the stream for the cores like in a triggered setup
+  if (settings.trigger > 0) {
+    OosVim::TriggerSettings triggerSettings;
+    triggerSettings.rate = settings.trigger;
+    pipeline.scheduler = std::make_shared<OosVim::TriggerScheduler>(triggerSettings);
+    pipeline.scheduler->start();
+  }
+
+  // Events arrive ahead of their frames like ExposureEnd does
+  if (settings.events) pipeline.eventChannel = std::make_shared<OosVim::EventChannel>();
+  return true;
+}
+
+// Mirrors ofxVimba::Grabber::streamFrameCallBack, falls back to a plain copy
+// like it does. The color conversion is timed on its own when a stage is
+// given.
+static void copyFrame(const Settings& settings, const Pipeline& pipeline, uint32_t channels,
+                      const OosVim::Frame& frame, Image& image, Stage* color = nullptr) {
+  image.width = frame.getWidth();
+  image.height = frame.getHeight();
+  uint32_t bitDepth = OosVim::getUnpackBitDepth(frame.getImageFormat());
+  if (bitDepth > 0) {
+    // Mirrors the ofShortPixels path of ofxVimba
+    image.data.resize(image.width * image.height * OosVim::getUnpackChannels(frame.getImageFormat()) * 2);
+    OosVim::unpack(frame.getImageData(), image.width, image.height, frame.getImageFormat(), true,
+                   reinterpret_cast<uint16_t*>(image.data.data()));
+    return;
+  }
+  if (pipeline.colorPipeline) {
+    image.data.resize(image.width * image.height * 3);
+    uint64_t start = now();
+    bool converted = pipeline.colorPipeline->convert(frame, image.data.data());
+    if (color) color->add(now() - start);
+    if (converted) return;
+  }
+  if (pipeline.remapper) {
+    image.data.resize(frame.getImageSize());
+    if (pipeline.remapper->remap(frame, image.data.data())) return;
+  }
+  if (settings.downsample > 1) {
+    image.width = frame.getWidth() / settings.downsample;
+    image.height = frame.getHeight() / settings.downsample;
+    image.data.resize(image.width * image.height * channels);
+    OosVim::downsample(frame.getImageData(), frame.getWidth(), frame.getHeight(), channels, settings.downsample,
+                       image.data.data());
+    return;
+  }
+  image.data.resize(frame.getImageSize());
+  if (!pipeline.correction ||
+      !pipeline.correction->apply(frame.getImageData(), frame.getWidth(), frame.getHeight(), frame.getImageFormat(),
+                                  frame.getImageSize(), image.data.data())) {
+    std::memcpy(image.data.data(), frame.getImageData(), frame.getImageSize());
+  }
+}
+
+// -- SOURCE -------------------------------------------------------------------
+
+struct Measurement {
+  double seconds = 0;
+  double cpu = 0;
+  uint64_t allocations = 0;
+  uint64_t frameAllocations = 0;
+  uint64_t dropped = 0;
+  Stage dispatch;
+
+  Measurement(size_t capacity) : dispatch("dispatch", capacity) {}
+};
+
+// Injects the warmup and the measured frames, the measurement starts after
+// the warmup
+static void inject(const Settings& settings, const Format& format, const Pipeline& pipeline, OosVim::Stream& stream,
+                   OosVim::Handoff<Image>& handoff, std::atomic<bool>& measuring, Measurement& result) {
+  const uint32_t size = settings.width * settings.height * format.bitsPerPixel / 8;
+  const size_t total = settings.warmup + settings.frames;
+
+  // Synthetic announced buffers
+  std::vector<std::vector<unsigned char>> buffers(4, std::vector<unsigned char>(size));
+  for (size_t b = 0; b < buffers.size(); b++) {
+    for (uint32_t i = 0; i < size; i++) buffers[b][i] = static_cast<unsigned char>(i * 7 + b * 31);
+  }
+
+  uint64_t allocationsAtStart = 0;
+  uint64_t framesAtStart = 0;
+  std::clock_t cpuAtStart = 0;
+  uint64_t timeAtStart = 0;
+  uint64_t droppedAtStart = 0;
+
+  OOSVIM_TRACE_THREAD("Source");
+  auto next = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < total; i++) {
+    if (i == settings.warmup) {
+      measuring = true;
+      allocationsAtStart = allocationCount.load();
+      framesAtStart = stream.getFrameAllocations();
+      droppedAtStart = handoff.getDropped();
+      cpuAtStart = std::clock();
+      timeAtStart = now();
+    }
+
+    if (settings.rate > 0) {
+      next += std::chrono::nanoseconds(static_cast<uint64_t>(1e9 / settings.rate));
+      std::this_thread::sleep_until(next);
+    }
+
+    // A mostly static scene for the change detector
+    auto& buffer = buffers[(pipeline.changeDetector ? i / 10 : i) % buffers.size()];
+    uint64_t start = now();
+    OosVim::Chunk chunk;
+    if (pipeline.hdrMerger) {
+      chunk.valid = true;
+      chunk.frameCount = i;
+      chunk.exposure = i % 2 == 0 ? 4000 : 1000;
+    }
+    if (pipeline.eventChannel) {
+      OosVim::CameraEvent event;
+      event.frameId = i;
+      event.timestamp = start;
+      event.hostTime = start;
+      pipeline.eventChannel->inject(event);
+    }
+    stream.inject(buffer.data(), settings.width, settings.height, format.type, size, i, start, chunk);
+    if (measuring) result.dispatch.add(now() - start);
+  }
+
+  result.seconds = (now() - timeAtStart) / 1e9;
+  result.cpu = static_cast<double>(std::clock() - cpuAtStart) / CLOCKS_PER_SEC;
+  result.allocations = allocationCount.load() - allocationsAtStart;
+  result.frameAllocations = stream.getFrameAllocations() - framesAtStart;
+  result.dropped = handoff.getDropped() - droppedAtStart;
+}
+
+static std::string report(const Settings& settings, const Format& format, const Pipeline& pipeline,
+                          const OosVim::Stream& stream, const Measurement& result,
+                          const std::vector<const Stage*>& stages) {
+  const uint32_t size = settings.width * settings.height * format.bitsPerPixel / 8;
+  const double frames = static_cast<double>(settings.frames);
+  const auto& recorder = pipeline.recorder;
+  const auto& hdrMerger = pipeline.hdrMerger;
+  const auto& scheduler = pipeline.scheduler;
+  const auto& eventChannel = pipeline.eventChannel;
+
+  Report json;
+  json.addText("label", settings.label);
+  json.add("width", settings.width);
+  json.add("height", settings.height);
+  json.addText("format", format.name);
+  json.add("rate", settings.rate);
+  json.add("consumerRate", settings.consumerRate);
+  json.add("decimation", settings.decimation);
+  json.add("downsample", settings.downsample);
+  json.addFlag("correction", pipeline.correction != nullptr);
+  json.add("remapThreads", settings.remap);
+  json.addText("color", settings.color);
+  json.add("colorThreads", pipeline.colorPipeline ? settings.colorThreads : 0);
+  json.add("changeThreshold", settings.change);
+  json.add("unchanged", stream.getUnchanged());
+  json.add("hdrThreads", settings.hdr);
+  json.add("hdrMerged", hdrMerger ? hdrMerger->getMerged() : 0);
+  json.add("hdrSkipped", hdrMerger ? hdrMerger->getSkipped() : 0);
+  json.add("hdrMergeUs", hdrMerger ? hdrMerger->getMergeTimes().getPercentile(0.5) / 1e3 : 0);
+  json.add("triggerRate", settings.trigger);
+  json.add("triggerIssued", scheduler ? scheduler->getIssued() : 0);
+  json.add("triggerMissed", scheduler ? scheduler->getMissed() : 0);
+  std::ostringstream jitter;
+  jitter << std::fixed << std::setprecision(3)
+         << "{\"p50\": " << (scheduler ? scheduler->getJitter().getPercentile(0.5) / 1e3 : 0)
+         << ", \"p99\": " << (scheduler ? scheduler->getJitter().getPercentile(0.99) / 1e3 : 0) << "}";
+  json.addJson("triggerJitterUs", jitter.str());
+  json.add("eventsMatched", eventChannel ? eventChannel->getMatched() : 0);
+  json.add("eventsUnmatched", eventChannel ? eventChannel->getUnmatched() : 0);
+  json.add("eventDelayUs",
+           eventChannel ? eventChannel->getDelay(OosVim::CameraEventType::ExposureEnd).getPercentile(0.5) / 1e3 : 0);
+  json.add("frames", settings.frames);
+  json.add("seconds", result.seconds);
+  json.add("framesPerSecond", frames / result.seconds);
+  json.add("megabytesPerSecond", frames * size / result.seconds / 1e6);
+  json.add("allocationsPerFrame", result.allocations / frames);
+  json.add("frameAllocations", result.frameAllocations);
+  json.add("cpuPerFrameUs", result.cpu / frames * 1e6);
+  json.add("dropped", result.dropped);
+  json.add("recorded", recorder ? recorder->getRecorded() : 0);
+  json.add("recordDropped", recorder ? recorder->getDropped() : 0);
+  json.add("recordFailed", recorder ? recorder->getFailed() : 0);
+  json.add("compressionRatio", recorder ? recorder->getRatio() : 0);
+
+  std::ostringstream summary;
+  summary << "{" << std::endl;
+  for (size_t i = 0; i < stages.size(); i++) {
+    summary << "    \"" << stages[i]->name << "\": " << summarize(*stages[i]) << (i + 1 < stages.size() ? "," : "")
+            << std::endl;
+  }
+  summary << "  }";
+  json.addJson("stagesUs", summary.str());
+  return json.str();
+}
+
+// -- VERIFY -------------------------------------------------------------------
+
+// Reference packers, written from the format definitions and independent of
+// the unpack kernels. Mono10p and Mono12p are little endian bit streams,
+// Mono12Packed stores the high bits of two values in the first and the last
+// byte and their low nibbles in the middle byte.
+static std::vector<unsigned char> pack(const std::vector<uint16_t>& values, VmbPixelFormatType format) {
+  if (format == VmbPixelFormatMono12Packed) {
+    std::vector<unsigned char> packed((values.size() * 3 + 1) / 2);
+    for (size_t i = 0; i < values.size(); i++) {
+      unsigned char* pair = packed.data() + i / 2 * 3;
+      if (i % 2 == 0) {
+        pair[0] = static_cast<unsigned char>(values[i] >> 4);
+        pair[1] = static_cast<unsigned char>((pair[1] & 0xF0) | (values[i] & 0x0F));
+      } else {
+        pair[1] = static_cast<unsigned char>((pair[1] & 0x0F) | (values[i] & 0x0F) << 4);
+        pair[2] = static_cast<unsigned char>(values[i] >> 4);
+      }
+    }
+    return packed;
+  }
+
+  const uint32_t bits = OosVim::getUnpackBitDepth(format);
+  std::vector<unsigned char> packed((values.size() * bits + 7) / 8);
+  for (size_t i = 0; i < values.size(); i++) {
+    for (uint32_t b = 0; b < bits; b++) {
+      size_t bit = i * bits + b;
+      if (values[i] >> b & 1) packed[bit / 8] |= static_cast<unsigned char>(1 << (bit % 8));
+    }
+  }
+  return packed;
+}
+
+// Unpacks random values of every packed format at sizes that end in the
+// scalar tail of the kernels and at full frame sizes, with and without scale
+static bool verifyUnpack() {
+  const Format formats[] = {
+      {"Mono10p", VmbPixelFormatMono10p, 10},
+      {"Mono12p", VmbPixelFormatMono12p, 12},
+      {"Mono12Packed", VmbPixelFormatMono12Packed, 12},
+  };
+  std::vector<std::pair<uint32_t, uint32_t>> sizes;
+  for (uint32_t width = 1; width <= 48; width++) {
+    sizes.emplace_back(width, 1);
+    sizes.emplace_back(width, 3);
+  }
+  sizes.emplace_back(1920, 1080);
+  sizes.emplace_back(2048, 1536);
+  sizes.emplace_back(1921, 7);
+
+  std::mt19937 random(1);
+  bool valid = true;
+  for (auto& format : formats) {
+    const uint32_t bits = format.bitsPerPixel;
+    size_t checked = 0, mismatches = 0;
+    for (auto& size : sizes) {
+      std::vector<uint16_t> values(size_t(size.first) * size.second);
+      for (auto& value : values) value = static_cast<uint16_t>(random() & ((1u << bits) - 1));
+      std::vector<unsigned char> packed = pack(values, format.type);
+
+      for (bool scale : {false, true}) {
+        const uint32_t shift = scale ? 16 - bits : 0;
+        std::vector<uint16_t> unpacked(values.size());
+        OosVim::unpack(packed.data(), size.first, size.second, format.type, scale, unpacked.data());
+        for (size_t i = 0; i < values.size(); i++) {
+          if (unpacked[i] == static_cast<uint16_t>(values[i] << shift)) continue;
+          if (mismatches++ < 4) {
+            std::cerr << "Mismatch at " << size.first << "x" << size.second << (scale ? " scaled" : "") << " value "
+                      << i << ": " << unpacked[i] << " instead of " << (values[i] << shift) << std::endl;
+          }
+        }
+        checked += values.size();
+      }
+    }
+    std::cout << format.name << ": " << checked << " values, " << mismatches << " mismatches" << std::endl;
+    valid = valid && mismatches == 0;
+  }
+  return valid;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  if (!parse(argc, argv, settings)) {
+    usage();
+    return 1;
+  }
+  if (settings.verify) return verifyUnpack() ? 0 : 1;
+
+  auto format = std::find_if(std::begin(FORMATS), std::end(FORMATS),
+                             [&](const Format& f) { return f.name == settings.format; });
+  if (format == std::end(FORMATS)) {
+    usage();
+    return 1;
+  }
+
+  uint32_t channels = OosVim::getDownsampleChannels(format->type);
+  if (!validate(settings, *format)) {
+    usage();
+    return 1;
+  }
+
+  Pipeline pipeline;
+  if (!createPipeline(settings, pipeline)) return 1;
+
+  const size_t total = settings.warmup + settings.frames;
+  Stage receive("receive", total);
+  Stage copy("copy", total);
+  Stage color("color", total);
+  Stage pickup("pickup", total);
+  Measurement result(total);
+
+  auto device = std::make_shared<OosVim::Device>(AVT::VmbAPI::CameraPtr());
+  OosVim::Stream stream(device);
+  stream.setDecimation(settings.decimation);
+  if (pipeline.changeDetector) stream.setChangeDetector(pipeline.changeDetector);
+  OosVim::Handoff<Image> handoff;
+
+  // The frame callback mirrors ofxVimba::Grabber::streamFrameCallBack
+  std::atomic<bool> measuring(false);
+  stream.setFrameCallback([&](const std::shared_ptr<OosVim::Frame> frame) {
+    uint64_t start = now();
+    auto image = handoff.acquire();
+    copyFrame(settings, pipeline, channels, *frame, *image, measuring ? &color : nullptr);
+    image->injectedAt = frame->getTimestamp();
+    handoff.publish(image);
+    if (pipeline.recorder) pipeline.recorder->record(*frame);
+    if (pipeline.hdrMerger) pipeline.hdrMerger->submit(*frame);
+    if (pipeline.eventChannel) pipeline.eventChannel->recordFrame(*frame);
+    if (measuring) {
+      receive.add(start - frame->getTimestamp());
+      copy.add(now() - start);
+    }
+  });
+
+  // The consumer mirrors ofxVimba::Grabber::update from the render loop
+  std::atomic<bool> consuming(true);
+  std::thread consumer([&]() {
+    OOSVIM_TRACE_THREAD("Consumer");
+    std::shared_ptr<Image> current;
+    auto next = std::chrono::steady_clock::now();
+    while (consuming) {
+      if (settings.consumerRate > 0) {
+        next += std::chrono::nanoseconds(static_cast<uint64_t>(1e9 / settings.consumerRate));
+        std::this_thread::sleep_until(next);
+      } else {
+        std::this_thread::yield();
+      }
+      OOSVIM_TRACE_SCOPE("pickup");
+      if (handoff.take(current) && measuring) pickup.add(now() - current->injectedAt);
+    }
+  });
+
+  inject(settings, *format, pipeline, stream, handoff, measuring, result);
+
+  if (pipeline.scheduler) pipeline.scheduler->stop();
+  measuring = false;
+  consuming = false;
+  consumer.join();
+  stream.setFrameCallback();
+  if (pipeline.recorder) pipeline.recorder->close();
+
+  std::vector<const Stage*> stages = {&receive, &copy, &result.dispatch, &pickup};
+  if (pipeline.colorPipeline) stages.insert(stages.begin() + 2, &color);
+  std::string json = report(settings, *format, pipeline, stream, result, stages);
+
+  if (!settings.trace.empty() && !OosVim::Trace::write(settings.trace)) {
+    std::cerr << "No trace written, build with TRACE=1" << std::endl;
+  }
+
+  std::cout << json;
+  std::ofstream file(settings.output);
+  file << json;
+  return file.good() ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+
+namespace OosVim {
+
+static const size_t BUFFER_DEFAULT_ALIGNMENT = 4096;
+static const size_t BUFFER_HUGE_PAGE_SIZE = 2 << 20;
+
+struct BufferPolicy {
+  size_t alignment = BUFFER_DEFAULT_ALIGNMENT;
+  bool hugePages = false;         // 2MB pages, falls back to transparent huge pages
+  int numaNode = -1;              // -1 allocates on any node
+  std::string networkInterface;   // resolves the NUMA node of the NIC when numaNode is -1
+
+  bool operator==(const BufferPolicy& other) const {
+    return alignment == other.alignment && hugePages == other.hugePages && numaNode == other.numaNode &&
+           networkInterface == other.networkInterface;
+  }
+  bool operator!=(const BufferPolicy& other) const { return !(*this == other); }
+};
+
+// Allocates the buffers that a Stream announces to the camera. Linux supports
+// huge pages and NUMA placement, other platforms only align the buffers.
+class BufferProvider {
+ public:
+  BufferProvider(BufferProvider const&) = delete;
+  BufferProvider& operator=(BufferProvider const&) = delete;
+
+  BufferProvider(const BufferPolicy& policy = BufferPolicy());
+  ~BufferProvider();
+
+  unsigned char* allocate(size_t size);
+  void release(unsigned char* buffer);
+
+  const BufferPolicy& getPolicy() const { return policy; }
+  int getNumaNode() const { return numaNode; }
+
+  // The NUMA node of a network interface, -1 when unknown
+  static int getNumaNode(const std::string& networkInterface);
+
+ private:
+  struct Allocation {
+    unsigned char* data;
+    size_t size;
+    bool mapped;
+  };
+
+  Logger logger;
+  BufferPolicy policy;
+  int numaNode;
+
+  std::mutex mutex;
+  std::vector<Allocation> allocations;
+
+  void free(const Allocation& allocation);
+};
+}  // namespace OosVimba
@@ -0,0 +1,107 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Change detection for mostly static scenes. A frame is compared with a
+// reference frame by the sum of absolute differences over every nth row of a
+// region of interest, optionally restricted by a mask. The reference holds a
+// compact copy of the compared rows only, so a comparison reads a fraction of
+// the frame and never allocates once the frame size is known.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Logger.h"
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+namespace OosVim {
+
+static const float CHANGE_DEFAULT_THRESHOLD = 2;
+static const uint32_t CHANGE_DEFAULT_STEP = 4;
+static const float CHANGE_MAX_SCORE = 255;
+
+// The frame a new frame is compared with
+enum class ChangeReference {
+  Changed,   // the last changed frame, slow drift adds up until it counts as a change
+  Previous   // the previous frame, only sudden changes count
+};
+
+struct ChangeSettings {
+  float threshold = CHANGE_DEFAULT_THRESHOLD;  // mean absolute difference in 8 bit levels
+  uint32_t step = CHANGE_DEFAULT_STEP;         // compare every step-th row
+  ChangeReference reference = ChangeReference::Changed;
+
+  // Region of interest, a width or height of 0 extends to the frame edge
+  uint32_t x = 0;
+  uint32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  // One value per pixel of the frame, pixels with a 0 are ignored. Empty
+  // compares all pixels of the region.
+  std::vector<unsigned char> mask;
+
+  // The stream drops unchanged frames instead of delivering them with their score
+  bool skipUnchanged = false;
+};
+
+class ChangeDetector {
+ public:
+  ChangeDetector(ChangeDetector const&) = delete;
+  ChangeDetector& operator=(ChangeDetector const&) = delete;
+
+  ChangeDetector(const ChangeSettings& settings = ChangeSettings());
+
+  // Thread safe, the next comparison uses the new settings and counts as a change
+  void setSettings(const ChangeSettings& settings);
+  ChangeSettings getSettings();
+  void reset();
+
+  bool isSkipUnchanged() const { return skipUnchanged.load(); }
+
+  // Mono8, Bayer 8 bit, RGB8, BGR8, RGBA8, BGRA8 and Mono10 to Mono16 in 16 bit containers
+  static bool isSupported(VmbPixelFormatType format);
+
+  // Compare a frame with the reference and update the reference. The score is
+  // the mean absolute difference in 8 bit levels. The first frame, a frame of
+  // another size or format and an unsupported frame count as a change with the
+  // maximum score. Comparisons should run on one thread at a time, e.g. the
+  // frame delivery thread.
+  bool compare(const unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format,
+               float& score);
+
+  uint64_t getCompared() const { return compared.load(); }
+  uint64_t getChanged() const { return changed.load(); }
+
+ private:
+  Logger logger;
+
+  std::mutex mutex;
+  ChangeSettings settings;
+  bool dirty;
+  std::atomic<bool> skipUnchanged;
+
+  // Only used from the thread that compares
+  struct Segment {
+    size_t offset;  // in the frame, in bytes
+    size_t length;  // in bytes
+  };
+  ChangeSettings current;
+  uint32_t width;
+  uint32_t height;
+  VmbPixelFormatType format;
+  uint32_t bitDepth;
+  std::vector<Segment> segments;
+  std::vector<unsigned char> reference;  // the segments back to back
+  std::vector<unsigned char> weights;    // 0xff for compared bytes, empty without a mask
+  uint64_t samples;
+  bool referenced;
+
+  std::atomic<uint64_t> compared;
+  std::atomic<uint64_t> changed;
+
+  void build(uint32_t width, uint32_t height, VmbPixelFormatType format);
+};
+}  // namespace OosVimba
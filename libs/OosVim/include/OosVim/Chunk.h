@@ -0,0 +1,79 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+#include "Common.h"
+#include "Logger.h"
+
+namespace OosVim {
+
+// Decoded chunk data of a single frame
+struct Chunk {
+  bool valid = false;
+  uint64_t frameCount = 0;
+  uint64_t timestamp = 0;   // camera ticks
+  uint32_t exposure = 0;    // microseconds
+  double gain = 0;          // dB
+  uint16_t syncIn = 0;      // line status of the inputs
+  uint16_t syncOut = 0;     // line status of the outputs
+};
+
+// The ChunkDecoder resolves the chunk layout on the first frame of a stream.
+// Frames are decoded through the ancillary feature interface. Only for Allied
+// Vision GigE cameras, whose chunk layout is known, the raw ancillary buffer
+// is read instead, once it matched the feature interface on the first frame.
+//
+// The ancillary data of an announced frame is opened and its features are
+// located on the first delivery of that frame. They stay open until the
+// frames are revoked, later deliveries only read the values.
+class ChunkDecoder {
+ public:
+  ChunkDecoder(ChunkDecoder const&) = delete;
+  ChunkDecoder& operator=(ChunkDecoder const&) = delete;
+
+  ChunkDecoder() : layout(Layout::Unresolved), rawLayout(false) {}
+  ~ChunkDecoder() { release(); }
+
+  bool decode(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk);
+
+  // Resolve the layout again for the announced frames of a stream, rawLayout
+  // allows the raw buffer to be read. Call before the frames are queued.
+  void prepare(const AVT::VmbAPI::FramePtrVector& frames, bool allowRaw = false);
+
+  // Close the ancillary data of the frames, before they are revoked
+  void release();
+
+  // Whether a camera appends its chunk data in the raw layout
+  static bool hasRawLayout(const std::string& vendor, VmbInterfaceType type);
+
+ private:
+  enum class Layout { Unresolved, Raw, Features, None };
+  Layout layout;
+  bool rawLayout;
+
+  // The ancillary features of an announced frame
+  struct Features {
+    const AVT::VmbAPI::Frame* frame = nullptr;
+    AVT::VmbAPI::AncillaryDataPtr ancillary;
+    AVT::VmbAPI::FeaturePtr frameCount;
+    AVT::VmbAPI::FeaturePtr exposure;
+    AVT::VmbAPI::FeaturePtr gain;
+    AVT::VmbAPI::FeaturePtr syncIn;
+    AVT::VmbAPI::FeaturePtr syncOut;
+    bool located = false;
+  };
+  std::vector<Features> features;
+
+  bool resolve(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk);
+  bool decodeRaw(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk) const;
+  bool decodeFeatures(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk);
+  bool locate(const AVT::VmbAPI::FramePtr& frame, Features& state);
+  static void close(Features& state);
+};
+}  // namespace OosVimba
@@ -0,0 +1,100 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Color pipeline applied while converting a frame to RGB8: demosaicing of
+// Bayer frames, white balance, a 3x3 color matrix, a gamma curve and an
+// optional 3D LUT, in one pass over bands of rows on a WorkerPool. The
+// settings and the LUT can be replaced while frames are converted, a
+// conversion uses either the old or the new program and never waits for the
+// swap.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+#include "VimbaCPP/Include/VimbaCPP.h"
+#include "WorkerPool.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const uint32_t COLOR_GAMMA_SIZE = 4096;
+static const uint32_t COLOR_LUT_DEFAULT_SIZE = 33;
+static const uint32_t COLOR_LUT_MAX_SIZE = 256;
+static const uint32_t COLOR_BAND_ROWS = 16;
+
+struct ColorSettings {
+  std::array<float, 3> whiteBalance = {{1, 1, 1}};  // gains of red, green and blue
+  std::array<float, 9> matrix = {{1, 0, 0, 0, 1, 0, 0, 0, 1}};  // row major, after the white balance
+  float gamma = 1;  // the output is the linear value to the power 1 / gamma
+};
+
+// A 3D LUT of size^3 RGB entries, red changes fastest like in .cube files
+class ColorLut {
+ public:
+  // An identity LUT
+  ColorLut(uint32_t size = COLOR_LUT_DEFAULT_SIZE);
+
+  // Adobe / Resolve .cube files with LUT_3D_SIZE, nullptr on failure
+  static std::shared_ptr<ColorLut> load(const std::string& path);
+
+  uint32_t getSize() const { return size; }
+  void set(uint32_t r, uint32_t g, uint32_t b, float red, float green, float blue);
+  void setDomain(const std::array<float, 3>& min, const std::array<float, 3>& max);
+
+  // Four 16 bit values per entry, the last is padding
+  const uint16_t* getTable() const { return table.data(); }
+  const std::array<float, 3>& getDomainMin() const { return domainMin; }
+  const std::array<float, 3>& getDomainMax() const { return domainMax; }
+
+ private:
+  uint32_t size;
+  std::vector<uint16_t> table;
+  std::array<float, 3> domainMin;
+  std::array<float, 3> domainMax;
+};
+
+class ColorPipeline {
+ public:
+  ColorPipeline(ColorPipeline const&) = delete;
+  ColorPipeline& operator=(ColorPipeline const&) = delete;
+
+  // The calling thread takes part in the conversion
+  ColorPipeline(const ColorSettings& settings = ColorSettings(), size_t threads = 1);
+
+  // Thread safe, the next conversion uses the new program
+  void setSettings(const ColorSettings& settings);
+  ColorSettings getSettings();
+  void setLut(std::shared_ptr<const ColorLut> lut);
+  bool loadLut(const std::string& path);
+
+  // Bayer 8 bit, RGB8, BGR8, RGBA8 and BGRA8
+  static bool isSupported(VmbPixelFormatType format);
+
+  // Convert to a RGB8 destination of width * height * 3 bytes. Conversions
+  // should run on one thread at a time, e.g. the frame callback.
+  bool convert(const Frame& frame, unsigned char* destination);
+  bool convert(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format,
+               unsigned char* destination);
+
+  struct Program;
+
+ private:
+  Logger logger;
+
+  std::mutex mutex;
+  ColorSettings settings;
+  std::shared_ptr<const ColorLut> lut;
+  std::shared_ptr<const Program> program;  // swapped atomically
+
+  std::unique_ptr<WorkerPool> pool;
+
+  void build();
+};
+}  // namespace OosVimba
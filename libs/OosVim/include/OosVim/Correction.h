@@ -0,0 +1,101 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Per pixel calibration of raw Mono and Bayer frames: dark frame subtraction,
+// a flat field gain map and defective pixel replacement in one pass over the
+// frame. The calibration maps are memory mapped from files.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+namespace OosVim {
+
+static const uint32_t CALIBRATION_MAGIC = 0x436f734f;  // "OosC"
+static const uint32_t CALIBRATION_VERSION = 1;
+static const uint32_t CORRECTION_GAIN_SHIFT = 12;       // gain map values are 1.0 at 4096
+static const uint32_t CORRECTION_GAIN_ONE = 1 << CORRECTION_GAIN_SHIFT;
+static const uint32_t CORRECTION_BLOCK_ROWS = 16;
+
+// Dark and gain maps hold a 16 bit value per pixel, dark values in camera
+// counts. Defect maps hold the sorted 32 bit indices of the defective pixels.
+enum class CalibrationType : uint32_t { Dark = 1, Gain = 2, Defects = 3 };
+
+struct CalibrationHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t type;
+  uint32_t width;
+  uint32_t height;
+  uint32_t count;  // number of values after the header
+  uint32_t reserved[2];
+};
+
+// A read only calibration map, memory mapped on Linux and macOS
+class CalibrationMap {
+ public:
+  CalibrationMap(CalibrationMap const&) = delete;
+  CalibrationMap& operator=(CalibrationMap const&) = delete;
+
+  CalibrationMap(const std::string& path);
+  ~CalibrationMap();
+
+  bool isValid() const { return header != nullptr; }
+  CalibrationType getType() const { return static_cast<CalibrationType>(header->type); }
+  uint32_t getWidth() const { return header->width; }
+  uint32_t getHeight() const { return header->height; }
+  uint32_t getCount() const { return header->count; }
+  const void* getData() const { return header + 1; }
+
+  // Write a map, e.g. the average of dark frames
+  static bool save(const std::string& path, CalibrationType type, uint32_t width, uint32_t height, const void* data,
+                   uint32_t count);
+
+ private:
+  Logger logger;
+  const CalibrationHeader* header;
+  void* memory;
+  size_t length;
+  std::vector<unsigned char> storage;
+
+  bool validate();
+};
+
+// Configure the maps before the correction is handed to a stream, replace the
+// correction to change them.
+class Correction {
+ public:
+  Correction(Correction const&) = delete;
+  Correction& operator=(Correction const&) = delete;
+
+  Correction();
+
+  bool loadDark(const std::string& path);
+  bool loadGain(const std::string& path);
+  bool loadDefects(const std::string& path);
+
+  // Mono8, Bayer 8 bit and the 16 bit mono containers are supported. The
+  // source and destination may be the same buffer, both hold size bytes.
+  // Returns false and leaves the destination untouched when the format or
+  // size does not match the maps, or the buffer is smaller than the image.
+  bool apply(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format, size_t size,
+             unsigned char* destination) const;
+  bool apply(unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format, size_t size) const {
+    return apply(data, width, height, format, size, data);
+  }
+
+ private:
+  Logger logger;
+  std::shared_ptr<CalibrationMap> dark;
+  std::shared_ptr<CalibrationMap> gain;
+  std::shared_ptr<CalibrationMap> defects;
+
+  std::shared_ptr<CalibrationMap> load(const std::string& path, CalibrationType type);
+};
+}  // namespace OosVimba
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "VimbaCPP/Include/VimbaCPP.h"
 
 #include "Common.h"
@@ -22,8 +24,8 @@ class Device {
   const std::string& getName() const { return name; }
   const std::string& getModel() const { return model; }
   const std::string& getSerial() const { return serial; }
-  const AccessMode& getAvailableAccessMode() const { return availableMode; }
-  const AccessMode& getCurrentAccessMode() const { return currentMode; }
+  AccessMode getAvailableAccessMode() const { return availableMode.load(); }
+  AccessMode getCurrentAccessMode() const { return currentMode.load(); }
   const AVT::VmbAPI::CameraPtr& getHandle() const { return handle; }
 
   // Flags
@@ -35,9 +37,18 @@ class Device {
   bool open(const AccessMode mode);
   bool close();
 
+  // Update the available access mode without a full inspection
+  bool refresh();
+
   // Access commands
   bool run(const std::string& name);
 
+  // Run a command located before, without the feature lookup, e.g. on a timer
+  bool run(const AVT::VmbAPI::FeaturePtr& command);
+
+  // Turn the notification of a camera event on or off, e.g. ExposureEnd
+  bool notify(const std::string& event, bool value);
+
   // Locate features
   bool locate(const std::string& name, AVT::VmbAPI::FeaturePtr& feature);
 
@@ -106,8 +117,8 @@ class Device {
   std::string name = "";
   std::string model = "";
   std::string serial = "";
-  AccessMode availableMode = AccessModeNone;
-  AccessMode currentMode = AccessModeNone;
+  std::atomic<AccessMode> availableMode{AccessModeNone};
+  std::atomic<AccessMode> currentMode{AccessModeNone};
   AVT::VmbAPI::CameraPtr handle;
 
   bool inspect();
@@ -10,6 +10,7 @@
 
 #include "Device.h"
 #include "Logger.h"
+#include "Registry.h"
 #include "System.h"
 
 namespace OosVim {
@@ -56,6 +57,7 @@ class Discovery {
     Observer(Discovery &discovery, std::string requestID)
         : logger("Discovery::Observer"),
           system(System::getInstance()),
+          registry(Registry::getInstance()),
           discovery(discovery),
           reqID(requestID) {
       discover();
@@ -71,12 +73,14 @@ class Discovery {
    private:
     Logger logger;
     std::shared_ptr<System> system;
+    std::shared_ptr<Registry> registry;
 
     Discovery &discovery;
     std::mutex reqIdMutex;
     std::string reqID;
 
     void process(AVT::VmbAPI::CameraPtr camera, AVT::VmbAPI::UpdateTriggerType reason);
+    void publish(std::shared_ptr<Device> device, const DiscoveryTrigger trigger);
   };
 
   Logger logger;
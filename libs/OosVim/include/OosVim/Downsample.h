@@ -0,0 +1,20 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <cstdint>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+namespace OosVim {
+
+// Channels of the 8 bit pixel formats that can be downsampled, 0 otherwise
+uint32_t getDownsampleChannels(VmbPixelFormatType format);
+
+// Box filter an 8 bit image by a factor of 2 or 4, every output pixel is the
+// rounded mean of a factor x factor block. The output is width / factor by
+// height / factor, remaining rows and columns are ignored. Mono images use
+// SSE2 or NEON when available.
+bool downsample(const unsigned char* source, uint32_t width, uint32_t height, uint32_t channels, uint32_t factor,
+                unsigned char* destination);
+}  // namespace OosVimba
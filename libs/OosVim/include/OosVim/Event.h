@@ -0,0 +1,183 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// GigE camera events, e.g. the end of an exposure, which the camera sends
+// before the image has been transferred. The events are read on the Vimba
+// event thread, handed to an optional callback right away and queued for the
+// frame delivery thread, which pops them without locking, matches them with
+// the frames by frame id and measures how long before its frame every event
+// arrived.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+#include "Device.h"
+#include "Latency.h"
+#include "Logger.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const size_t EVENT_QUEUE_SIZE = 256;     // power of two
+static const size_t EVENT_PENDING_SIZE = 32;    // events per type kept to match the frames
+static const uint64_t EVENT_FRAME_ID_MASK = 0xffff;  // GigE block ids are 16 bit
+
+enum class CameraEventType {
+  ExposureEnd = 0,
+  FrameTrigger,
+  Count
+};
+
+struct CameraEvent {
+  CameraEventType type = CameraEventType::ExposureEnd;
+  uint64_t frameId = 0;    // block id of the frame the event belongs to
+  uint64_t timestamp = 0;  // raw camera ticks, not mapped to the host clock, compare with hostTime
+  uint64_t hostTime = 0;   // host steady clock in ns when the event was read
+};
+
+// Fixed capacity ring of events with one producer and one consumer. The
+// channel serializes its producers, the feature observers and inject.
+class EventQueue {
+ public:
+  EventQueue(EventQueue const&) = delete;
+  EventQueue& operator=(EventQueue const&) = delete;
+
+  explicit EventQueue(size_t capacity = EVENT_QUEUE_SIZE);
+
+  // Producer, returns false and drops the event when the ring is full
+  bool push(const CameraEvent& event);
+
+  // Consumer, returns false when the ring is empty
+  bool pop(CameraEvent& event);
+
+  // Events pushed and popped since construction
+  uint64_t getPushed() const { return tail.load(std::memory_order_acquire); }
+  uint64_t getPopped() const { return head.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<CameraEvent> events;
+  uint64_t mask;
+  std::atomic<uint64_t> head;  // next event to pop, written by the consumer
+  std::atomic<uint64_t> tail;  // next event to push, written by the producer
+};
+
+class EventObserver;
+class EventChannel {
+  friend EventObserver;
+
+ public:
+  EventChannel(EventChannel const&) = delete;
+  EventChannel& operator=(EventChannel const&) = delete;
+
+  EventChannel(const std::vector<CameraEventType>& types = {CameraEventType::ExposureEnd,
+                                                            CameraEventType::FrameTrigger});
+  ~EventChannel();
+
+  static const char* getName(CameraEventType type);
+
+  // Turn the notification of the events on and subscribe to them, a camera
+  // that was opened before is closed first. Needs a connection that is not
+  // read only. Returns false when the camera sends none of the events.
+  bool open(std::shared_ptr<Device> device);
+  void close();
+  bool isOpen() const { return bOpen.load(); }
+
+  // Called on the Vimba event thread with every event, before it is queued
+  void setCallback(std::function<void(const CameraEvent&)> callback = nullptr);
+
+  // Queue an event from the host instead of the camera, e.g. for playback or
+  // synthetic sources. Ignored while open, the host and the camera ids would
+  // mix.
+  void inject(const CameraEvent& event);
+
+  // Match a delivered frame with its events, call from the frame delivery
+  // thread only
+  void recordFrame(const Frame& frame);
+
+  uint64_t getReceived() const { return received.load(); }
+  uint64_t getDropped() const { return dropped.load(); }    // the queue was full
+  uint64_t getMatched() const { return matched.load(); }
+  uint64_t getUnmatched() const { return unmatched.load(); }  // no frame arrived with the id
+
+  // Arrival of an event to the arrival of its frame
+  const LatencyHistogram& getDelay(CameraEventType type) const { return delays[static_cast<size_t>(type)]; }
+
+ private:
+  // The features an observer reads, they do not change after the open
+  struct Source {
+    CameraEventType type;
+    AVT::VmbAPI::FeaturePtr timestamp;
+    AVT::VmbAPI::FeaturePtr frameId;
+  };
+
+  struct Subscription {
+    std::shared_ptr<const Source> source;
+    AVT::VmbAPI::FeaturePtr event;
+    SP_DECL(EventObserver) observer;
+  };
+
+  struct Pending {
+    CameraEvent event;
+    bool matched = true;
+  };
+
+  Logger logger;
+  std::vector<CameraEventType> types;
+
+  std::mutex mutex;
+  std::shared_ptr<Device> device;
+  std::vector<Subscription> subscriptions;
+  std::atomic<bool> bOpen;
+
+  std::mutex callbackMutex;
+  std::function<void(const CameraEvent&)> callback;
+
+  std::mutex producerMutex;  // the observers and inject push to the queue
+  EventQueue queue;
+
+  // The block ids restart with every open, the delivery thread drops the
+  // pending events and the queued events before sessionBegin on a new session
+  std::atomic<uint64_t> session;
+  std::atomic<uint64_t> sessionBegin;
+
+  // Only used from the frame delivery thread
+  std::array<std::array<Pending, EVENT_PENDING_SIZE>, static_cast<size_t>(CameraEventType::Count)> pending;
+  std::array<uint64_t, static_cast<size_t>(CameraEventType::Count)> pendingCount;
+  uint64_t pendingSession;
+
+  std::atomic<uint64_t> received;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> matched;
+  std::atomic<uint64_t> unmatched;
+  std::array<LatencyHistogram, static_cast<size_t>(CameraEventType::Count)> delays;
+
+  void receive(const Source& source);
+  void dispatch(const CameraEvent& event);
+};
+
+class EventObserver : public AVT::VmbAPI::IFeatureObserver {
+ public:
+  EventObserver(EventChannel& channel, std::shared_ptr<const EventChannel::Source> source)
+      : channel(channel), source(source) {}
+
+  void start();
+  void stop();
+
+  void FeatureChanged(const AVT::VmbAPI::FeaturePtr&) override;
+
+ private:
+  EventChannel& channel;
+  const std::shared_ptr<const EventChannel::Source> source;
+  std::mutex mutex;
+  bool running = false;
+};
+}  // namespace OosVimba
@@ -0,0 +1,48 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <cstdint>
+
+#include "Statistics.h"
+
+namespace OosVim {
+
+struct ExposureSettings {
+  double target = 0.45;       // mean brightness, 0 to 1
+  double maxClipped = 0.01;   // ratio of saturated samples that pulls the exposure down
+  double minExposure = 50;    // microseconds
+  double maxExposure = 33000;
+  double minGain = 0;         // dB, only raised once the exposure is at its maximum
+  double maxGain = 24;
+  double damping = 0.5;       // part of the correction applied per step, 0 to 1
+  double tolerance = 0.05;    // relative brightness error that is not corrected
+  uint32_t interval = 3;      // frames between corrections, the camera applies new values with a delay
+};
+
+// Closed loop auto exposure on the host. Corrects the product of exposure time
+// and gain in proportion to the brightness error, the exposure time takes the
+// correction first so the gain and with it the noise stays low.
+class ExposureController {
+ public:
+  ExposureController(const ExposureSettings& settings = ExposureSettings());
+
+  void setSettings(const ExposureSettings& settings);
+  const ExposureSettings& getSettings() const { return settings; }
+
+  // Start from the values the camera currently uses
+  void reset(double exposure, double gain);
+
+  // Returns true when the exposure or gain changed and should be applied
+  bool update(const FrameStatistics& statistics);
+
+  double getExposure() const { return exposure; }
+  double getGain() const { return gain; }
+
+ private:
+  ExposureSettings settings;
+  double exposure;
+  double gain;
+  uint32_t frames;
+};
+}  // namespace OosVimba
@@ -2,12 +2,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "VimbaCPP/Include/VimbaCPP.h"
 
+#include "Chunk.h"
 #include "Common.h"
 #include "Device.h"
 
 namespace OosVim {
+
+static const size_t FRAME_POOL_GROWTH = 4;      // default limit of a pool, times its size
+static const size_t FRAME_POOL_MIN_LIMIT = 16;  // default limit of small pools
+
 class Stream;
 class Frame {
   friend Stream;
@@ -25,12 +34,28 @@ class Frame {
   const unsigned char* getImageData() const { return data; }
   const VmbPixelFormatType& getImageFormat() const { return format; }
   const std::shared_ptr<Device>& getDevice() const { return device; }
+  const Chunk& getChunk() const { return chunk; }
+
+  // Host steady clock in ns, the exposure time is 0 when the camera clock is
+  // not synchronized with the host
+  const uint64_t& getExposureTime() const { return exposureTime; }
+  const uint64_t& getArrivalTime() const { return arrivalTime; }
+
+  // Mean absolute difference with the reference of the change detector of the
+  // stream in 8 bit levels, -1 when the frame was not compared
+  float getChangeScore() const { return changeScore; }
+
+  // Copy the metadata and the data of another frame. The copy owns its data,
+  // so unlike a delivered frame it stays valid outside the frame callback.
+  // Ancillary data is not copied, the decoded chunk is.
+  void copyFrom(const Frame& frame);
 
+  // Ancillary data is opened on first access, like the image data it is only
+  // available within the scope of the frame callback
   bool getAncillaryFeature(const std::string& name, AVT::VmbAPI::FeaturePtr& feature) const;
 
   template <typename ValueType>
   bool getAncillary(const std::string& name, ValueType& value) const {
-    if (SP_ISNULL(ancilleryData)) return false;
     AVT::VmbAPI::FeaturePtr feature;
     if (getAncillaryFeature(name, feature)) {
       return getAncillary(feature, value);
@@ -44,7 +69,10 @@ class Frame {
   }
 
  protected:
-  bool load(const AVT::VmbAPI::FramePtr& framePtr);
+  bool load(const AVT::VmbAPI::FramePtr& framePtr, ChunkDecoder& decoder);
+  bool load(unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format, uint32_t size,
+            uint64_t id, uint64_t timestamp, const Chunk& chunk);
+  void unload();
 
  private:
   std::shared_ptr<Device> device;
@@ -62,8 +90,57 @@ class Frame {
   // Pointer to the data
   unsigned char* data;
 
+  // Data of a copied frame
+  std::vector<unsigned char> storage;
+
+  // Decoded chunk data
+  Chunk chunk;
+
+  // Host times, set by the stream
+  uint64_t exposureTime;
+  uint64_t arrivalTime;
+
+  // Set by the stream
+  float changeScore;
+
   // Ancillery data access
-  AVT::VmbAPI::AncillaryDataPtr ancilleryData;
-  AVT::VmbAPI::FeaturePtrVector ancilleryFeatures;
+  AVT::VmbAPI::Frame* source;
+  mutable AVT::VmbAPI::AncillaryDataPtr ancilleryData;
+};
+
+// Frames are handed out as shared pointers. The pool keeps the pointers it
+// created and reuses a frame once the pool holds the only reference, so the
+// frame, its control block and its device reference are allocated only once.
+// The pool grows while the consumers hold on to its frames, up to its limit.
+// Beyond that acquire returns nullptr and the frame should be dropped. The
+// pool is used from the frame delivery thread only.
+class FramePool {
+ public:
+  FramePool(FramePool const&) = delete;
+  FramePool& operator=(FramePool const&) = delete;
+
+  // A limit of 0 allows FRAME_POOL_GROWTH times the size, at least
+  // FRAME_POOL_MIN_LIMIT frames
+  FramePool(std::shared_ptr<Device> device, size_t size, size_t limit = 0);
+
+  // nullptr when all frames are in use and the pool reached its limit
+  std::shared_ptr<Frame> acquire();
+
+  void setLimit(size_t limit);
+  size_t getLimit() const { return limit.load(); }
+
+  size_t getSize() const { return frames.size(); }
+  uint64_t getAllocations() const { return allocations.load(); }
+  uint64_t getExhausted() const { return exhausted.load(); }
+
+ private:
+  std::shared_ptr<Device> device;
+  std::vector<std::shared_ptr<Frame>> frames;
+  size_t next;
+  std::atomic<size_t> limit;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> exhausted;
+
+  void allocate();
 };
 }  // namespace OosVimba
@@ -0,0 +1,119 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Bounded channel of frame copies for asynchronous consumers. With C++20
+// coroutines a consumer awaits the next frame:
+//
+//   auto frame = co_await grabber.nextFrame();
+//   if (!frame) co_return;  // the grabber stopped
+//
+// The channel itself is plain C++17, so the addon builds without coroutines.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define OOSVIM_COROUTINES 1
+#endif
+#endif
+
+#include "Frame.h"
+
+namespace OosVim {
+
+static const size_t CHANNEL_DEFAULT_CAPACITY = 4;
+
+enum class ChannelOverflow {
+  DropOldest,  // drop the oldest buffered frame, the producer never waits
+  Block        // the producer waits for room, the camera drops frames once its buffers run out
+};
+
+// Runs a consumer continuation, e.g. by posting it to a thread pool. Without
+// an executor consumers resume on the frame delivery thread.
+using FrameExecutor = std::function<void(std::function<void()>)>;
+
+class FrameChannel {
+ public:
+  FrameChannel(FrameChannel const&) = delete;
+  FrameChannel& operator=(FrameChannel const&) = delete;
+
+  // A suspended consumer, the channel sets the frame before waking it
+  class Waiter {
+   public:
+    virtual ~Waiter() {}
+    virtual void wake() = 0;
+    std::shared_ptr<const Frame> frame;
+  };
+
+  FrameChannel(size_t capacity = CHANNEL_DEFAULT_CAPACITY, ChannelOverflow overflow = ChannelOverflow::DropOldest);
+  ~FrameChannel() { close(); }
+
+  void setCapacity(size_t capacity, ChannelOverflow overflow = ChannelOverflow::DropOldest);
+  void setExecutor(FrameExecutor executor);
+
+  // Producer, copy a frame into the channel, call from the frame callback
+  void push(const Frame& frame);
+
+  // Consumer, returns true with the frame set on the waiter when a frame is
+  // buffered or the channel is closed, otherwise the waiter is woken later
+  bool receive(Waiter& waiter);
+
+  // Consumer, remove a waiter that was not woken, e.g. when it is destroyed
+  void cancel(Waiter& waiter);
+
+  // Close wakes all waiters without a frame and drops pushed frames, until
+  // the channel is opened again
+  void open();
+  void close();
+
+  bool isOpen();
+  uint64_t getDropped() const { return dropped.load(); }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable space;
+  size_t capacity;
+  ChannelOverflow overflow;
+  FrameExecutor executor;
+  bool closed;
+
+  std::deque<std::shared_ptr<const Frame>> frames;
+  std::deque<Waiter*> waiters;
+
+  // Copies are recycled once the consumers release them, the consumers may
+  // hold FRAME_POOL_GROWTH times the capacity before pushes are dropped
+  FramePool pool;
+  std::atomic<uint64_t> dropped;
+
+  void wake(Waiter* waiter, const FrameExecutor& executor);
+};
+
+#ifdef OOSVIM_COROUTINES
+// Awaitable for the next frame of a channel, nullptr when the channel closed
+class FrameAwaiter : public FrameChannel::Waiter {
+ public:
+  FrameAwaiter(FrameChannel& channel) : channel(channel) {}
+  ~FrameAwaiter() { channel.cancel(*this); }
+
+  bool await_ready() const { return false; }
+  bool await_suspend(std::coroutine_handle<> awaiting) {
+    handle = awaiting;
+    return !channel.receive(*this);
+  }
+  std::shared_ptr<const Frame> await_resume() { return std::move(frame); }
+
+  void wake() override { handle.resume(); }
+
+ private:
+  FrameChannel& channel;
+  std::coroutine_handle<> handle;
+};
+#endif
+}  // namespace OosVimba
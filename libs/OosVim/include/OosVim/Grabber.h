@@ -7,32 +7,108 @@
 #include <condition_variable>
 #include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "Buffer.h"
+#include "Change.h"
+#include "Color.h"
 #include "Device.h"
 #include "Discovery.h"
+#include "Event.h"
+#include "Exposure.h"
+#include "FrameChannel.h"
+#include "Handoff.h"
+#include "Hdr.h"
 #include "Logger.h"
+#include "Preview.h"
+#include "Recorder.h"
+#include "Registry.h"
+#include "Remap.h"
+#include "SharedMemory.h"
+#include "Statistics.h"
 #include "Stream.h"
 #include "System.h"
+#include "Thread.h"
+#include "Trigger.h"
 
 namespace OosVim {
 
 class Grabber {
-// -- SET --------------------------------------------------------------------
-public:
- Grabber();
- virtual ~Grabber() { stop(); }
+ public:
+  Grabber();
+  virtual ~Grabber() { stop(); }
 
- void start();
- virtual void streamFrameCallBack(const std::shared_ptr<OosVim::Frame> frame) = 0;
- virtual bool updateFrame() = 0;
- void stop();
+  void start();
+  virtual void streamFrameCallBack(const std::shared_ptr<OosVim::Frame>) {}
+  virtual bool updateFrame() { return false; }
+  void stop();
 
+  // -- PULL -------------------------------------------------------------------
+  // Copies of the latest frame for consumers outside a render loop. Copying
+  // starts on the first call, every frame is returned to one caller only.
+  // Returns nullptr on a timeout, when nothing new arrived, or on stop().
+  std::shared_ptr<const OosVim::Frame> waitForFrame(std::chrono::milliseconds timeout);
+  std::shared_ptr<const OosVim::Frame> tryGetFrame();
 
- // -- SET --------------------------------------------------------------------
+  // -- CHANNEL ----------------------------------------------------------------
+  // Buffered copies for asynchronous consumers, set the capacity, overflow and
+  // executor on the channel. Buffering starts on the first nextFrame().
+  OosVim::FrameChannel& getFrameChannel() { bChannel = true; return channel; }
+#ifdef OOSVIM_COROUTINES
+  OosVim::FrameAwaiter nextFrame() { return OosVim::FrameAwaiter(getFrameChannel()); }
+#endif
+
+  // -- STATISTICS -------------------------------------------------------------
+  // Histograms, clipping and sharpness of every delivered frame, computed on
+  // the thread that delivers the frames. Host auto exposure turns the camera
+  // auto exposure off and drives ExposureTimeAbs and Gain from the statistics.
+  void setImageStatistics(bool value, const OosVim::StatisticsSettings& settings = OosVim::StatisticsSettings());
+  void setHostAutoExposure(bool value, const OosVim::ExposureSettings& settings = OosVim::ExposureSettings());
+  bool isImageStatistics()    { return bImageStatistics.load(); }
+  bool isHostAutoExposure()   { return bHostAutoExposure.load(); }
+  OosVim::FrameStatistics getImageStatistics() { std::lock_guard<std::mutex> lock(imageStatisticsMutex); return imageStatistics; };
+
+  // -- BRACKETING -------------------------------------------------------------
+  // Cycle ExposureTimeAbs through the exposures, one per frame, with the camera
+  // sequencer when it has one and otherwise from the host. Chunk mode is turned
+  // on to tag the frames with their exposure. Host auto exposure is paused
+  // while bracketing. An empty list turns bracketing off. The HDR merger
+  // receives every delivered frame.
+  void setBracketing(const std::vector<double>& exposures);
+  void setHdrMerger(std::shared_ptr<OosVim::HdrMerger> merger);
+  bool isBracketing()         { return bBracketing.load(); }
+  bool isSequencerBracketing() { return bSequencer.load(); }
+  std::vector<double> getBracketing() { std::lock_guard<std::mutex> lock(bracketMutex); return bracketExposures; };
+  std::shared_ptr<OosVim::HdrMerger> getHdrMerger() { std::lock_guard<std::mutex> lock(bracketMutex); return hdrMerger; };
+
+  // -- TRIGGER ----------------------------------------------------------------
+  // Let a trigger scheduler fire the frames of the camera. The scheduler can
+  // be shared by several grabbers to trigger their cameras together. The
+  // trigger to arrival latency of every delivered frame is recorded in it.
+  void setTriggerScheduler(std::shared_ptr<OosVim::TriggerScheduler> scheduler);
+  std::shared_ptr<OosVim::TriggerScheduler> getTriggerScheduler() { std::lock_guard<std::mutex> lock(triggerMutex); return triggerScheduler; };
+
+  // -- EVENTS -----------------------------------------------------------------
+  // Subscribe an event channel to the camera events, e.g. ExposureEnd, when
+  // the camera is configured. Every delivered frame is matched with its events
+  // in the channel. nullptr turns the events off.
+  void setEventChannel(std::shared_ptr<OosVim::EventChannel> channel);
+  std::shared_ptr<OosVim::EventChannel> getEventChannel() { std::lock_guard<std::mutex> lock(eventMutex); return eventChannel; };
+
+  // -- THREADS ----------------------------------------------------------------
+  // Real-time scheduling, nice values and cores of the stream, delivery and
+  // action threads of this grabber, e.g. a core per camera. A refused policy
+  // falls back to what the process may do, the placements report what the
+  // threads actually got.
+  void setThreadPolicy(OosVim::ThreadRole role, const OosVim::ThreadPolicy& policy);
+  std::vector<OosVim::ThreadPlacement> getThreadPlacements();
+
+  // -- SET --------------------------------------------------------------------
   void setVerbose(bool bTalkToMe);
   void setDesiredFrameRate(double framerate);
   bool setDesiredPixelFormat(std::string format);
@@ -40,7 +116,20 @@ public:
   void setDeviceID(std::string ID);
   void setMulticast(bool value);
   void setReadOnly(bool value);
+  void setChunkMode(bool value);
+  void setLatencyMode(bool value);
+  void setDecimation(unsigned int n);
+  void setMaxDeliveryRate(double rate);
+  void setDownsample(unsigned int factor);
+  void setBufferPolicy(const OosVim::BufferPolicy& policy);
   void setLoadUserSet(int setToLoad = 1);
+  void setPublisher(std::shared_ptr<OosVim::SharedPublisher> publisher);
+  void setRecorder(std::shared_ptr<OosVim::Recorder> recorder);
+  void setPreviewEncoder(std::shared_ptr<OosVim::PreviewEncoder> encoder);
+  void setCorrection(std::shared_ptr<const OosVim::Correction> correction);
+  void setRemapper(std::shared_ptr<OosVim::Remapper> remapper);
+  void setColorPipeline(std::shared_ptr<OosVim::ColorPipeline> pipeline);
+  void setChangeDetector(std::shared_ptr<OosVim::ChangeDetector> detector);
   void loadUserSet() { setLoadUserSet(userSet.load()); }
 
   // -- GET --------------------------------------------------------------------
@@ -49,14 +138,36 @@ public:
 
   bool isMultiCast()          { return bMulticast.load(); }
   bool isReadOnly()           { return bReadOnly.load(); }
+  bool isChunkMode()          { return bChunkMode.load(); }
+  bool isLatencyMode()        { return bLatencyMode.load(); }
+  unsigned int getDecimation()  { return decimation.load(); }
+  double getMaxDeliveryRate()   { return maxDeliveryRate.load(); }
+  unsigned int getDownsample()  { return downsampleFactor.load(); }
   int  getUserSet()           { return userSet.load(); }
 
   double getFrameRate()       { return framerate.load(); }
   std::string getDeviceId()           { std::lock_guard<std::mutex> lock(deviceMutex); return deviceID; };
   std::string getDesiredPixelFormat() { std::lock_guard<std::mutex> lock(deviceMutex); return desiredPixelFormat; };
+  OosVim::BufferPolicy getBufferPolicy() { std::lock_guard<std::mutex> lock(deviceMutex); return bufferPolicy; };
+  std::shared_ptr<OosVim::SharedPublisher> getPublisher() { std::lock_guard<std::mutex> lock(publisherMutex); return publisher; };
+  std::shared_ptr<OosVim::Recorder> getRecorder() { std::lock_guard<std::mutex> lock(recorderMutex); return recorder; };
+  std::shared_ptr<OosVim::PreviewEncoder> getPreviewEncoder() { std::lock_guard<std::mutex> lock(previewMutex); return previewEncoder; };
+  std::shared_ptr<const OosVim::Correction> getCorrection() { std::lock_guard<std::mutex> lock(correctionMutex); return correction; };
+  std::shared_ptr<OosVim::Remapper> getRemapper() { std::lock_guard<std::mutex> lock(remapperMutex); return remapper; };
+  std::shared_ptr<OosVim::ColorPipeline> getColorPipeline() { std::lock_guard<std::mutex> lock(colorMutex); return colorPipeline; };
+  std::shared_ptr<OosVim::ChangeDetector> getChangeDetector() { std::lock_guard<std::mutex> lock(changeMutex); return changeDetector; };
 
+  // The cameras known so far, without blocking. Before the first enumeration
+  // completes the list is empty, and an enumeration is started.
   Device_List_t listDevices() const;
 
+  // Metadata of the frames received by the current stream
+  std::shared_ptr<const OosVim::History> getHistory();
+  OosVim::HistoryStatistics getStatistics(size_t window = OosVim::HISTORY_DEFAULT_CAPACITY / 2);
+
+  // Latency from exposure to pickup of the frames received by the current stream
+  std::shared_ptr<const OosVim::Latency> getLatency();
+
   // -- FEATURES ---------------------------------------------------------------
   template <typename ValueType>
   bool getFeature(const std::string& name, ValueType& value) {
@@ -80,15 +191,15 @@ public:
   }
 
  protected:
-
   // -- CORE -------------------------------------------------------------------
   std::shared_ptr<OosVim::System>     system;
+  std::shared_ptr<OosVim::Registry>   registry;
   std::shared_ptr<OosVim::Discovery>  discovery;
   std::shared_ptr<OosVim::Stream>     stream;
   std::shared_ptr<OosVim::Logger>     logger;
 
   // -- ACTION -----------------------------------------------------------------
-  enum class ActionType { Connect, Disconnect, Configure };
+  enum class ActionType { Initialize, Enumerate, Connect, Disconnect, Configure, Expose, Bracket };
   struct Action {
     ActionType type;
     std::shared_ptr<OosVim::Device> device;
@@ -96,13 +207,15 @@ public:
     bool operator == (Action action) { return action.type == type && action.device == device; }
   };
 
-  std::mutex actionMutex;
-  std::deque<Action> actionQueue;
-  std::condition_variable actionSignal;
+  mutable std::mutex actionMutex;
+  mutable std::deque<Action> actionQueue;
+  mutable std::condition_variable actionSignal;
   std::shared_ptr<std::thread> actionThread;
   std::atomic<bool> actionsRunning;
-  void addAction(ActionType type, std::shared_ptr<OosVim::Device> device = nullptr);
+  OosVim::ThreadBinding actionBinding;
+  void addAction(ActionType type, std::shared_ptr<OosVim::Device> device = nullptr) const;
   void actionRunner();
+  void initialize();
 
   // -- DISCOVERY --------------------------------------------------------------
   void startDiscovery();
@@ -116,11 +229,15 @@ public:
   std::string deviceID;
   std::atomic<bool> bReadOnly;
   std::atomic<bool> bMulticast;
+  std::atomic<bool> bChunkMode;
+  std::atomic<bool> bLatencyMode;
   std::atomic<int>  userSet;
   std::string desiredPixelFormat;
+  OosVim::BufferPolicy bufferPolicy;
   std::mutex deviceMutex;
   std::shared_ptr<OosVim::Device> activeDevice;
   bool filterDevice(std::shared_ptr<OosVim::Device>     device, std::string id);
+  bool connectDevice(std::shared_ptr<OosVim::Device>    device);
   bool openDevice(std::shared_ptr<OosVim::Device>       device);
   void closeDevice(std::shared_ptr<OosVim::Device>      device);
   bool configureDevice(std::shared_ptr<OosVim::Device>  device);
@@ -129,8 +246,91 @@ public:
   void setActiveDevice(std::shared_ptr<OosVim::Device> device);
 
   // -- STREAM -----------------------------------------------------------------
+  std::mutex streamMutex;
   bool startStream(std::shared_ptr<OosVim::Device> device);
   void stopStream();
+  std::shared_ptr<OosVim::Stream> getStream();
+  void receiveFrame(const std::shared_ptr<OosVim::Frame> frame);
+
+  // Call from updateFrame with the times of the frame that is picked up
+  void recordPickup(uint64_t exposureTime, uint64_t arrivalTime);
+
+  // -- DECIMATION -------------------------------------------------------------
+  std::atomic<unsigned int> decimation;
+  std::atomic<double> maxDeliveryRate;
+  std::atomic<unsigned int> downsampleFactor;
+
+  // -- STATISTICS -------------------------------------------------------------
+  std::atomic<bool> bImageStatistics;
+  std::atomic<bool> bHostAutoExposure;
+  std::atomic<bool> bExposureSynced;
+  std::atomic<double> pendingExposure;
+  std::atomic<double> pendingGain;
+  std::mutex statisticsMutex;
+  OosVim::StatisticsEngine statisticsEngine;
+  OosVim::ExposureController exposureController;
+  std::mutex imageStatisticsMutex;
+  OosVim::FrameStatistics imageStatistics;
+  void updateImageStatistics(const OosVim::Frame& frame);
+  void syncExposure(std::shared_ptr<OosVim::Device> device);
+  void applyExposure(std::shared_ptr<OosVim::Device> device);
+
+  // -- BRACKETING -------------------------------------------------------------
+  std::atomic<bool> bBracketing;
+  std::atomic<bool> bSequencer;
+  std::atomic<size_t> nextBracket;
+  std::mutex bracketMutex;
+  std::vector<double> bracketExposures;
+  std::shared_ptr<OosVim::HdrMerger> hdrMerger;
+  void configureBracketing(std::shared_ptr<OosVim::Device> device);
+  void applyBracket(std::shared_ptr<OosVim::Device> device);
+
+  // -- TRIGGER ----------------------------------------------------------------
+  std::mutex triggerMutex;
+  std::shared_ptr<OosVim::TriggerScheduler> triggerScheduler;
+  std::shared_ptr<OosVim::TriggerScheduler> retiredScheduler;  // releases the camera on the next configure
+  void configureTrigger(std::shared_ptr<OosVim::Device> device);
+
+  // -- EVENTS -----------------------------------------------------------------
+  std::mutex eventMutex;
+  std::shared_ptr<OosVim::EventChannel> eventChannel;
+  std::shared_ptr<OosVim::EventChannel> retiredChannel;  // closed on the next configure
+  void configureEvents(std::shared_ptr<OosVim::Device> device);
+
+  // -- THREADS ----------------------------------------------------------------
+  std::mutex threadMutex;
+  std::map<OosVim::ThreadRole, OosVim::ThreadPolicy> threadPolicies;  // of the stream and delivery threads
+
+  // -- PULL -------------------------------------------------------------------
+  std::atomic<bool> bPulling;
+  OosVim::Handoff<OosVim::Frame> pullHandoff;
+
+  // -- CHANNEL ----------------------------------------------------------------
+  std::atomic<bool> bChannel;
+  OosVim::FrameChannel channel;
+
+  // -- SHARED MEMORY ----------------------------------------------------------
+  std::mutex publisherMutex;
+  std::shared_ptr<OosVim::SharedPublisher> publisher;
+
+  // -- RECORDING --------------------------------------------------------------
+  std::mutex recorderMutex;
+  std::shared_ptr<OosVim::Recorder> recorder;
+
+  // -- PREVIEW ----------------------------------------------------------------
+  std::mutex previewMutex;
+  std::shared_ptr<OosVim::PreviewEncoder> previewEncoder;
+
+  // -- CORRECTION -------------------------------------------------------------
+  // Each has its own lock, the delivery thread reads them for every frame
+  std::mutex correctionMutex;
+  std::shared_ptr<const OosVim::Correction> correction;
+  std::mutex remapperMutex;
+  std::shared_ptr<OosVim::Remapper> remapper;
+  std::mutex colorMutex;
+  std::shared_ptr<OosVim::ColorPipeline> colorPipeline;
+  std::mutex changeMutex;
+  std::shared_ptr<OosVim::ChangeDetector> changeDetector;
 
   // -- FRAMERATE --------------------------------------------------------------
   std::atomic<double> desiredFrameRate;
@@ -138,11 +338,7 @@ public:
   void setFrameRate(std::shared_ptr<OosVim::Device> device, double value);
 
   // -- LIST -------------------------------------------------------------------
-  mutable std::mutex listMutex;
-  Device_List_t deviceList;
   Device_List_t getDeviceList() const;
-  void updateDeviceList();
-  Device_List_t createDeviceList();
   void printDeviceList(Device_List_t dList) const;
   std::string createCameraString(Device_List_t dList) const;
 
@@ -0,0 +1,133 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace OosVim {
+
+static const size_t HANDOFF_SPARE_SIZE = 2;
+
+// Hands the latest value from the frame callback to a consumer thread.
+// A published value that is not taken before the next one is dropped.
+// Values are recycled: the producer fills values the consumer is done with,
+// so after the first frames no new values are allocated.
+template <typename T>
+class Handoff {
+ public:
+  Handoff(Handoff const&) = delete;
+  Handoff& operator=(Handoff const&) = delete;
+
+  Handoff() : dropped(0), interrupts(0) { spare.reserve(HANDOFF_SPARE_SIZE); }
+
+  // Producer, get a value to fill, the arguments construct a new value
+  template <typename... Args>
+  std::shared_ptr<T> acquire(Args&&... args) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = spare.begin(); it != spare.end(); ++it) {
+      if (it->use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto value = *it;
+        spare.erase(it);
+        return value;
+      }
+    }
+    return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+
+  // Producer, publish a filled value, replaces a value that was not taken
+  void publish(std::shared_ptr<T> value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending) {
+        dropped++;
+        recycle(pending);
+      }
+      pending.swap(value);
+    }
+    signal.notify_one();
+  }
+
+  // Consumer, replace current with the latest value, returns false when
+  // nothing new was published. The previous current value is recycled.
+  bool take(std::shared_ptr<T>& current) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending) return false;
+    current.swap(pending);
+    recycle(pending);
+    pending = nullptr;
+    return true;
+  }
+
+  // Consumer, the latest value or nullptr when nothing new was published.
+  // The value is recycled once the caller releases it.
+  std::shared_ptr<T> poll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lend();
+  }
+
+  // Consumer, block until a new value is published, returns nullptr on a
+  // timeout or interrupt. Every value is returned to one waiter only.
+  template <typename Rep, typename Period>
+  std::shared_ptr<T> wait(const std::chrono::duration<Rep, Period>& timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t interrupt = interrupts;
+    signal.wait_for(lock, timeout, [&] { return pending || interrupts != interrupt; });
+    if (interrupts != interrupt) return nullptr;
+    return lend();
+  }
+
+  // Wake all waiters, e.g. when the producer stops
+  void interrupt() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      interrupts++;
+    }
+    signal.notify_all();
+  }
+
+  // Drop a value that was not taken
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = nullptr;
+  }
+
+  uint64_t getDropped() const { return dropped.load(); }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable signal;
+  std::shared_ptr<T> pending;
+  std::vector<std::shared_ptr<T>> spare;
+  std::atomic<uint64_t> dropped;
+  uint64_t interrupts;
+
+  // Values in use by the consumer stay in spare, acquire skips them
+  std::shared_ptr<T> lend() {
+    std::shared_ptr<T> value;
+    value.swap(pending);
+    recycle(value);
+    return value;
+  }
+
+  void recycle(std::shared_ptr<T>& value) {
+    if (!value) return;
+    if (spare.size() < HANDOFF_SPARE_SIZE) {
+      spare.push_back(value);
+      return;
+    }
+    // Replace a value the consumer holds on to, it is not recycled anymore
+    for (auto& candidate : spare) {
+      if (candidate.use_count() > 1) {
+        candidate = value;
+        return;
+      }
+    }
+  }
+};
+}  // namespace OosVimba
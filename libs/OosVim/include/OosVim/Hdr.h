@@ -0,0 +1,147 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Merge of exposure bracketed frames into one high dynamic range frame. The
+// frames are tagged with their bracket by the exposure time in the chunk data
+// and grouped when every bracket has a recent frame. A complete group is
+// merged on a separate thread over a WorkerPool and tone mapped to 8 bit, so
+// the merge never holds up the stream. Groups that arrive while the previous
+// group is merged are skipped.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Chunk.h"
+#include "Handoff.h"
+#include "Latency.h"
+#include "Logger.h"
+#include "VimbaCPP/Include/VimbaCPP.h"
+#include "WorkerPool.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const size_t HDR_MAX_BRACKETS = 8;
+static const uint32_t HDR_GAMMA_SIZE = 4096;
+static const size_t HDR_BAND_SAMPLES = 64 * 1024;
+static const size_t HDR_DEFAULT_SPAN = 4;
+
+struct HdrSettings {
+  std::vector<double> exposures;  // microseconds, in the order of the sequence
+  double tolerance = 0.1;         // relative difference between a chunk exposure and its bracket
+  size_t span = HDR_DEFAULT_SPAN; // frames per bracket a group may span, 1 for consecutive frames
+                                  // from a sequencer, bracketing from the host lags a few frames
+  float gamma = 2.2f;             // of the tone mapped output
+  bool radiance = false;          // also keep the linear radiance in counts of the longest exposure
+  size_t threads = 2;             // the merge thread and its workers
+};
+
+struct HdrFrame {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t channels = 0;
+  VmbPixelFormatType format = 0;  // 8 bit variant of the bracketed format
+  std::vector<unsigned char> pixels;  // tone mapped
+  std::vector<float> radiance;        // empty unless HdrSettings::radiance is set
+  uint64_t frameCount = 0;        // of the first frame of the group
+  uint64_t timestamp = 0;         // camera ticks of the first frame of the group
+  uint64_t mergeTime = 0;         // nanoseconds
+};
+
+class HdrMerger {
+ public:
+  HdrMerger(HdrMerger const&) = delete;
+  HdrMerger& operator=(HdrMerger const&) = delete;
+
+  HdrMerger(const HdrSettings& settings);
+  ~HdrMerger();
+
+  const HdrSettings& getSettings() const { return settings; }
+
+  // The bracket of a frame by its chunk exposure, -1 when it matches none.
+  // Without chunk data the frame count selects the bracket.
+  int getBracket(const Chunk& chunk, uint64_t frameCount) const;
+
+  // Mono8, Bayer 8 bit, RGB8, BGR8 and Mono10 to Mono16 in 16 bit containers
+  static bool isSupported(VmbPixelFormatType format);
+
+  // Copy a frame into its bracket, a later frame of the same bracket replaces
+  // it. A complete group is queued for the merge. Returns false when the frame
+  // was not used.
+  bool submit(const Frame& frame);
+
+  // Called from the merge thread with every merged frame
+  void setCallback(std::function<void(std::shared_ptr<const HdrFrame>)> callback = nullptr);
+
+  // The latest merged frame, nullptr when nothing new was merged
+  std::shared_ptr<const HdrFrame> poll() { return merged.poll(); }
+
+  uint64_t getMerged() const { return mergedCount.load(); }
+  uint64_t getSkipped() const { return skipped.load(); }
+  uint64_t getIncomplete() const { return incomplete.load(); }  // frames replaced before their group completed
+  const LatencyHistogram& getMergeTimes() const { return mergeTimes; }
+
+ private:
+  struct Slot {
+    std::vector<unsigned char> data;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VmbPixelFormatType format = 0;
+    uint64_t frameCount = 0;
+    uint64_t timestamp = 0;
+    double exposure = 0;
+    bool filled = false;
+  };
+
+  Logger logger;
+  HdrSettings settings;
+  std::vector<unsigned char> gammaTable;
+
+  // Filled by submit, swapped with the merged group when the merge is idle
+  std::vector<Slot> filling;
+  std::vector<Slot> merging;
+
+  std::mutex mutex;
+  std::condition_variable signal;
+  bool queued;  // a group waits for the merge
+  bool busy;    // the merging group is in use
+  bool running;
+  std::thread thread;
+
+  // Only used from the merge thread
+  std::unique_ptr<WorkerPool> pool;
+  struct Job {
+    const unsigned char* sources[HDR_MAX_BRACKETS];
+    float factors[HDR_MAX_BRACKETS];
+    float biases[HDR_MAX_BRACKETS];
+    size_t brackets = 0;
+    size_t samples = 0;
+    bool wide = false;
+    float maxValue = 0;
+    float white = 0;
+    HdrFrame* output = nullptr;
+  } job;
+
+  std::mutex callbackMutex;
+  std::function<void(std::shared_ptr<const HdrFrame>)> callback;
+  Handoff<HdrFrame> merged;
+
+  std::atomic<uint64_t> mergedCount;
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> incomplete;
+  LatencyHistogram mergeTimes;
+
+  bool isComplete() const;
+  void run();
+  bool merge(HdrFrame& frame);
+  void mergeBand(size_t band);
+};
+}  // namespace OosVimba
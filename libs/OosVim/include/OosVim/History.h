@@ -0,0 +1,77 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Chunk.h"
+
+namespace OosVim {
+
+static const size_t HISTORY_DEFAULT_CAPACITY = 4096;
+
+struct HistoryStatistics {
+  size_t frames = 0;           // number of frames in the window
+  double interval = 0;         // mean host arrival interval in ms
+  double jitter = 0;           // standard deviation of the host arrival interval in ms
+  double cameraInterval = 0;   // mean camera timestamp interval in ms
+  double cameraJitter = 0;     // standard deviation of the camera timestamp interval in ms
+  double dropRate = 0;         // fraction of missing or incomplete frames
+  double latency = 0;          // mean arrival latency in ms, relative to the fastest frame
+  double maxLatency = 0;       // maximum arrival latency in ms, relative to the fastest frame
+};
+
+// Fixed capacity history of per frame metadata, stored as a struct of arrays.
+// There is a single writer (the frame delivery thread) that appends without
+// locking. Readers access the columns in place: entry n lives in slot
+// getSlot(n), entries [max(0, count - capacity), count) are available. Only
+// the count is atomic, a reader that falls behind the writer by close to the
+// capacity can see the oldest entries overwritten, so reads while frames
+// arrive are approximate.
+class History {
+ public:
+  History(History const&) = delete;
+  History& operator=(History const&) = delete;
+
+  explicit History(size_t capacity = HISTORY_DEFAULT_CAPACITY);
+
+  void append(uint64_t id, uint64_t cameraTime, uint64_t hostTime, int32_t status, uint32_t size,
+              const Chunk& chunk);
+
+  size_t getCapacity() const { return capacity; }
+  uint64_t getCount() const { return count.load(std::memory_order_acquire); }
+  size_t getSlot(uint64_t n) const { return static_cast<size_t>(n & mask); }
+
+  // Columns
+  const uint64_t* getIds() const { return ids.data(); }
+  const uint64_t* getCameraTimes() const { return cameraTimes.data(); }
+  const uint64_t* getHostTimes() const { return hostTimes.data(); }   // steady clock in ns
+  const int32_t* getStatuses() const { return statuses.data(); }
+  const uint32_t* getSizes() const { return sizes.data(); }
+  const uint64_t* getFrameCounts() const { return frameCounts.data(); }
+  const uint32_t* getExposures() const { return exposures.data(); }
+  const double* getGains() const { return gains.data(); }   // dB
+
+  // Statistics over the last window frames, the tick frequency of the camera
+  // clock is needed for the camera interval and latency
+  HistoryStatistics computeStatistics(size_t window, uint64_t tickFrequency) const;
+
+ private:
+  size_t capacity;
+  uint64_t mask;
+  std::atomic<uint64_t> count;
+
+  std::vector<uint64_t> ids;
+  std::vector<uint64_t> cameraTimes;
+  std::vector<uint64_t> hostTimes;
+  std::vector<int32_t> statuses;
+  std::vector<uint32_t> sizes;
+  std::vector<uint64_t> frameCounts;
+  std::vector<uint32_t> exposures;
+  std::vector<double> gains;
+
+  bool computeWindow(uint64_t begin, uint64_t end, uint64_t tickFrequency, HistoryStatistics& statistics) const;
+};
+}  // namespace OosVimba
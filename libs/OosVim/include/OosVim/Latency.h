@@ -0,0 +1,80 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace OosVim {
+
+// Buckets of one microsecond up to 8us, then 8 buckets per power of two, so
+// every bucket is within 12.5% of its value, up to about 15 minutes
+static const size_t LATENCY_SUB_BUCKETS = 8;
+static const size_t LATENCY_BUCKET_COUNT = 224;
+
+enum class LatencyStage {
+  Transfer = 0,  // camera exposure to host arrival
+  Callback,      // host arrival to the exit of the frame callback
+  Pickup,        // host arrival to the pickup by the consumer
+  Total,         // camera exposure to the pickup by the consumer
+  Count
+};
+
+// Lock free histogram, recorded from one thread and read from any other
+class LatencyHistogram {
+ public:
+  LatencyHistogram(LatencyHistogram const&) = delete;
+  LatencyHistogram& operator=(LatencyHistogram const&) = delete;
+
+  LatencyHistogram() { reset(); }
+
+  void record(uint64_t nanoseconds);
+  void reset();
+
+  uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+  uint64_t getMax() const { return maximum.load(std::memory_order_relaxed); }
+  double getMean() const;
+
+  // Latency in ns below which a fraction p of the samples fall
+  uint64_t getPercentile(double p) const;
+
+  // Lower bound in ns and count of the buckets with samples
+  std::vector<std::pair<uint64_t, uint64_t>> getBuckets() const;
+
+ private:
+  std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> buckets;
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> maximum;
+
+  static size_t getBucket(uint64_t microseconds);
+  static uint64_t getLowerBound(size_t bucket);
+  static uint64_t getWidth(size_t bucket);
+};
+
+// Latency of the stages between camera exposure and the pickup by the
+// consumer, all times are host steady clock times in ns. An exposure time of
+// 0 means the camera clock is not synchronized with the host.
+class Latency {
+ public:
+  Latency(Latency const&) = delete;
+  Latency& operator=(Latency const&) = delete;
+
+  Latency() {}
+
+  void recordDelivery(uint64_t exposureTime, uint64_t arrivalTime, uint64_t callbackTime);
+  void recordPickup(uint64_t exposureTime, uint64_t arrivalTime, uint64_t pickupTime);
+  void reset();
+
+  const LatencyHistogram& getHistogram(LatencyStage stage) const { return histograms[static_cast<size_t>(stage)]; }
+
+ private:
+  std::array<LatencyHistogram, static_cast<size_t>(LatencyStage::Count)> histograms;
+
+  void record(LatencyStage stage, uint64_t from, uint64_t to);
+};
+}  // namespace OosVimba
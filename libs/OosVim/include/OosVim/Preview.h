@@ -0,0 +1,119 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Low rate JPEG or PNG previews of a stream, e.g. thumbnails for a remote
+// dashboard. Frames are downscaled on the delivery thread, a small pool of
+// workers encodes them. Frames are skipped when the rate is reached or when
+// all workers are busy, so encoding never holds up the stream.
+//
+// JPEG needs OOSVIM_TURBOJPEG and libturbojpeg, PNG needs OOSVIM_PNG and
+// libpng 1.6.29 or newer.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Handoff.h"
+#include "Latency.h"
+#include "Logger.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const double PREVIEW_DEFAULT_RATE = 2;
+static const uint32_t PREVIEW_DEFAULT_WIDTH = 640;
+static const uint32_t PREVIEW_MAX_FACTOR = 16;
+
+enum class PreviewCodec { Jpeg, Png };
+
+struct PreviewSettings {
+  PreviewCodec codec = PreviewCodec::Jpeg;
+  int quality = 75;                          // JPEG quality, 1 to 100
+  double rate = PREVIEW_DEFAULT_RATE;        // previews per second, 0 encodes what the workers keep up with
+  uint32_t maxWidth = PREVIEW_DEFAULT_WIDTH; // halved until the preview fits
+  size_t workers = 1;
+};
+
+struct Preview {
+  std::vector<unsigned char> data;  // encoded image
+  PreviewCodec codec = PreviewCodec::Jpeg;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint64_t id = 0;
+  uint64_t timestamp = 0;   // camera ticks
+  uint64_t encodeTime = 0;  // nanoseconds
+};
+
+// Whether a codec is available in this build
+bool isPreviewCodecAvailable(PreviewCodec codec);
+
+class PreviewEncoder {
+ public:
+  PreviewEncoder(PreviewEncoder const&) = delete;
+  PreviewEncoder& operator=(PreviewEncoder const&) = delete;
+
+  PreviewEncoder(const PreviewSettings& settings = PreviewSettings());
+  ~PreviewEncoder();
+
+  // Downscale and queue a frame, returns false when it was skipped. Mono8,
+  // RGB8, BGR8, RGBA8 and BGRA8 are supported.
+  bool submit(const Frame& frame);
+
+  // Called from a worker with every encoded preview
+  void setCallback(std::function<void(std::shared_ptr<const Preview>)> callback = nullptr);
+
+  // The latest preview, nullptr when nothing new was encoded
+  std::shared_ptr<const Preview> poll() { return previews.poll(); }
+
+  uint64_t getEncoded() const { return encoded.load(); }
+  uint64_t getSkipped() const { return skipped.load(); }  // unsupported, or all workers busy
+  uint64_t getLimited() const { return limited.load(); }  // above the preview rate
+  size_t getQueueDepth() const { return depth.load(); }
+  const LatencyHistogram& getEncodeTimes() const { return encodeTimes; }
+
+ private:
+  struct Job {
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> scratch;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t channels = 0;
+    uint32_t format = 0;
+    uint64_t id = 0;
+    uint64_t timestamp = 0;
+    bool queued = false;
+    bool busy = false;
+  };
+
+  Logger logger;
+  PreviewSettings settings;
+  bool available;
+
+  std::mutex mutex;
+  std::condition_variable signal;
+  std::vector<Job> jobs;
+  bool running;
+  std::vector<std::thread> workers;
+
+  std::mutex callbackMutex;
+  std::function<void(std::shared_ptr<const Preview>)> callback;
+  Handoff<Preview> previews;
+
+  uint64_t nextPreviewAt;
+  std::atomic<uint64_t> encoded;
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> limited;
+  std::atomic<size_t> depth;
+  LatencyHistogram encodeTimes;
+
+  void encode();
+  bool encode(const Job& job, void* compressor, Preview& preview);
+};
+}  // namespace OosVimba
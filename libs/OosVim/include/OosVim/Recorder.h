@@ -0,0 +1,178 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Record raw frames to disk. Frames are copied on the delivery thread, a pool
+// of workers compresses every frame on its own and a writer thread appends
+// them in order. A seek index is written when the recording is closed, the
+// RecordReader rebuilds it when a recording was not closed.
+//
+// LZ4 and Zstd are available when built with OOSVIM_LZ4 and OOSVIM_ZSTD and
+// linked with liblz4 and libzstd, without them the frames are stored as is.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logger.h"
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const uint32_t RECORD_MAGIC = 0x526f734f;        // "OosR"
+static const uint32_t RECORD_FRAME_MAGIC = 0x466f734f;  // "OosF"
+static const uint32_t RECORD_INDEX_MAGIC = 0x496f734f;  // "OosI"
+static const uint32_t RECORD_VERSION = 1;
+static const size_t RECORD_DEFAULT_WORKERS = 2;
+static const size_t RECORD_DEFAULT_QUEUE = 8;
+
+enum class RecordCodec : uint32_t { None = 0, Lz4 = 1, Zstd = 2 };
+enum class RecordOverflow { Drop, Block };
+
+struct RecordSettings {
+  RecordCodec codec = RecordCodec::Lz4;
+  int level = 1;                      // Zstd level, LZ4 acceleration
+  bool filter = true;                 // delta and byte plane preprocessing of mono and bayer frames
+  size_t workers = RECORD_DEFAULT_WORKERS;
+  size_t queueSize = RECORD_DEFAULT_QUEUE;  // frames in flight before the overflow applies
+  RecordOverflow overflow = RecordOverflow::Drop;
+};
+
+struct RecordFileHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+// Precedes the stored data of every frame
+struct RecordFrameHeader {
+  uint32_t magic;
+  uint32_t codec;
+  uint32_t filtered;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint64_t id;
+  uint64_t timestamp;
+  uint64_t frameCount;
+  uint32_t rawSize;
+  uint32_t storedSize;
+};
+
+struct RecordIndexEntry {
+  uint64_t offset;  // of the frame header
+  uint64_t id;
+  uint64_t timestamp;
+};
+
+// Ends a closed recording, after the index
+struct RecordTrailer {
+  uint64_t indexOffset;
+  uint64_t count;
+  uint32_t magic;
+  uint32_t version;
+};
+
+// Whether a codec is available in this build
+bool isRecordCodecAvailable(RecordCodec codec);
+
+class Recorder {
+ public:
+  Recorder(Recorder const&) = delete;
+  Recorder& operator=(Recorder const&) = delete;
+
+  Recorder(const std::string& path, const RecordSettings& settings = RecordSettings());
+  ~Recorder();
+
+  bool isOpen() const { return bOpen.load(); }
+
+  // Queue a copy of the frame, returns false when it was dropped. Call from
+  // one thread, usually the thread that delivers the frames.
+  bool record(const Frame& frame);
+  bool record(const unsigned char* data, uint32_t size, uint32_t width, uint32_t height, uint32_t format,
+              uint64_t id, uint64_t timestamp, uint64_t frameCount);
+
+  // Write the queued frames and the index
+  void close();
+
+  uint64_t getRecorded() const { return recorded.load(); }
+  uint64_t getDropped() const { return dropped.load(); }  // the queue was full
+  uint64_t getFailed() const { return failed.load(); }    // the write failed
+
+  // Frame data before and after compression, without the headers
+  uint64_t getRawBytes() const { return rawBytes.load(); }
+  uint64_t getStoredBytes() const { return storedBytes.load(); }
+  double getRatio() const;
+
+ private:
+  struct Job {
+    RecordFrameHeader header;
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> stored;
+    bool done = false;
+  };
+
+  Logger logger;
+  RecordSettings settings;
+  std::ofstream file;
+  uint64_t offset;
+  std::vector<RecordIndexEntry> index;
+
+  std::mutex mutex;
+  std::condition_variable workSignal;
+  std::condition_variable doneSignal;
+  std::condition_variable freeSignal;
+  std::vector<Job> jobs;
+  uint64_t submitted;
+  uint64_t claimed;
+  uint64_t written;
+  bool closing;
+
+  std::vector<std::thread> workers;
+  std::thread writer;
+
+  std::atomic<bool> bOpen;
+  std::atomic<uint64_t> recorded;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> failed;
+  std::atomic<uint64_t> rawBytes;
+  std::atomic<uint64_t> storedBytes;
+
+  void compress();
+  void write();
+};
+
+class RecordReader {
+ public:
+  RecordReader(RecordReader const&) = delete;
+  RecordReader& operator=(RecordReader const&) = delete;
+
+  RecordReader(const std::string& path);
+
+  bool isOpen() const { return file.is_open(); }
+  size_t getFrameCount() const { return index.size(); }
+  const std::vector<RecordIndexEntry>& getIndex() const { return index; }
+
+  // Position of the first frame at or after a camera timestamp
+  size_t find(uint64_t timestamp) const;
+
+  // Read and decompress the frame at a position in the recording
+  bool read(size_t position, RecordFrameHeader& header, std::vector<unsigned char>& data);
+
+ private:
+  Logger logger;
+  std::ifstream file;
+  std::vector<RecordIndexEntry> index;
+  std::vector<unsigned char> stored;
+  std::vector<unsigned char> filtered;
+
+  bool readIndex();
+  void rebuildIndex();
+};
+}  // namespace OosVimba
@@ -0,0 +1,108 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+#include "Device.h"
+#include "Logger.h"
+#include "System.h"
+
+namespace OosVim {
+
+// Every discovery observer receives the same plug event, a camera that was
+// refreshed this recently is not refreshed again
+static const uint64_t REGISTRY_EVENT_WINDOW = 250;  // ms
+
+// Cameras inspected at the same time during an enumeration
+static const size_t REGISTRY_MAX_INSPECTIONS = 4;
+
+// The registry keeps a single Device per camera id. It is updated incrementally
+// by discovery events, so a hot-plug only inspects the camera that changed.
+// Readers receive an immutable snapshot of the list, which is replaced (not
+// modified) whenever the registry changes.
+class Registry {
+ public:
+  // Disable copy and move
+  Registry(Registry const&) = delete;
+  Registry(Registry&&) = delete;
+  Registry& operator=(Registry const&) = delete;
+  Registry& operator=(Registry&&) = delete;
+
+  ~Registry();
+
+  static std::shared_ptr<Registry> getInstance() {
+    static std::weak_ptr<Registry> _weakInstance;
+    if (auto existingPtr = _weakInstance.lock()) return existingPtr;
+    auto newPtr = std::shared_ptr<Registry>(new Registry());
+    _weakInstance = newPtr;
+    return newPtr;
+  }
+
+  // Full enumeration, reconciles the registry with the cameras the API knows
+  // about. Existing devices are reused, new cameras are inspected in parallel,
+  // up to REGISTRY_MAX_INSPECTIONS at a time. Cameras plugged in or out during
+  // the enumeration keep their plug state.
+  bool enumerate();
+  bool isEnumerated() const { return enumerated.load(); }
+
+  // Enumerate on a background thread unless the registry is enumerated or an
+  // enumeration is already running, returns right away
+  void requestEnumeration();
+
+  // Incremental updates, these return the registered device for the camera
+  std::shared_ptr<Device> pluggedIn(AVT::VmbAPI::CameraPtr camera);
+  std::shared_ptr<Device> pluggedOut(AVT::VmbAPI::CameraPtr camera);
+  std::shared_ptr<Device> stateChanged(AVT::VmbAPI::CameraPtr camera);
+
+  // Lookup, find only searches the registry, while lookup queries the API
+  // for a single unknown camera without enumerating all of them
+  std::shared_ptr<Device> find(const std::string& id) const;
+  std::shared_ptr<Device> lookup(const std::string& id);
+  std::shared_ptr<const Device_List_t> getSnapshot() const;
+
+ private:
+  Registry();
+
+  Logger logger;
+
+  // The system is only started when the registry first needs it
+  std::mutex systemMutex;
+  std::shared_ptr<System> system;
+  std::shared_ptr<System> getSystem();
+
+  std::mutex enumerateMutex;
+  std::mutex enumeratorMutex;
+  std::thread enumerator;
+  std::atomic<bool> enumerating;
+
+  mutable std::mutex mutex;
+  std::map<std::string, std::shared_ptr<Device>> devices;
+  std::shared_ptr<const Device_List_t> snapshot;
+  std::atomic<bool> enumerated;
+
+  // Plug events during an enumeration, true for plugged in
+  bool scanning;
+  std::map<std::string, bool> plugged;
+
+  // Inspections in progress and the last refresh per camera, so the
+  // observers of one plug event share a single inspection
+  std::map<std::string, std::shared_future<std::shared_ptr<Device>>> inspecting;
+  std::map<std::string, uint64_t> refreshedAt;
+
+  std::shared_ptr<Device> insert(AVT::VmbAPI::CameraPtr camera, const std::string& id);
+  void publish();
+  void touch(const std::string& id, bool pluggedIn);
+
+  static bool readId(const AVT::VmbAPI::CameraPtr& camera, std::string& id);
+};
+}  // namespace OosVimba
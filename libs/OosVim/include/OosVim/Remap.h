@@ -0,0 +1,96 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Lens undistortion and other geometric warps of 8 bit frames, e.g. for
+// projection mapping. The mapping is evaluated once per frame size into a
+// compact table of fixed point source positions. Every frame is then remapped
+// with bilinear interpolation in bands of rows over a WorkerPool.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+#include "WorkerPool.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const uint32_t REMAP_FRACTION_BITS = 7;
+static const uint32_t REMAP_FRACTION_ONE = 1 << REMAP_FRACTION_BITS;
+static const uint16_t REMAP_OUTSIDE = 0xffff;  // weight of output pixels without a source, they are black
+static const uint32_t REMAP_BAND_ROWS = 16;
+
+// Brown-Conrady model with the camera matrix and distortion coefficients of
+// an OpenCV calibration. The model is scaled to the frame size.
+struct LensModel {
+  uint32_t width = 0;   // resolution of the calibration
+  uint32_t height = 0;
+  double fx = 0;
+  double fy = 0;
+  double cx = 0;
+  double cy = 0;
+  double k1 = 0;
+  double k2 = 0;
+  double k3 = 0;
+  double p1 = 0;
+  double p2 = 0;
+  double zoom = 1;      // of the undistorted image, below 1 keeps more of the border
+
+  bool isValid() const { return width > 0 && height > 0 && fx > 0 && fy > 0 && zoom > 0; }
+};
+
+// The source position of the center of an output pixel, in pixels of a frame
+// of width by height. Both the output and the source have the frame size.
+using RemapFunction = std::function<void(double x, double y, uint32_t width, uint32_t height, double& sourceX,
+                                         double& sourceY)>;
+
+// The source position of the output pixels of one frame size
+struct RemapTable {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint32_t> offsets;  // index of the top left source pixel
+  std::vector<uint16_t> weights;  // horizontal fraction in the low byte, vertical in the high byte
+};
+
+class Remapper {
+ public:
+  Remapper(Remapper const&) = delete;
+  Remapper& operator=(Remapper const&) = delete;
+
+  // The calling thread takes part in the remap
+  Remapper(size_t threads = 1);
+
+  // Replace the mapping, the table is rebuilt with the next frame
+  void setLens(const LensModel& lens);
+  void setFunction(RemapFunction function);
+
+  // Remap into a destination of the frame size, Mono8, RGB8, BGR8, RGBA8 and
+  // BGRA8 are supported. The table is rebuilt when the frame size changes,
+  // e.g. after the stream was resized.
+  bool remap(const Frame& frame, unsigned char* destination);
+  bool remap(const unsigned char* source, uint32_t width, uint32_t height, uint32_t channels,
+             unsigned char* destination);
+
+  // Number of times the table was built
+  uint64_t getBuilds() const { return builds.load(); }
+
+ private:
+  std::mutex mutex;
+  RemapFunction function;
+  bool dirty;
+
+  // Only used from the thread that remaps
+  RemapFunction current;
+  RemapTable table;
+  std::unique_ptr<WorkerPool> pool;
+  std::atomic<uint64_t> builds;
+
+  void build(uint32_t width, uint32_t height);
+};
+}  // namespace OosVimba
@@ -0,0 +1,151 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Fan out frames to other processes on the same host through a POSIX shared
+// memory ring. One process acquires from the camera and publishes, any number
+// of subscribers read the frames in place without opening the camera or the
+// Vimba system. Not available on Windows.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Logger.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const uint32_t SHARED_MAGIC = 0x4f6f7356;  // "OosV"
+static const uint32_t SHARED_VERSION = 2;
+static const size_t SHARED_DEFAULT_SLOTS = 8;
+static const size_t SHARED_ALIGNMENT = 64;
+static const unsigned int SHARED_DEFAULT_PERMISSIONS = 0600;  // owner only
+static const uint64_t SHARED_CHECK_INTERVAL = 500;            // ms between checks for a new region
+
+// Header at the start of the shared memory
+struct SharedHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t slotSize;                // payload capacity of a slot
+  uint64_t generation;              // unique per region, changes when the publisher recreates it
+  std::atomic<uint64_t> published;  // number of published frames
+  std::atomic<uint32_t> retired;    // set when the publisher leaves the region
+};
+
+// Header of every slot, followed by the payload. The sequence is odd while the
+// slot is written and 2 * (n + 1) once frame n is complete.
+struct SharedSlot {
+  std::atomic<uint64_t> sequence;
+  uint64_t id;
+  uint64_t timestamp;
+  uint64_t frameCount;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t size;
+};
+
+// A frame in shared memory, the data is valid as long as isValid returns true
+struct SharedFrame {
+  const unsigned char* data = nullptr;
+  uint64_t number = 0;  // position in the published sequence
+  uint64_t generation = 0;
+  uint64_t id = 0;
+  uint64_t timestamp = 0;
+  uint64_t frameCount = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t format = 0;
+  uint32_t size = 0;
+};
+
+// Maps a shared memory region, base of the publisher and subscriber
+class SharedRegion {
+ public:
+  SharedRegion(SharedRegion const&) = delete;
+  SharedRegion& operator=(SharedRegion const&) = delete;
+
+  SharedRegion(const std::string& name);
+  virtual ~SharedRegion();
+
+  bool isOpen() const { return header != nullptr; }
+  const std::string& getName() const { return name; }
+
+ protected:
+  Logger logger;
+  std::string name;
+  SharedHeader* header;
+  unsigned char* memory;
+  size_t length;
+
+  bool map(bool create, size_t size, unsigned int permissions = SHARED_DEFAULT_PERMISSIONS);
+  void unmap();
+
+  // Generation of the region that is currently published under the name
+  bool readGeneration(uint64_t& generation) const;
+
+  SharedSlot* getSlot(uint64_t number) const;
+  static size_t getSlotStride(size_t slotSize);
+  static size_t getLength(size_t slotCount, size_t slotSize);
+};
+
+class SharedPublisher : public SharedRegion {
+ public:
+  // A slot size of 0 sizes the slots on the first published frame, and grows
+  // them when a larger frame arrives. The permissions apply to the region,
+  // other users need e.g. 0644 to subscribe.
+  SharedPublisher(const std::string& name, size_t slotCount = SHARED_DEFAULT_SLOTS, size_t slotSize = 0,
+                  unsigned int permissions = SHARED_DEFAULT_PERMISSIONS);
+  ~SharedPublisher();
+
+  bool publish(const Frame& frame);
+  bool publish(const unsigned char* data, uint32_t size, uint32_t width, uint32_t height, uint32_t format,
+               uint64_t id, uint64_t timestamp, uint64_t frameCount);
+
+  uint64_t getPublished() const { return isOpen() ? header->published.load() : 0; }
+  uint64_t getSkipped() const { return skipped.load(); }
+
+ private:
+  size_t slotCount;
+  size_t slotSize;
+  unsigned int permissions;
+  std::atomic<uint64_t> skipped;
+
+  bool create(size_t size);
+  void retire();
+};
+
+class SharedSubscriber : public SharedRegion {
+ public:
+  SharedSubscriber(const std::string& name);
+
+  // Attach to the publisher, retry until the publisher is available. The
+  // subscriber attaches again by itself when the publisher restarts or grows
+  // its slots, frames read before are no longer valid then.
+  bool open();
+
+  // Latest only, the newest frame when it was not read before
+  bool latest(SharedFrame& frame);
+
+  // Lossless, the next frame in order. Frames are lost only when the
+  // subscriber falls behind more than the number of slots.
+  bool next(SharedFrame& frame);
+
+  // Check after reading the data that the publisher did not overwrite it
+  bool isValid(const SharedFrame& frame) const;
+
+  uint64_t getLost() const { return lost; }
+
+ private:
+  uint64_t cursor;
+  uint64_t lost;
+  uint64_t checkedAt;
+
+  bool read(uint64_t number, SharedFrame& frame) const;
+  bool refresh();
+};
+}  // namespace OosVimba
@@ -0,0 +1,103 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Image statistics computed straight from the raw frame buffer, for host side
+// auto exposure and focus metrics. Histograms, means and clipping per channel
+// and the Laplacian variance as a sharpness measure, on a region of interest
+// that can be sampled sparsely and split over a WorkerPool.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+#include "WorkerPool.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const uint32_t STATISTICS_BINS = 256;
+static const uint32_t STATISTICS_MAX_CHANNELS = 3;
+
+struct StatisticsSettings {
+  uint32_t x = 0;       // region of interest, a width or height of 0 extends
+  uint32_t y = 0;       // the region to the edge of the frame
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t stride = 1;  // sample every stride-th pixel of every stride-th row
+  bool sharpness = true;
+  size_t threads = 1;   // including the thread that delivers the frames
+};
+
+struct ChannelStatistics {
+  std::array<uint32_t, STATISTICS_BINS> histogram{};  // values scaled to 8 bits
+  uint64_t count = 0;
+  double mean = 0;         // 0 to 1
+  double clippedLow = 0;   // ratio of the samples in the lowest bin
+  double clippedHigh = 0;  // ratio of the samples in the highest bin
+
+  // The value below which a ratio p of the samples falls, 0 to 1
+  double getPercentile(double p) const;
+};
+
+struct FrameStatistics {
+  uint64_t frameId = 0;
+  uint32_t channels = 0;  // 1 for mono and raw bayer, 3 for color in RGB order
+  uint32_t bitDepth = 0;
+  std::array<ChannelStatistics, STATISTICS_MAX_CHANNELS> channel;
+  double sharpness = 0;   // Laplacian variance of the luminance, values scaled to 0 to 1
+
+  bool isValid() const { return channels > 0; }
+  double getMean() const;
+  double getClippedLow() const;
+  double getClippedHigh() const;
+};
+
+// Channels of the formats the statistics support, 0 otherwise. Bayer formats
+// are measured as mono, packed formats are not supported.
+uint32_t getStatisticsChannels(VmbPixelFormatType format);
+
+class StatisticsEngine {
+ public:
+  StatisticsEngine(StatisticsEngine const&) = delete;
+  StatisticsEngine& operator=(StatisticsEngine const&) = delete;
+
+  StatisticsEngine(const StatisticsSettings& settings = StatisticsSettings());
+
+  void setSettings(const StatisticsSettings& settings);
+  const StatisticsSettings& getSettings() const { return settings; }
+
+  bool compute(const Frame& frame, FrameStatistics& statistics);
+  bool compute(const unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format,
+               FrameStatistics& statistics);
+
+  // Description of the values in a row of a frame
+  struct Layout {
+    uint32_t bytes;       // per value
+    uint32_t step;        // values per pixel
+    uint32_t channels;
+    uint32_t offset[STATISTICS_MAX_CHANNELS];
+    uint32_t luminance;   // channel used for the sharpness
+    uint32_t shift;       // from the bit depth to the 8 bit histogram
+    uint32_t spacing;     // pixels to the neighbours of the same color
+  };
+
+  // Results of one band of rows
+  struct Partial {
+    uint32_t histogram[STATISTICS_MAX_CHANNELS][STATISTICS_BINS];
+    uint64_t sum[STATISTICS_MAX_CHANNELS];
+    double laplacianSum;
+    double laplacianSquares;
+    uint64_t laplacianCount;
+  };
+
+ private:
+  StatisticsSettings settings;
+  std::unique_ptr<WorkerPool> pool;
+  std::vector<Partial> partials;
+};
+}  // namespace OosVimba
@@ -2,18 +2,27 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <functional>
+#include <vector>
 
 #include "VimbaCPP/Include/VimbaCPP.h"
 
+#include "Buffer.h"
+#include "Change.h"
+#include "Chunk.h"
+#include "Correction.h"
 #include "Device.h"
 #include "Frame.h"
+#include "History.h"
+#include "Latency.h"
 #include "Logger.h"
+#include "Thread.h"
 
 namespace OosVim {
 static const uint64_t CAMERA_NO_TIMEOUT = 0;
@@ -21,6 +30,10 @@ static const uint64_t CAMERA_HEALTH_TIMEOUT = 100;
 static const uint64_t CAMERA_STALLED_TIMEOUT = 1500;
 static const uint64_t CAMERA_INITIALIZE_TIMEOUT = 1000;
 static const uint64_t CAMERA_WAIT_TIMEOUT = 1000;
+static const uint64_t CAMERA_CLOCK_SYNC_INTERVAL = 10000;
+
+static const unsigned int STREAM_DEFAULT_BUFFER_SIZE = 4;
+static const unsigned int STREAM_LATENCY_BUFFER_SIZE = 2;
 
 class StreamObserver;
 class Stream {
@@ -30,7 +43,8 @@ class Stream {
   Stream(Stream const&) = delete;
   Stream& operator=(Stream const&) = delete;
 
-  Stream(const std::shared_ptr<Device> device, unsigned int bufferSize = 4);
+  Stream(const std::shared_ptr<Device> device, unsigned int bufferSize = STREAM_DEFAULT_BUFFER_SIZE,
+         size_t historySize = HISTORY_DEFAULT_CAPACITY);
   ~Stream();
 
   bool isRunning() const { return running.load(); };
@@ -42,6 +56,69 @@ class Stream {
   void start();
   void stop();
 
+  // Memory of the announced buffers, applies to the next allocation
+  void setBufferPolicy(const BufferPolicy& policy);
+
+  // Metadata of the received frames
+  std::shared_ptr<const History> getHistory() const { return history; }
+  HistoryStatistics getStatistics(size_t window) const { return history->computeStatistics(window, tickFrequency.load()); }
+
+  // Latency between exposure, arrival and the exit of the frame callback, the
+  // consumer adds the pickup with recordPickup
+  std::shared_ptr<Latency> getLatency() const { return latency; }
+
+  // Drop frames that are late when a newer complete frame is already waiting,
+  // instead of delivering a backlog. Dropped frames are recorded in the
+  // history, but not delivered.
+  void setDropStale(bool value) { dropStale = value; }
+  bool isDropStale() const { return dropStale.load(); }
+  uint64_t getStale() const { return stale.load(); }
+
+  // Deliver only every nth frame and at most rate frames per second, based on
+  // the camera timestamps, or the host arrival time for injected frames and
+  // cameras without a tick frequency. Skipped frames are dropped before they
+  // are loaded and are recorded in the history only. 1 and 0 disable the
+  // decimation.
+  void setDecimation(unsigned int n) { decimation = n; }
+  void setMaxRate(double rate) { minInterval = rate > 0 ? static_cast<uint64_t>(1e9 / rate) : 0; }
+  uint64_t getDecimated() const { return decimated.load(); }
+
+  // Calibrate the frames in place, in the announced buffers, before they are
+  // delivered. nullptr disables the correction.
+  void setCorrection(std::shared_ptr<const Correction> value);
+  std::shared_ptr<const Correction> getCorrection() const;
+
+  // Compare the frames with a reference before they are loaded. The score is
+  // set on the delivered frames, unchanged frames are dropped when the detector
+  // skips them and are recorded in the history only. nullptr disables it.
+  void setChangeDetector(std::shared_ptr<ChangeDetector> value);
+  std::shared_ptr<ChangeDetector> getChangeDetector() const;
+  uint64_t getUnchanged() const { return unchanged.load(); }
+
+  // Scheduling and cores of the stream thread and of the Vimba thread that
+  // delivers the frames. Applied when the threads next run, the delivery
+  // thread keeps its policy after the stream stops. Action is ignored.
+  void setThreadPolicy(ThreadRole role, const ThreadPolicy& policy);
+  std::vector<ThreadPlacement> getThreadPlacements();
+
+  // Host steady clock in ns, used for all frame times
+  static uint64_t getHostTime() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  }
+
+  // Deliver a frame from a host buffer instead of the camera, e.g. for playback
+  // or synthetic sources. The data is only used within the frame callback.
+  bool inject(unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format, uint32_t size,
+              uint64_t id, uint64_t timestamp, const Chunk& chunk = Chunk());
+
+  // Number of frame objects allocated by the stream, stays constant once the
+  // pool covers the frames held by the consumers. The pool stops growing at
+  // FRAME_POOL_GROWTH times the buffer count, frames that arrive while the
+  // consumers hold all of them are dropped and counted as exhausted.
+  uint64_t getFrameAllocations() const { return pool.getAllocations(); }
+  uint64_t getExhausted() const { return pool.getExhausted(); }
+
   // Callback
   std::function<void(const std::shared_ptr<Frame>)> frameCallbackFunction;
   void setFrameCallback(std::function<void(const std::shared_ptr<Frame>)> value) { frameCallbackFunction = value; }
@@ -55,7 +132,17 @@ class Stream {
   bool close();
 
   // Process frames
-  bool receive(AVT::VmbAPI::FramePtr frame);
+  bool receive(AVT::VmbAPI::FramePtr frame, VmbFrameStatusType status);
+  void deliver(const std::shared_ptr<Frame>& frame, uint64_t hostTime);
+  bool isStale(const AVT::VmbAPI::FramePtr& frame, uint64_t timestamp, uint64_t hostTime);
+  bool hasNewerFrame(const AVT::VmbAPI::FramePtr& frame, uint64_t timestamp) const;
+  bool isDecimated(uint64_t timestamp, uint64_t hostTime);
+  bool isUnchanged(ChangeDetector& detector, const unsigned char* data, uint32_t width, uint32_t height,
+                   VmbPixelFormatType format, float& score);
+
+  // Map the camera clock to the host clock
+  bool synchronizeClock();
+  uint64_t toHostTime(uint64_t timestamp) const;
 
   // Prepare and teardown stream
   bool prepare();
@@ -78,10 +165,53 @@ class Stream {
   Logger logger;
 
   std::shared_ptr<Device> device;
+
+  // The provider owns the memory of the frames, so it is declared first
+  std::shared_ptr<BufferProvider> provider;
+  std::vector<unsigned char*> buffers;
   AVT::VmbAPI::FramePtrVector frames;
   SP_DECL(StreamObserver) observer;
 
+  // The chunk layout is resolved once per stream
+  ChunkDecoder decoder;
+  FramePool pool;
+
+  std::shared_ptr<History> history;
+  std::shared_ptr<Latency> latency;
+  std::atomic<uint64_t> tickFrequency;
+
+  // Host time in ns minus camera time in ns, valid once synchronized
+  std::atomic<int64_t> clockOffset;
+  std::atomic<bool> clockSynchronized;
+  uint64_t clockSynchronizedAt;
+
+  // Stale frame detection, only used from the frame delivery thread
+  std::atomic<bool> dropStale;
+  std::atomic<uint64_t> stale;
+  int64_t ageBaseline;
+  uint64_t lastTimestamp;
+
+  // Decimation, the counters are only used from the frame delivery thread
+  std::atomic<unsigned int> decimation;
+  std::atomic<uint64_t> minInterval;
+  std::atomic<uint64_t> decimated;
+  uint64_t decimationCount;
+  uint64_t nextDeliveryAt;
+  bool decimationOnHost;  // the schedule follows the host clock
+
+  // Calibration, the flag is only used from the frame delivery thread
+  mutable std::mutex correctionMutex;
+  std::shared_ptr<const Correction> correction;
+  bool correctionFailed;
+
+  // Change detection
+  mutable std::mutex changeMutex;
+  std::shared_ptr<ChangeDetector> changeDetector;
+  std::atomic<uint64_t> unchanged;
+
   // Thread and communication
+  ThreadBinding streamThread;
+  ThreadBinding deliveryThread;
   std::mutex mutex;
   std::shared_ptr<std::thread> thread;
   std::condition_variable signal;
@@ -101,6 +231,10 @@ class Stream {
     std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
     return std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
   }
+
+  static uint64_t ticksToNanoseconds(uint64_t ticks, uint64_t frequency) {
+    return ticks / frequency * 1000000000ULL + ticks % frequency * 1000000000ULL / frequency;
+  }
 };
 
 class StreamObserver : public AVT::VmbAPI::IFrameObserver,
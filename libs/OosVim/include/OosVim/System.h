@@ -2,7 +2,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 
@@ -20,6 +22,18 @@ struct Version {
   std::string string = "Unknown";
 };
 
+// The features of a GigE action command with its keys, prepared once by the
+// scheduler that sends it
+struct ActionCommand {
+  uint32_t deviceKey = 0;
+  uint32_t groupKey = 0;
+  uint32_t groupMask = 0;
+  AVT::VmbAPI::FeaturePtr deviceKeyFeature;
+  AVT::VmbAPI::FeaturePtr groupKeyFeature;
+  AVT::VmbAPI::FeaturePtr groupMaskFeature;
+  AVT::VmbAPI::FeaturePtr command;
+};
+
 class System {
  public:
   // Disable copy and move
@@ -47,6 +61,14 @@ class System {
   Version& getVersion() { return version; };
   std::string& getVersionString() { return version.string; };
 
+  // GigE action commands, the transport layer broadcasts one command to all
+  // cameras with a matching device key, group key and group mask. Prepare
+  // locates the features once. The keys are shared by the whole system, so
+  // send writes them again when another command changed them and runs the
+  // command under the same lock.
+  bool prepareAction(ActionCommand& action, uint32_t deviceKey, uint32_t groupKey, uint32_t groupMask);
+  bool sendAction(const ActionCommand& action);
+
  private:
   System();
 
@@ -58,5 +80,9 @@ class System {
   AVT::VmbAPI::VimbaSystem* api = nullptr;
   Logger logger;
   Version version;
+
+  std::mutex actionMutex;
+  bool actionKeysValid = false;
+  uint32_t actionKeys[3] = {};  // the keys that were written last
 };
 }  // namespace OosVimba
@@ -0,0 +1,85 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Scheduling and CPU placement of the threads that acquire the frames, so a
+// render loop that loads the machine does not delay them. Real-time policies
+// need CAP_SYS_NICE or an rtprio limit on Linux, without it the thread falls
+// back to its nice value. Nothing fails when a policy is refused, the
+// placement that is in effect afterwards is reported instead.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+
+namespace OosVim {
+
+enum class ThreadScheduling {
+  Other,      // the default time sharing scheduler, with a nice value
+  Fifo,       // real-time, runs until it blocks
+  RoundRobin  // real-time, time sliced between threads of the same priority
+};
+
+enum class ThreadRole {
+  Stream,    // Stream::run, opens the stream and watches its health
+  Delivery,  // the Vimba thread that delivers the frames and runs the frame callback
+  Action     // Grabber::actionRunner, connects and configures the camera
+};
+
+struct ThreadPolicy {
+  ThreadScheduling scheduling = ThreadScheduling::Other;
+  int priority = 0;        // 1 to 99 for the real-time policies
+  int nice = 0;            // -20 to 19 with Other, Linux only
+  std::vector<int> cores;  // cores the thread may run on, empty for any core
+};
+
+// The policy that is in effect for a thread
+struct ThreadPlacement {
+  std::string name;
+  bool applied = false;    // false until a policy was applied to the thread
+  bool degraded = false;   // part of the policy was refused
+  ThreadScheduling scheduling = ThreadScheduling::Other;
+  int priority = 0;
+  int nice = 0;
+  std::vector<int> cores;  // empty when unknown on this platform
+};
+
+std::string toString(const ThreadPlacement& placement);
+
+// Applies a policy to the threads that call apply, once per thread and again
+// when the policy changes. Threads that OosVim does not create, like the
+// Vimba delivery thread, apply it from their callbacks. Without a policy
+// apply leaves the thread alone.
+class ThreadBinding {
+ public:
+  ThreadBinding(ThreadBinding const&) = delete;
+  ThreadBinding& operator=(ThreadBinding const&) = delete;
+
+  ThreadBinding(const std::string& name);
+
+  void setPolicy(const ThreadPolicy& policy);
+  ThreadPolicy getPolicy();
+  ThreadPlacement getPlacement();
+
+  // Cheap when nothing changed, call at the top of a thread loop or callback
+  void apply();
+
+ private:
+  Logger logger;
+  std::string name;
+
+  std::mutex mutex;
+  ThreadPolicy policy;
+  ThreadPlacement placement;
+  std::atomic<uint64_t> version;
+  std::atomic<uint64_t> appliedVersion;
+  std::atomic<size_t> appliedThread;
+
+  void applyPolicy(const ThreadPolicy& policy, ThreadPlacement& placement);
+  void queryPlacement(ThreadPlacement& placement);
+};
+}  // namespace OosVimba
@@ -0,0 +1,57 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Lightweight trace spans, written as a Chrome trace event file that opens in
+// chrome://tracing or ui.perfetto.dev. Every thread records into its own ring
+// buffer without locking. Define OOSVIM_TRACE for all sources to enable the
+// spans, otherwise the macros compile to nothing and write() returns false.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace OosVim {
+
+static const size_t TRACE_BUFFER_SIZE = 16384;  // spans per thread, the oldest are overwritten
+
+class Trace {
+ public:
+  static bool isEnabled();
+
+  // Name of the calling thread in the trace, the name should be a literal
+  static void setThreadName(const char* name);
+
+  static void record(const char* name, uint64_t start, uint64_t end);
+  static uint64_t now();
+
+  // Write the spans of all threads, they are kept for the next write
+  static bool write(const std::string& path);
+
+  // Drop the spans of threads that have exited
+  static void clear();
+};
+
+#ifdef OOSVIM_TRACE
+class TraceScope {
+ public:
+  TraceScope(TraceScope const&) = delete;
+  TraceScope& operator=(TraceScope const&) = delete;
+
+  explicit TraceScope(const char* name) : name(name), start(Trace::now()) {}
+  ~TraceScope() { Trace::record(name, start, Trace::now()); }
+
+ private:
+  const char* name;
+  uint64_t start;
+};
+
+#define OOSVIM_TRACE_CONCAT_(a, b) a##b
+#define OOSVIM_TRACE_CONCAT(a, b) OOSVIM_TRACE_CONCAT_(a, b)
+#define OOSVIM_TRACE_SCOPE(name) OosVim::TraceScope OOSVIM_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define OOSVIM_TRACE_THREAD(name) OosVim::Trace::setThreadName(name)
+#else
+#define OOSVIM_TRACE_SCOPE(name) ((void)0)
+#define OOSVIM_TRACE_THREAD(name) ((void)0)
+#endif
+}  // namespace OosVimba
@@ -0,0 +1,124 @@
+// Copyright (C) 2022 Matthias Oostrik
+//
+// Triggers cameras at a fixed rate from a timer thread, with a software
+// trigger per camera or with one GigE action command for all cameras. The
+// thread sleeps until shortly before a trigger and spins the rest, so the
+// triggers keep their cadence on a core that is not overloaded. The latency
+// from a trigger to the arrival of its frame is measured per camera.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Device.h"
+#include "Latency.h"
+#include "Logger.h"
+#include "System.h"
+#include "Thread.h"
+
+namespace OosVim {
+
+class Frame;
+
+static const double TRIGGER_DEFAULT_RATE = 30;
+static const uint64_t TRIGGER_DEFAULT_SPIN = 200000;  // ns
+static const size_t TRIGGER_HISTORY_SIZE = 64;        // triggers kept per camera to match the frames
+
+enum class TriggerMode {
+  Software,  // TriggerSoftware on every camera in turn
+  Action     // one action command, the cameras trigger together
+};
+
+struct TriggerSettings {
+  TriggerMode mode = TriggerMode::Software;
+  double rate = TRIGGER_DEFAULT_RATE;  // triggers per second
+  uint64_t spin = TRIGGER_DEFAULT_SPIN;  // ns before a trigger that are spun instead of slept
+  uint32_t deviceKey = 1;  // keys of the action command
+  uint32_t groupKey = 1;
+  uint32_t groupMask = 1;
+};
+
+class TriggerScheduler {
+ public:
+  TriggerScheduler(TriggerScheduler const&) = delete;
+  TriggerScheduler& operator=(TriggerScheduler const&) = delete;
+
+  TriggerScheduler(const TriggerSettings& settings = TriggerSettings());
+  ~TriggerScheduler();
+
+  // Turn the frame start trigger of a camera on or off. Cameras can be added
+  // and removed while the scheduler runs.
+  bool addDevice(std::shared_ptr<Device> device);
+  void removeDevice(std::shared_ptr<Device> device);
+
+  void start();
+  void stop();
+  bool isRunning() const { return running.load(); }
+
+  void setRate(double rate);
+  double getRate() const { return 1e9 / interval.load(); }
+
+  // Real-time scheduling keeps the spin short on a loaded machine
+  void setThreadPolicy(const ThreadPolicy& policy) { binding.setPolicy(policy); }
+  ThreadPlacement getThreadPlacement() { return binding.getPlacement(); }
+
+  // Match a delivered frame with the trigger before its exposure, or before
+  // its arrival when the camera clock is not synchronized
+  void recordFrame(const Frame& frame);
+
+  uint64_t getIssued() const { return issued.load(); }
+  uint64_t getMissed() const { return missed.load(); }
+  uint64_t getFailed() const { return failed.load(); }
+
+  // Delay of the triggers after their scheduled time
+  const LatencyHistogram& getJitter() const { return jitter; }
+
+  // Trigger to frame arrival of a camera, nullptr for an unknown camera
+  std::shared_ptr<const LatencyHistogram> getLatency(const std::string& deviceId);
+
+ private:
+  struct Target {
+    std::shared_ptr<Device> device;
+    AVT::VmbAPI::FeaturePtr command;
+    std::array<std::atomic<uint64_t>, TRIGGER_HISTORY_SIZE> times;
+    std::atomic<uint64_t> count;
+    std::shared_ptr<LatencyHistogram> latency;
+  };
+
+  Logger logger;
+  TriggerSettings settings;
+  std::shared_ptr<System> system;
+  ActionCommand action;  // prepared by start, before the timer thread runs
+
+  // Only for the sleep of the timer thread, the triggers are sent unlocked
+  std::mutex mutex;
+  std::condition_variable signal;
+  std::atomic<bool> running;
+  std::atomic<uint64_t> interval;  // ns
+  std::thread thread;
+  ThreadBinding binding;
+
+  std::atomic<uint64_t> issued;
+  std::atomic<uint64_t> missed;
+  std::atomic<uint64_t> failed;
+  LatencyHistogram jitter;
+
+  // The cameras are replaced as a whole, the timer and the delivery threads
+  // only lock to copy the pointer
+  typedef std::vector<std::shared_ptr<Target>> Target_List_t;
+  mutable std::mutex targetsMutex;
+  std::shared_ptr<const Target_List_t> targets;
+  std::shared_ptr<const Target_List_t> getTargets() const;
+
+  void run();
+  void fire(const Target_List_t& current);
+};
+}  // namespace OosVimba
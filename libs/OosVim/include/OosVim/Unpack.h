@@ -0,0 +1,30 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "VimbaCPP/Include/VimbaCPP.h"
+
+namespace OosVim {
+
+// Significant bits per value of the high bit depth formats that can be
+// unpacked, 0 for other formats
+uint32_t getUnpackBitDepth(VmbPixelFormatType format);
+uint32_t getUnpackChannels(VmbPixelFormatType format);
+
+// Unpack Mono10, Mono12, Mono14, Mono16, Mono10p, Mono12p, Mono12Packed, Rgb12
+// and Rgb16 to one 16 bit value per channel. With scale the values are shifted
+// to the full 16 bit range, otherwise they keep the camera counts. The packed
+// formats use SSSE3 or NEON when available.
+bool unpack(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format, bool scale,
+            uint16_t* destination);
+
+// Shift 16 bit values down to 8 bit, e.g. by 8 for scaled values or by the
+// bit depth minus 8 for camera counts
+void narrow(const uint16_t* source, size_t count, uint32_t shift, unsigned char* destination);
+
+// Convert 16 bit values to floats between 0 and 1, maximum maps to 1
+void normalize(const uint16_t* source, size_t count, uint16_t maximum, float* destination);
+}  // namespace OosVimba
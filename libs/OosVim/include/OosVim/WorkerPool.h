@@ -0,0 +1,49 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OosVim {
+
+// A fixed set of threads that split per frame work into tasks. The threads are
+// started once, so running a batch does not create threads on every frame.
+class WorkerPool {
+ public:
+  WorkerPool(WorkerPool const&) = delete;
+  WorkerPool& operator=(WorkerPool const&) = delete;
+
+  // The calling thread takes part in every batch, a size of 1 starts no threads
+  WorkerPool(size_t size);
+  ~WorkerPool();
+
+  // Run task(index) for every index below count, returns when all are done
+  void run(size_t count, const std::function<void(size_t)>& task);
+
+  size_t getSize() const { return workers.size() + 1; }
+
+ private:
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable startSignal;
+  std::condition_variable doneSignal;
+  bool running;
+  uint64_t generation;
+  size_t active;
+
+  const std::function<void(size_t)>* task;
+  size_t count;
+  std::atomic<size_t> next;
+
+  void worker();
+  void process();
+};
+}  // namespace OosVimba
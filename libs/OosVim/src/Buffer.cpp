@@ -0,0 +1,133 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Buffer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+
+using namespace OosVim;
+
+#if defined(__linux__)
+static const int BUFFER_MPOL_BIND = 2;
+static const unsigned BUFFER_MPOL_MF_MOVE = 1 << 1;
+#endif
+
+static size_t roundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+BufferProvider::BufferProvider(const BufferPolicy& _policy)
+    : logger("BufferProvider"), policy(_policy), numaNode(_policy.numaNode) {
+  if (numaNode < 0 && !policy.networkInterface.empty()) {
+    numaNode = getNumaNode(policy.networkInterface);
+    if (numaNode < 0) logger.notice("NUMA node of " + policy.networkInterface + " unknown, allocating on any node");
+  }
+}
+
+BufferProvider::~BufferProvider() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& allocation : allocations) free(allocation);
+  allocations.clear();
+}
+
+unsigned char* BufferProvider::allocate(size_t size) {
+  Allocation allocation = {nullptr, 0, false};
+  size_t alignment = (std::max)(policy.alignment, sizeof(void*));
+
+#if defined(__linux__)
+  size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  if (numaNode >= 0) alignment = (std::max)(alignment, pageSize);
+
+  if (policy.hugePages) {
+    size_t length = roundUp(size, BUFFER_HUGE_PAGE_SIZE);
+    void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      allocation = {static_cast<unsigned char*>(data), length, true};
+    } else {
+      logger.verbose("No huge pages reserved, using transparent huge pages");
+      alignment = (std::max)(alignment, BUFFER_HUGE_PAGE_SIZE);
+    }
+  }
+
+  if (allocation.data == nullptr) {
+    size_t length = roundUp(size, alignment);
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, length) != 0) {
+      logger.error("Failed to allocate buffer of " + std::to_string(size) + " bytes");
+      return nullptr;
+    }
+    if (policy.hugePages) madvise(data, length, MADV_HUGEPAGE);
+    allocation = {static_cast<unsigned char*>(data), length, false};
+  }
+
+  if (numaNode >= 0 && numaNode < static_cast<int>(sizeof(unsigned long) * 8)) {
+    unsigned long nodeMask = 1UL << numaNode;
+    long result = syscall(SYS_mbind, allocation.data, allocation.size, BUFFER_MPOL_BIND, &nodeMask,
+                          sizeof(nodeMask) * 8, BUFFER_MPOL_MF_MOVE);
+    if (result != 0) logger.verbose("Failed to bind buffer to NUMA node " + std::to_string(numaNode));
+  }
+#elif defined(_WIN32)
+  size_t length = roundUp(size, alignment);
+  allocation = {static_cast<unsigned char*>(_aligned_malloc(length, alignment)), length, false};
+#else
+  size_t length = roundUp(size, alignment);
+  allocation = {static_cast<unsigned char*>(std::aligned_alloc(alignment, length)), length, false};
+#endif
+
+  if (allocation.data == nullptr) {
+    logger.error("Failed to allocate buffer of " + std::to_string(size) + " bytes");
+    return nullptr;
+  }
+
+  // Touch the pages, so they are faulted in before the first frame arrives
+  std::memset(allocation.data, 0, allocation.size);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  allocations.push_back(allocation);
+  return allocation.data;
+}
+
+void BufferProvider::release(unsigned char* buffer) {
+  if (buffer == nullptr) return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = std::find_if(allocations.begin(), allocations.end(),
+                         [&](const Allocation& allocation) { return allocation.data == buffer; });
+  if (it == allocations.end()) return;
+
+  free(*it);
+  allocations.erase(it);
+}
+
+void BufferProvider::free(const Allocation& allocation) {
+#if defined(__linux__)
+  if (allocation.mapped) {
+    munmap(allocation.data, allocation.size);
+    return;
+  }
+  std::free(allocation.data);
+#elif defined(_WIN32)
+  _aligned_free(allocation.data);
+#else
+  std::free(allocation.data);
+#endif
+}
+
+int BufferProvider::getNumaNode(const std::string& networkInterface) {
+#if defined(__linux__)
+  std::ifstream file("/sys/class/net/" + networkInterface + "/device/numa_node");
+  int node = -1;
+  if (file >> node) return node;
+#endif
+  return -1;
+}
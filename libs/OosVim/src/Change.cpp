@@ -0,0 +1,267 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Change.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "OosVim/Unpack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_CHANGE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_CHANGE_NEON
+#endif
+
+using namespace OosVim;
+
+// -- KERNELS ------------------------------------------------------------------
+
+// Sum of the absolute differences of count bytes, bytes with a zero weight
+// are skipped
+template <bool masked>
+static uint64_t difference8(const unsigned char* frame, const unsigned char* reference,
+                            const unsigned char* weights, size_t count) {
+  uint64_t sum = 0;
+  size_t i = 0;
+#if defined(OOSVIM_CHANGE_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reference + i));
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    if (masked) difference = _mm_and_si128(difference, _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i)));
+    total = _mm_add_epi64(total, _mm_sad_epu8(difference, zero));
+  }
+  sum = static_cast<uint32_t>(_mm_cvtsi128_si32(total)) +
+        static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+#elif defined(OOSVIM_CHANGE_NEON)
+  // 16 bit lanes are widened every iteration, a row does not overflow 32 bits
+  uint32x4_t total = vdupq_n_u32(0);
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t difference = vabdq_u8(vld1q_u8(frame + i), vld1q_u8(reference + i));
+    if (masked) difference = vandq_u8(difference, vld1q_u8(weights + i));
+    total = vpadalq_u16(total, vpaddlq_u8(difference));
+  }
+  uint64x2_t wide = vpaddlq_u32(total);
+  sum = vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+#endif
+  for (; i < count; i++) {
+    if (masked && weights[i] == 0) continue;
+    sum += frame[i] > reference[i] ? frame[i] - reference[i] : reference[i] - frame[i];
+  }
+  return sum;
+}
+
+// The same for count 16 bit little endian values, the weights are per byte
+template <bool masked>
+static uint64_t difference16(const unsigned char* frame, const unsigned char* reference,
+                             const unsigned char* weights, size_t count) {
+  uint64_t sum = 0;
+  size_t i = 0;
+#if defined(OOSVIM_CHANGE_SSE2)
+  // The low and the high bytes of the differences are summed separately
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_set1_epi16(0xff);
+  __m128i lows = zero;
+  __m128i highs = zero;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + i * 2));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reference + i * 2));
+    __m128i difference = _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+    if (masked) difference = _mm_and_si128(difference, _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i * 2)));
+    lows = _mm_add_epi64(lows, _mm_sad_epu8(_mm_and_si128(difference, low), zero));
+    highs = _mm_add_epi64(highs, _mm_sad_epu8(_mm_srli_epi16(difference, 8), zero));
+  }
+  __m128i total = _mm_add_epi64(lows, _mm_slli_epi64(highs, 8));
+  sum = static_cast<uint32_t>(_mm_cvtsi128_si32(total)) +
+        static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+#elif defined(OOSVIM_CHANGE_NEON)
+  uint32x4_t total = vdupq_n_u32(0);
+  for (; i + 8 <= count; i += 8) {
+    uint16x8_t a = vreinterpretq_u16_u8(vld1q_u8(frame + i * 2));
+    uint16x8_t b = vreinterpretq_u16_u8(vld1q_u8(reference + i * 2));
+    uint16x8_t difference = vabdq_u16(a, b);
+    if (masked) difference = vandq_u16(difference, vreinterpretq_u16_u8(vld1q_u8(weights + i * 2)));
+    total = vpadalq_u16(total, difference);
+  }
+  uint64x2_t wide = vpaddlq_u32(total);
+  sum = vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+#endif
+  for (; i < count; i++) {
+    if (masked && weights[i * 2] == 0) continue;
+    int a = frame[i * 2] | frame[i * 2 + 1] << 8;
+    int b = reference[i * 2] | reference[i * 2 + 1] << 8;
+    sum += a > b ? a - b : b - a;
+  }
+  return sum;
+}
+
+static uint32_t getBytesPerPixel(VmbPixelFormatType format) {
+  switch (format) {
+    case VmbPixelFormatMono8:
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+      return 1;
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
+      return 2;
+    case VmbPixelFormatRgb8:
+    case VmbPixelFormatBgr8:
+      return 3;
+    case VmbPixelFormatRgba8:
+    case VmbPixelFormatBgra8:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// -- DETECTOR -----------------------------------------------------------------
+
+ChangeDetector::ChangeDetector(const ChangeSettings& settings)
+    : logger("Change"),
+      settings(settings),
+      dirty(true),
+      skipUnchanged(settings.skipUnchanged),
+      width(0),
+      height(0),
+      format(0),
+      bitDepth(8),
+      samples(0),
+      referenced(false),
+      compared(0),
+      changed(0) {}
+
+void ChangeDetector::setSettings(const ChangeSettings& value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  settings = value;
+  skipUnchanged = value.skipUnchanged;
+  dirty = true;
+}
+
+ChangeSettings ChangeDetector::getSettings() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return settings;
+}
+
+void ChangeDetector::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  dirty = true;
+}
+
+bool ChangeDetector::isSupported(VmbPixelFormatType format) { return getBytesPerPixel(format) > 0; }
+
+bool ChangeDetector::compare(const unsigned char* data, uint32_t frameWidth, uint32_t frameHeight,
+                             VmbPixelFormatType frameFormat, float& score) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dirty) {
+      current = settings;
+      dirty = false;
+      width = 0;
+    }
+  }
+
+  compared++;
+  score = CHANGE_MAX_SCORE;
+  if (data == nullptr || !isSupported(frameFormat) || frameWidth == 0 || frameHeight == 0) {
+    changed++;
+    return true;
+  }
+  if (frameWidth != width || frameHeight != height || frameFormat != format) {
+    build(frameWidth, frameHeight, frameFormat);
+  }
+
+  bool masked = !weights.empty();
+  bool wide = bitDepth > 8;
+  uint64_t sum = 0;
+  size_t position = 0;
+  for (const auto& segment : segments) {
+    const unsigned char* source = data + segment.offset;
+    const unsigned char* target = reference.data() + position;
+    const unsigned char* weight = masked ? weights.data() + position : nullptr;
+    if (wide) {
+      sum += masked ? difference16<true>(source, target, weight, segment.length / 2)
+                    : difference16<false>(source, target, weight, segment.length / 2);
+    } else {
+      sum += masked ? difference8<true>(source, target, weight, segment.length)
+                    : difference8<false>(source, target, weight, segment.length);
+    }
+    position += segment.length;
+  }
+
+  bool isChanged = true;
+  if (referenced) {
+    score = samples > 0 ? static_cast<float>(static_cast<double>(sum) / samples / (1u << (bitDepth - 8))) : 0;
+    isChanged = score > current.threshold;
+  }
+
+  // Copy the compared rows while they are still in cache
+  if (isChanged || current.reference == ChangeReference::Previous) {
+    position = 0;
+    for (const auto& segment : segments) {
+      std::memcpy(reference.data() + position, data + segment.offset, segment.length);
+      position += segment.length;
+    }
+    referenced = true;
+  }
+
+  if (isChanged) changed++;
+  return isChanged;
+}
+
+void ChangeDetector::build(uint32_t frameWidth, uint32_t frameHeight, VmbPixelFormatType frameFormat) {
+  width = frameWidth;
+  height = frameHeight;
+  format = frameFormat;
+  bitDepth = getBytesPerPixel(format) == 2 ? getUnpackBitDepth(format) : 8;
+  referenced = false;
+
+  uint32_t bytes = getBytesPerPixel(format);
+  uint32_t x0 = (std::min)(current.x, width);
+  uint32_t y0 = (std::min)(current.y, height);
+  uint32_t x1 = current.width > 0 ? (std::min)(x0 + current.width, width) : width;
+  uint32_t y1 = current.height > 0 ? (std::min)(y0 + current.height, height) : height;
+  uint32_t step = (std::max)(current.step, 1u);
+
+  segments.clear();
+  for (uint32_t y = y0; y < y1 && x1 > x0; y += step) {
+    segments.push_back({(size_t(y) * width + x0) * bytes, size_t(x1 - x0) * bytes});
+  }
+  size_t length = segments.size() * size_t(x1 - x0) * bytes;
+  reference.assign(length, 0);
+
+  bool masked = !current.mask.empty();
+  if (masked && current.mask.size() != size_t(width) * height) {
+    logger.warning("Mask does not match the frame size, compared all pixels");
+    masked = false;
+  }
+
+  // Expand the mask to the bytes of the compared pixels
+  weights.clear();
+  samples = length / (bitDepth > 8 ? 2 : 1);
+  if (masked) {
+    weights.resize(length);
+    size_t position = 0;
+    samples = 0;
+    for (uint32_t y = y0; y < y1 && x1 > x0; y += step) {
+      const unsigned char* row = current.mask.data() + size_t(y) * width;
+      for (uint32_t x = x0; x < x1; x++) {
+        unsigned char weight = row[x] ? 0xff : 0;
+        std::fill(weights.begin() + position, weights.begin() + position + bytes, weight);
+        position += bytes;
+        if (weight) samples += bitDepth > 8 ? 1 : bytes;
+      }
+    }
+  }
+  logger.verbose("Comparing " + std::to_string(samples) + " samples of " + std::to_string(width) + "x" +
+                 std::to_string(height) + " frames");
+}
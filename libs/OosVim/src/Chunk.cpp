@@ -0,0 +1,170 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Chunk.h"
+
+using namespace OosVim;
+
+// Allied Vision GigE chunk layout, little endian, appended to the image data
+static const VmbUint32_t CHUNK_OFFSET_FRAMECOUNT = 0;
+static const VmbUint32_t CHUNK_OFFSET_EXPOSURE = 8;
+static const VmbUint32_t CHUNK_OFFSET_GAIN = 12;
+static const VmbUint32_t CHUNK_OFFSET_SYNC_IN = 16;
+static const VmbUint32_t CHUNK_OFFSET_SYNC_OUT = 18;
+static const VmbUint32_t CHUNK_RAW_SIZE = 20;
+
+static inline uint32_t readUint32(const VmbUchar_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+static inline uint16_t readUint16(const VmbUchar_t* p) {
+  return uint16_t(p[0] | p[1] << 8);
+}
+
+static bool readValue(const AVT::VmbAPI::FeaturePtr& feature, double& value) {
+  if (SP_ISNULL(feature)) return false;
+
+  long long integer;
+  if (getFeature(feature, integer)) {
+    value = static_cast<double>(integer);
+    return true;
+  }
+  return getFeature(feature, value);
+}
+
+static void locateAncillary(const AVT::VmbAPI::AncillaryDataPtr& ancillary, const char* name,
+                            AVT::VmbAPI::FeaturePtr& feature) {
+  if (ancillary->GetFeatureByName(name, feature) != VmbErrorSuccess) SP_RESET(feature);
+}
+
+bool ChunkDecoder::hasRawLayout(const std::string& vendor, VmbInterfaceType type) {
+  return type == VmbInterfaceEthernet && vendor.find("Allied Vision") != std::string::npos;
+}
+
+void ChunkDecoder::prepare(const AVT::VmbAPI::FramePtrVector& frames, bool allowRaw) {
+  release();
+  layout = Layout::Unresolved;
+  rawLayout = allowRaw;
+  features.resize(frames.size());
+  for (size_t i = 0; i < frames.size(); i++) features[i].frame = SP_ACCESS(frames[i]);
+}
+
+void ChunkDecoder::release() {
+  for (auto& state : features) close(state);
+  features.clear();
+}
+
+void ChunkDecoder::close(Features& state) {
+  if (state.located) state.ancillary->Close();
+  const AVT::VmbAPI::Frame* frame = state.frame;
+  state = Features();
+  state.frame = frame;
+}
+
+bool ChunkDecoder::decode(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk) {
+  chunk = Chunk();
+
+  VmbUint64_t timestamp;
+  if (frame->GetTimestamp(timestamp) == VmbErrorSuccess) chunk.timestamp = timestamp;
+
+  switch (layout) {
+    case Layout::Raw:
+      return decodeRaw(frame, chunk);
+    case Layout::Features:
+      return decodeFeatures(frame, chunk);
+    case Layout::None:
+      return false;
+    default:
+      return resolve(frame, chunk);
+  }
+}
+
+bool ChunkDecoder::resolve(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk) {
+  VmbUint32_t ancillarySize = 0;
+  if (frame->GetAncillarySize(ancillarySize) != VmbErrorSuccess || ancillarySize == 0) {
+    layout = Layout::None;
+    return false;
+  }
+
+  Chunk raw = chunk;
+  Chunk features = chunk;
+  bool hasRaw = rawLayout && decodeRaw(frame, raw);
+  bool hasFeatures = decodeFeatures(frame, features);
+
+  // Only trust the raw layout when it agrees with the feature interface
+  if (hasRaw && hasFeatures && raw.frameCount == features.frameCount && raw.exposure == features.exposure) {
+    Logger::verbose("ChunkDecoder", "Resolved raw chunk layout");
+    layout = Layout::Raw;
+    chunk = raw;
+    return true;
+  }
+
+  if (hasFeatures) {
+    Logger::verbose("ChunkDecoder", "Unknown chunk layout, using ancillary features");
+    layout = Layout::Features;
+    chunk = features;
+    return true;
+  }
+
+  Logger::warning("ChunkDecoder", "Failed to decode chunk data");
+  layout = Layout::None;
+  return false;
+}
+
+bool ChunkDecoder::decodeRaw(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk) const {
+  const VmbUchar_t* buffer = nullptr;
+  VmbUint32_t imageSize = 0;
+  VmbUint32_t ancillarySize = 0;
+  if (frame->GetBuffer(buffer) != VmbErrorSuccess || buffer == nullptr) return false;
+  if (frame->GetImageSize(imageSize) != VmbErrorSuccess) return false;
+  if (frame->GetAncillarySize(ancillarySize) != VmbErrorSuccess) return false;
+  if (ancillarySize < CHUNK_RAW_SIZE) return false;
+
+  const VmbUchar_t* data = buffer + imageSize;
+  chunk.frameCount = readUint32(data + CHUNK_OFFSET_FRAMECOUNT);
+  chunk.exposure = readUint32(data + CHUNK_OFFSET_EXPOSURE);
+  chunk.gain = readUint32(data + CHUNK_OFFSET_GAIN);
+  chunk.syncIn = readUint16(data + CHUNK_OFFSET_SYNC_IN);
+  chunk.syncOut = readUint16(data + CHUNK_OFFSET_SYNC_OUT);
+  chunk.valid = true;
+  return true;
+}
+
+bool ChunkDecoder::decodeFeatures(const AVT::VmbAPI::FramePtr& frame, Chunk& chunk) {
+  Features* state = nullptr;
+  for (auto& candidate : features) {
+    if (candidate.frame == SP_ACCESS(frame)) state = &candidate;
+  }
+
+  // A frame that was not announced through prepare opens its features once
+  Features single;
+  single.frame = SP_ACCESS(frame);
+  if (state == nullptr) state = &single;
+  if (!state->located && !locate(frame, *state)) return false;
+
+  double value;
+  if (readValue(state->frameCount, value)) {
+    chunk.frameCount = static_cast<uint64_t>(value);
+    chunk.valid = true;
+  }
+  if (readValue(state->exposure, value)) chunk.exposure = static_cast<uint32_t>(value);
+  if (readValue(state->gain, value)) chunk.gain = value;
+  if (readValue(state->syncIn, value)) chunk.syncIn = static_cast<uint16_t>(value);
+  if (readValue(state->syncOut, value)) chunk.syncOut = static_cast<uint16_t>(value);
+
+  // Locate again on the next delivery when the values could not be read
+  if (state == &single || !chunk.valid) close(*state);
+  return chunk.valid;
+}
+
+bool ChunkDecoder::locate(const AVT::VmbAPI::FramePtr& frame, Features& state) {
+  if (frame->GetAncillaryData(state.ancillary) != VmbErrorSuccess || SP_ISNULL(state.ancillary)) return false;
+  if (state.ancillary->Open() != VmbErrorSuccess) return false;
+
+  locateAncillary(state.ancillary, "ChunkAcquisitionFrameCount", state.frameCount);
+  locateAncillary(state.ancillary, "ChunkExposureTime", state.exposure);
+  locateAncillary(state.ancillary, "ChunkGain", state.gain);
+  locateAncillary(state.ancillary, "ChunkSyncInLevels", state.syncIn);
+  locateAncillary(state.ancillary, "ChunkSyncOutLevels", state.syncOut);
+  state.located = true;
+  return true;
+}
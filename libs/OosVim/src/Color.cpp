@@ -0,0 +1,573 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Color.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "OosVim/Frame.h"
+#include "OosVim/Trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_COLOR_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_COLOR_NEON
+#endif
+
+using namespace OosVim;
+
+// Everything a conversion needs, rebuilt when the settings or the LUT change
+struct ColorPipeline::Program {
+  // The linear output of every input channel and value, scaled to the gamma
+  // table. The fourth value is padding.
+  alignas(16) float contributions[3][256][4];
+  unsigned char gamma8[COLOR_GAMMA_SIZE];
+
+  // Gamma table entry to the LUT cell and the position within the cell, per
+  // channel. The offset is in values of the LUT table.
+  struct Axis {
+    uint32_t offset;
+    float fraction;
+  };
+  std::shared_ptr<const ColorLut> lut;
+  Axis axes[3][COLOR_GAMMA_SIZE];
+};
+
+typedef ColorPipeline::Program Program;
+
+// -- VECTORS ------------------------------------------------------------------
+
+// Four floats, one pixel with a padding channel
+#if defined(OOSVIM_COLOR_SSE2)
+typedef __m128 Vector;
+static inline Vector load(const float* values) { return _mm_load_ps(values); }
+static inline Vector splat(float value) { return _mm_set1_ps(value); }
+static inline Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+static inline Vector multiply(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+static inline Vector clamp(Vector value, Vector low, Vector high) { return _mm_min_ps(_mm_max_ps(value, low), high); }
+static inline void storeIndices(Vector value, int32_t* values) {
+  _mm_store_si128(reinterpret_cast<__m128i*>(values), _mm_cvttps_epi32(value));
+}
+static inline Vector set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline Vector subtract(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+static inline Vector minimum(Vector a, Vector b) { return _mm_min_ps(a, b); }
+static inline Vector maximum(Vector a, Vector b) { return _mm_max_ps(a, b); }
+typedef __m128 Mask;
+static inline Mask greaterEqual(Vector a, Vector b) { return _mm_cmpge_ps(a, b); }
+static inline Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+static inline Vector select(Mask mask, Vector a, Vector b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+template <int lane>
+static inline Vector broadcast(Vector value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(lane, lane, lane, lane)); }
+static inline void transpose(Vector& a, Vector& b, Vector& c, Vector& d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+static inline Vector loadEntry(const uint16_t* entry) {
+  __m128i value = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(entry));
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(value, _mm_setzero_si128()));
+}
+static inline void storePixel(Vector value, unsigned char* pixel) {
+  __m128i integer = _mm_cvttps_epi32(value);
+  integer = _mm_packus_epi16(_mm_packs_epi32(integer, integer), integer);
+  uint32_t bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(integer));
+  std::memcpy(pixel, &bytes, 3);
+}
+#elif defined(OOSVIM_COLOR_NEON)
+typedef float32x4_t Vector;
+static inline Vector load(const float* values) { return vld1q_f32(values); }
+static inline Vector splat(float value) { return vdupq_n_f32(value); }
+static inline Vector add(Vector a, Vector b) { return vaddq_f32(a, b); }
+static inline Vector multiply(Vector a, Vector b) { return vmulq_f32(a, b); }
+static inline Vector clamp(Vector value, Vector low, Vector high) { return vminq_f32(vmaxq_f32(value, low), high); }
+static inline void storeIndices(Vector value, int32_t* values) { vst1q_s32(values, vcvtq_s32_f32(value)); }
+static inline Vector set(float a, float b, float c, float d) {
+  const float values[4] = {a, b, c, d};
+  return vld1q_f32(values);
+}
+static inline Vector subtract(Vector a, Vector b) { return vsubq_f32(a, b); }
+static inline Vector minimum(Vector a, Vector b) { return vminq_f32(a, b); }
+static inline Vector maximum(Vector a, Vector b) { return vmaxq_f32(a, b); }
+typedef uint32x4_t Mask;
+static inline Mask greaterEqual(Vector a, Vector b) { return vcgeq_f32(a, b); }
+static inline Mask both(Mask a, Mask b) { return vandq_u32(a, b); }
+static inline Vector select(Mask mask, Vector a, Vector b) { return vbslq_f32(mask, a, b); }
+template <int lane>
+static inline Vector broadcast(Vector value) { return vdupq_n_f32(vgetq_lane_f32(value, lane)); }
+static inline void transpose(Vector& a, Vector& b, Vector& c, Vector& d) {
+  float32x4x2_t ab = vtrnq_f32(a, b);
+  float32x4x2_t cd = vtrnq_f32(c, d);
+  a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+  b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+  c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+  d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+static inline Vector loadEntry(const uint16_t* entry) { return vcvtq_f32_u32(vmovl_u16(vld1_u16(entry))); }
+static inline void storePixel(Vector value, unsigned char* pixel) {
+  uint16x4_t narrow = vmovn_u32(vcvtq_u32_f32(value));
+  uint8x8_t bytes = vqmovn_u16(vcombine_u16(narrow, narrow));
+  pixel[0] = vget_lane_u8(bytes, 0);
+  pixel[1] = vget_lane_u8(bytes, 1);
+  pixel[2] = vget_lane_u8(bytes, 2);
+}
+#else
+struct Vector {
+  float v[4];
+};
+static inline Vector load(const float* values) { return {{values[0], values[1], values[2], values[3]}}; }
+static inline Vector splat(float value) { return {{value, value, value, value}}; }
+static inline Vector add(Vector a, Vector b) {
+  return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+static inline Vector multiply(Vector a, Vector b) {
+  return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+}
+static inline Vector clamp(Vector value, Vector low, Vector high) {
+  for (int i = 0; i < 4; i++) value.v[i] = (std::min)((std::max)(value.v[i], low.v[i]), high.v[i]);
+  return value;
+}
+static inline void storeIndices(Vector value, int32_t* values) {
+  for (int i = 0; i < 4; i++) values[i] = static_cast<int32_t>(value.v[i]);
+}
+static inline Vector set(float a, float b, float c, float d) { return {{a, b, c, d}}; }
+static inline Vector subtract(Vector a, Vector b) {
+  return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+}
+static inline Vector minimum(Vector a, Vector b) {
+  for (int i = 0; i < 4; i++) a.v[i] = (std::min)(a.v[i], b.v[i]);
+  return a;
+}
+static inline Vector maximum(Vector a, Vector b) {
+  for (int i = 0; i < 4; i++) a.v[i] = (std::max)(a.v[i], b.v[i]);
+  return a;
+}
+struct Mask {
+  bool v[4];
+};
+static inline Mask greaterEqual(Vector a, Vector b) {
+  return {{a.v[0] >= b.v[0], a.v[1] >= b.v[1], a.v[2] >= b.v[2], a.v[3] >= b.v[3]}};
+}
+static inline Mask both(Mask a, Mask b) { return {{a.v[0] && b.v[0], a.v[1] && b.v[1], a.v[2] && b.v[2], a.v[3] && b.v[3]}}; }
+static inline Vector select(Mask mask, Vector a, Vector b) {
+  for (int i = 0; i < 4; i++) a.v[i] = mask.v[i] ? a.v[i] : b.v[i];
+  return a;
+}
+template <int lane>
+static inline Vector broadcast(Vector value) { return splat(value.v[lane]); }
+static inline void transpose(Vector& a, Vector& b, Vector& c, Vector& d) {
+  Vector* rows[4] = {&a, &b, &c, &d};
+  for (int i = 0; i < 4; i++) {
+    for (int j = i + 1; j < 4; j++) std::swap(rows[i]->v[j], rows[j]->v[i]);
+  }
+}
+static inline Vector loadEntry(const uint16_t* entry) { return {{float(entry[0]), float(entry[1]), float(entry[2]), 0}}; }
+static inline void storePixel(Vector value, unsigned char* pixel) {
+  for (int i = 0; i < 3; i++) pixel[i] = static_cast<unsigned char>((std::min)(value.v[i], 255.0f));
+}
+#endif
+
+// -- KERNELS ------------------------------------------------------------------
+
+// Bilinear demosaicing of one row, the neighbours are mirrored at the edges
+static void demosaicRow(const unsigned char* above, const unsigned char* current, const unsigned char* below,
+                        uint32_t width, bool redRow, uint32_t redX, unsigned char* rgb) {
+  const uint32_t colorX = redRow ? redX : 1 - redX;
+  for (uint32_t x = 0; x < width; x++, rgb += 3) {
+    uint32_t left = x > 0 ? x - 1 : x + 1;
+    uint32_t right = x + 1 < width ? x + 1 : x - 1;
+    if ((x & 1) == colorX) {
+      auto cross = static_cast<unsigned char>((current[left] + current[right] + above[x] + below[x] + 2) >> 2);
+      auto diagonal = static_cast<unsigned char>((above[left] + above[right] + below[left] + below[right] + 2) >> 2);
+      rgb[0] = redRow ? current[x] : diagonal;
+      rgb[1] = cross;
+      rgb[2] = redRow ? diagonal : current[x];
+    } else {
+      auto horizontal = static_cast<unsigned char>((current[left] + current[right] + 1) >> 1);
+      auto vertical = static_cast<unsigned char>((above[x] + below[x] + 1) >> 1);
+      rgb[0] = redRow ? horizontal : vertical;
+      rgb[1] = current[x];
+      rgb[2] = redRow ? vertical : horizontal;
+    }
+  }
+}
+
+// The corners of the tetrahedra of four pixels. The walk from the base goes
+// along the axis with the largest fraction first and reaches the diagonal
+// corner last, the corner in between lacks the axis with the smallest one.
+struct Tetrahedra {
+  alignas(16) int32_t base[4];
+  alignas(16) int32_t first[4];    // step along the axis with the largest fraction
+  alignas(16) int32_t last[4];     // step along the axis with the smallest fraction
+  Vector weights[4];
+};
+
+template <int lane>
+static inline void interpolate(const uint16_t* table, uint32_t diagonal, const Tetrahedra& tetrahedra, Vector scale,
+                               unsigned char* destination) {
+  const uint16_t* corner = table + tetrahedra.base[lane];
+  Vector value = multiply(loadEntry(corner), broadcast<lane>(tetrahedra.weights[0]));
+  value = add(value, multiply(loadEntry(corner + tetrahedra.first[lane]), broadcast<lane>(tetrahedra.weights[1])));
+  value = add(value, multiply(loadEntry(corner + diagonal - tetrahedra.last[lane]),
+                              broadcast<lane>(tetrahedra.weights[2])));
+  value = add(value, multiply(loadEntry(corner + diagonal), broadcast<lane>(tetrahedra.weights[3])));
+  storePixel(add(multiply(value, scale), splat(0.5f)), destination + lane * 3);
+}
+
+// White balance and matrix through the contribution tables, then the gamma
+// table or the gamma and the tetrahedral interpolation of the LUT. The source
+// and the destination may be the same row.
+static void colorRow(const Program& program, const unsigned char* source, uint32_t width, uint32_t step,
+                     const uint32_t* order, unsigned char* destination) {
+  const float* first = program.contributions[order[0]][0];
+  const float* second = program.contributions[order[1]][0];
+  const float* third = program.contributions[order[2]][0];
+  const Vector zero = splat(0);
+  const Vector maxIndex = splat(COLOR_GAMMA_SIZE - 1);
+  const Vector half = splat(0.5f);
+  alignas(16) int32_t index[4];
+
+  if (!program.lut) {
+    for (uint32_t x = 0; x < width; x++, source += step, destination += 3) {
+      Vector linear = add(add(load(first + source[0] * 4), load(second + source[1] * 4)), load(third + source[2] * 4));
+      storeIndices(add(clamp(linear, zero, maxIndex), half), index);
+      destination[0] = program.gamma8[index[0]];
+      destination[1] = program.gamma8[index[1]];
+      destination[2] = program.gamma8[index[2]];
+    }
+    return;
+  }
+
+  const uint32_t size = program.lut->getSize();
+  const uint16_t* table = program.lut->getTable();
+  const uint32_t diagonal = 4 * (1 + size + size * size);
+  const Vector redStep = splat(4.0f);
+  const Vector greenStep = splat(4.0f * size);
+  const Vector blueStep = splat(4.0f * size * size);
+  const Vector one = splat(1);
+  const Vector scale = splat(255.0f / 65535.0f);
+  const Program::Axis* axes[3] = {program.axes[0], program.axes[1], program.axes[2]};
+
+  // Four pixels at a time, the tetrahedron of every lane is chosen by compares
+  auto pixels = [&](const unsigned char* in, unsigned char* out) {
+    const unsigned char* pixel[4] = {in, in + step, in + 2 * step, in + 3 * step};
+    Vector red = add(add(load(first + pixel[0][0] * 4), load(second + pixel[0][1] * 4)), load(third + pixel[0][2] * 4));
+    Vector green = add(add(load(first + pixel[1][0] * 4), load(second + pixel[1][1] * 4)), load(third + pixel[1][2] * 4));
+    Vector blue = add(add(load(first + pixel[2][0] * 4), load(second + pixel[2][1] * 4)), load(third + pixel[2][2] * 4));
+    Vector padding =
+        add(add(load(first + pixel[3][0] * 4), load(second + pixel[3][1] * 4)), load(third + pixel[3][2] * 4));
+    transpose(red, green, blue, padding);  // one pixel per vector to one channel per vector
+
+    alignas(16) int32_t indices[3][4];
+    storeIndices(add(clamp(red, zero, maxIndex), half), indices[0]);
+    storeIndices(add(clamp(green, zero, maxIndex), half), indices[1]);
+    storeIndices(add(clamp(blue, zero, maxIndex), half), indices[2]);
+
+    Tetrahedra tetrahedra;
+    Vector fractions[3];
+    for (int channel = 0; channel < 3; channel++) {
+      const Program::Axis* axis = axes[channel];
+      const int32_t* i = indices[channel];
+      fractions[channel] = set(axis[i[0]].fraction, axis[i[1]].fraction, axis[i[2]].fraction, axis[i[3]].fraction);
+    }
+    for (int lane = 0; lane < 4; lane++) {
+      tetrahedra.base[lane] = static_cast<int32_t>(axes[0][indices[0][lane]].offset + axes[1][indices[1][lane]].offset +
+                                                   axes[2][indices[2][lane]].offset);
+    }
+
+    // Ties pick red first and blue last, so the first and last axes differ
+    const Vector r = fractions[0], g = fractions[1], b = fractions[2];
+    const Vector largest = maximum(r, maximum(g, b));
+    const Vector smallest = minimum(r, minimum(g, b));
+    const Vector middle = subtract(add(add(r, g), b), add(largest, smallest));
+    Vector firstStep = select(both(greaterEqual(r, g), greaterEqual(r, b)), redStep,
+                              select(greaterEqual(g, b), greenStep, blueStep));
+    Vector lastStep = select(both(greaterEqual(g, b), greaterEqual(r, b)), blueStep,
+                             select(greaterEqual(r, g), greenStep, redStep));
+    storeIndices(firstStep, tetrahedra.first);
+    storeIndices(lastStep, tetrahedra.last);
+    tetrahedra.weights[0] = subtract(one, largest);
+    tetrahedra.weights[1] = subtract(largest, middle);
+    tetrahedra.weights[2] = subtract(middle, smallest);
+    tetrahedra.weights[3] = smallest;
+
+    interpolate<0>(table, diagonal, tetrahedra, scale, out);
+    interpolate<1>(table, diagonal, tetrahedra, scale, out);
+    interpolate<2>(table, diagonal, tetrahedra, scale, out);
+    interpolate<3>(table, diagonal, tetrahedra, scale, out);
+  };
+
+  uint32_t x = 0;
+  for (; x + 4 <= width; x += 4, source += 4 * step, destination += 12) pixels(source, destination);
+
+  // The last pixels of the row are padded to four
+  if (x < width) {
+    unsigned char in[16] = {};
+    unsigned char out[12];
+    std::memcpy(in, source, (width - x) * step);
+    pixels(in, out);
+    std::memcpy(destination, out, (width - x) * 3);
+  }
+}
+
+// -- LUT ----------------------------------------------------------------------
+
+ColorLut::ColorLut(uint32_t _size)
+    : size((std::min)((std::max)(_size, 2u), COLOR_LUT_MAX_SIZE)),
+      table(size_t(size) * size * size * 4, 0),
+      domainMin({{0, 0, 0}}),
+      domainMax({{1, 1, 1}}) {
+  const float step = 1.0f / (size - 1);
+  for (uint32_t b = 0; b < size; b++) {
+    for (uint32_t g = 0; g < size; g++) {
+      for (uint32_t r = 0; r < size; r++) set(r, g, b, r * step, g * step, b * step);
+    }
+  }
+}
+
+void ColorLut::set(uint32_t r, uint32_t g, uint32_t b, float red, float green, float blue) {
+  if (r >= size || g >= size || b >= size) return;
+  uint16_t* entry = &table[4 * ((size_t(b) * size + g) * size + r)];
+  const float values[3] = {red, green, blue};
+  for (int i = 0; i < 3; i++) {
+    entry[i] = static_cast<uint16_t>(std::lround((std::min)((std::max)(values[i], 0.0f), 1.0f) * 65535));
+  }
+}
+
+void ColorLut::setDomain(const std::array<float, 3>& min, const std::array<float, 3>& max) {
+  domainMin = min;
+  domainMax = max;
+}
+
+std::shared_ptr<ColorLut> ColorLut::load(const std::string& path) {
+  Logger logger("ColorLut");
+  logger.setScope(path);
+
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    logger.error("Failed to open file");
+    return nullptr;
+  }
+
+  uint32_t size = 0;
+  std::array<float, 3> min = {{0, 0, 0}};
+  std::array<float, 3> max = {{1, 1, 1}};
+  std::vector<float> values;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::string key;
+    if (!(stream >> key) || key[0] == '#' || key == "TITLE") continue;
+
+    if (key == "LUT_3D_SIZE") {
+      stream >> size;
+      if (size < 2 || size > COLOR_LUT_MAX_SIZE) {
+        logger.error("Unsupported LUT size");
+        return nullptr;
+      }
+      values.reserve(size_t(size) * size * size * 3);
+    } else if (key == "LUT_1D_SIZE") {
+      logger.error("1D LUTs are not supported, use the gamma of the settings");
+      return nullptr;
+    } else if (key == "DOMAIN_MIN") {
+      stream >> min[0] >> min[1] >> min[2];
+    } else if (key == "DOMAIN_MAX") {
+      stream >> max[0] >> max[1] >> max[2];
+    } else if (key == "LUT_3D_INPUT_RANGE") {
+      stream >> min[0] >> max[0];
+      min[1] = min[2] = min[0];
+      max[1] = max[2] = max[0];
+    } else if (std::isdigit(static_cast<unsigned char>(key[0])) || key[0] == '-' || key[0] == '+' || key[0] == '.') {
+      float green, blue;
+      if (!(stream >> green >> blue)) {
+        logger.error("Invalid line " + line);
+        return nullptr;
+      }
+      try {
+        values.push_back(std::stof(key));
+      } catch (const std::exception&) {
+        logger.error("Invalid line " + line);
+        return nullptr;
+      }
+      values.push_back(green);
+      values.push_back(blue);
+    }
+  }
+
+  if (size == 0 || values.size() != size_t(size) * size * size * 3) {
+    logger.error("Missing LUT_3D_SIZE or wrong number of entries");
+    return nullptr;
+  }
+
+  auto lut = std::make_shared<ColorLut>(size);
+  lut->setDomain(min, max);
+  const float* value = values.data();
+  for (uint32_t b = 0; b < size; b++) {
+    for (uint32_t g = 0; g < size; g++) {
+      for (uint32_t r = 0; r < size; r++, value += 3) lut->set(r, g, b, value[0], value[1], value[2]);
+    }
+  }
+  return lut;
+}
+
+// -- PIPELINE -----------------------------------------------------------------
+
+ColorPipeline::ColorPipeline(const ColorSettings& _settings, size_t threads)
+    : logger("ColorPipeline"), settings(_settings), pool(new WorkerPool((std::max)(threads, size_t(1)))) {
+  std::lock_guard<std::mutex> lock(mutex);
+  build();
+}
+
+void ColorPipeline::setSettings(const ColorSettings& value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  settings = value;
+  build();
+}
+
+ColorSettings ColorPipeline::getSettings() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return settings;
+}
+
+void ColorPipeline::setLut(std::shared_ptr<const ColorLut> value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  lut = value;
+  build();
+}
+
+bool ColorPipeline::loadLut(const std::string& path) {
+  auto value = ColorLut::load(path);
+  if (!value) return false;
+  setLut(value);
+  return true;
+}
+
+void ColorPipeline::build() {
+  auto next = std::make_shared<Program>();
+
+  const float maxIndex = COLOR_GAMMA_SIZE - 1;
+  for (uint32_t channel = 0; channel < 3; channel++) {
+    for (uint32_t value = 0; value < 256; value++) {
+      float* contribution = next->contributions[channel][value];
+      for (uint32_t output = 0; output < 3; output++) {
+        contribution[output] =
+            settings.matrix[output * 3 + channel] * settings.whiteBalance[channel] * value / 255.0f * maxIndex;
+      }
+      contribution[3] = 0;
+    }
+  }
+
+  const double exponent = 1.0 / (std::max)(settings.gamma, 0.01f);
+  std::vector<float> encoded(COLOR_GAMMA_SIZE);
+  for (uint32_t i = 0; i < COLOR_GAMMA_SIZE; i++) {
+    encoded[i] = static_cast<float>(std::pow(i / double(maxIndex), exponent));
+    next->gamma8[i] = static_cast<unsigned char>(std::lround(encoded[i] * 255));
+  }
+
+  next->lut = lut;
+  if (lut) {
+    const uint32_t size = lut->getSize();
+    const uint32_t steps[3] = {4, 4 * size, 4 * size * size};
+    for (uint32_t channel = 0; channel < 3; channel++) {
+      float range = lut->getDomainMax()[channel] - lut->getDomainMin()[channel];
+      if (range <= 0) range = 1;
+      for (uint32_t i = 0; i < COLOR_GAMMA_SIZE; i++) {
+        float position = (encoded[i] - lut->getDomainMin()[channel]) / range * (size - 1);
+        position = (std::min)((std::max)(position, 0.0f), float(size - 1));
+        uint32_t cell = (std::min)(static_cast<uint32_t>(position), size - 2);
+        next->axes[channel][i] = {cell * steps[channel], position - cell};
+      }
+    }
+  }
+
+  std::atomic_store(&program, std::shared_ptr<const Program>(next));
+}
+
+bool ColorPipeline::isSupported(VmbPixelFormatType format) {
+  switch (format) {
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+    case VmbPixelFormatRgb8:
+    case VmbPixelFormatBgr8:
+    case VmbPixelFormatRgba8:
+    case VmbPixelFormatBgra8:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool ColorPipeline::convert(const Frame& frame, unsigned char* destination) {
+  const uint32_t step = frame.getImageFormat() == VmbPixelFormatRgb8 || frame.getImageFormat() == VmbPixelFormatBgr8
+                            ? 3
+                        : frame.getImageFormat() == VmbPixelFormatRgba8 || frame.getImageFormat() == VmbPixelFormatBgra8
+                            ? 4
+                            : 1;
+  if (frame.getImageData() == nullptr || frame.getImageSize() < size_t(frame.getWidth()) * frame.getHeight() * step)
+    return false;
+  return convert(frame.getImageData(), frame.getWidth(), frame.getHeight(), frame.getImageFormat(), destination);
+}
+
+bool ColorPipeline::convert(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format,
+                            unsigned char* destination) {
+  OOSVIM_TRACE_SCOPE("ColorPipeline::convert");
+  if (source == nullptr || destination == nullptr || width < 2 || height < 2 || !isSupported(format)) return false;
+
+  // Keep the program alive for the whole frame, a swap applies to the next
+  std::shared_ptr<const Program> active = std::atomic_load(&program);
+  const size_t outputStride = size_t(width) * 3;
+  const uint32_t bands = (height + COLOR_BAND_ROWS - 1) / COLOR_BAND_ROWS;
+
+  uint32_t redX = 0, redY = 0;
+  switch (format) {
+    case VmbPixelFormatBayerGR8:
+      redX = 1;
+      break;
+    case VmbPixelFormatBayerGB8:
+      redY = 1;
+      break;
+    case VmbPixelFormatBayerBG8:
+      redX = 1;
+      redY = 1;
+      break;
+    case VmbPixelFormatBayerRG8:
+      break;
+    default: {
+      const bool bgr = format == VmbPixelFormatBgr8 || format == VmbPixelFormatBgra8;
+      const uint32_t step = format == VmbPixelFormatRgba8 || format == VmbPixelFormatBgra8 ? 4 : 3;
+      static const uint32_t rgbOrder[3] = {0, 1, 2};
+      static const uint32_t bgrOrder[3] = {2, 1, 0};
+      const uint32_t* order = bgr ? bgrOrder : rgbOrder;
+      pool->run(bands, [&](size_t index) {
+        const uint32_t first = static_cast<uint32_t>(index) * COLOR_BAND_ROWS;
+        const uint32_t last = (std::min)(first + COLOR_BAND_ROWS, height);
+        for (uint32_t y = first; y < last; y++) {
+          colorRow(*active, source + size_t(y) * width * step, width, step, order, destination + y * outputStride);
+        }
+      });
+      return true;
+    }
+  }
+
+  // Demosaic a row into the destination, where it stays in cache for the
+  // color pass over the same row
+  static const uint32_t order[3] = {0, 1, 2};
+  pool->run(bands, [&](size_t index) {
+    const uint32_t first = static_cast<uint32_t>(index) * COLOR_BAND_ROWS;
+    const uint32_t last = (std::min)(first + COLOR_BAND_ROWS, height);
+    for (uint32_t y = first; y < last; y++) {
+      const unsigned char* current = source + size_t(y) * width;
+      const unsigned char* above = y > 0 ? current - width : current + width;
+      const unsigned char* below = y + 1 < height ? current + width : current - width;
+      unsigned char* row = destination + y * outputStride;
+      demosaicRow(above, current, below, width, (y & 1) == redY, redX, row);
+      colorRow(*active, row, width, 3, order, row);
+    }
+  });
+  return true;
+}
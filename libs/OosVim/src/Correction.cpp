@@ -0,0 +1,315 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Correction.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "OosVim/Unpack.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_CORRECTION_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_CORRECTION_NEON
+#endif
+
+using namespace OosVim;
+
+// -- MAP ----------------------------------------------------------------------
+
+CalibrationMap::CalibrationMap(const std::string& path)
+    : logger("Calibration"), header(nullptr), memory(nullptr), length(0) {
+  logger.setScope(path);
+
+#if !defined(_WIN32)
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    logger.error("Failed to open file");
+    return;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(CalibrationHeader)) {
+    logger.error("File is too small");
+    ::close(fd);
+    return;
+  }
+  length = static_cast<size_t>(status.st_size);
+  void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (address == MAP_FAILED) {
+    logger.error("Failed to map file");
+    length = 0;
+    return;
+  }
+  memory = address;
+#else
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    logger.error("Failed to open file");
+    return;
+  }
+  length = static_cast<size_t>(file.tellg());
+  storage.resize((std::max)(length, sizeof(CalibrationHeader)));
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char*>(storage.data()), length)) {
+    logger.error("Failed to read file");
+    return;
+  }
+  memory = storage.data();
+#endif
+
+  header = static_cast<const CalibrationHeader*>(memory);
+  if (!validate()) header = nullptr;
+}
+
+CalibrationMap::~CalibrationMap() {
+#if !defined(_WIN32)
+  if (memory != nullptr) munmap(memory, length);
+#endif
+}
+
+bool CalibrationMap::validate() {
+  if (length < sizeof(CalibrationHeader) || header->magic != CALIBRATION_MAGIC ||
+      header->version != CALIBRATION_VERSION) {
+    logger.error("Not a calibration map");
+    return false;
+  }
+
+  CalibrationType type = static_cast<CalibrationType>(header->type);
+  size_t valueSize = type == CalibrationType::Defects ? sizeof(uint32_t) : sizeof(uint16_t);
+  size_t pixels = size_t(header->width) * header->height;
+  bool valid = type == CalibrationType::Dark || type == CalibrationType::Gain || type == CalibrationType::Defects;
+  valid = valid && (type == CalibrationType::Defects ? header->count <= pixels : header->count == pixels);
+  valid = valid && length >= sizeof(CalibrationHeader) + header->count * valueSize;
+  if (!valid) {
+    logger.error("Calibration map is inconsistent");
+    return false;
+  }
+
+  if (type == CalibrationType::Defects) {
+    const uint32_t* indices = static_cast<const uint32_t*>(getData());
+    if (!std::is_sorted(indices, indices + header->count) ||
+        (header->count > 0 && indices[header->count - 1] >= pixels)) {
+      logger.error("Defective pixels are not sorted or outside the frame");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CalibrationMap::save(const std::string& path, CalibrationType type, uint32_t width, uint32_t height,
+                          const void* data, uint32_t count) {
+  CalibrationHeader header = {CALIBRATION_MAGIC, CALIBRATION_VERSION, static_cast<uint32_t>(type), width, height,
+                              count, {0, 0}};
+  size_t valueSize = type == CalibrationType::Defects ? sizeof(uint32_t) : sizeof(uint16_t);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(static_cast<const char*>(data), count * valueSize);
+  return file.good();
+}
+
+// -- KERNELS ------------------------------------------------------------------
+
+// Subtract the dark value, clamped at 0, then scale by the gain, rounded and
+// clamped at the maximum. A missing map is passed as nullptr.
+static inline uint32_t correctValue(uint32_t value, const uint16_t* dark, const uint16_t* gain, uint32_t x,
+                                    uint32_t maxValue) {
+  if (dark) value = value > dark[x] ? value - dark[x] : 0;
+  if (gain) value = (std::min)((value * gain[x] + CORRECTION_GAIN_ONE / 2) >> CORRECTION_GAIN_SHIFT, maxValue);
+  return value;
+}
+
+#if defined(OOSVIM_CORRECTION_SSE2)
+// Eight 16 bit values
+static inline __m128i correctVector(__m128i value, const uint16_t* dark, const uint16_t* gain, uint32_t x,
+                                    __m128i maxBiased) {
+  const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+  if (dark) value = _mm_subs_epu16(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(dark + x)));
+  if (gain) {
+    __m128i factor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gain + x));
+    __m128i low = _mm_mullo_epi16(value, factor);
+    __m128i high = _mm_mulhi_epu16(value, factor);
+    const __m128i round = _mm_set1_epi32(CORRECTION_GAIN_ONE / 2);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    __m128i first = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(low, high), round), CORRECTION_GAIN_SHIFT);
+    __m128i second = _mm_srli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(low, high), round), CORRECTION_GAIN_SHIFT);
+    // Unsigned saturation with the signed pack, then clamp at the maximum
+    __m128i biased = _mm_packs_epi32(_mm_sub_epi32(first, bias32), _mm_sub_epi32(second, bias32));
+    value = _mm_xor_si128(_mm_min_epi16(biased, maxBiased), bias16);
+  }
+  return value;
+}
+#elif defined(OOSVIM_CORRECTION_NEON)
+static inline uint16x8_t correctVector(uint16x8_t value, const uint16_t* dark, const uint16_t* gain, uint32_t x,
+                                       uint16x8_t maximum) {
+  if (dark) value = vqsubq_u16(value, vld1q_u16(dark + x));
+  if (gain) {
+    uint16x8_t factor = vld1q_u16(gain + x);
+    uint32x4_t first = vrshrq_n_u32(vmull_u16(vget_low_u16(value), vget_low_u16(factor)), CORRECTION_GAIN_SHIFT);
+    uint32x4_t second = vrshrq_n_u32(vmull_u16(vget_high_u16(value), vget_high_u16(factor)), CORRECTION_GAIN_SHIFT);
+    value = vminq_u16(vcombine_u16(vqmovn_u32(first), vqmovn_u32(second)), maximum);
+  }
+  return value;
+}
+#endif
+
+static void correctRow8(const unsigned char* source, const uint16_t* dark, const uint16_t* gain, uint32_t width,
+                        unsigned char* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_CORRECTION_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i maxBiased = _mm_set1_epi16(static_cast<short>(255 ^ 0x8000));
+  for (; x + 16 <= width; x += 16) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+    __m128i low = correctVector(_mm_unpacklo_epi8(value, zero), dark, gain, x, maxBiased);
+    __m128i high = correctVector(_mm_unpackhi_epi8(value, zero), dark, gain, x + 8, maxBiased);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(low, high));
+  }
+#elif defined(OOSVIM_CORRECTION_NEON)
+  const uint16x8_t maximum = vdupq_n_u16(255);
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t value = vld1q_u8(source + x);
+    uint16x8_t low = correctVector(vmovl_u8(vget_low_u8(value)), dark, gain, x, maximum);
+    uint16x8_t high = correctVector(vmovl_u8(vget_high_u8(value)), dark, gain, x + 8, maximum);
+    vst1q_u8(destination + x, vcombine_u8(vqmovn_u16(low), vqmovn_u16(high)));
+  }
+#endif
+  for (; x < width; x++) destination[x] = static_cast<unsigned char>(correctValue(source[x], dark, gain, x, 255));
+}
+
+static void correctRow16(const uint16_t* source, const uint16_t* dark, const uint16_t* gain, uint32_t width,
+                         uint32_t maxValue, uint16_t* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_CORRECTION_SSE2)
+  const __m128i maxBiased = _mm_set1_epi16(static_cast<short>(maxValue ^ 0x8000));
+  for (; x + 8 <= width; x += 8) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), correctVector(value, dark, gain, x, maxBiased));
+  }
+#elif defined(OOSVIM_CORRECTION_NEON)
+  const uint16x8_t maximum = vdupq_n_u16(static_cast<uint16_t>(maxValue));
+  for (; x + 8 <= width; x += 8) vst1q_u16(destination + x, correctVector(vld1q_u16(source + x), dark, gain, x, maximum));
+#endif
+  for (; x < width; x++) destination[x] = static_cast<uint16_t>(correctValue(source[x], dark, gain, x, maxValue));
+}
+
+// Replace defective pixels with the mean of the corrected neighbours of the
+// same color on their row
+template <typename T>
+static const uint32_t* replaceDefects(const uint32_t* defect, const uint32_t* end, size_t rowsEnd, uint32_t width,
+                                      uint32_t spacing, T* destination) {
+  for (; defect != end && *defect < rowsEnd; defect++) {
+    uint32_t x = *defect % width;
+    T* pixel = destination + *defect;
+    bool left = x >= spacing;
+    bool right = x + spacing < width;
+    if (left && right) *pixel = static_cast<T>((uint32_t(pixel[-int(spacing)]) + pixel[spacing] + 1) / 2);
+    else if (left) *pixel = pixel[-int(spacing)];
+    else if (right) *pixel = pixel[spacing];
+  }
+  return defect;
+}
+
+// -- CORRECTION ---------------------------------------------------------------
+
+Correction::Correction() : logger("Correction") {}
+
+std::shared_ptr<CalibrationMap> Correction::load(const std::string& path, CalibrationType type) {
+  auto map = std::make_shared<CalibrationMap>(path);
+  if (!map->isValid()) return nullptr;
+  if (map->getType() != type) {
+    logger.error("Wrong type of calibration map " + path);
+    return nullptr;
+  }
+  return map;
+}
+
+bool Correction::loadDark(const std::string& path) {
+  dark = load(path, CalibrationType::Dark);
+  return dark != nullptr;
+}
+
+bool Correction::loadGain(const std::string& path) {
+  gain = load(path, CalibrationType::Gain);
+  return gain != nullptr;
+}
+
+bool Correction::loadDefects(const std::string& path) {
+  defects = load(path, CalibrationType::Defects);
+  return defects != nullptr;
+}
+
+bool Correction::apply(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format,
+                       size_t size, unsigned char* destination) const {
+  if (source == nullptr || destination == nullptr) return false;
+
+  uint32_t bitDepth = getUnpackBitDepth(format);
+  uint32_t spacing = 1;
+  switch (format) {
+    case VmbPixelFormatMono8:
+      bitDepth = 8;
+      break;
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+      bitDepth = 8;
+      spacing = 2;
+      break;
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
+      break;
+    default:
+      return false;
+  }
+
+  for (auto& map : {dark, gain, defects}) {
+    if (map && (map->getWidth() != width || map->getHeight() != height)) return false;
+  }
+
+  const uint16_t* darkValues = dark ? static_cast<const uint16_t*>(dark->getData()) : nullptr;
+  const uint16_t* gainValues = gain ? static_cast<const uint16_t*>(gain->getData()) : nullptr;
+  const uint32_t* defect = defects ? static_cast<const uint32_t*>(defects->getData()) : nullptr;
+  const uint32_t* defectsEnd = defects ? defect + defects->getCount() : nullptr;
+  const uint32_t maxValue = (1u << bitDepth) - 1;
+  const size_t rowBytes = size_t(width) * (bitDepth > 8 ? 2 : 1);
+  if (size < rowBytes * height) return false;
+
+  // Blocks of rows, so the defects are replaced while the rows are in cache
+  for (uint32_t y0 = 0; y0 < height; y0 += CORRECTION_BLOCK_ROWS) {
+    uint32_t y1 = (std::min)(y0 + CORRECTION_BLOCK_ROWS, height);
+    for (uint32_t y = y0; y < y1; y++) {
+      size_t offset = size_t(y) * width;
+      const uint16_t* darkRow = darkValues ? darkValues + offset : nullptr;
+      const uint16_t* gainRow = gainValues ? gainValues + offset : nullptr;
+      if (!darkRow && !gainRow) {
+        if (source != destination) std::memcpy(destination + y * rowBytes, source + y * rowBytes, rowBytes);
+      } else if (bitDepth == 8) {
+        correctRow8(source + offset, darkRow, gainRow, width, destination + offset);
+      } else {
+        correctRow16(reinterpret_cast<const uint16_t*>(source) + offset, darkRow, gainRow, width, maxValue,
+                     reinterpret_cast<uint16_t*>(destination) + offset);
+      }
+    }
+
+    if (defect != defectsEnd) {
+      size_t rowsEnd = size_t(y1) * width;
+      if (bitDepth == 8) defect = replaceDefects(defect, defectsEnd, rowsEnd, width, spacing, destination);
+      else defect = replaceDefects(defect, defectsEnd, rowsEnd, width, spacing, reinterpret_cast<uint16_t*>(destination));
+    }
+  }
+  return true;
+}
@@ -71,6 +71,21 @@ bool Device::run(const std::string& name) {
   return true;
 }
 
+bool Device::run(const AVT::VmbAPI::FeaturePtr& command) {
+  if (SP_ISNULL(command)) return false;
+  auto error = command->RunCommand();
+  if (error != VmbErrorSuccess) {
+    logger.error("Failed to run command", error);
+    return false;
+  }
+  return true;
+}
+
+bool Device::notify(const std::string& event, bool value) {
+  if (!set("EventSelector", event)) return false;
+  return set("EventNotification", std::string(value ? "On" : "Off"));
+}
+
 bool Device::locate(const std::string& name, AVT::VmbAPI::FeaturePtr& feature) {
   return handle->GetFeatureByName(name.c_str(), feature) == VmbErrorSuccess;
 }
@@ -104,8 +119,14 @@ bool Device::inspect() {
     return false;
   }
 
+  return refresh();
+}
+
+bool Device::refresh() {
+  if (SP_ISNULL(handle)) return false;
+
   VmbAccessModeType modes;
-  error = SP_ACCESS(handle)->GetPermittedAccess(modes);
+  auto error = SP_ACCESS(handle)->GetPermittedAccess(modes);
   if (error == VmbErrorSuccess) {
     availableMode = translateAccessMode(modes);
   } else if (error != VmbErrorNotFound) {
@@ -59,50 +59,45 @@ void Discovery::Observer::setId(std::string id) {
 }
 
 void Discovery::Observer::discover() {
-  if (!system->isAvailable()) {
-    logger.error(
-        "Failed to retrieve current camera list, system is unavailable");
-    return;
-  }
-
-  AVT::VmbAPI::CameraPtrVector cameras;
-  auto err = system->getAPI().GetCameras(cameras);
-
-  if (err != VmbErrorSuccess) {
+  if (!registry->isEnumerated() && !registry->enumerate()) {
     logger.error("Failed to retrieve current camera list");
     return;
   }
 
   // Make sure we discover all the camera's at boot
-  for (auto &camera : cameras) {
-    process(camera, AVT::VmbAPI::UpdateTriggerPluggedIn);
+  auto devices = registry->getSnapshot();
+  for (auto &device : *devices) {
+    publish(device, OOS_DISCOVERY_PLUGGED_IN);
   }
 }
 
 void Discovery::Observer::process(AVT::VmbAPI::CameraPtr camera,
                                   AVT::VmbAPI::UpdateTriggerType reason) {
-  auto device = std::make_shared<Device>(camera);
-
-  // Make sure the provided filter matched the camera
-
-  {
-  std::lock_guard<std::mutex> lock(reqIdMutex);
-  if (reqID != DISCOVERY_ANY_ID && device->getId() != reqID) return;
-  }
-
-  // Publish the event
-  if (discovery.triggerCallbackFuction)
+  // Keep the registry up to date, this reuses the known devices
   switch (reason) {
     case AVT::VmbAPI::UpdateTriggerPluggedIn:
-      discovery.triggerCallbackFuction(device, OOS_DISCOVERY_PLUGGED_IN);
+      publish(registry->pluggedIn(camera), OOS_DISCOVERY_PLUGGED_IN);
       break;
     case AVT::VmbAPI::UpdateTriggerPluggedOut:
-      discovery.triggerCallbackFuction(device, OOS_DISCOVERY_PLUGGED_OUT);
+      publish(registry->pluggedOut(camera), OOS_DISCOVERY_PLUGGED_OUT);
       break;
     case AVT::VmbAPI::UpdateTriggerOpenStateChanged:
-      discovery.triggerCallbackFuction(device, OOS_DISCOVERY_STATE_CHANGED);
+      publish(registry->stateChanged(camera), OOS_DISCOVERY_STATE_CHANGED);
       break;
     default:
       break;
   }
-};
+}
+
+void Discovery::Observer::publish(std::shared_ptr<Device> device, const DiscoveryTrigger trigger) {
+  if (!device) return;
+
+  // Make sure the provided filter matched the camera
+  {
+  std::lock_guard<std::mutex> lock(reqIdMutex);
+  if (reqID != DISCOVERY_ANY_ID && device->getId() != reqID) return;
+  }
+
+  // Publish the event
+  if (discovery.triggerCallbackFuction) discovery.triggerCallbackFuction(device, trigger);
+}
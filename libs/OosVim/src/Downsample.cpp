@@ -0,0 +1,136 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Downsample.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_DOWNSAMPLE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_DOWNSAMPLE_NEON
+#endif
+
+using namespace OosVim;
+
+uint32_t OosVim::getDownsampleChannels(VmbPixelFormatType format) {
+  switch (format) {
+    case VmbPixelFormatMono8:
+      return 1;
+    case VmbPixelFormatRgb8:
+    case VmbPixelFormatBgr8:
+      return 3;
+    case VmbPixelFormatRgba8:
+    case VmbPixelFormatBgra8:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// Scalar kernel for any number of channels, starting at output column x
+static void downsampleRow(const unsigned char* source, uint32_t stride, uint32_t channels, uint32_t factor,
+                          uint32_t x, uint32_t outputWidth, unsigned char* destination) {
+  const uint32_t area = factor * factor;
+  for (; x < outputWidth; x++) {
+    for (uint32_t c = 0; c < channels; c++) {
+      uint32_t sum = area / 2;
+      const unsigned char* block = source + x * factor * channels + c;
+      for (uint32_t row = 0; row < factor; row++) {
+        const unsigned char* pixel = block + row * stride;
+        for (uint32_t column = 0; column < factor; column++) sum += pixel[column * channels];
+      }
+      destination[x * channels + c] = static_cast<unsigned char>(sum / area);
+    }
+  }
+}
+
+// Mono kernels, return the number of output columns they produced
+static uint32_t downsampleMono2(const unsigned char* source, uint32_t stride, uint32_t outputWidth,
+                                unsigned char* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_DOWNSAMPLE_SSE2)
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  const __m128i two = _mm_set1_epi16(2);
+  for (; x + 8 <= outputWidth; x += 8) {
+    __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * 2));
+    __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + stride + x * 2));
+    __m128i sum = _mm_add_epi16(_mm_and_si128(top, mask), _mm_srli_epi16(top, 8));
+    sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(bottom, mask), _mm_srli_epi16(bottom, 8)));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(sum, sum));
+  }
+#elif defined(OOSVIM_DOWNSAMPLE_NEON)
+  for (; x + 8 <= outputWidth; x += 8) {
+    uint16x8_t sum = vpaddlq_u8(vld1q_u8(source + x * 2));
+    sum = vpadalq_u8(sum, vld1q_u8(source + stride + x * 2));
+    vst1_u8(destination + x, vrshrn_n_u16(sum, 2));
+  }
+#else
+  (void)source;
+  (void)stride;
+  (void)destination;
+  (void)outputWidth;
+#endif
+  return x;
+}
+
+static uint32_t downsampleMono4(const unsigned char* source, uint32_t stride, uint32_t outputWidth,
+                                unsigned char* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_DOWNSAMPLE_SSE2)
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i eight = _mm_set1_epi32(8);
+  for (; x + 4 <= outputWidth; x += 4) {
+    __m128i sum = _mm_setzero_si128();
+    for (uint32_t row = 0; row < 4; row++) {
+      __m128i line = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + row * stride + x * 4));
+      sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(line, mask), _mm_srli_epi16(line, 8)));
+    }
+    __m128i total = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(sum, ones), eight), 4);
+    total = _mm_packs_epi32(total, total);
+    int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(total, total));
+    destination[x + 0] = static_cast<unsigned char>(packed);
+    destination[x + 1] = static_cast<unsigned char>(packed >> 8);
+    destination[x + 2] = static_cast<unsigned char>(packed >> 16);
+    destination[x + 3] = static_cast<unsigned char>(packed >> 24);
+  }
+#elif defined(OOSVIM_DOWNSAMPLE_NEON)
+  for (; x + 4 <= outputWidth; x += 4) {
+    uint16x8_t sum = vpaddlq_u8(vld1q_u8(source + x * 4));
+    for (uint32_t row = 1; row < 4; row++) sum = vpadalq_u8(sum, vld1q_u8(source + row * stride + x * 4));
+    uint16x4_t total = vrshrn_n_u32(vpaddlq_u16(sum), 4);
+    uint8x8_t narrow = vmovn_u16(vcombine_u16(total, total));
+    vst1_lane_u32(reinterpret_cast<uint32_t*>(destination + x), vreinterpret_u32_u8(narrow), 0);
+  }
+#else
+  (void)source;
+  (void)stride;
+  (void)destination;
+  (void)outputWidth;
+#endif
+  return x;
+}
+
+bool OosVim::downsample(const unsigned char* source, uint32_t width, uint32_t height, uint32_t channels,
+                        uint32_t factor, unsigned char* destination) {
+  if (source == nullptr || destination == nullptr || channels == 0) return false;
+  if (factor != 2 && factor != 4) return false;
+
+  const uint32_t stride = width * channels;
+  const uint32_t outputWidth = width / factor;
+  const uint32_t outputHeight = height / factor;
+
+  for (uint32_t y = 0; y < outputHeight; y++) {
+    const unsigned char* rows = source + static_cast<size_t>(y) * factor * stride;
+    unsigned char* output = destination + static_cast<size_t>(y) * outputWidth * channels;
+
+    uint32_t x = 0;
+    if (channels == 1) {
+      x = factor == 2 ? downsampleMono2(rows, stride, outputWidth, output)
+                      : downsampleMono4(rows, stride, outputWidth, output);
+    }
+    downsampleRow(rows, stride, channels, factor, x, outputWidth, output);
+  }
+  return true;
+}
@@ -0,0 +1,202 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Event.h"
+
+#include "OosVim/Frame.h"
+#include "OosVim/Stream.h"
+#include "OosVim/Trace.h"
+
+using namespace OosVim;
+
+// -- QUEUE --------------------------------------------------------------------
+
+EventQueue::EventQueue(size_t capacity) : head(0), tail(0) {
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+  events.resize(size);
+  mask = size - 1;
+}
+
+bool EventQueue::push(const CameraEvent& event) {
+  uint64_t position = tail.load(std::memory_order_relaxed);
+  if (position - head.load(std::memory_order_acquire) > mask) return false;
+  events[position & mask] = event;
+  tail.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool EventQueue::pop(CameraEvent& event) {
+  uint64_t position = head.load(std::memory_order_relaxed);
+  if (position == tail.load(std::memory_order_acquire)) return false;
+  event = events[position & mask];
+  head.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+// -- CHANNEL ------------------------------------------------------------------
+
+EventChannel::EventChannel(const std::vector<CameraEventType>& types)
+    : logger("Event"),
+      types(types),
+      bOpen(false),
+      session(0),
+      sessionBegin(0),
+      pendingSession(0),
+      received(0),
+      dropped(0),
+      matched(0),
+      unmatched(0) {
+  pendingCount.fill(0);
+}
+
+EventChannel::~EventChannel() { close(); }
+
+const char* EventChannel::getName(CameraEventType type) {
+  switch (type) {
+    case CameraEventType::ExposureEnd:
+      return "ExposureEnd";
+    case CameraEventType::FrameTrigger:
+      return "FrameTrigger";
+    default:
+      return "";
+  }
+}
+
+bool EventChannel::open(std::shared_ptr<Device> value) {
+  close();
+  if (!value || !value->isOpen() || !value->isMaster()) {
+    logger.warning("Camera events need an open connection that is not read only");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  device = value;
+  sessionBegin = queue.getPushed();
+  session++;
+  for (auto type : types) {
+    // The event feature changes with every event, its data is in features
+    // named after it, e.g. EventExposureEndTimestamp
+    std::string name = std::string("Event") + getName(type);
+    auto source = std::make_shared<Source>();
+    source->type = type;
+    Subscription subscription;
+    if (!device->locate(name, subscription.event) || !device->locate(name + "Timestamp", source->timestamp) ||
+        !device->locate(name + "FrameID", source->frameId) || !device->notify(getName(type), true)) {
+      logger.warning(std::string("Camera does not send ") + getName(type) + " events");
+      continue;
+    }
+    subscription.source = source;
+    SP_SET(subscription.observer, new EventObserver(*this, source));
+    subscriptions.push_back(subscription);
+  }
+
+  // Observers only start once the subscriptions are complete
+  for (auto& subscription : subscriptions) {
+    auto error = subscription.event->RegisterObserver(subscription.observer);
+    if (error != VmbErrorSuccess) logger.error(std::string("Failed to observe ") + getName(subscription.source->type), error);
+    else subscription.observer->start();
+  }
+
+  bOpen = !subscriptions.empty();
+  if (bOpen) logger.verbose("Observing " + std::to_string(subscriptions.size()) + " camera events");
+  return bOpen;
+}
+
+void EventChannel::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& subscription : subscriptions) {
+    subscription.observer->stop();
+    subscription.event->UnregisterObserver(subscription.observer);
+    if (device->isOpen() && device->isMaster()) device->notify(getName(subscription.source->type), false);
+  }
+  subscriptions.clear();
+  device = nullptr;
+  bOpen = false;
+}
+
+void EventChannel::setCallback(std::function<void(const CameraEvent&)> value) {
+  std::lock_guard<std::mutex> lock(callbackMutex);
+  callback = value;
+}
+
+void EventChannel::inject(const CameraEvent& event) {
+  if (bOpen) return;
+  dispatch(event);
+}
+
+void EventChannel::receive(const Source& source) {
+  CameraEvent event;
+  event.hostTime = Stream::getHostTime();
+  event.type = source.type;
+  getFeature(source.timestamp, event.timestamp);
+  getFeature(source.frameId, event.frameId);
+  dispatch(event);
+}
+
+void EventChannel::dispatch(const CameraEvent& event) {
+  OOSVIM_TRACE_SCOPE("EventChannel::dispatch");
+  received++;
+  {
+    std::lock_guard<std::mutex> lock(callbackMutex);
+    if (callback) callback(event);
+  }
+  std::lock_guard<std::mutex> lock(producerMutex);
+  if (!queue.push(event)) dropped++;
+}
+
+void EventChannel::recordFrame(const Frame& frame) {
+  // Forget the events of the previous connection, their block ids would match
+  // the new frames
+  CameraEvent event;
+  uint64_t current = session.load();
+  if (current != pendingSession) {
+    pendingSession = current;
+    uint64_t begin = sessionBegin.load();
+    while (queue.getPopped() < begin && queue.pop(event)) {}
+    for (auto& ring : pending) {
+      for (auto& slot : ring) slot = Pending();
+    }
+    pendingCount.fill(0);
+  }
+
+  // Move the queued events to the pending rings, overwritten events never
+  // met their frame
+  while (queue.pop(event)) {
+    size_t type = static_cast<size_t>(event.type);
+    auto& slot = pending[type][pendingCount[type]++ % EVENT_PENDING_SIZE];
+    if (!slot.matched) unmatched++;
+    slot.event = event;
+    slot.matched = false;
+  }
+
+  uint64_t id = frame.getId() & EVENT_FRAME_ID_MASK;
+  for (size_t type = 0; type < pending.size(); type++) {
+    for (auto& slot : pending[type]) {
+      if (slot.matched || (slot.event.frameId & EVENT_FRAME_ID_MASK) != id) continue;
+      slot.matched = true;
+      matched++;
+      uint64_t arrival = frame.getArrivalTime();
+      delays[type].record(arrival > slot.event.hostTime ? arrival - slot.event.hostTime : 0);
+      break;
+    }
+  }
+}
+
+// -- OBSERVER -----------------------------------------------------------------
+
+void EventObserver::start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  running = true;
+}
+
+void EventObserver::stop() {
+  std::lock_guard<std::mutex> lock(mutex);
+  running = false;
+}
+
+void EventObserver::FeatureChanged(const AVT::VmbAPI::FeaturePtr&) {
+  OOSVIM_TRACE_THREAD("VimbaEvent");
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!running) return;
+  channel.receive(*source);
+}
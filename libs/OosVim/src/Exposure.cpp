@@ -0,0 +1,55 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Exposure.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace OosVim;
+
+static const double EXPOSURE_MIN_MEAN = 1.0 / 1024;
+static const double EXPOSURE_MIN_CLIPPED_RATIO = 0.5;
+
+ExposureController::ExposureController(const ExposureSettings& _settings)
+    : exposure(_settings.minExposure), gain(_settings.minGain), frames(0) {
+  setSettings(_settings);
+}
+
+void ExposureController::setSettings(const ExposureSettings& _settings) {
+  settings = _settings;
+  settings.damping = (std::min)((std::max)(settings.damping, 0.0), 1.0);
+  settings.maxExposure = (std::max)(settings.maxExposure, settings.minExposure);
+  settings.maxGain = (std::max)(settings.maxGain, settings.minGain);
+}
+
+void ExposureController::reset(double _exposure, double _gain) {
+  exposure = (std::min)((std::max)(_exposure, settings.minExposure), settings.maxExposure);
+  gain = (std::min)((std::max)(_gain, settings.minGain), settings.maxGain);
+  frames = 0;
+}
+
+bool ExposureController::update(const FrameStatistics& statistics) {
+  if (!statistics.isValid()) return false;
+  if (++frames < settings.interval) return false;
+
+  double ratio = settings.target / (std::max)(statistics.getMean(), EXPOSURE_MIN_MEAN);
+
+  // Saturated highlights win from the mean, the exposure never rises while they clip
+  double clipped = statistics.getClippedHigh();
+  if (clipped > settings.maxClipped) {
+    ratio = (std::min)(ratio, (std::max)(settings.maxClipped / clipped, EXPOSURE_MIN_CLIPPED_RATIO));
+  }
+
+  if (std::fabs(std::log(ratio)) < std::log1p(settings.tolerance)) return false;
+
+  double total = exposure * std::pow(10.0, gain / 20.0) * std::pow(ratio, settings.damping);
+  double newExposure = (std::min)((std::max)(total, settings.minExposure), settings.maxExposure);
+  double newGain = (std::min)((std::max)(20.0 * std::log10(total / newExposure), settings.minGain), settings.maxGain);
+
+  if (newExposure == exposure && newGain == gain) return false;
+
+  exposure = newExposure;
+  gain = newGain;
+  frames = 0;
+  return true;
+}
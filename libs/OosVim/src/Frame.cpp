@@ -1,5 +1,7 @@
 #include "OosVim/Frame.h"
 
+#include <algorithm>
+
 using namespace OosVim;
 
 Frame::Frame(std::shared_ptr<Device>&_device) :
@@ -7,7 +9,12 @@ Frame::Frame(std::shared_ptr<Device>&_device) :
   id(0),
   timestamp(0), frameCount(0),
   width(0), height(0),
-  size(0)
+  size(0),
+  format(0),
+  data(nullptr),
+  exposureTime(0), arrivalTime(0),
+  changeScore(-1),
+  source(nullptr)
 { };
 
 Frame::~Frame() {
@@ -15,11 +22,20 @@ Frame::~Frame() {
 }
 
 bool Frame::getAncillaryFeature(const std::string& name, AVT::VmbAPI::FeaturePtr& feature) const {
-  if (SP_ISNULL(ancilleryData)) return false;
+  if (SP_ISNULL(ancilleryData)) {
+    if (source == nullptr || source->GetAncillaryData(ancilleryData) != VmbErrorSuccess) return false;
+    if (ancilleryData->Open() != VmbErrorSuccess) {
+      SP_RESET(ancilleryData);
+      return false;
+    }
+  }
   return ancilleryData->GetFeatureByName(name.c_str(), feature) == VmbErrorSuccess;
 }
 
-bool Frame::load(const AVT::VmbAPI::FramePtr& framePtr) {
+bool Frame::load(const AVT::VmbAPI::FramePtr& framePtr, ChunkDecoder& decoder) {
+  unload();
+  source = SP_ACCESS(framePtr);
+
   auto error = framePtr->GetPixelFormat(format);
   if (error != VmbErrorSuccess) {
     Logger::warning("Frame", "Failed to extract pixel format from frame", error);
@@ -67,18 +83,93 @@ bool Frame::load(const AVT::VmbAPI::FramePtr& framePtr) {
     return false;
   }
 
-  // Attempt to extract ancillery data
-  if (framePtr->GetAncillaryData(ancilleryData) == VmbErrorSuccess) {
-    if (ancilleryData->Open() == VmbErrorSuccess) {
-      ancilleryData->GetFeatures(ancilleryFeatures);
-    } else {
-      SP_RESET(ancilleryData);
+  // Decode the chunk data without opening the ancillary features
+  if (decoder.decode(framePtr, chunk)) frameCount = chunk.frameCount;
+  else frameCount = id;
+  return true;
+}
+
+
+bool Frame::load(unsigned char* _data, uint32_t _width, uint32_t _height, VmbPixelFormatType _format,
+                 uint32_t _size, uint64_t _id, uint64_t _timestamp, const Chunk& _chunk) {
+  unload();
+  if (_data == nullptr) return false;
+
+  data = _data;
+  width = _width;
+  height = _height;
+  format = _format;
+  size = _size;
+  id = _id;
+  timestamp = _timestamp;
+  chunk = _chunk;
+  frameCount = chunk.valid ? chunk.frameCount : id;
+  return true;
+}
+
+void Frame::copyFrom(const Frame& frame) {
+  unload();
+
+  device = frame.device;
+  id = frame.id;
+  timestamp = frame.timestamp;
+  frameCount = frame.frameCount;
+  width = frame.width;
+  height = frame.height;
+  size = frame.size;
+  format = frame.format;
+  chunk = frame.chunk;
+  exposureTime = frame.exposureTime;
+  arrivalTime = frame.arrivalTime;
+  changeScore = frame.changeScore;
+
+  // Resizing only allocates when the frames grow
+  storage.resize(size);
+  if (frame.data != nullptr) std::copy(frame.data, frame.data + size, storage.begin());
+  data = storage.data();
+}
+
+void Frame::unload() {
+  if (!SP_ISNULL(ancilleryData)) {
+    ancilleryData->Close();
+    SP_RESET(ancilleryData);
+  }
+  source = nullptr;
+}
+
+FramePool::FramePool(std::shared_ptr<Device> device, size_t size, size_t _limit)
+    : device(device), next(0), limit(0), allocations(0), exhausted(0) {
+  setLimit(_limit > 0 ? _limit : (std::max)(size * FRAME_POOL_GROWTH, FRAME_POOL_MIN_LIMIT));
+  frames.reserve(size);
+  while (frames.size() < size) allocate();
+}
+
+void FramePool::setLimit(size_t value) { limit = value > 0 ? value : 1; }
+
+std::shared_ptr<Frame> FramePool::acquire() {
+  for (size_t i = 0; i < frames.size(); i++) {
+    size_t index = (next + i) % frames.size();
+    auto& frame = frames[index];
+    if (frame.use_count() == 1) {
+      // Make sure the last user is done with the frame before we reuse it
+      std::atomic_thread_fence(std::memory_order_acquire);
+      next = (index + 1) % frames.size();
+      return frame;
     }
   }
 
-  uint64_t fc;
-  if (getAncillary("ChunkAcquisitionFrameCount", fc)) frameCount = fc;
-  else frameCount++;
-  return true;
+  // All frames are still in use, grow the pool unless the consumers already
+  // hold on to more frames than they should
+  if (frames.size() >= limit.load()) {
+    exhausted++;
+    return nullptr;
+  }
+  allocate();
+  next = 0;
+  return frames.back();
 }
 
+void FramePool::allocate() {
+  frames.push_back(std::make_shared<Frame>(device));
+  allocations++;
+}
@@ -0,0 +1,123 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/FrameChannel.h"
+
+#include <algorithm>
+
+using namespace OosVim;
+
+FrameChannel::FrameChannel(size_t capacity, ChannelOverflow overflow)
+    : capacity(capacity > 0 ? capacity : 1), overflow(overflow), closed(false),
+      pool(nullptr, 0, this->capacity * FRAME_POOL_GROWTH),
+      dropped(0) {}
+
+void FrameChannel::setCapacity(size_t value, ChannelOverflow mode) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = value > 0 ? value : 1;
+    pool.setLimit(capacity * FRAME_POOL_GROWTH);
+    overflow = mode;
+    while (frames.size() > capacity) {
+      frames.pop_front();
+      dropped++;
+    }
+  }
+  space.notify_all();
+}
+
+void FrameChannel::setExecutor(FrameExecutor value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  executor = value;
+}
+
+void FrameChannel::push(const Frame& frame) {
+  // The pool is only used from the producer thread
+  auto copy = pool.acquire();
+  if (!copy) {
+    dropped++;
+    return;
+  }
+  copy->copyFrom(frame);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (closed) return;
+
+  // Hand the frame to a waiting consumer directly
+  if (!waiters.empty()) {
+    auto waiter = waiters.front();
+    waiters.pop_front();
+    waiter->frame = copy;
+    auto currentExecutor = executor;
+    lock.unlock();
+    wake(waiter, currentExecutor);
+    return;
+  }
+
+  if (frames.size() >= capacity) {
+    if (overflow == ChannelOverflow::Block) {
+      space.wait(lock, [&] { return frames.size() < capacity || closed; });
+      if (closed) return;
+    } else {
+      frames.pop_front();
+      dropped++;
+    }
+  }
+  frames.push_back(copy);
+}
+
+bool FrameChannel::receive(Waiter& waiter) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!frames.empty()) {
+    waiter.frame = frames.front();
+    frames.pop_front();
+    lock.unlock();
+    space.notify_one();
+    return true;
+  }
+
+  if (closed) {
+    waiter.frame = nullptr;
+    return true;
+  }
+
+  waiters.push_back(&waiter);
+  return false;
+}
+
+void FrameChannel::cancel(Waiter& waiter) {
+  std::lock_guard<std::mutex> lock(mutex);
+  waiters.erase(std::remove(waiters.begin(), waiters.end(), &waiter), waiters.end());
+}
+
+void FrameChannel::open() {
+  std::lock_guard<std::mutex> lock(mutex);
+  closed = false;
+}
+
+void FrameChannel::close() {
+  std::deque<Waiter*> closedWaiters;
+  FrameExecutor currentExecutor;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    frames.clear();
+    closedWaiters.swap(waiters);
+    currentExecutor = executor;
+  }
+  space.notify_all();
+
+  for (auto waiter : closedWaiters) {
+    waiter->frame = nullptr;
+    wake(waiter, currentExecutor);
+  }
+}
+
+bool FrameChannel::isOpen() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return !closed;
+}
+
+void FrameChannel::wake(Waiter* waiter, const FrameExecutor& currentExecutor) {
+  if (currentExecutor) currentExecutor([waiter]() { waiter->wake(); });
+  else waiter->wake();
+}
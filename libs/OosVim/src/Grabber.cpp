@@ -2,34 +2,56 @@
 
 #include "OosVim/Grabber.h"
 
+#include "OosVim/Trace.h"
+
 using namespace OosVim;
 
 Grabber::Grabber() :
-  system(OosVim::System::getInstance()),
+  system(nullptr),
+  registry(OosVim::Registry::getInstance()),
   discovery(nullptr),
   stream(nullptr),
   logger(std::make_shared<OosVim::Logger>("Grabber ")),
   actionsRunning(false),
+  actionBinding("Action"),
   deviceID(OosVim::DISCOVERY_ANY_ID),
   bReadOnly(false),
   bMulticast(false),
+  bChunkMode(false),
+  bLatencyMode(false),
   userSet(-1),
   desiredPixelFormat("BGR8Packed"),
+  decimation(1),
+  maxDeliveryRate(0),
+  downsampleFactor(1),
+  bImageStatistics(false),
+  bHostAutoExposure(false),
+  bExposureSynced(false),
+  pendingExposure(0),
+  pendingGain(0),
+  bBracketing(false),
+  bSequencer(false),
+  nextBracket(0),
+  bPulling(false),
+  bChannel(false),
   desiredFrameRate(OosVim::MAX_FRAMERATE),
-  framerate(0),
-  deviceList(createDeviceList())
+  framerate(0)
 { }
 
 void Grabber::start() {
+  // The system, enumeration and discovery are started from the action thread,
+  // so starting the grabber does not block on the cameras.
+  {
+    std::lock_guard<std::mutex> lock(actionMutex);
+    actionQueue.clear();
+    actionQueue.push_back(Action(ActionType::Initialize, nullptr));
+  }
+  channel.open();
   actionsRunning = true;
   actionThread = std::make_shared<std::thread>(std::bind(&Grabber::actionRunner, this));
-  startDiscovery();
 }
 
 void Grabber::stop() {
-  stopDiscovery();
-  stopStream();
-
   std::shared_ptr<std::thread> threadToKill;
   {
     std::lock_guard<std::mutex> lock(actionMutex);
@@ -42,6 +64,178 @@ void Grabber::stop() {
     actionSignal.notify_one();
     if (threadToKill->joinable()) threadToKill->join();
   }
+
+  // Release the threads and coroutines waiting for a frame first, a blocked
+  // push holds the delivery thread and with it the stream observer
+  channel.close();
+  pullHandoff.clear();
+  pullHandoff.interrupt();
+
+  stopDiscovery();
+  stopStream();
+}
+
+// -- PULL ---------------------------------------------------------------------
+
+std::shared_ptr<const OosVim::Frame> Grabber::waitForFrame(std::chrono::milliseconds timeout) {
+  bPulling = true;
+  return pullHandoff.wait(timeout);
+}
+
+std::shared_ptr<const OosVim::Frame> Grabber::tryGetFrame() {
+  bPulling = true;
+  return pullHandoff.poll();
+}
+
+// -- STATISTICS ---------------------------------------------------------------
+
+void Grabber::setImageStatistics(bool value, const OosVim::StatisticsSettings& settings) {
+  {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    statisticsEngine.setSettings(settings);
+  }
+  bImageStatistics.store(value);
+}
+
+void Grabber::setHostAutoExposure(bool value, const OosVim::ExposureSettings& settings) {
+  {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    exposureController.setSettings(settings);
+  }
+  bExposureSynced.store(false);
+  bHostAutoExposure.store(value);
+  if (value && isInitialized() && isConnected()) addAction(ActionType::Expose, getActiveDevice());
+}
+
+void Grabber::updateImageStatistics(const OosVim::Frame& frame) {
+  OOSVIM_TRACE_SCOPE("Grabber::updateImageStatistics");
+  OosVim::FrameStatistics result;
+  bool expose = false;
+  {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    if (!statisticsEngine.compute(frame, result)) return;
+    if (bHostAutoExposure && bExposureSynced && !bBracketing && exposureController.update(result)) {
+      pendingExposure.store(exposureController.getExposure());
+      pendingGain.store(exposureController.getGain());
+      expose = true;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(imageStatisticsMutex);
+    imageStatistics = result;
+  }
+  // Writing the features blocks, it is left to the action thread
+  if (expose) addAction(ActionType::Expose, getActiveDevice());
+}
+
+void Grabber::syncExposure(std::shared_ptr<OosVim::Device> device) {
+  if (!device || !device->isOpen()) return;
+  if (bReadOnly || !device->isMaster()) {
+    logger->warning("Host auto exposure needs a connection that is not read only");
+    return;
+  }
+
+  device->set("ExposureAuto", std::string("Off"));
+  device->set("GainAuto", std::string("Off"));
+
+  double exposure = 0, gain = 0;
+  device->get("ExposureTimeAbs", exposure);
+  device->get("Gain", gain);
+  double minExposure, maxExposure, minGain, maxGain;
+  bool exposureRange = device->getRange("ExposureTimeAbs", minExposure, maxExposure);
+  bool gainRange = device->getRange("Gain", minGain, maxGain);
+  {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    // Keep the controller within what the camera accepts
+    auto settings = exposureController.getSettings();
+    if (exposureRange) {
+      settings.minExposure = (std::max)(settings.minExposure, minExposure);
+      settings.maxExposure = (std::min)(settings.maxExposure, maxExposure);
+    }
+    if (gainRange) {
+      settings.minGain = (std::max)(settings.minGain, minGain);
+      settings.maxGain = (std::min)(settings.maxGain, maxGain);
+    }
+    exposureController.setSettings(settings);
+    exposureController.reset(exposure, gain);
+    pendingExposure.store(exposureController.getExposure());
+    pendingGain.store(exposureController.getGain());
+  }
+  applyExposure(device);
+  bExposureSynced.store(true);
+}
+
+void Grabber::applyExposure(std::shared_ptr<OosVim::Device> device) {
+  if (!device || !device->isOpen() || !device->isMaster()) return;
+  device->set("ExposureTimeAbs", pendingExposure.load());
+  device->set("Gain", pendingGain.load());
+}
+
+// -- BRACKETING ---------------------------------------------------------------
+
+void Grabber::setBracketing(const std::vector<double>& exposures) {
+  {
+    std::lock_guard<std::mutex> lock(bracketMutex);
+    if (exposures == bracketExposures) return;
+    bracketExposures = exposures;
+  }
+  bBracketing.store(!exposures.empty());
+  auto device = getActiveDevice();
+  if (isInitialized() && device) addAction(ActionType::Configure, device);
+}
+
+void Grabber::setHdrMerger(std::shared_ptr<OosVim::HdrMerger> value) {
+  std::lock_guard<std::mutex> lock(bracketMutex);
+  hdrMerger = value;
+}
+
+void Grabber::configureBracketing(std::shared_ptr<OosVim::Device> device) {
+  auto exposures = getBracketing();
+  bSequencer.store(false);
+
+  AVT::VmbAPI::FeaturePtr feature;
+  bool hasSequencer = device->locate("SequencerMode", feature);
+  if (hasSequencer) device->set("SequencerMode", std::string("Off"));
+  if (exposures.empty()) return;
+
+  device->set("ExposureAuto", std::string("Off"));
+
+  // One sequencer set per exposure, each set moves on to the next on every frame
+  if (hasSequencer) {
+    long long count = static_cast<long long>(exposures.size());
+    bool valid = device->set("SequencerConfigurationMode", std::string("On"));
+    for (long long i = 0; valid && i < count; i++) {
+      valid = device->set("SequencerSetSelector", i) &&
+              device->set("ExposureTimeAbs", exposures[i]) &&
+              device->set("SequencerPathSelector", 0LL) &&
+              device->set("SequencerSetNext", (i + 1) % count) &&
+              device->set("SequencerTriggerSource", std::string("FrameStart")) &&
+              device->run("SequencerSetSave");
+    }
+    valid = valid && device->set("SequencerSetStart", 0LL) &&
+            device->set("SequencerConfigurationMode", std::string("Off")) &&
+            device->set("SequencerMode", std::string("On"));
+    if (valid) {
+      bSequencer.store(true);
+      logger->notice("Bracketing " + std::to_string(count) + " exposures with the sequencer");
+      return;
+    }
+    device->set("SequencerConfigurationMode", std::string("Off"));
+    device->set("SequencerMode", std::string("Off"));
+  }
+
+  // The camera applies a new exposure a few frames later, the chunk data tells
+  // which exposure a frame actually had
+  logger->notice("Bracketing " + std::to_string(exposures.size()) + " exposures from the host");
+  nextBracket.store(0);
+  applyBracket(device);
+}
+
+void Grabber::applyBracket(std::shared_ptr<OosVim::Device> device) {
+  if (!device || !device->isOpen() || !device->isMaster()) return;
+  auto exposures = getBracketing();
+  if (exposures.empty()) return;
+  device->set("ExposureTimeAbs", exposures[nextBracket.load() % exposures.size()]);
 }
 
 // -- SET ----------------------------------------------------------------------
@@ -72,6 +266,40 @@ void Grabber::setMulticast(bool value) {
   if (isInitialized() && activeDevice) addAction(ActionType::Configure, activeDevice);
 }
 
+void Grabber::setChunkMode(bool value) {
+  if (value == bChunkMode.load()) return;
+  std::lock_guard<std::mutex> lock(deviceMutex);
+  bChunkMode.store(value);
+  if (isInitialized() && activeDevice) addAction(ActionType::Configure, activeDevice);
+}
+
+void Grabber::setLatencyMode(bool value) {
+  if (value == bLatencyMode.load()) return;
+  std::lock_guard<std::mutex> lock(deviceMutex);
+  bLatencyMode.store(value);
+  if (isInitialized() && activeDevice) addAction(ActionType::Configure, activeDevice);
+}
+
+void Grabber::setDecimation(unsigned int n) {
+  decimation.store(n > 0 ? n : 1);
+  auto currentStream = getStream();
+  if (currentStream) currentStream->setDecimation(decimation.load());
+}
+
+void Grabber::setMaxDeliveryRate(double rate) {
+  maxDeliveryRate.store(rate > 0 ? rate : 0);
+  auto currentStream = getStream();
+  if (currentStream) currentStream->setMaxRate(maxDeliveryRate.load());
+}
+
+void Grabber::setDownsample(unsigned int factor) {
+  if (factor != 1 && factor != 2 && factor != 4) {
+    logger->warning("setDownsample(): factor should be 1, 2 or 4, downsample set to 1");
+    factor = 1;
+  }
+  downsampleFactor.store(factor);
+}
+
 bool Grabber::setDesiredPixelFormat(std::string format) {
   if (format == desiredPixelFormat) return true;
   std::lock_guard<std::mutex> lock(deviceMutex);
@@ -87,20 +315,103 @@ void Grabber::setLoadUserSet(int setToLoad) {
   if (isInitialized() && activeDevice) addAction(ActionType::Configure, activeDevice);
 }
 
+void Grabber::setBufferPolicy(const OosVim::BufferPolicy& policy) {
+  std::lock_guard<std::mutex> lock(deviceMutex);
+  if (policy == bufferPolicy) return;
+  bufferPolicy = policy;
+  if (isInitialized() && activeDevice) addAction(ActionType::Configure, activeDevice);
+}
+
 void Grabber::setDesiredFrameRate(double framerate) {
   if (framerate == desiredFrameRate) return;
   desiredFrameRate.store(framerate);
   if (isInitialized() && isConnected()) setFrameRate(activeDevice, desiredFrameRate.load());
 }
 
+// -- TRIGGER ------------------------------------------------------------------
+
+void Grabber::setTriggerScheduler(std::shared_ptr<OosVim::TriggerScheduler> value) {
+  {
+    std::lock_guard<std::mutex> lock(triggerMutex);
+    if (value == triggerScheduler) return;
+    if (triggerScheduler) retiredScheduler = triggerScheduler;
+    triggerScheduler = value;
+  }
+  auto device = getActiveDevice();
+  if (isInitialized() && device) addAction(ActionType::Configure, device);
+}
+
+void Grabber::configureTrigger(std::shared_ptr<OosVim::Device> device) {
+  std::shared_ptr<OosVim::TriggerScheduler> retired;
+  std::shared_ptr<OosVim::TriggerScheduler> current;
+  {
+    std::lock_guard<std::mutex> lock(triggerMutex);
+    retired.swap(retiredScheduler);
+    current = triggerScheduler;
+  }
+  if (retired) retired->removeDevice(device);
+  if (current && !current->addDevice(device)) logger->warning("Frames are not triggered by the scheduler");
+}
+
+// -- EVENTS -------------------------------------------------------------------
+
+void Grabber::setEventChannel(std::shared_ptr<OosVim::EventChannel> value) {
+  {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    if (value == eventChannel) return;
+    if (eventChannel) retiredChannel = eventChannel;
+    eventChannel = value;
+  }
+  auto device = getActiveDevice();
+  if (isInitialized() && device) addAction(ActionType::Configure, device);
+}
+
+void Grabber::configureEvents(std::shared_ptr<OosVim::Device> device) {
+  std::shared_ptr<OosVim::EventChannel> retired;
+  std::shared_ptr<OosVim::EventChannel> current;
+  {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    retired.swap(retiredChannel);
+    current = eventChannel;
+  }
+  if (retired) retired->close();
+  if (current && !current->open(device)) logger->warning("Camera events are not available");
+}
+
+// -- THREADS ------------------------------------------------------------------
+
+void Grabber::setThreadPolicy(OosVim::ThreadRole role, const OosVim::ThreadPolicy& policy) {
+  // The action thread picks up its policy before the next action
+  if (role == OosVim::ThreadRole::Action) {
+    actionBinding.setPolicy(policy);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(threadMutex);
+    threadPolicies[role] = policy;
+  }
+  auto currentStream = getStream();
+  if (currentStream) currentStream->setThreadPolicy(role, policy);
+}
+
+std::vector<OosVim::ThreadPlacement> Grabber::getThreadPlacements() {
+  std::vector<OosVim::ThreadPlacement> placements;
+  auto currentStream = getStream();
+  if (currentStream) placements = currentStream->getThreadPlacements();
+  placements.push_back(actionBinding.getPlacement());
+  return placements;
+}
+
 // -- ACTION -------------------------------------------------------------------
 
-void Grabber::addAction(ActionType type, std::shared_ptr<OosVim::Device> device) {
+void Grabber::addAction(ActionType type, std::shared_ptr<OosVim::Device> device) const {
   auto action = Action(type, device);
   std::lock_guard<std::mutex> lock(actionMutex);
 
   if (type == ActionType::Disconnect) {
-    actionQueue.clear();
+    actionQueue.erase(std::remove_if(actionQueue.begin(), actionQueue.end(),
+                                     [](const Action& a) { return a.type != ActionType::Initialize; }),
+                      actionQueue.end());
     actionQueue.push_back(action);
     actionSignal.notify_one();
     return;
@@ -113,31 +424,53 @@ void Grabber::addAction(ActionType type, std::shared_ptr<OosVim::Device> device)
 }
 
 void Grabber::actionRunner() {
+  OOSVIM_TRACE_THREAD("Grabber");
   std::unique_lock<std::mutex> lock(actionMutex);
   while (actionsRunning.load()) {
+    actionBinding.apply();
     if (!actionQueue.empty()) {
       auto action = actionQueue.front();
       actionQueue.pop_front();
       lock.unlock();
 
+      if (action.type == ActionType::Initialize){
+        OOSVIM_TRACE_SCOPE("Grabber::initialize");
+        initialize();
+      }
+
+      if (action.type == ActionType::Enumerate){
+        OOSVIM_TRACE_SCOPE("Grabber::enumerate");
+        if (!registry->isEnumerated()) registry->enumerate();
+      }
+
       if (action.type == ActionType::Disconnect){
+        OOSVIM_TRACE_SCOPE("Grabber::disconnect");
         stopStream();
         closeDevice(action.device);
         setActiveDevice(nullptr);
-        discovery->updateTriggers();
+        if (discovery) discovery->updateTriggers();
       }
 
       if (action.type == ActionType::Connect){
-        if (openDevice(action.device)) {
-          configureDevice(action.device);
-          if (startStream(action.device)) {
-            setActiveDevice(action.device);
-          }
-          else (closeDevice(action.device));
+        OOSVIM_TRACE_SCOPE("Grabber::connect");
+        connectDevice(action.device);
+      }
+
+      if (action.type == ActionType::Expose){
+        OOSVIM_TRACE_SCOPE("Grabber::expose");
+        if (isEqualDevice(action.device, getActiveDevice()) && bHostAutoExposure){
+          if (bExposureSynced) applyExposure(action.device);
+          else syncExposure(action.device);
         }
       }
 
+      if (action.type == ActionType::Bracket){
+        OOSVIM_TRACE_SCOPE("Grabber::bracket");
+        if (isEqualDevice(action.device, getActiveDevice()) && bBracketing && !bSequencer) applyBracket(action.device);
+      }
+
       if (action.type == ActionType::Configure){
+        OOSVIM_TRACE_SCOPE("Grabber::configure");
         if (isEqualDevice(action.device, getActiveDevice())){
           stopStream();
           configureDevice(action.device);
@@ -154,6 +487,20 @@ void Grabber::actionRunner() {
   }
 }
 
+void Grabber::initialize() {
+  if (!system) system = OosVim::System::getInstance();
+
+  // Connect to a known id right away, without enumerating all cameras first
+  std::string id = getDeviceId();
+  if (id != OosVim::DISCOVERY_ANY_ID && !getActiveDevice()) {
+    auto device = registry->lookup(id);
+    if (filterDevice(device, id)) connectDevice(device);
+  }
+
+  if (!registry->isEnumerated()) registry->enumerate();
+  startDiscovery();
+}
+
 // -- DISCOVERY ----------------------------------------------------------------
 
 void Grabber::startDiscovery() {
@@ -188,14 +535,13 @@ void Grabber::discoveryCallback(std::shared_ptr<OosVim::Device> device, const Oo
     default:
       break;
   }
-  updateDeviceList();
 }
 
 void Grabber::onDiscoveryFound(std::shared_ptr<OosVim::Device> device) {
   std::shared_ptr<OosVim::Device> currentDevice = getActiveDevice();
   std::string id = getDeviceId();
   if (isEqualDevice(currentDevice, device)) {
-    logger->warning("Discovered device is already active");
+    logger->verbose("Discovered device is already active");
     return;
   }
   if (!filterDevice(device, id)) return;
@@ -266,7 +612,24 @@ bool Grabber::openDevice(std::shared_ptr<OosVim::Device> device) {
   return true;
 }
 
+bool Grabber::connectDevice(std::shared_ptr<OosVim::Device> device) {
+  if (!openDevice(device)) return false;
+
+  configureDevice(device);
+  if (startStream(device)) {
+    setActiveDevice(device);
+    return true;
+  }
+
+  closeDevice(device);
+  return false;
+}
+
 void Grabber::closeDevice(std::shared_ptr<OosVim::Device> device) {
+  auto currentScheduler = getTriggerScheduler();
+  if (currentScheduler && device) currentScheduler->removeDevice(device);
+  auto currentChannel = getEventChannel();
+  if (currentChannel) currentChannel->close();
   if (device && device->isOpen()) {
     device->close();
     if (!bReadOnly) logger->verbose("Closed connection");
@@ -276,6 +639,7 @@ void Grabber::closeDevice(std::shared_ptr<OosVim::Device> device) {
 }
 
 bool Grabber::configureDevice(std::shared_ptr<OosVim::Device> device) {
+  OOSVIM_TRACE_SCOPE("Grabber::configureDevice");
   if (bReadOnly) return true;
 
   device->run("GVSPAdjustPacketSize");
@@ -290,7 +654,8 @@ bool Grabber::configureDevice(std::shared_ptr<OosVim::Device> device) {
     device->run("UserSetLoad");
   }
 
-  //device->set("ChunkModeActive", true);
+  // Bracketed frames are tagged by the exposure in the chunk data
+  device->set("ChunkModeActive", bChunkMode.load() || bBracketing.load());
 
   auto desiredFormat = getDesiredPixelFormat();
   device->set("PixelFormat", desiredFormat);
@@ -300,6 +665,13 @@ bool Grabber::configureDevice(std::shared_ptr<OosVim::Device> device) {
   if (desiredFormat != currentPixelFormat)
     logger->notice("Desired pixel format not set, format set to " + currentPixelFormat);
 
+  // A user set can restore the camera auto exposure
+  bExposureSynced.store(false);
+  if (bHostAutoExposure) syncExposure(device);
+  configureBracketing(device);
+  configureTrigger(device);
+  configureEvents(device);
+
   setFrameRate(device, desiredFrameRate.load());
   logger->notice("Device Configured");
   return true;
@@ -322,24 +694,161 @@ bool Grabber::isEqualDevice(std::shared_ptr<OosVim::Device> dev1, std::shared_pt
 // -- STREAM -------------------------------------------------------------------
 
 bool Grabber::startStream(std::shared_ptr<OosVim::Device> device) {
-  if (stream) return true;
+  if (getStream()) return true;
 
   if (device) {
-    stream = std::make_shared<OosVim::Stream>(device);
-    std::function<void(const std::shared_ptr<OosVim::Frame>)> callback = std::bind(&Grabber::streamFrameCallBack, this, std::placeholders::_1);
-    stream->setFrameCallback(callback);
-    stream->start();
+    // Latency mode keeps the queue short and drops frames when a newer one has arrived
+    auto bufferSize = isLatencyMode() ? OosVim::STREAM_LATENCY_BUFFER_SIZE : OosVim::STREAM_DEFAULT_BUFFER_SIZE;
+    auto newStream = std::make_shared<OosVim::Stream>(device, bufferSize);
+    newStream->setBufferPolicy(getBufferPolicy());
+    newStream->setDropStale(isLatencyMode());
+    newStream->setDecimation(getDecimation());
+    newStream->setMaxRate(getMaxDeliveryRate());
+    newStream->setCorrection(getCorrection());
+    newStream->setChangeDetector(getChangeDetector());
+    {
+      std::lock_guard<std::mutex> lock(threadMutex);
+      for (auto& policy : threadPolicies) newStream->setThreadPolicy(policy.first, policy.second);
+    }
+    std::function<void(const std::shared_ptr<OosVim::Frame>)> callback = std::bind(&Grabber::receiveFrame, this, std::placeholders::_1);
+    newStream->setFrameCallback(callback);
+    newStream->start();
+    std::lock_guard<std::mutex> lock(streamMutex);
+    stream = newStream;
     return true;
   }
   return false;
 }
 
 void Grabber::stopStream() {
-  if (stream) {
-    stream->setFrameCallback();
-    stream->stop();
-    stream = nullptr;
+  std::shared_ptr<OosVim::Stream> oldStream;
+  {
+    std::lock_guard<std::mutex> lock(streamMutex);
+    oldStream.swap(stream);
+  }
+  if (oldStream) {
+    oldStream->setFrameCallback();
+    oldStream->stop();
+  }
+}
+
+std::shared_ptr<OosVim::Stream> Grabber::getStream() {
+  std::lock_guard<std::mutex> lock(streamMutex);
+  return stream;
+}
+
+std::shared_ptr<const OosVim::History> Grabber::getHistory() {
+  auto currentStream = getStream();
+  if (!currentStream) return nullptr;
+  return currentStream->getHistory();
+}
+
+OosVim::HistoryStatistics Grabber::getStatistics(size_t window) {
+  auto currentStream = getStream();
+  if (!currentStream) return OosVim::HistoryStatistics();
+  return currentStream->getStatistics(window);
+}
+
+std::shared_ptr<const OosVim::Latency> Grabber::getLatency() {
+  auto currentStream = getStream();
+  if (!currentStream) return nullptr;
+  return currentStream->getLatency();
+}
+
+void Grabber::recordPickup(uint64_t exposureTime, uint64_t arrivalTime) {
+  auto currentStream = getStream();
+  if (currentStream) currentStream->getLatency()->recordPickup(exposureTime, arrivalTime, OosVim::Stream::getHostTime());
+}
+
+void Grabber::receiveFrame(const std::shared_ptr<OosVim::Frame> frame) {
+  OOSVIM_TRACE_SCOPE("Grabber::receiveFrame");
+  auto currentPublisher = getPublisher();
+  if (currentPublisher) currentPublisher->publish(*frame);
+
+  auto currentRecorder = getRecorder();
+  if (currentRecorder) currentRecorder->record(*frame);
+
+  auto currentPreviewEncoder = getPreviewEncoder();
+  if (currentPreviewEncoder) currentPreviewEncoder->submit(*frame);
+
+  if (bPulling) {
+    auto device = frame->getDevice();
+    auto copy = pullHandoff.acquire(device);
+    copy->copyFrom(*frame);
+    pullHandoff.publish(copy);
+  }
+
+  if (bChannel) channel.push(*frame);
+
+  if (bImageStatistics || bHostAutoExposure) updateImageStatistics(*frame);
+
+  auto currentMerger = getHdrMerger();
+  if (currentMerger) currentMerger->submit(*frame);
+
+  auto currentScheduler = getTriggerScheduler();
+  if (currentScheduler) currentScheduler->recordFrame(*frame);
+
+  auto currentChannel = getEventChannel();
+  if (currentChannel) currentChannel->recordFrame(*frame);
+
+  // Writing the exposure blocks, it is left to the action thread
+  if (bBracketing && !bSequencer) {
+    nextBracket++;
+    addAction(ActionType::Bracket, getActiveDevice());
+  }
+
+  streamFrameCallBack(frame);
+}
+
+// -- SHARED MEMORY ------------------------------------------------------------
+
+void Grabber::setPublisher(std::shared_ptr<OosVim::SharedPublisher> value) {
+  std::lock_guard<std::mutex> lock(publisherMutex);
+  publisher = value;
+}
+
+// -- RECORDING ----------------------------------------------------------------
+
+void Grabber::setRecorder(std::shared_ptr<OosVim::Recorder> value) {
+  std::lock_guard<std::mutex> lock(recorderMutex);
+  recorder = value;
+}
+
+// -- PREVIEW ------------------------------------------------------------------
+
+void Grabber::setPreviewEncoder(std::shared_ptr<OosVim::PreviewEncoder> value) {
+  std::lock_guard<std::mutex> lock(previewMutex);
+  previewEncoder = value;
+}
+
+// -- CORRECTION ---------------------------------------------------------------
+
+void Grabber::setCorrection(std::shared_ptr<const OosVim::Correction> value) {
+  {
+    std::lock_guard<std::mutex> lock(correctionMutex);
+    correction = value;
+  }
+  auto currentStream = getStream();
+  if (currentStream) currentStream->setCorrection(value);
+}
+
+void Grabber::setRemapper(std::shared_ptr<OosVim::Remapper> value) {
+  std::lock_guard<std::mutex> lock(remapperMutex);
+  remapper = value;
+}
+
+void Grabber::setColorPipeline(std::shared_ptr<OosVim::ColorPipeline> value) {
+  std::lock_guard<std::mutex> lock(colorMutex);
+  colorPipeline = value;
+}
+
+void Grabber::setChangeDetector(std::shared_ptr<OosVim::ChangeDetector> value) {
+  {
+    std::lock_guard<std::mutex> lock(changeMutex);
+    changeDetector = value;
   }
+  auto currentStream = getStream();
+  if (currentStream) currentStream->setChangeDetector(value);
 }
 
 // -- FRAMERATE ----------------------------------------------------------------
@@ -364,6 +873,7 @@ void Grabber::setFrameRate(std::shared_ptr<OosVim::Device> device, double value)
     framerate.store(maxFrameRate);
     logger->notice("Desired framerate has no effect, TriggerSource is not 'FixedRate',  framerate is " + std::to_string(framerate));
     logger->notice("Framerate depends on exposure and is currently, " + std::to_string(framerate));
+    if (value < framerate) logger->notice("Use setMaxDeliveryRate() to limit the delivered frames on the host");
     return;
   }
 
@@ -389,37 +899,13 @@ Device_List_t Grabber::listDevices() const {
 }
 
 Device_List_t Grabber::getDeviceList() const {
-  std::lock_guard<std::mutex> lock(listMutex);
-  return deviceList;
-}
-
-void Grabber::updateDeviceList() {
-  std::lock_guard<std::mutex> lock(listMutex);
-  deviceList = createDeviceList();
-}
-
-Device_List_t Grabber::createDeviceList() {
-  Device_List_t videoDevices;
-  if (!system->isAvailable()) {
-    logger->error(
-        "Failed to retrieve current camera list, system is unavailable");
-    return videoDevices;
+  // Enumerating takes seconds, return what is known and enumerate on the
+  // action thread, or in the registry when the grabber is not started
+  if (!registry->isEnumerated()) {
+    if (actionsRunning.load()) addAction(ActionType::Enumerate);
+    else registry->requestEnumeration();
   }
-
-  AVT::VmbAPI::CameraPtrVector cameras;
-  auto err = system->getAPI().GetCameras(cameras);
-
-  if (err != VmbErrorSuccess) {
-    logger->error("Failed to retrieve current camera list");
-    return videoDevices;
-  }
-
-  for (auto cam : cameras) {
-    auto device = std::make_shared<OosVim::Device>(cam);
-    videoDevices.push_back(device);
-  }
-
-  return videoDevices;
+  return *registry->getSnapshot();
 }
 
 void Grabber::printDeviceList(Device_List_t dList) const {
@@ -0,0 +1,439 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Hdr.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "OosVim/Frame.h"
+#include "OosVim/Stream.h"
+#include "OosVim/Trace.h"
+#include "OosVim/Unpack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_HDR_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_HDR_NEON
+#endif
+
+using namespace OosVim;
+
+// The shortest exposure keeps a small weight, so samples that are saturated
+// in every bracket take its value
+static const float HDR_SHORTEST_BIAS = 1e-3f;
+
+// -- VECTORS ------------------------------------------------------------------
+
+// Four samples as floats
+#if defined(OOSVIM_HDR_SSE2)
+typedef __m128 Vector;
+static inline Vector splat(float value) { return _mm_set1_ps(value); }
+static inline Vector add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+static inline Vector subtract(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+static inline Vector multiply(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+static inline Vector divide(Vector a, Vector b) { return _mm_div_ps(a, b); }
+static inline Vector minimum(Vector a, Vector b) { return _mm_min_ps(a, b); }
+static inline Vector maximum(Vector a, Vector b) { return _mm_max_ps(a, b); }
+static inline Vector load8(const unsigned char* samples) {
+  int32_t value;
+  std::memcpy(&value, samples, 4);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i bytes = _mm_cvtsi32_si128(value);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+static inline Vector load16(const unsigned char* samples) {
+  __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples));
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+}
+static inline void store(Vector value, float* values) { _mm_storeu_ps(values, value); }
+static inline void storeIndices(Vector value, int32_t* values) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(values), _mm_cvttps_epi32(value));
+}
+#elif defined(OOSVIM_HDR_NEON)
+typedef float32x4_t Vector;
+static inline Vector splat(float value) { return vdupq_n_f32(value); }
+static inline Vector add(Vector a, Vector b) { return vaddq_f32(a, b); }
+static inline Vector subtract(Vector a, Vector b) { return vsubq_f32(a, b); }
+static inline Vector multiply(Vector a, Vector b) { return vmulq_f32(a, b); }
+static inline Vector divide(Vector a, Vector b) {
+  // Two Newton steps on the estimate, ARMv7 has no division
+  Vector reciprocal = vrecpeq_f32(b);
+  reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+  reciprocal = vmulq_f32(vrecpsq_f32(b, reciprocal), reciprocal);
+  return vmulq_f32(a, reciprocal);
+}
+static inline Vector minimum(Vector a, Vector b) { return vminq_f32(a, b); }
+static inline Vector maximum(Vector a, Vector b) { return vmaxq_f32(a, b); }
+static inline Vector load8(const unsigned char* samples) {
+  uint32_t value;
+  std::memcpy(&value, samples, 4);
+  uint16x8_t words = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(value)));
+  return vcvtq_f32_u32(vmovl_u16(vget_low_u16(words)));
+}
+static inline Vector load16(const unsigned char* samples) {
+  return vcvtq_f32_u32(vmovl_u16(vreinterpret_u16_u8(vld1_u8(samples))));
+}
+static inline void store(Vector value, float* values) { vst1q_f32(values, value); }
+static inline void storeIndices(Vector value, int32_t* values) { vst1q_s32(values, vcvtq_s32_f32(value)); }
+#else
+struct Vector {
+  float v[4];
+};
+static inline Vector splat(float value) { return {{value, value, value, value}}; }
+static inline Vector add(Vector a, Vector b) {
+  return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+static inline Vector subtract(Vector a, Vector b) {
+  return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+}
+static inline Vector multiply(Vector a, Vector b) {
+  return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+}
+static inline Vector divide(Vector a, Vector b) {
+  return {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}};
+}
+static inline Vector minimum(Vector a, Vector b) {
+  return {{(std::min)(a.v[0], b.v[0]), (std::min)(a.v[1], b.v[1]), (std::min)(a.v[2], b.v[2]),
+           (std::min)(a.v[3], b.v[3])}};
+}
+static inline Vector maximum(Vector a, Vector b) {
+  return {{(std::max)(a.v[0], b.v[0]), (std::max)(a.v[1], b.v[1]), (std::max)(a.v[2], b.v[2]),
+           (std::max)(a.v[3], b.v[3])}};
+}
+static inline Vector load8(const unsigned char* samples) {
+  return {{float(samples[0]), float(samples[1]), float(samples[2]), float(samples[3])}};
+}
+static inline Vector load16(const unsigned char* samples) {
+  return {{float(samples[0] | samples[1] << 8), float(samples[2] | samples[3] << 8),
+           float(samples[4] | samples[5] << 8), float(samples[6] | samples[7] << 8)}};
+}
+static inline void store(Vector value, float* values) { std::memcpy(values, value.v, sizeof(value.v)); }
+static inline void storeIndices(Vector value, int32_t* values) {
+  for (int i = 0; i < 4; i++) values[i] = static_cast<int32_t>(value.v[i]);
+}
+#endif
+
+// -- KERNEL -------------------------------------------------------------------
+
+// Weighted mean of the brackets scaled to the longest exposure. The weight
+// falls off linearly towards black and towards saturation. The radiance is
+// tone mapped with the extended Reinhard curve, with the white point at the
+// radiance of a saturated sample in the shortest exposure:
+//   x = radiance / max, t = x * (1 + x / white^2) / (1 + x)
+// which with sum and weights as a = sum / max and b = weights is
+//   t = a * (b + a / white^2) / (b * (b + a))
+template <bool wide>
+static void mergeSamples(const unsigned char* const* sources, const float* factors, const float* biases,
+                         size_t brackets, float maxValue, float white, const unsigned char* gamma, size_t begin,
+                         size_t end, unsigned char* pixels, float* radiance) {
+  const size_t bytes = wide ? 2 : 1;
+  const float scale = 1.0f / maxValue;
+  const float inverseWhite = 1.0f / (white * white);
+  const float indexScale = static_cast<float>(HDR_GAMMA_SIZE - 1);
+
+  Vector factorVectors[HDR_MAX_BRACKETS];
+  Vector biasVectors[HDR_MAX_BRACKETS];
+  for (size_t b = 0; b < brackets; b++) {
+    factorVectors[b] = splat(factors[b]);
+    biasVectors[b] = splat(biases[b]);
+  }
+  const Vector zero = splat(0);
+  const Vector top = splat(maxValue);
+  const Vector scaleVector = splat(scale);
+  const Vector inverseWhiteVector = splat(inverseWhite);
+  const Vector indexScaleVector = splat(indexScale);
+  const Vector half = splat(0.5f);
+  const Vector maxIndex = splat(indexScale);
+
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    Vector sum = zero;
+    Vector weights = zero;
+    for (size_t b = 0; b < brackets; b++) {
+      Vector sample = wide ? load16(sources[b] + i * bytes) : load8(sources[b] + i * bytes);
+      Vector weight = add(maximum(minimum(sample, subtract(top, sample)), zero), biasVectors[b]);
+      sum = add(sum, multiply(multiply(weight, sample), factorVectors[b]));
+      weights = add(weights, weight);
+    }
+    if (radiance != nullptr) store(divide(sum, weights), radiance + i);
+
+    Vector a = multiply(sum, scaleVector);
+    Vector t = divide(multiply(a, add(weights, multiply(a, inverseWhiteVector))), multiply(weights, add(weights, a)));
+    int32_t indices[4];
+    storeIndices(minimum(add(multiply(t, indexScaleVector), half), maxIndex), indices);
+    pixels[i] = gamma[indices[0]];
+    pixels[i + 1] = gamma[indices[1]];
+    pixels[i + 2] = gamma[indices[2]];
+    pixels[i + 3] = gamma[indices[3]];
+  }
+
+  for (; i < end; i++) {
+    float sum = 0;
+    float weights = 0;
+    for (size_t b = 0; b < brackets; b++) {
+      const unsigned char* source = sources[b] + i * bytes;
+      float sample = wide ? float(source[0] | source[1] << 8) : float(source[0]);
+      float weight = (std::max)((std::min)(sample, maxValue - sample), 0.0f) + biases[b];
+      sum += weight * sample * factors[b];
+      weights += weight;
+    }
+    if (radiance != nullptr) radiance[i] = sum / weights;
+
+    float a = sum * scale;
+    float t = a * (weights + a * inverseWhite) / (weights * (weights + a));
+    pixels[i] = gamma[static_cast<int32_t>((std::min)(t * indexScale + 0.5f, indexScale))];
+  }
+}
+
+// Samples per pixel, bit depth and tone mapped format of a bracketed format
+static bool getLayout(VmbPixelFormatType format, uint32_t& channels, uint32_t& bitDepth,
+                      VmbPixelFormatType& output) {
+  channels = 1;
+  bitDepth = 8;
+  output = format;
+  switch (format) {
+    case VmbPixelFormatMono8:
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+      return true;
+    case VmbPixelFormatRgb8:
+    case VmbPixelFormatBgr8:
+      channels = 3;
+      return true;
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
+      bitDepth = getUnpackBitDepth(format);
+      output = VmbPixelFormatMono8;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// -- MERGER -------------------------------------------------------------------
+
+HdrMerger::HdrMerger(const HdrSettings& _settings)
+    : logger("HDR"),
+      settings(_settings),
+      gammaTable(HDR_GAMMA_SIZE),
+      queued(false),
+      busy(false),
+      running(true),
+      mergedCount(0),
+      skipped(0),
+      incomplete(0) {
+  if (settings.exposures.size() > HDR_MAX_BRACKETS) {
+    logger.warning("Only the first " + std::to_string(HDR_MAX_BRACKETS) + " brackets are merged");
+    settings.exposures.resize(HDR_MAX_BRACKETS);
+  }
+  if (settings.exposures.size() < 2) logger.error("Bracketing needs at least two exposures, nothing is merged");
+  for (auto& exposure : settings.exposures) {
+    if (exposure <= 0) {
+      logger.error("Bracket exposures should be above 0, nothing is merged");
+      settings.exposures.clear();
+      break;
+    }
+  }
+  if (settings.span == 0) settings.span = 1;
+
+  float gamma = settings.gamma > 0 ? settings.gamma : 1;
+  for (uint32_t i = 0; i < HDR_GAMMA_SIZE; i++) {
+    double value = std::pow(double(i) / (HDR_GAMMA_SIZE - 1), 1.0 / gamma);
+    gammaTable[i] = static_cast<unsigned char>(std::lround(value * 255));
+  }
+
+  filling.resize(settings.exposures.size());
+  merging.resize(settings.exposures.size());
+  pool.reset(new WorkerPool((std::max)(settings.threads, size_t(1))));
+  thread = std::thread([this]() { run(); });
+}
+
+HdrMerger::~HdrMerger() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  signal.notify_all();
+  if (thread.joinable()) thread.join();
+  merged.interrupt();
+}
+
+void HdrMerger::setCallback(std::function<void(std::shared_ptr<const HdrFrame>)> value) {
+  std::lock_guard<std::mutex> lock(callbackMutex);
+  callback = value;
+}
+
+bool HdrMerger::isSupported(VmbPixelFormatType format) {
+  uint32_t channels, bitDepth;
+  VmbPixelFormatType output;
+  return getLayout(format, channels, bitDepth, output);
+}
+
+int HdrMerger::getBracket(const Chunk& chunk, uint64_t frameCount) const {
+  size_t brackets = settings.exposures.size();
+  if (brackets < 2) return -1;
+  if (!chunk.valid || chunk.exposure == 0) return static_cast<int>(frameCount % brackets);
+
+  int bracket = -1;
+  double closest = settings.tolerance;
+  for (size_t i = 0; i < brackets; i++) {
+    double error = std::fabs(chunk.exposure - settings.exposures[i]) / settings.exposures[i];
+    if (error <= closest) {
+      closest = error;
+      bracket = static_cast<int>(i);
+    }
+  }
+  return bracket;
+}
+
+bool HdrMerger::submit(const Frame& frame) {
+  OOSVIM_TRACE_SCOPE("HdrMerger::submit");
+  uint32_t channels, bitDepth;
+  VmbPixelFormatType output;
+  if (!getLayout(frame.getImageFormat(), channels, bitDepth, output)) return false;
+  size_t size = size_t(frame.getWidth()) * frame.getHeight() * channels * (bitDepth > 8 ? 2 : 1);
+  if (frame.getImageData() == nullptr || frame.getImageSize() < size) return false;
+
+  int bracket = getBracket(frame.getChunk(), frame.geFrameCount());
+  if (bracket < 0) return false;
+
+  // A bracket that is filled again did not complete a group
+  Slot& slot = filling[bracket];
+  if (slot.filled) incomplete++;
+  slot.data.resize(size);
+  std::memcpy(slot.data.data(), frame.getImageData(), size);
+  slot.width = frame.getWidth();
+  slot.height = frame.getHeight();
+  slot.format = frame.getImageFormat();
+  slot.frameCount = frame.geFrameCount();
+  slot.timestamp = frame.getTimestamp();
+  const Chunk& chunk = frame.getChunk();
+  slot.exposure = chunk.valid && chunk.exposure > 0 ? chunk.exposure : settings.exposures[bracket];
+  slot.filled = true;
+  if (!isComplete()) return true;
+
+  // Swapping the groups only swaps the buffers
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy) {
+      skipped++;
+    } else {
+      filling.swap(merging);
+      queued = true;
+      busy = true;
+    }
+  }
+  for (auto& empty : filling) empty.filled = false;
+  signal.notify_one();
+  return true;
+}
+
+bool HdrMerger::isComplete() const {
+  const Slot& first = filling.front();
+  uint64_t minCount = first.frameCount;
+  uint64_t maxCount = first.frameCount;
+  for (const auto& slot : filling) {
+    if (!slot.filled || slot.width != first.width || slot.height != first.height || slot.format != first.format) {
+      return false;
+    }
+    minCount = (std::min)(minCount, slot.frameCount);
+    maxCount = (std::max)(maxCount, slot.frameCount);
+  }
+  // The frames of a group do not need to be consecutive, bracketing from the
+  // host repeats an exposure until the camera takes the next one
+  return maxCount - minCount < filling.size() * settings.span;
+}
+
+void HdrMerger::run() {
+  OOSVIM_TRACE_THREAD("HDR");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    signal.wait(lock, [&] { return !running || queued; });
+    if (!running) break;
+    queued = false;
+    lock.unlock();
+
+    uint64_t start = Stream::getHostTime();
+    auto frame = merged.acquire();
+    bool valid = merge(*frame);
+    uint64_t time = Stream::getHostTime() - start;
+
+    lock.lock();
+    busy = false;
+    lock.unlock();
+
+    if (valid) {
+      frame->mergeTime = time;
+      mergeTimes.record(time);
+      mergedCount++;
+      {
+        std::lock_guard<std::mutex> callbackLock(callbackMutex);
+        if (callback) callback(frame);
+      }
+      merged.publish(frame);
+    }
+    lock.lock();
+  }
+}
+
+bool HdrMerger::merge(HdrFrame& frame) {
+  OOSVIM_TRACE_SCOPE("HdrMerger::merge");
+  const Slot* first = &merging.front();
+  uint32_t channels, bitDepth;
+  if (!getLayout(first->format, channels, bitDepth, frame.format)) return false;
+
+  double shortest = first->exposure;
+  double longest = first->exposure;
+  for (const auto& slot : merging) {
+    shortest = (std::min)(shortest, slot.exposure);
+    longest = (std::max)(longest, slot.exposure);
+    if (slot.frameCount < first->frameCount) first = &slot;
+  }
+
+  job.brackets = merging.size();
+  for (size_t b = 0; b < job.brackets; b++) {
+    job.sources[b] = merging[b].data.data();
+    job.factors[b] = static_cast<float>(longest / merging[b].exposure);
+    job.biases[b] = merging[b].exposure == shortest ? HDR_SHORTEST_BIAS : 0;
+  }
+  job.samples = size_t(first->width) * first->height * channels;
+  job.wide = bitDepth > 8;
+  job.maxValue = static_cast<float>((1u << bitDepth) - 1);
+  job.white = static_cast<float>(longest / shortest);
+  job.output = &frame;
+
+  // Resizing only allocates when the frames grow
+  frame.width = first->width;
+  frame.height = first->height;
+  frame.channels = channels;
+  frame.frameCount = first->frameCount;
+  frame.timestamp = first->timestamp;
+  frame.pixels.resize(job.samples);
+  if (settings.radiance) frame.radiance.resize(job.samples);
+  else frame.radiance.clear();
+
+  size_t bands = (job.samples + HDR_BAND_SAMPLES - 1) / HDR_BAND_SAMPLES;
+  pool->run(bands, [this](size_t band) { mergeBand(band); });
+  return true;
+}
+
+void HdrMerger::mergeBand(size_t band) {
+  size_t begin = band * HDR_BAND_SAMPLES;
+  size_t end = (std::min)(begin + HDR_BAND_SAMPLES, job.samples);
+  unsigned char* pixels = job.output->pixels.data();
+  float* radiance = job.output->radiance.empty() ? nullptr : job.output->radiance.data();
+  if (job.wide) {
+    mergeSamples<true>(job.sources, job.factors, job.biases, job.brackets, job.maxValue, job.white, gammaTable.data(),
+                       begin, end, pixels, radiance);
+  } else {
+    mergeSamples<false>(job.sources, job.factors, job.biases, job.brackets, job.maxValue, job.white,
+                        gammaTable.data(), begin, end, pixels, radiance);
+  }
+}
@@ -0,0 +1,215 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/History.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace OosVim;
+
+static const size_t HISTORY_LANES = 4;
+static const int HISTORY_READ_ATTEMPTS = 3;
+
+// A contiguous range of slots
+struct Segment {
+  size_t offset = 0;
+  size_t length = 0;
+};
+
+// Sums of the values shifted by a reference, in independent lanes without a
+// division per value, so the lanes do not wait for each other and the
+// reductions can be vectorized. The reference is the first value, which keeps
+// the sums small for long windows of nearly equal intervals. The lanes are
+// merged with the pairwise formula of Chan et al. when the statistics are read.
+struct Moments {
+  double reference = 0;
+  bool referenced = false;
+  double count[HISTORY_LANES] = {};
+  double sum[HISTORY_LANES] = {};      // of the shifted values
+  double squares[HISTORY_LANES] = {};  // of the squared shifted values
+
+  void setReference(double value) {
+    if (referenced) return;
+    reference = value;
+    referenced = true;
+  }
+
+  void add(double value, size_t lane = 0) {
+    double shifted = value - reference;
+    count[lane] += 1;
+    sum[lane] += shifted;
+    squares[lane] += shifted * shifted;
+  }
+
+  void get(double& average, double& deviation) const {
+    double n = 0, m = 0, sq = 0;
+    for (size_t lane = 0; lane < HISTORY_LANES; lane++) {
+      if (count[lane] == 0) continue;
+      double mean = sum[lane] / count[lane];
+      double laneSquares = (std::max)(squares[lane] - sum[lane] * mean, 0.0);
+      double total = n + count[lane];
+      double delta = mean - m;
+      m += delta * count[lane] / total;
+      sq += laneSquares + delta * delta * n * count[lane] / total;
+      n = total;
+    }
+    if (n == 0) return;
+    average = reference + m;
+    deviation = std::sqrt(sq / n);
+  }
+};
+
+static double getDelta(const uint64_t* values, size_t i, double scale) {
+  return static_cast<double>(static_cast<int64_t>(values[i] - values[i - 1])) * scale;
+}
+
+static void addDeltas(const uint64_t* values, size_t length, double scale, Moments& moments) {
+  if (length < 2) return;
+  moments.setReference(getDelta(values, 1, scale));
+  size_t i = 1;
+  for (; i + HISTORY_LANES <= length; i += HISTORY_LANES) {
+    for (size_t lane = 0; lane < HISTORY_LANES; lane++) moments.add(getDelta(values, i + lane, scale), lane);
+  }
+  for (; i < length; i++) moments.add(getDelta(values, i, scale));
+}
+
+static size_t countIncomplete(const int32_t* statuses, size_t length) {
+  size_t incomplete = 0;
+  for (size_t i = 0; i < length; i++) incomplete += statuses[i] != 0;
+  return incomplete;
+}
+
+History::History(size_t size) : capacity(1), count(0) {
+  while (capacity < size) capacity <<= 1;
+  mask = capacity - 1;
+
+  ids.resize(capacity);
+  cameraTimes.resize(capacity);
+  hostTimes.resize(capacity);
+  statuses.resize(capacity);
+  sizes.resize(capacity);
+  frameCounts.resize(capacity);
+  exposures.resize(capacity);
+  gains.resize(capacity);
+}
+
+void History::append(uint64_t id, uint64_t cameraTime, uint64_t hostTime, int32_t status, uint32_t size,
+                     const Chunk& chunk) {
+  uint64_t n = count.load(std::memory_order_relaxed);
+  size_t slot = getSlot(n);
+
+  ids[slot] = id;
+  cameraTimes[slot] = cameraTime;
+  hostTimes[slot] = hostTime;
+  statuses[slot] = status;
+  sizes[slot] = size;
+  frameCounts[slot] = chunk.valid ? chunk.frameCount : id;
+  exposures[slot] = chunk.exposure;
+  gains[slot] = chunk.gain;
+
+  count.store(n + 1, std::memory_order_release);
+}
+
+HistoryStatistics History::computeStatistics(size_t window, uint64_t tickFrequency) const {
+  HistoryStatistics statistics;
+
+  // Keep a margin to the oldest slots, the writer may overwrite them while we
+  // read. Retry when it did anyway. The columns are not read atomically, after
+  // the retries the statistics can still include a slot that was overwritten,
+  // so they are approximate while frames arrive.
+  uint64_t margin = capacity / 8;
+  for (int attempt = 0; attempt < HISTORY_READ_ATTEMPTS; attempt++) {
+    uint64_t end = getCount();
+    uint64_t available = (std::min)(end, static_cast<uint64_t>(capacity - margin));
+    uint64_t begin = end - (std::min)(static_cast<uint64_t>(window), available);
+
+    statistics = HistoryStatistics();
+    if (!computeWindow(begin, end, tickFrequency, statistics)) break;
+    if (getCount() - begin <= capacity) break;
+  }
+  return statistics;
+}
+
+bool History::computeWindow(uint64_t begin, uint64_t end, uint64_t tickFrequency,
+                            HistoryStatistics& statistics) const {
+  statistics.frames = static_cast<size_t>(end - begin);
+  if (statistics.frames < 2) return false;
+
+  // The window spans at most two contiguous segments
+  Segment segments[2];
+  size_t numSegments = 0;
+  for (uint64_t n = begin; n < end; numSegments++) {
+    size_t offset = getSlot(n);
+    size_t length = static_cast<size_t>((std::min)(end - n, static_cast<uint64_t>(capacity - offset)));
+    segments[numSegments].offset = offset;
+    segments[numSegments].length = length;
+    n += length;
+  }
+
+  const double hostScale = 1e-6;
+  const double cameraScale = tickFrequency > 0 ? 1e3 / tickFrequency : 0;
+
+  // Intervals
+  Moments host, camera;
+  for (size_t s = 0; s < numSegments; s++) {
+    auto& segment = segments[s];
+    addDeltas(hostTimes.data() + segment.offset, segment.length, hostScale, host);
+    addDeltas(cameraTimes.data() + segment.offset, segment.length, cameraScale, camera);
+    if (s > 0) {
+      size_t previous = segments[s - 1].offset + segments[s - 1].length - 1;
+      host.add(static_cast<int64_t>(hostTimes[segment.offset] - hostTimes[previous]) * hostScale);
+      camera.add(static_cast<int64_t>(cameraTimes[segment.offset] - cameraTimes[previous]) * cameraScale);
+    }
+  }
+  host.get(statistics.interval, statistics.jitter);
+  if (tickFrequency > 0) camera.get(statistics.cameraInterval, statistics.cameraJitter);
+
+  // Drops, missing ids and incomplete frames
+  size_t first = getSlot(begin);
+  size_t last = getSlot(end - 1);
+  size_t incomplete = 0;
+  for (size_t s = 0; s < numSegments; s++) {
+    incomplete += countIncomplete(statuses.data() + segments[s].offset, segments[s].length);
+  }
+  double expected = static_cast<double>(ids[last] - ids[first] + 1);
+  if (expected >= statistics.frames) {
+    double missing = expected - statistics.frames;
+    statistics.dropRate = (missing + incomplete) / expected;
+  }
+
+  // Latency of the host arrival against the camera clock
+  if (tickFrequency > 0) {
+    double minimum[HISTORY_LANES], maximum[HISTORY_LANES], sum[HISTORY_LANES];
+    for (size_t lane = 0; lane < HISTORY_LANES; lane++) {
+      minimum[lane] = std::numeric_limits<double>::max();
+      maximum[lane] = std::numeric_limits<double>::lowest();
+      sum[lane] = 0;
+    }
+
+    const uint64_t hostFirst = hostTimes[first];
+    const uint64_t cameraFirst = cameraTimes[first];
+    for (size_t s = 0; s < numSegments; s++) {
+      const uint64_t* hostColumn = hostTimes.data() + segments[s].offset;
+      const uint64_t* cameraColumn = cameraTimes.data() + segments[s].offset;
+      size_t length = segments[s].length;
+      for (size_t i = 0; i < length; i++) {
+        size_t lane = i % HISTORY_LANES;
+        double latency = static_cast<int64_t>(hostColumn[i] - hostFirst) * hostScale -
+                         static_cast<int64_t>(cameraColumn[i] - cameraFirst) * cameraScale;
+        minimum[lane] = (std::min)(minimum[lane], latency);
+        maximum[lane] = (std::max)(maximum[lane], latency);
+        sum[lane] += latency;
+      }
+    }
+
+    double lowest = *std::min_element(minimum, minimum + HISTORY_LANES);
+    double highest = *std::max_element(maximum, maximum + HISTORY_LANES);
+    double total = 0;
+    for (size_t lane = 0; lane < HISTORY_LANES; lane++) total += sum[lane];
+    statistics.latency = total / statistics.frames - lowest;
+    statistics.maxLatency = highest - lowest;
+  }
+
+  return true;
+}
@@ -0,0 +1,102 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Latency.h"
+
+using namespace OosVim;
+
+// -- HISTOGRAM ----------------------------------------------------------------
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+  buckets[getBucket(nanoseconds / 1000)].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t current = maximum.load(std::memory_order_relaxed);
+  while (nanoseconds > current && !maximum.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  maximum.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const {
+  uint64_t samples = getCount();
+  if (samples == 0) return 0;
+  return static_cast<double>(sum.load(std::memory_order_relaxed)) / samples;
+}
+
+uint64_t LatencyHistogram::getPercentile(double p) const {
+  uint64_t total = 0;
+  for (auto& bucket : buckets) total += bucket.load(std::memory_order_relaxed);
+  if (total == 0) return 0;
+
+  uint64_t rank = static_cast<uint64_t>(p * total + 0.5);
+  if (rank < 1) rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // Report the middle of the bucket, but never above the maximum
+      uint64_t value = (getLowerBound(i) + getWidth(i) / 2) * 1000;
+      uint64_t max = getMax();
+      return max > 0 && value > max ? max : value;
+    }
+  }
+  return getMax();
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> LatencyHistogram::getBuckets() const {
+  std::vector<std::pair<uint64_t, uint64_t>> result;
+  for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+    uint64_t samples = buckets[i].load(std::memory_order_relaxed);
+    if (samples > 0) result.emplace_back(getLowerBound(i) * 1000, samples);
+  }
+  return result;
+}
+
+size_t LatencyHistogram::getBucket(uint64_t microseconds) {
+  if (microseconds < LATENCY_SUB_BUCKETS) return static_cast<size_t>(microseconds);
+
+  size_t msb = 3;
+  while ((microseconds >> (msb + 1)) != 0) msb++;
+
+  size_t bucket = (msb - 2) * LATENCY_SUB_BUCKETS + ((microseconds >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1));
+  return bucket < LATENCY_BUCKET_COUNT ? bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+uint64_t LatencyHistogram::getLowerBound(size_t bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+  size_t msb = bucket / LATENCY_SUB_BUCKETS + 2;
+  return (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (msb - 3);
+}
+
+uint64_t LatencyHistogram::getWidth(size_t bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) return 1;
+  return uint64_t(1) << (bucket / LATENCY_SUB_BUCKETS - 1);
+}
+
+// -- LATENCY ------------------------------------------------------------------
+
+void Latency::recordDelivery(uint64_t exposureTime, uint64_t arrivalTime, uint64_t callbackTime) {
+  record(LatencyStage::Transfer, exposureTime, arrivalTime);
+  record(LatencyStage::Callback, arrivalTime, callbackTime);
+}
+
+void Latency::recordPickup(uint64_t exposureTime, uint64_t arrivalTime, uint64_t pickupTime) {
+  record(LatencyStage::Pickup, arrivalTime, pickupTime);
+  record(LatencyStage::Total, exposureTime, pickupTime);
+}
+
+void Latency::reset() {
+  for (auto& histogram : histograms) histogram.reset();
+}
+
+void Latency::record(LatencyStage stage, uint64_t from, uint64_t to) {
+  if (from == 0 || to < from) return;
+  histograms[static_cast<size_t>(stage)].record(to - from);
+}
@@ -0,0 +1,266 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Preview.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "OosVim/Downsample.h"
+#include "OosVim/Frame.h"
+#include "OosVim/Stream.h"
+#include "OosVim/Trace.h"
+
+#if defined(OOSVIM_TURBOJPEG)
+#include <turbojpeg.h>
+#endif
+
+#if defined(OOSVIM_PNG)
+#include <png.h>
+#endif
+
+using namespace OosVim;
+
+bool OosVim::isPreviewCodecAvailable(PreviewCodec codec) {
+  switch (codec) {
+#if defined(OOSVIM_TURBOJPEG)
+    case PreviewCodec::Jpeg:
+      return true;
+#endif
+#if defined(OOSVIM_PNG)
+    case PreviewCodec::Png:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+PreviewEncoder::PreviewEncoder(const PreviewSettings& _settings)
+    : logger("Preview"),
+      settings(_settings),
+      available(isPreviewCodecAvailable(_settings.codec)),
+      running(true),
+      nextPreviewAt(0),
+      encoded(0),
+      skipped(0),
+      limited(0),
+      depth(0) {
+  if (!available) {
+    logger.error("Codec not available in this build, no previews are encoded");
+    return;
+  }
+
+  settings.workers = (std::max)(settings.workers, size_t(1));
+  settings.maxWidth = (std::max)(settings.maxWidth, 1u);
+  jobs.resize(settings.workers);
+  for (size_t i = 0; i < settings.workers; i++) workers.emplace_back([this]() { encode(); });
+}
+
+PreviewEncoder::~PreviewEncoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  signal.notify_all();
+  for (auto& worker : workers) {
+    if (worker.joinable()) worker.join();
+  }
+  previews.interrupt();
+}
+
+void PreviewEncoder::setCallback(std::function<void(std::shared_ptr<const Preview>)> value) {
+  std::lock_guard<std::mutex> lock(callbackMutex);
+  callback = value;
+}
+
+bool PreviewEncoder::submit(const Frame& frame) {
+  OOSVIM_TRACE_SCOPE("PreviewEncoder::submit");
+  if (!available) return false;
+
+  uint32_t channels = getDownsampleChannels(frame.getImageFormat());
+  if (channels == 0 || frame.getImageData() == nullptr ||
+      frame.getImageSize() < size_t(frame.getWidth()) * frame.getHeight() * channels) {
+    skipped++;
+    return false;
+  }
+
+  // Keep the schedule, like the delivery rate of the stream
+  uint64_t now = Stream::getHostTime();
+  uint64_t interval = settings.rate > 0 ? static_cast<uint64_t>(1e9 / settings.rate) : 0;
+  if (interval > 0 && now + interval / 8 < nextPreviewAt) {
+    limited++;
+    return false;
+  }
+
+  Job* job = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& candidate : jobs) {
+      if (!candidate.queued && !candidate.busy) {
+        job = &candidate;
+        job->busy = true;
+        break;
+      }
+    }
+  }
+  if (job == nullptr) {
+    skipped++;
+    return false;
+  }
+  if (interval > 0) nextPreviewAt = now > nextPreviewAt + interval ? now + interval : nextPreviewAt + interval;
+
+  uint32_t factor = 1;
+  while (frame.getWidth() / factor > settings.maxWidth && factor < PREVIEW_MAX_FACTOR) factor *= 2;
+
+  // Box filter in steps of at most 4, the first step reads the frame once
+  const unsigned char* source = frame.getImageData();
+  uint32_t width = frame.getWidth();
+  uint32_t height = frame.getHeight();
+  if (factor == 1) {
+    job->pixels.resize(size_t(width) * height * channels);
+    std::memcpy(job->pixels.data(), source, job->pixels.size());
+  }
+  while (factor > 1) {
+    uint32_t step = (std::min)(factor, 4u);
+    uint32_t stepWidth = width / step;
+    uint32_t stepHeight = height / step;
+    auto& target = source == frame.getImageData() ? job->pixels : job->scratch;
+    target.resize(size_t(stepWidth) * stepHeight * channels);
+    downsample(source, width, height, channels, step, target.data());
+    if (&target == &job->scratch) job->pixels.swap(job->scratch);
+    source = job->pixels.data();
+    width = stepWidth;
+    height = stepHeight;
+    factor /= step;
+  }
+
+  job->width = width;
+  job->height = height;
+  job->channels = channels;
+  job->format = frame.getImageFormat();
+  job->id = frame.getId();
+  job->timestamp = frame.getTimestamp();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job->busy = false;
+    job->queued = true;
+    depth++;
+  }
+  signal.notify_one();
+  return true;
+}
+
+void PreviewEncoder::encode() {
+  void* compressor = nullptr;
+#if defined(OOSVIM_TURBOJPEG)
+  if (settings.codec == PreviewCodec::Jpeg) compressor = tjInitCompress();
+#endif
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    Job* job = nullptr;
+    signal.wait(lock, [&] {
+      if (!running) return true;
+      for (auto& candidate : jobs) {
+        if (candidate.queued) {
+          job = &candidate;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (!running) break;
+
+    job->queued = false;
+    job->busy = true;
+    lock.unlock();
+
+    uint64_t start = Stream::getHostTime();
+    auto preview = previews.acquire();
+    bool valid = encode(*job, compressor, *preview);
+    uint64_t time = Stream::getHostTime() - start;
+
+    lock.lock();
+    job->busy = false;
+    depth--;
+    lock.unlock();
+
+    if (valid) {
+      preview->encodeTime = time;
+      encodeTimes.record(time);
+      encoded++;
+      {
+        std::lock_guard<std::mutex> callbackLock(callbackMutex);
+        if (callback) callback(preview);
+      }
+      previews.publish(preview);
+    }
+    lock.lock();
+  }
+
+#if defined(OOSVIM_TURBOJPEG)
+  if (compressor != nullptr) tjDestroy(compressor);
+#endif
+}
+
+bool PreviewEncoder::encode(const Job& job, void* compressor, Preview& preview) {
+  OOSVIM_TRACE_SCOPE("PreviewEncoder::encode");
+  preview.codec = settings.codec;
+  preview.width = job.width;
+  preview.height = job.height;
+  preview.id = job.id;
+  preview.timestamp = job.timestamp;
+  if (job.width == 0 || job.height == 0) return false;
+
+#if defined(OOSVIM_TURBOJPEG)
+  if (settings.codec == PreviewCodec::Jpeg) {
+    if (compressor == nullptr) return false;
+    int pixelFormat = job.format == VmbPixelFormatRgb8    ? TJPF_RGB
+                      : job.format == VmbPixelFormatBgr8  ? TJPF_BGR
+                      : job.format == VmbPixelFormatRgba8 ? TJPF_RGBA
+                      : job.format == VmbPixelFormatBgra8 ? TJPF_BGRA
+                                                          : TJPF_GRAY;
+    int subsampling = job.channels == 1 ? TJSAMP_GRAY : TJSAMP_420;
+
+    // Compress into the recycled buffer, without reallocating it
+    unsigned long size = tjBufSize(job.width, job.height, subsampling);
+    preview.data.resize(size);
+    unsigned char* data = preview.data.data();
+    int quality = (std::min)((std::max)(settings.quality, 1), 100);
+    if (tjCompress2(compressor, job.pixels.data(), job.width, 0, job.height, pixelFormat, &data, &size,
+                    subsampling, quality, TJFLAG_NOREALLOC | TJFLAG_FASTDCT) != 0) {
+      logger.warning(std::string("Failed to encode JPEG, ") + tjGetErrorStr2(compressor));
+      return false;
+    }
+    preview.data.resize(size);
+    return true;
+  }
+#endif
+
+#if defined(OOSVIM_PNG)
+  if (settings.codec == PreviewCodec::Png) {
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = job.width;
+    image.height = job.height;
+    image.format = job.format == VmbPixelFormatRgb8    ? PNG_FORMAT_RGB
+                   : job.format == VmbPixelFormatBgr8  ? PNG_FORMAT_BGR
+                   : job.format == VmbPixelFormatRgba8 ? PNG_FORMAT_RGBA
+                   : job.format == VmbPixelFormatBgra8 ? PNG_FORMAT_BGRA
+                                                       : PNG_FORMAT_GRAY;
+
+    png_alloc_size_t size = PNG_IMAGE_PNG_SIZE_MAX(image);
+    preview.data.resize(size);
+    bool valid = png_image_write_to_memory(&image, preview.data.data(), &size, 0, job.pixels.data(), 0, nullptr) != 0;
+    if (!valid) logger.warning(std::string("Failed to encode PNG, ") + image.message);
+    png_image_free(&image);
+    preview.data.resize(valid ? size : 0);
+    return valid;
+  }
+#endif
+
+  (void)compressor;
+  return false;
+}
@@ -0,0 +1,458 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "OosVim/Frame.h"
+
+#if defined(OOSVIM_LZ4)
+#include <lz4.h>
+#endif
+
+#if defined(OOSVIM_ZSTD)
+#include <zstd.h>
+#endif
+
+using namespace OosVim;
+
+bool OosVim::isRecordCodecAvailable(RecordCodec codec) {
+  switch (codec) {
+    case RecordCodec::None:
+      return true;
+#if defined(OOSVIM_LZ4)
+    case RecordCodec::Lz4:
+      return true;
+#endif
+#if defined(OOSVIM_ZSTD)
+    case RecordCodec::Zstd:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+// -- FILTER -------------------------------------------------------------------
+
+// Distance to the previous value of the same color, 0 when not filtered
+static uint32_t getFilterSpacing(uint32_t format, uint32_t& bytes) {
+  switch (format) {
+    case VmbPixelFormatMono8:
+      bytes = 1;
+      return 1;
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+      bytes = 1;
+      return 2;
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
+      bytes = 2;
+      return 1;
+    default:
+      bytes = 0;
+      return 0;
+  }
+}
+
+// Replace every value by the difference with its left neighbour of the same
+// color. 16 bit differences are split into a plane of low and a plane of high
+// bytes, the high bytes of small differences compress to almost nothing.
+static bool filter(const unsigned char* source, uint32_t width, uint32_t height, uint32_t format,
+                   unsigned char* destination) {
+  uint32_t bytes;
+  uint32_t spacing = getFilterSpacing(format, bytes);
+  if (spacing == 0 || width <= spacing) return false;
+
+  if (bytes == 1) {
+    for (uint32_t y = 0; y < height; y++) {
+      const unsigned char* row = source + size_t(y) * width;
+      unsigned char* out = destination + size_t(y) * width;
+      for (uint32_t x = 0; x < spacing; x++) out[x] = row[x];
+      for (uint32_t x = spacing; x < width; x++) out[x] = static_cast<unsigned char>(row[x] - row[x - spacing]);
+    }
+    return true;
+  }
+
+  const size_t count = size_t(width) * height;
+  unsigned char* low = destination;
+  unsigned char* high = destination + count;
+  for (uint32_t y = 0; y < height; y++) {
+    const uint16_t* row = reinterpret_cast<const uint16_t*>(source) + size_t(y) * width;
+    size_t start = size_t(y) * width;
+    for (uint32_t x = 0; x < width; x++) {
+      uint16_t delta = x < spacing ? row[x] : static_cast<uint16_t>(row[x] - row[x - spacing]);
+      low[start + x] = static_cast<unsigned char>(delta);
+      high[start + x] = static_cast<unsigned char>(delta >> 8);
+    }
+  }
+  return true;
+}
+
+static bool unfilter(const unsigned char* source, uint32_t width, uint32_t height, uint32_t format,
+                     unsigned char* destination) {
+  uint32_t bytes;
+  uint32_t spacing = getFilterSpacing(format, bytes);
+  if (spacing == 0 || width <= spacing) return false;
+
+  if (bytes == 1) {
+    for (uint32_t y = 0; y < height; y++) {
+      const unsigned char* row = source + size_t(y) * width;
+      unsigned char* out = destination + size_t(y) * width;
+      for (uint32_t x = 0; x < spacing; x++) out[x] = row[x];
+      for (uint32_t x = spacing; x < width; x++) out[x] = static_cast<unsigned char>(row[x] + out[x - spacing]);
+    }
+    return true;
+  }
+
+  const size_t count = size_t(width) * height;
+  const unsigned char* low = source;
+  const unsigned char* high = source + count;
+  for (uint32_t y = 0; y < height; y++) {
+    uint16_t* out = reinterpret_cast<uint16_t*>(destination) + size_t(y) * width;
+    size_t start = size_t(y) * width;
+    for (uint32_t x = 0; x < width; x++) {
+      uint16_t delta = static_cast<uint16_t>(low[start + x] | (high[start + x] << 8));
+      out[x] = x < spacing ? delta : static_cast<uint16_t>(delta + out[x - spacing]);
+    }
+  }
+  return true;
+}
+
+static bool isFilterable(uint32_t format, uint32_t width, uint32_t height, uint32_t size) {
+  uint32_t bytes;
+  uint32_t spacing = getFilterSpacing(format, bytes);
+  return spacing > 0 && width > spacing && size == size_t(width) * height * bytes;
+}
+
+// -- RECORDER -----------------------------------------------------------------
+
+Recorder::Recorder(const std::string& path, const RecordSettings& _settings)
+    : logger("Recorder"),
+      settings(_settings),
+      offset(0),
+      submitted(0),
+      claimed(0),
+      written(0),
+      closing(false),
+      bOpen(false),
+      recorded(0),
+      dropped(0),
+      failed(0),
+      rawBytes(0),
+      storedBytes(0) {
+  logger.setScope(path);
+
+  if (!isRecordCodecAvailable(settings.codec)) {
+    logger.warning("Codec not available in this build, storing frames uncompressed");
+    settings.codec = RecordCodec::None;
+  }
+  settings.workers = (std::max)(settings.workers, size_t(1));
+  settings.queueSize = (std::max)(settings.queueSize, settings.workers);
+
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    logger.error("Failed to open file");
+    return;
+  }
+
+  RecordFileHeader header = {RECORD_MAGIC, RECORD_VERSION};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  offset = sizeof(header);
+  index.reserve(4096);
+
+  jobs.resize(settings.queueSize);
+  for (size_t i = 0; i < settings.workers; i++) workers.emplace_back(&Recorder::compress, this);
+  writer = std::thread(&Recorder::write, this);
+  bOpen = true;
+}
+
+Recorder::~Recorder() { close(); }
+
+bool Recorder::record(const Frame& frame) {
+  return record(frame.getImageData(), frame.getImageSize(), frame.getWidth(), frame.getHeight(),
+                frame.getImageFormat(), frame.getId(), frame.getTimestamp(), frame.geFrameCount());
+}
+
+bool Recorder::record(const unsigned char* data, uint32_t size, uint32_t width, uint32_t height, uint32_t format,
+                      uint64_t id, uint64_t timestamp, uint64_t frameCount) {
+  if (data == nullptr || !bOpen) return false;
+
+  Job* job;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closing) return false;
+
+    // Backpressure, the workers or the disk fall behind
+    if (submitted - written >= jobs.size()) {
+      if (settings.overflow == RecordOverflow::Drop) {
+        if (dropped++ == 0) logger.warning("Recording falls behind, dropping frames");
+        return false;
+      }
+      freeSignal.wait(lock, [&] { return submitted - written < jobs.size() || closing; });
+      if (closing) return false;
+    }
+    job = &jobs[submitted % jobs.size()];
+  }
+
+  // The slot is free until it is submitted, only this thread submits
+  job->header = {RECORD_FRAME_MAGIC, 0, 0, format, width, height, id, timestamp, frameCount, size, 0};
+  job->raw.resize(size);
+  std::memcpy(job->raw.data(), data, size);
+  job->done = false;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closing) return false;
+    submitted++;
+  }
+  workSignal.notify_one();
+  return true;
+}
+
+void Recorder::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closing) return;
+    closing = true;
+  }
+  workSignal.notify_all();
+  freeSignal.notify_all();
+  doneSignal.notify_all();
+
+  for (auto& worker : workers) {
+    if (worker.joinable()) worker.join();
+  }
+  if (writer.joinable()) writer.join();
+
+  if (!file.is_open()) return;
+
+  RecordTrailer trailer = {offset, index.size(), RECORD_INDEX_MAGIC, RECORD_VERSION};
+  file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(RecordIndexEntry));
+  file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+  file.close();
+  bOpen = false;
+
+  logger.notice("Recorded " + std::to_string(recorded.load()) + " frames, dropped " +
+                std::to_string(dropped.load()) + ", failed " + std::to_string(failed.load()) + ", ratio " +
+                std::to_string(getRatio()));
+}
+
+double Recorder::getRatio() const {
+  uint64_t stored = storedBytes.load();
+  return stored > 0 ? double(rawBytes.load()) / stored : 0;
+}
+
+void Recorder::compress() {
+  std::vector<unsigned char> scratch;
+#if defined(OOSVIM_ZSTD)
+  ZSTD_CCtx* context = settings.codec == RecordCodec::Zstd ? ZSTD_createCCtx() : nullptr;
+#endif
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    workSignal.wait(lock, [&] { return claimed < submitted || closing; });
+    if (claimed >= submitted) break;
+    Job& job = jobs[claimed++ % jobs.size()];
+    lock.unlock();
+
+    RecordFrameHeader& header = job.header;
+    const unsigned char* input = job.raw.data();
+    size_t stored = 0;
+
+    if (settings.codec != RecordCodec::None) {
+      if (settings.filter && isFilterable(header.format, header.width, header.height, header.rawSize)) {
+        scratch.resize(header.rawSize);
+        filter(job.raw.data(), header.width, header.height, header.format, scratch.data());
+        input = scratch.data();
+        header.filtered = 1;
+      }
+#if defined(OOSVIM_LZ4)
+      if (settings.codec == RecordCodec::Lz4) {
+        int bound = LZ4_compressBound(static_cast<int>(header.rawSize));
+        job.stored.resize(bound);
+        int size = LZ4_compress_fast(reinterpret_cast<const char*>(input), reinterpret_cast<char*>(job.stored.data()),
+                                     static_cast<int>(header.rawSize), bound, (std::max)(settings.level, 1));
+        stored = size > 0 ? static_cast<size_t>(size) : 0;
+      }
+#endif
+#if defined(OOSVIM_ZSTD)
+      if (settings.codec == RecordCodec::Zstd && context != nullptr) {
+        size_t bound = ZSTD_compressBound(header.rawSize);
+        job.stored.resize(bound);
+        size_t size = ZSTD_compressCCtx(context, job.stored.data(), bound, input, header.rawSize, settings.level);
+        stored = ZSTD_isError(size) ? 0 : size;
+      }
+#endif
+    }
+    (void)input;
+
+    // Frames that do not compress are stored as they are
+    if (stored == 0 || stored >= header.rawSize) {
+      header.codec = static_cast<uint32_t>(RecordCodec::None);
+      header.filtered = 0;
+      header.storedSize = header.rawSize;
+    } else {
+      header.codec = static_cast<uint32_t>(settings.codec);
+      header.storedSize = static_cast<uint32_t>(stored);
+    }
+
+    lock.lock();
+    job.done = true;
+    doneSignal.notify_all();
+  }
+
+#if defined(OOSVIM_ZSTD)
+  if (context != nullptr) ZSTD_freeCCtx(context);
+#endif
+}
+
+void Recorder::write() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    doneSignal.wait(lock, [&] {
+      return (written < submitted && jobs[written % jobs.size()].done) || (closing && written == submitted);
+    });
+    if (written == submitted) break;
+    Job& job = jobs[written % jobs.size()];
+    lock.unlock();
+
+    const RecordFrameHeader& header = job.header;
+    const unsigned char* data = header.codec == static_cast<uint32_t>(RecordCodec::None) ? job.raw.data()
+                                                                                          : job.stored.data();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data), header.storedSize);
+
+    if (file.good()) {
+      index.push_back({offset, header.id, header.timestamp});
+      offset += sizeof(header) + header.storedSize;
+      recorded++;
+      rawBytes += header.rawSize;
+      storedBytes += header.storedSize;
+    } else if (failed++ == 0) {
+      logger.error("Failed to write frame, dropping frames");
+    }
+
+    lock.lock();
+    written++;
+    freeSignal.notify_one();
+  }
+}
+
+// -- READER -------------------------------------------------------------------
+
+RecordReader::RecordReader(const std::string& path) : logger("RecordReader") {
+  logger.setScope(path);
+  file.open(path, std::ios::binary);
+  if (!file.is_open()) {
+    logger.error("Failed to open file");
+    return;
+  }
+
+  RecordFileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != RECORD_MAGIC ||
+      header.version != RECORD_VERSION) {
+    logger.error("Not a recording");
+    file.close();
+    return;
+  }
+
+  if (!readIndex()) {
+    rebuildIndex();
+    logger.notice("Recording was not closed, index rebuilt from " + std::to_string(index.size()) + " frames");
+  }
+}
+
+bool RecordReader::readIndex() {
+  file.clear();
+  file.seekg(0, std::ios::end);
+  uint64_t length = static_cast<uint64_t>(file.tellg());
+  if (length < sizeof(RecordFileHeader) + sizeof(RecordTrailer)) return false;
+
+  RecordTrailer trailer;
+  file.seekg(static_cast<std::streamoff>(length - sizeof(trailer)));
+  if (!file.read(reinterpret_cast<char*>(&trailer), sizeof(trailer))) return false;
+  if (trailer.magic != RECORD_INDEX_MAGIC || trailer.version != RECORD_VERSION) return false;
+  if (trailer.indexOffset + trailer.count * sizeof(RecordIndexEntry) + sizeof(trailer) != length) return false;
+
+  index.resize(trailer.count);
+  file.seekg(static_cast<std::streamoff>(trailer.indexOffset));
+  return static_cast<bool>(file.read(reinterpret_cast<char*>(index.data()), trailer.count * sizeof(RecordIndexEntry)));
+}
+
+void RecordReader::rebuildIndex() {
+  index.clear();
+  file.clear();
+  file.seekg(0, std::ios::end);
+  uint64_t length = static_cast<uint64_t>(file.tellg());
+  uint64_t position = sizeof(RecordFileHeader);
+
+  // Stops at the first incomplete frame
+  RecordFrameHeader header;
+  while (position + sizeof(header) <= length) {
+    file.seekg(static_cast<std::streamoff>(position));
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != RECORD_FRAME_MAGIC) break;
+    if (position + sizeof(header) + header.storedSize > length) break;
+    index.push_back({position, header.id, header.timestamp});
+    position += sizeof(header) + header.storedSize;
+  }
+  file.clear();
+}
+
+size_t RecordReader::find(uint64_t timestamp) const {
+  auto it = std::lower_bound(index.begin(), index.end(), timestamp,
+                             [](const RecordIndexEntry& entry, uint64_t value) { return entry.timestamp < value; });
+  return static_cast<size_t>(it - index.begin());
+}
+
+bool RecordReader::read(size_t position, RecordFrameHeader& header, std::vector<unsigned char>& data) {
+  if (!isOpen() || position >= index.size()) return false;
+
+  file.clear();
+  file.seekg(static_cast<std::streamoff>(index[position].offset));
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != RECORD_FRAME_MAGIC) return false;
+
+  RecordCodec codec = static_cast<RecordCodec>(header.codec);
+  if (codec == RecordCodec::None) {
+    data.resize(header.rawSize);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), header.rawSize));
+  }
+
+  if (!isRecordCodecAvailable(codec)) {
+    logger.error("Frame is compressed with a codec that is not available in this build");
+    return false;
+  }
+
+  stored.resize(header.storedSize);
+  if (!file.read(reinterpret_cast<char*>(stored.data()), header.storedSize)) return false;
+
+  // Filtered frames decompress into a scratch buffer first
+  std::vector<unsigned char>& target = header.filtered ? filtered : data;
+  target.resize(header.rawSize);
+  bool valid = false;
+#if defined(OOSVIM_LZ4)
+  if (codec == RecordCodec::Lz4) {
+    int size = LZ4_decompress_safe(reinterpret_cast<const char*>(stored.data()), reinterpret_cast<char*>(target.data()),
+                                   static_cast<int>(header.storedSize), static_cast<int>(header.rawSize));
+    valid = size == static_cast<int>(header.rawSize);
+  }
+#endif
+#if defined(OOSVIM_ZSTD)
+  if (codec == RecordCodec::Zstd) {
+    size_t size = ZSTD_decompress(target.data(), header.rawSize, stored.data(), header.storedSize);
+    valid = !ZSTD_isError(size) && size == header.rawSize;
+  }
+#endif
+  if (!valid) return false;
+
+  if (header.filtered) {
+    data.resize(header.rawSize);
+    return unfilter(filtered.data(), header.width, header.height, header.format, data.data());
+  }
+  return true;
+}
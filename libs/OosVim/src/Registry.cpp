@@ -0,0 +1,248 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Registry.h"
+
+#include <chrono>
+#include <exception>
+
+using namespace OosVim;
+
+static uint64_t getMilliseconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+Registry::Registry()
+    : logger("Registry"),
+      system(nullptr),
+      enumerating(false),
+      snapshot(std::make_shared<const Device_List_t>()),
+      enumerated(false),
+      scanning(false) {}
+
+Registry::~Registry() {
+  std::lock_guard<std::mutex> lock(enumeratorMutex);
+  if (enumerator.joinable()) enumerator.join();
+}
+
+bool Registry::enumerate() {
+  std::lock_guard<std::mutex> enumerateLock(enumerateMutex);
+
+  auto sys = getSystem();
+  if (!sys->isAvailable()) {
+    logger.error("Failed to retrieve current camera list, system is unavailable");
+    return false;
+  }
+
+  AVT::VmbAPI::CameraPtrVector cameras;
+  auto error = sys->getAPI().GetCameras(cameras);
+  if (error != VmbErrorSuccess) {
+    logger.error("Failed to retrieve current camera list", error);
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    scanning = true;
+    plugged.clear();
+  }
+
+  std::map<std::string, std::shared_ptr<Device>> next;
+  std::vector<std::pair<std::string, std::future<std::shared_ptr<Device>>>> inspections;
+  size_t inspected = 0;
+  for (auto& camera : cameras) {
+    std::string id;
+    if (!readId(camera, id)) continue;
+
+    // Reuse the device when we already know the camera
+    auto device = find(id);
+    if (device && SP_ISEQUAL(device->getHandle(), camera)) {
+      next[id] = device;
+      continue;
+    }
+
+    // Inspection takes several transactions per camera, run a few in parallel
+    if (inspections.size() - inspected >= REGISTRY_MAX_INSPECTIONS) {
+      next[inspections[inspected].first] = inspections[inspected].second.get();
+      inspected++;
+    }
+    inspections.emplace_back(id, std::async(std::launch::async, [camera]() {
+      return std::make_shared<Device>(camera);
+    }));
+  }
+
+  for (; inspected < inspections.size(); inspected++) {
+    next[inspections[inspected].first] = inspections[inspected].second.get();
+  }
+
+  // Merge instead of replacing, the plug events during the enumeration are
+  // newer than what the enumeration saw
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& entry : next) {
+    if (plugged.count(entry.first)) continue;
+    auto& registered = devices[entry.first];
+    if (!registered || !SP_ISEQUAL(registered->getHandle(), entry.second->getHandle())) registered = entry.second;
+  }
+  for (auto it = devices.begin(); it != devices.end();) {
+    auto event = plugged.find(it->first);
+    bool keep = next.count(it->first) ? event == plugged.end() || event->second : event != plugged.end() && event->second;
+    if (keep) ++it;
+    else it = devices.erase(it);
+  }
+  scanning = false;
+  plugged.clear();
+  publish();
+  enumerated = true;
+  logger.verbose("Enumerated " + std::to_string(devices.size()) + " devices, inspected " +
+                 std::to_string(inspections.size()));
+  return true;
+}
+
+void Registry::requestEnumeration() {
+  std::lock_guard<std::mutex> lock(enumeratorMutex);
+  if (enumerated.load() || enumerating.load()) return;
+  if (enumerator.joinable()) enumerator.join();
+  enumerating = true;
+  enumerator = std::thread([this]() {
+    enumerate();
+    enumerating = false;
+  });
+}
+
+std::shared_ptr<Device> Registry::pluggedIn(AVT::VmbAPI::CameraPtr camera) {
+  std::string id;
+  if (!readId(camera, id)) return nullptr;
+
+  auto device = find(id);
+  if (device && SP_ISEQUAL(device->getHandle(), camera)) {
+    // The other observers of the same event reuse the refresh
+    uint64_t now = getMilliseconds();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      touch(id, true);
+      auto& refreshed = refreshedAt[id];
+      if (now - refreshed < REGISTRY_EVENT_WINDOW) return device;
+      refreshed = now;
+    }
+    device->refresh();
+    return device;
+  }
+
+  return insert(camera, id);
+}
+
+std::shared_ptr<Device> Registry::pluggedOut(AVT::VmbAPI::CameraPtr camera) {
+  std::string id;
+  if (!readId(camera, id)) return nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  touch(id, false);
+  refreshedAt.erase(id);
+  auto it = devices.find(id);
+  if (it == devices.end()) return nullptr;
+
+  auto device = it->second;
+  devices.erase(it);
+  publish();
+  return device;
+}
+
+std::shared_ptr<Device> Registry::stateChanged(AVT::VmbAPI::CameraPtr camera) {
+  // A state change of an unknown camera is handled as a new camera
+  return pluggedIn(camera);
+}
+
+std::shared_ptr<Device> Registry::find(const std::string& id) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = devices.find(id);
+  if (it == devices.end()) return nullptr;
+  return it->second;
+}
+
+std::shared_ptr<Device> Registry::lookup(const std::string& id) {
+  auto device = find(id);
+  if (device) return device;
+
+  auto sys = getSystem();
+  if (!sys->isAvailable()) {
+    logger.error("Failed to look up camera, system is unavailable");
+    return nullptr;
+  }
+
+  AVT::VmbAPI::CameraPtr camera;
+  auto error = sys->getAPI().GetCameraByID(id.c_str(), camera);
+  if (error != VmbErrorSuccess) {
+    logger.verbose("Camera " + id + " not found", error);
+    return nullptr;
+  }
+
+  return insert(camera, id);
+}
+
+std::shared_ptr<const Device_List_t> Registry::getSnapshot() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return snapshot;
+}
+
+std::shared_ptr<Device> Registry::insert(AVT::VmbAPI::CameraPtr camera, const std::string& id) {
+  // Observers of the same event wait for the inspection that is in progress
+  std::promise<std::shared_ptr<Device>> promise;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = inspecting.find(id);
+    if (it != inspecting.end()) {
+      auto future = it->second;
+      lock.unlock();
+      return future.get();
+    }
+    inspecting[id] = promise.get_future().share();
+  }
+
+  // Inspect the camera outside of the lock, this requires several
+  // transactions. A failure reaches the waiting observers as well and the next
+  // attempt inspects again.
+  std::shared_ptr<Device> device;
+  try {
+    device = std::make_shared<Device>(camera);
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    std::lock_guard<std::mutex> lock(mutex);
+    inspecting.erase(id);
+    throw;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  touch(id, true);
+  refreshedAt[id] = getMilliseconds();
+  auto& registered = devices[id];
+  if (!registered || !SP_ISEQUAL(registered->getHandle(), camera)) {
+    registered = device;
+    publish();
+    logger.verbose("Registered device " + id);
+  }
+  promise.set_value(registered);
+  inspecting.erase(id);
+  return registered;
+}
+
+std::shared_ptr<System> Registry::getSystem() {
+  std::lock_guard<std::mutex> lock(systemMutex);
+  if (!system) system = System::getInstance();
+  return system;
+}
+
+void Registry::publish() {
+  auto list = std::make_shared<Device_List_t>();
+  list->reserve(devices.size());
+  for (auto& entry : devices) list->push_back(entry.second);
+  snapshot = list;
+}
+
+void Registry::touch(const std::string& id, bool pluggedIn) {
+  if (scanning) plugged[id] = pluggedIn;
+}
+
+bool Registry::readId(const AVT::VmbAPI::CameraPtr& camera, std::string& id) {
+  if (SP_ISNULL(camera)) return false;
+  return SP_ACCESS(camera)->GetID(id) == VmbErrorSuccess;
+}
@@ -0,0 +1,315 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Remap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "OosVim/Downsample.h"
+#include "OosVim/Frame.h"
+#include "OosVim/Trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_REMAP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_REMAP_NEON
+#endif
+
+using namespace OosVim;
+
+static const uint32_t REMAP_SHIFT = 2 * REMAP_FRACTION_BITS;
+static const uint32_t REMAP_ROUND = 1 << (REMAP_SHIFT - 1);
+
+// -- TABLE --------------------------------------------------------------------
+
+// Fixed point position of a source coordinate, the pixel and its right or
+// lower neighbour are always inside the frame
+static inline bool quantize(double position, uint32_t size, uint32_t& pixel, uint32_t& fraction) {
+  if (!(position >= -0.5 && position <= size - 0.5)) return false;
+  position = (std::min)((std::max)(position, 0.0), double(size - 1));
+  pixel = (std::min)(static_cast<uint32_t>(position), size - 2);
+  fraction = static_cast<uint32_t>(std::lround((position - pixel) * REMAP_FRACTION_ONE));
+  return true;
+}
+
+static void buildRows(const RemapFunction& function, uint32_t width, uint32_t height, uint32_t first, uint32_t last,
+                      RemapTable& table) {
+  for (uint32_t y = first; y < last; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      size_t index = size_t(y) * width + x;
+      double sourceX = x, sourceY = y;
+      if (function) function(x, y, width, height, sourceX, sourceY);
+
+      uint32_t column, row, fractionX, fractionY;
+      if (quantize(sourceX, width, column, fractionX) && quantize(sourceY, height, row, fractionY)) {
+        table.offsets[index] = row * width + column;
+        table.weights[index] = static_cast<uint16_t>(fractionX | fractionY << 8);
+      } else {
+        table.offsets[index] = 0;
+        table.weights[index] = REMAP_OUTSIDE;
+      }
+    }
+  }
+}
+
+// -- KERNELS ------------------------------------------------------------------
+
+// Scalar kernel, the channel count is a template argument so the inner loop
+// is unrolled for the color formats
+template <uint32_t channels>
+static void remapRow(const unsigned char* source, uint32_t width, const uint32_t* offsets, const uint16_t* weights,
+                     uint32_t x, uint32_t count, unsigned char* destination) {
+  const size_t stride = size_t(width) * channels;
+  for (; x < count; x++) {
+    unsigned char* pixel = destination + x * channels;
+    if (weights[x] == REMAP_OUTSIDE) {
+      for (uint32_t c = 0; c < channels; c++) pixel[c] = 0;
+      continue;
+    }
+    const uint32_t fractionX = weights[x] & 0xff;
+    const uint32_t fractionY = weights[x] >> 8;
+    const uint32_t inverseX = REMAP_FRACTION_ONE - fractionX;
+    const uint32_t inverseY = REMAP_FRACTION_ONE - fractionY;
+    const unsigned char* top = source + size_t(offsets[x]) * channels;
+    const unsigned char* bottom = top + stride;
+    for (uint32_t c = 0; c < channels; c++) {
+      uint32_t upper = top[c] * inverseX + top[c + channels] * fractionX;
+      uint32_t lower = bottom[c] * inverseX + bottom[c + channels] * fractionX;
+      pixel[c] = static_cast<unsigned char>((upper * inverseY + lower * fractionY + REMAP_ROUND) >> REMAP_SHIFT);
+    }
+  }
+}
+
+static inline uint16_t loadPair(const unsigned char* data) {
+  uint16_t pair;
+  std::memcpy(&pair, data, sizeof(pair));
+  return pair;
+}
+
+// Mono, the neighbours of eight pixels are gathered into vectors as pairs of
+// bytes and interpolated horizontally and then vertically
+static void remapRowMono(const unsigned char* source, uint32_t width, const uint32_t* offsets,
+                         const uint16_t* weights, uint32_t count, unsigned char* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_REMAP_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(REMAP_FRACTION_ONE);
+  const __m128i mask = _mm_set1_epi16(0xff);
+  const __m128i outside = _mm_set1_epi16(static_cast<short>(REMAP_OUTSIDE));
+  const __m128i round = _mm_set1_epi32(REMAP_ROUND);
+  for (; x + 8 <= count; x += 8) {
+    const uint32_t* o = offsets + x;
+    const unsigned char* s = source;
+    const unsigned char* t = source + width;
+    __m128i top = _mm_setr_epi16(loadPair(s + o[0]), loadPair(s + o[1]), loadPair(s + o[2]), loadPair(s + o[3]),
+                                 loadPair(s + o[4]), loadPair(s + o[5]), loadPair(s + o[6]), loadPair(s + o[7]));
+    __m128i bottom = _mm_setr_epi16(loadPair(t + o[0]), loadPair(t + o[1]), loadPair(t + o[2]), loadPair(t + o[3]),
+                                    loadPair(t + o[4]), loadPair(t + o[5]), loadPair(t + o[6]), loadPair(t + o[7]));
+
+    __m128i weight = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + x));
+    __m128i invalid = _mm_cmpeq_epi16(weight, outside);
+    __m128i fractionX = _mm_and_si128(weight, mask);
+    __m128i fractionY = _mm_srli_epi16(weight, 8);
+    __m128i inverseX = _mm_sub_epi16(one, fractionX);
+    __m128i inverseY = _mm_sub_epi16(one, fractionY);
+    __m128i horizontalLow = _mm_unpacklo_epi16(inverseX, fractionX);
+    __m128i horizontalHigh = _mm_unpackhi_epi16(inverseX, fractionX);
+
+    __m128i upper = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(top, zero), horizontalLow),
+                                    _mm_madd_epi16(_mm_unpackhi_epi8(top, zero), horizontalHigh));
+    __m128i lower = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bottom, zero), horizontalLow),
+                                    _mm_madd_epi16(_mm_unpackhi_epi8(bottom, zero), horizontalHigh));
+
+    __m128i first = _mm_madd_epi16(_mm_unpacklo_epi16(upper, lower), _mm_unpacklo_epi16(inverseY, fractionY));
+    __m128i second = _mm_madd_epi16(_mm_unpackhi_epi16(upper, lower), _mm_unpackhi_epi16(inverseY, fractionY));
+    first = _mm_srli_epi32(_mm_add_epi32(first, round), REMAP_SHIFT);
+    second = _mm_srli_epi32(_mm_add_epi32(second, round), REMAP_SHIFT);
+    __m128i value = _mm_andnot_si128(invalid, _mm_packs_epi32(first, second));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(value, zero));
+  }
+#elif defined(OOSVIM_REMAP_NEON)
+  const uint16x8_t one = vdupq_n_u16(REMAP_FRACTION_ONE);
+  const uint16x8_t outside = vdupq_n_u16(REMAP_OUTSIDE);
+  uint16_t topPairs[8], bottomPairs[8];
+  for (; x + 8 <= count; x += 8) {
+    for (int i = 0; i < 8; i++) {
+      topPairs[i] = loadPair(source + offsets[x + i]);
+      bottomPairs[i] = loadPair(source + offsets[x + i] + width);
+    }
+    uint16x8_t top = vld1q_u16(topPairs);
+    uint16x8_t bottom = vld1q_u16(bottomPairs);
+
+    uint16x8_t weight = vld1q_u16(weights + x);
+    uint16x8_t invalid = vceqq_u16(weight, outside);
+    uint16x8_t fractionX = vandq_u16(weight, vdupq_n_u16(0xff));
+    uint16x8_t fractionY = vshrq_n_u16(weight, 8);
+    uint16x8_t inverseX = vsubq_u16(one, fractionX);
+    uint16x8_t inverseY = vsubq_u16(one, fractionY);
+
+    uint16x8_t upper = vmlaq_u16(vmulq_u16(vandq_u16(top, vdupq_n_u16(0xff)), inverseX), vshrq_n_u16(top, 8), fractionX);
+    uint16x8_t lower =
+        vmlaq_u16(vmulq_u16(vandq_u16(bottom, vdupq_n_u16(0xff)), inverseX), vshrq_n_u16(bottom, 8), fractionX);
+
+    uint32x4_t first = vmlal_u16(vmull_u16(vget_low_u16(upper), vget_low_u16(inverseY)), vget_low_u16(lower),
+                                 vget_low_u16(fractionY));
+    uint32x4_t second = vmlal_u16(vmull_u16(vget_high_u16(upper), vget_high_u16(inverseY)), vget_high_u16(lower),
+                                  vget_high_u16(fractionY));
+    uint16x8_t value = vcombine_u16(vrshrn_n_u32(first, REMAP_SHIFT), vrshrn_n_u32(second, REMAP_SHIFT));
+    vst1_u8(destination + x, vmovn_u16(vbicq_u16(value, invalid)));
+  }
+#endif
+  remapRow<1>(source, width, offsets, weights, x, count, destination);
+}
+
+// Color, one pixel per vector with the channels of both neighbours as lanes.
+// The 8 byte loads read past the right neighbour, the last pixels of the frame
+// use the scalar kernel.
+template <uint32_t channels>
+static void remapRowColor(const unsigned char* source, uint32_t width, uint32_t height, const uint32_t* offsets,
+                          const uint16_t* weights, uint32_t count, unsigned char* destination) {
+  uint32_t x = 0;
+#if defined(OOSVIM_REMAP_SSE2)
+  const size_t stride = size_t(width) * channels;
+  const size_t limit = stride * height - 8;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(REMAP_ROUND);
+  for (; x < count; x++) {
+    const size_t offset = size_t(offsets[x]) * channels;
+    if (weights[x] == REMAP_OUTSIDE || offset + stride > limit) {
+      remapRow<channels>(source, width, offsets, weights, x, x + 1, destination);
+      continue;
+    }
+    const short fractionX = weights[x] & 0xff;
+    const short fractionY = weights[x] >> 8;
+    const short inverseX = REMAP_FRACTION_ONE - fractionX;
+    const short inverseY = REMAP_FRACTION_ONE - fractionY;
+
+    // Lanes 0 to 3 hold the left pixel, lanes from channels the right one
+    const __m128i horizontal = channels == 4 ? _mm_setr_epi16(inverseX, inverseX, inverseX, inverseX, fractionX,
+                                                              fractionX, fractionX, fractionX)
+                                             : _mm_setr_epi16(inverseX, inverseX, inverseX, fractionX, fractionX,
+                                                              fractionX, 0, 0);
+    __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + offset)), zero);
+    __m128i bottom =
+        _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + offset + stride)), zero);
+    top = _mm_mullo_epi16(top, horizontal);
+    bottom = _mm_mullo_epi16(bottom, horizontal);
+    __m128i upper = _mm_add_epi16(top, _mm_srli_si128(top, channels * 2));
+    __m128i lower = _mm_add_epi16(bottom, _mm_srli_si128(bottom, channels * 2));
+
+    __m128i vertical = _mm_set1_epi32(static_cast<uint16_t>(inverseY) | static_cast<int>(fractionY) << 16);
+    __m128i value = _mm_madd_epi16(_mm_unpacklo_epi16(upper, lower), vertical);
+    value = _mm_srli_epi32(_mm_add_epi32(value, round), REMAP_SHIFT);
+    value = _mm_packus_epi16(_mm_packs_epi32(value, zero), zero);
+    uint32_t pixel = static_cast<uint32_t>(_mm_cvtsi128_si32(value));
+    std::memcpy(destination + x * channels, &pixel, channels);
+  }
+#endif
+  remapRow<channels>(source, width, offsets, weights, x, count, destination);
+}
+
+// -- REMAPPER -----------------------------------------------------------------
+
+Remapper::Remapper(size_t threads)
+    : dirty(false), pool(new WorkerPool((std::max)(threads, size_t(1)))), builds(0) {}
+
+void Remapper::setLens(const LensModel& lens) {
+  if (!lens.isValid()) {
+    setFunction(nullptr);
+    return;
+  }
+
+  setFunction([lens](double x, double y, uint32_t width, uint32_t height, double& sourceX, double& sourceY) {
+    // Scale the camera matrix to the frame, the undistorted image has the
+    // same matrix, zoomed around the center
+    const double scaleX = double(width) / lens.width;
+    const double scaleY = double(height) / lens.height;
+    const double fx = lens.fx * scaleX;
+    const double fy = lens.fy * scaleY;
+    const double cx = lens.cx * scaleX;
+    const double cy = lens.cy * scaleY;
+
+    const double u = (x - cx) / (fx * lens.zoom);
+    const double v = (y - cy) / (fy * lens.zoom);
+    const double r2 = u * u + v * v;
+    const double radial = 1 + r2 * (lens.k1 + r2 * (lens.k2 + r2 * lens.k3));
+    const double du = u * radial + 2 * lens.p1 * u * v + lens.p2 * (r2 + 2 * u * u);
+    const double dv = v * radial + lens.p1 * (r2 + 2 * v * v) + 2 * lens.p2 * u * v;
+    sourceX = fx * du + cx;
+    sourceY = fy * dv + cy;
+  });
+}
+
+void Remapper::setFunction(RemapFunction value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  function = value;
+  dirty = true;
+}
+
+bool Remapper::remap(const Frame& frame, unsigned char* destination) {
+  uint32_t channels = getDownsampleChannels(frame.getImageFormat());
+  if (channels == 0 || frame.getImageData() == nullptr ||
+      frame.getImageSize() < size_t(frame.getWidth()) * frame.getHeight() * channels)
+    return false;
+  return remap(frame.getImageData(), frame.getWidth(), frame.getHeight(), channels, destination);
+}
+
+bool Remapper::remap(const unsigned char* source, uint32_t width, uint32_t height, uint32_t channels,
+                     unsigned char* destination) {
+  OOSVIM_TRACE_SCOPE("Remapper::remap");
+  if (source == nullptr || destination == nullptr || width < 2 || height < 2 || channels == 0) return false;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dirty) {
+      current = function;
+      dirty = false;
+      table.width = 0;
+    }
+  }
+  if (table.width != width || table.height != height) build(width, height);
+
+  // Two captures, so the task fits in std::function without an allocation
+  struct Band {
+    const unsigned char* source;
+    unsigned char* destination;
+    uint32_t channels;
+  } band = {source, destination, channels};
+
+  const uint32_t bands = (height + REMAP_BAND_ROWS - 1) / REMAP_BAND_ROWS;
+  pool->run(bands, [this, &band](size_t index) {
+    const uint32_t channels = band.channels;
+    const uint32_t width = table.width;
+    const uint32_t first = static_cast<uint32_t>(index) * REMAP_BAND_ROWS;
+    const uint32_t last = (std::min)(first + REMAP_BAND_ROWS, table.height);
+    for (uint32_t y = first; y < last; y++) {
+      const size_t offset = size_t(y) * width;
+      unsigned char* row = band.destination + offset * channels;
+      const uint32_t* offsets = &table.offsets[offset];
+      const uint16_t* weights = &table.weights[offset];
+      if (channels == 1) remapRowMono(band.source, width, offsets, weights, width, row);
+      else if (channels == 3) remapRowColor<3>(band.source, width, table.height, offsets, weights, width, row);
+      else remapRowColor<4>(band.source, width, table.height, offsets, weights, width, row);
+    }
+  });
+  return true;
+}
+
+void Remapper::build(uint32_t width, uint32_t height) {
+  OOSVIM_TRACE_SCOPE("Remapper::build");
+  table.width = width;
+  table.height = height;
+  table.offsets.resize(size_t(width) * height);
+  table.weights.resize(size_t(width) * height);
+
+  const uint32_t bands = (height + REMAP_BAND_ROWS - 1) / REMAP_BAND_ROWS;
+  pool->run(bands, [this](size_t index) {
+    const uint32_t first = static_cast<uint32_t>(index) * REMAP_BAND_ROWS;
+    const uint32_t last = (std::min)(first + REMAP_BAND_ROWS, table.height);
+    buildRows(current, table.width, table.height, first, last, table);
+  });
+  builds++;
+}
@@ -0,0 +1,323 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/SharedMemory.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "OosVim/Frame.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace OosVim;
+
+static size_t alignShared(size_t value) {
+  return (value + SHARED_ALIGNMENT - 1) / SHARED_ALIGNMENT * SHARED_ALIGNMENT;
+}
+
+static unsigned char* getPayload(SharedSlot* slot) {
+  return reinterpret_cast<unsigned char*>(slot) + alignShared(sizeof(SharedSlot));
+}
+
+static uint64_t getMilliseconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+// -- REGION -------------------------------------------------------------------
+
+SharedRegion::SharedRegion(const std::string& _name)
+    : logger("Shared"),
+      name(_name.empty() || _name[0] != '/' ? "/" + _name : _name),
+      header(nullptr),
+      memory(nullptr),
+      length(0) {
+  logger.setScope(name);
+}
+
+SharedRegion::~SharedRegion() { unmap(); }
+
+bool SharedRegion::map(bool create, size_t size, unsigned int permissions) {
+#if defined(_WIN32)
+  logger.error("Shared memory is not supported on this platform");
+  return false;
+#else
+  mode_t mode = static_cast<mode_t>(permissions);
+  int fd = create ? shm_open(name.c_str(), O_CREAT | O_RDWR, mode) : shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    if (create) logger.error("Failed to create shared memory");
+    return false;
+  }
+
+  if (create) {
+    // The umask would narrow the permissions that were asked for
+    if (fchmod(fd, mode) != 0) logger.warning("Failed to set the permissions of shared memory");
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      logger.error("Failed to size shared memory");
+      ::close(fd);
+      return false;
+    }
+  } else {
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(SharedHeader)) {
+      ::close(fd);
+      return false;
+    }
+    size = static_cast<size_t>(status.st_size);
+  }
+
+  int protection = create ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* address = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (address == MAP_FAILED) {
+    logger.error("Failed to map shared memory");
+    return false;
+  }
+
+  memory = static_cast<unsigned char*>(address);
+  length = size;
+  header = reinterpret_cast<SharedHeader*>(memory);
+  return true;
+#endif
+}
+
+bool SharedRegion::readGeneration(uint64_t& generation) const {
+#if defined(_WIN32)
+  return false;
+#else
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+
+  struct stat status;
+  void* address = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(SharedHeader)) {
+    address = mmap(nullptr, sizeof(SharedHeader), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (address == MAP_FAILED) return false;
+
+  const SharedHeader* other = static_cast<const SharedHeader*>(address);
+  bool valid = other->magic == SHARED_MAGIC;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (valid) generation = other->generation;
+  munmap(address, sizeof(SharedHeader));
+  return valid;
+#endif
+}
+
+void SharedRegion::unmap() {
+#if !defined(_WIN32)
+  if (memory != nullptr) munmap(memory, length);
+#endif
+  memory = nullptr;
+  header = nullptr;
+  length = 0;
+}
+
+SharedSlot* SharedRegion::getSlot(uint64_t number) const {
+  size_t index = static_cast<size_t>(number % header->slotCount);
+  size_t offset = alignShared(sizeof(SharedHeader)) + index * getSlotStride(header->slotSize);
+  return reinterpret_cast<SharedSlot*>(memory + offset);
+}
+
+size_t SharedRegion::getSlotStride(size_t slotSize) {
+  return alignShared(sizeof(SharedSlot)) + alignShared(slotSize);
+}
+
+size_t SharedRegion::getLength(size_t slotCount, size_t slotSize) {
+  return alignShared(sizeof(SharedHeader)) + slotCount * getSlotStride(slotSize);
+}
+
+// -- PUBLISHER ----------------------------------------------------------------
+
+SharedPublisher::SharedPublisher(const std::string& name, size_t slotCount, size_t slotSize,
+                                 unsigned int permissions)
+    : SharedRegion(name), slotCount(slotCount), slotSize(slotSize), permissions(permissions), skipped(0) {
+  if (slotSize > 0) create(slotSize);
+}
+
+SharedPublisher::~SharedPublisher() {
+  retire();
+#if !defined(_WIN32)
+  shm_unlink(name.c_str());
+#endif
+}
+
+bool SharedPublisher::create(size_t size) {
+#if !defined(_WIN32)
+  // Remove a region left behind by a previous publisher, the subscribers that
+  // still map it attach to the new region
+  shm_unlink(name.c_str());
+#endif
+  retire();
+  if (slotCount == 0 || !map(true, getLength(slotCount, size), permissions)) return false;
+
+  header->version = SHARED_VERSION;
+  header->slotCount = static_cast<uint32_t>(slotCount);
+  header->slotSize = static_cast<uint32_t>(size);
+  header->generation = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+  header->published.store(0);
+  header->retired.store(0);
+  for (size_t i = 0; i < slotCount; i++) getSlot(i)->sequence.store(0);
+
+  // Subscribers only attach once the magic is written
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SHARED_MAGIC;
+
+  logger.notice("Publishing " + std::to_string(slotCount) + " slots of " + std::to_string(size) + " bytes");
+  return true;
+}
+
+bool SharedPublisher::publish(const Frame& frame) {
+  return publish(frame.getImageData(), frame.getImageSize(), frame.getWidth(), frame.getHeight(),
+                 frame.getImageFormat(), frame.getId(), frame.getTimestamp(), frame.geFrameCount());
+}
+
+bool SharedPublisher::publish(const unsigned char* data, uint32_t size, uint32_t width, uint32_t height,
+                              uint32_t format, uint64_t id, uint64_t timestamp, uint64_t frameCount) {
+  if (data == nullptr) return false;
+  if (!isOpen() && !create(slotSize > 0 ? slotSize : size)) return false;
+
+  if (size > header->slotSize) {
+    // Slots that were sized by the first frame grow with the frames
+    if (slotSize == 0) {
+      if (!create(size)) return false;
+    } else {
+      if (skipped++ == 0) logger.warning("Frame exceeds the slot size, skipping frames");
+      return false;
+    }
+  }
+
+  uint64_t number = header->published.load(std::memory_order_relaxed);
+  SharedSlot* slot = getSlot(number);
+
+  slot->sequence.store(2 * number + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->id = id;
+  slot->timestamp = timestamp;
+  slot->frameCount = frameCount;
+  slot->width = width;
+  slot->height = height;
+  slot->format = format;
+  slot->size = size;
+  std::memcpy(getPayload(slot), data, size);
+
+  slot->sequence.store(2 * number + 2, std::memory_order_release);
+  header->published.store(number + 1, std::memory_order_release);
+  return true;
+}
+
+void SharedPublisher::retire() {
+  if (!isOpen()) return;
+  header->retired.store(1, std::memory_order_release);
+  unmap();
+}
+
+// -- SUBSCRIBER ---------------------------------------------------------------
+
+SharedSubscriber::SharedSubscriber(const std::string& name) : SharedRegion(name), cursor(0), lost(0), checkedAt(0) {}
+
+bool SharedSubscriber::open() {
+  if (isOpen()) return true;
+  if (!map(false, 0)) return false;
+
+  bool valid = header->magic == SHARED_MAGIC;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  valid = valid && header->version == SHARED_VERSION && header->slotCount > 0 &&
+          length >= getLength(header->slotCount, header->slotSize);
+
+  if (!valid) {
+    unmap();
+    return false;
+  }
+
+  cursor = header->published.load(std::memory_order_acquire);
+  checkedAt = getMilliseconds();
+  logger.notice("Subscribed");
+  return true;
+}
+
+bool SharedSubscriber::latest(SharedFrame& frame) {
+  if (!isOpen()) return false;
+
+  uint64_t published = header->published.load(std::memory_order_acquire);
+  if (published == 0 || published == cursor) {
+    refresh();
+    return false;
+  }
+
+  cursor = published;
+  return read(published - 1, frame);
+}
+
+bool SharedSubscriber::next(SharedFrame& frame) {
+  if (!isOpen()) return false;
+
+  uint64_t published = header->published.load(std::memory_order_acquire);
+  if (cursor >= published) {
+    refresh();
+    return false;
+  }
+
+  // The slot after the newest frame may be written right now
+  uint64_t oldest = published > header->slotCount ? published - header->slotCount + 1 : 0;
+  if (cursor < oldest) {
+    lost += oldest - cursor;
+    cursor = oldest;
+  }
+
+  if (read(cursor++, frame)) return true;
+  lost++;
+  return false;
+}
+
+bool SharedSubscriber::isValid(const SharedFrame& frame) const {
+  if (!isOpen()) return false;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return frame.generation == header->generation &&
+         getSlot(frame.number)->sequence.load(std::memory_order_relaxed) == 2 * frame.number + 2;
+}
+
+bool SharedSubscriber::read(uint64_t number, SharedFrame& frame) const {
+  SharedSlot* slot = getSlot(number);
+  uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+  if (sequence != 2 * number + 2) return false;
+
+  frame.number = number;
+  frame.generation = header->generation;
+  frame.id = slot->id;
+  frame.timestamp = slot->timestamp;
+  frame.frameCount = slot->frameCount;
+  frame.width = slot->width;
+  frame.height = slot->height;
+  frame.format = slot->format;
+  frame.size = slot->size;
+  frame.data = getPayload(slot);
+
+  return isValid(frame);
+}
+
+bool SharedSubscriber::refresh() {
+  // Without new frames, check whether the publisher left for a new region. A
+  // retired region is known right away, a publisher that restarted after a
+  // crash only by the generation of the region under the name.
+  bool stale = header->retired.load(std::memory_order_acquire) != 0;
+  if (!stale) {
+    uint64_t now = getMilliseconds();
+    if (now - checkedAt < SHARED_CHECK_INTERVAL) return false;
+    checkedAt = now;
+    uint64_t generation = 0;
+    stale = readGeneration(generation) && generation != header->generation;
+  }
+  if (!stale) return false;
+
+  logger.notice("Publisher replaced the region, subscribing again");
+  unmap();
+  return open();
+}
@@ -0,0 +1,403 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Statistics.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "OosVim/Frame.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_STATISTICS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_STATISTICS_NEON
+#endif
+
+using namespace OosVim;
+
+typedef StatisticsEngine::Layout Layout;
+typedef StatisticsEngine::Partial Partial;
+
+// The sampled part of a frame
+struct Region {
+  const unsigned char* data;
+  uint32_t width;
+  uint32_t height;
+  size_t rowBytes;
+  uint32_t x0, y0, x1, y1;
+  uint32_t stride;
+};
+
+static bool getLayout(VmbPixelFormatType format, Layout& layout, uint32_t& bitDepth) {
+  switch (format) {
+    case VmbPixelFormatMono8:
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerBG8:
+      layout = {1, 1, 1, {0, 0, 0}, 0, 0, format == VmbPixelFormatMono8 ? 1u : 2u};
+      bitDepth = 8;
+      return true;
+    case VmbPixelFormatRgb8:
+      layout = {1, 3, 3, {0, 1, 2}, 1, 0, 1};
+      bitDepth = 8;
+      return true;
+    case VmbPixelFormatBgr8:
+      layout = {1, 3, 3, {2, 1, 0}, 1, 0, 1};
+      bitDepth = 8;
+      return true;
+    case VmbPixelFormatRgba8:
+      layout = {1, 4, 3, {0, 1, 2}, 1, 0, 1};
+      bitDepth = 8;
+      return true;
+    case VmbPixelFormatBgra8:
+      layout = {1, 4, 3, {2, 1, 0}, 1, 0, 1};
+      bitDepth = 8;
+      return true;
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
+      bitDepth = format == VmbPixelFormatMono10 ? 10 : format == VmbPixelFormatMono12 ? 12
+                 : format == VmbPixelFormatMono14 ? 14 : 16;
+      layout = {2, 1, 1, {0, 0, 0}, 0, bitDepth - 8, 1};
+      return true;
+    case VmbPixelFormatRgb12:
+    case VmbPixelFormatRgb16:
+      bitDepth = format == VmbPixelFormatRgb12 ? 12 : 16;
+      layout = {2, 3, 3, {0, 1, 2}, 1, bitDepth - 8, 1};
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t OosVim::getStatisticsChannels(VmbPixelFormatType format) {
+  Layout layout;
+  uint32_t bitDepth;
+  return getLayout(format, layout, bitDepth) ? layout.channels : 0;
+}
+
+// -- RESULTS ------------------------------------------------------------------
+
+double ChannelStatistics::getPercentile(double p) const {
+  if (count == 0) return 0;
+  double threshold = (std::min)((std::max)(p, 0.0), 1.0) * count;
+  uint64_t cumulative = 0;
+  for (uint32_t bin = 0; bin < STATISTICS_BINS; bin++) {
+    cumulative += histogram[bin];
+    if (cumulative >= threshold && cumulative > 0) return bin / double(STATISTICS_BINS - 1);
+  }
+  return 1;
+}
+
+double FrameStatistics::getMean() const {
+  if (channels == 0) return 0;
+  double mean = 0;
+  for (uint32_t c = 0; c < channels; c++) mean += channel[c].mean;
+  return mean / channels;
+}
+
+double FrameStatistics::getClippedLow() const {
+  double clipped = 0;
+  for (uint32_t c = 0; c < channels; c++) clipped = (std::max)(clipped, channel[c].clippedLow);
+  return clipped;
+}
+
+double FrameStatistics::getClippedHigh() const {
+  double clipped = 0;
+  for (uint32_t c = 0; c < channels; c++) clipped = (std::max)(clipped, channel[c].clippedHigh);
+  return clipped;
+}
+
+// -- HISTOGRAM ----------------------------------------------------------------
+
+// Mono 8 bit without sampling, the common case. Consecutive pixels count into
+// separate histograms so equal values do not wait on each others increment.
+static void histogramMono8(const Region& region, uint32_t first, uint32_t last, Partial& partial) {
+  uint32_t counts[4][STATISTICS_BINS] = {};
+  const uint32_t length = region.x1 - region.x0;
+
+  for (uint32_t i = first; i < last; i++) {
+    const unsigned char* row = region.data + (region.y0 + i) * region.rowBytes + region.x0;
+    uint32_t x = 0;
+    for (; x + 4 <= length; x += 4) {
+      counts[0][row[x]]++;
+      counts[1][row[x + 1]]++;
+      counts[2][row[x + 2]]++;
+      counts[3][row[x + 3]]++;
+    }
+    for (; x < length; x++) counts[0][row[x]]++;
+  }
+
+  for (uint32_t bin = 0; bin < STATISTICS_BINS; bin++)
+    partial.histogram[0][bin] += counts[0][bin] + counts[1][bin] + counts[2][bin] + counts[3][bin];
+}
+
+// Any layout and sampling stride, 8 bit sums follow from the histogram
+template <typename T>
+static void histogramRows(const Region& region, const Layout& layout, uint32_t first, uint32_t last,
+                          Partial& partial) {
+  const uint32_t maxBin = STATISTICS_BINS - 1;
+  for (uint32_t i = first; i < last; i++) {
+    const T* row = reinterpret_cast<const T*>(region.data + (region.y0 + i * region.stride) * region.rowBytes);
+    for (uint32_t x = region.x0; x < region.x1; x += region.stride) {
+      const T* pixel = row + x * layout.step;
+      for (uint32_t c = 0; c < layout.channels; c++) {
+        uint32_t value = pixel[layout.offset[c]];
+        partial.histogram[c][(std::min)(value >> layout.shift, maxBin)]++;
+        if (sizeof(T) > 1) partial.sum[c] += value;
+      }
+    }
+  }
+}
+
+// -- SHARPNESS ----------------------------------------------------------------
+
+// Mono 8 bit Laplacian without sampling, returns the column where it stopped
+static uint32_t laplacianMono8(const unsigned char* row, const unsigned char* up, const unsigned char* down,
+                               uint32_t x, uint32_t end, int64_t& sum, int64_t& squares) {
+#if defined(OOSVIM_STATISTICS_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  while (x + 16 <= end) {
+    __m128i sum32 = zero;
+    __m128i squares32 = zero;
+    // Flush before the 32 bit squares can overflow
+    for (uint32_t n = 0; n < 256 && x + 16 <= end; n++, x += 16) {
+      __m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+      __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+      __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+      __m128i above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+      __m128i below = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+
+      __m128i neighbours = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(right, zero)),
+                                         _mm_add_epi16(_mm_unpacklo_epi8(above, zero), _mm_unpacklo_epi8(below, zero)));
+      __m128i low = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(center, zero), 2), neighbours);
+
+      neighbours = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(right, zero)),
+                                 _mm_add_epi16(_mm_unpackhi_epi8(above, zero), _mm_unpackhi_epi8(below, zero)));
+      __m128i high = _mm_sub_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(center, zero), 2), neighbours);
+
+      sum32 = _mm_add_epi32(sum32, _mm_add_epi32(_mm_madd_epi16(low, ones), _mm_madd_epi16(high, ones)));
+      squares32 = _mm_add_epi32(squares32, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+    }
+
+    int32_t sums[4], square[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sum32);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(square), squares32);
+    for (int i = 0; i < 4; i++) {
+      sum += sums[i];
+      squares += square[i];
+    }
+  }
+#elif defined(OOSVIM_STATISTICS_NEON)
+  while (x + 16 <= end) {
+    int32x4_t sum32 = vdupq_n_s32(0);
+    int32x4_t squares32 = vdupq_n_s32(0);
+    for (uint32_t n = 0; n < 256 && x + 16 <= end; n++, x += 16) {
+      uint8x16_t center = vld1q_u8(row + x);
+      uint8x16_t left = vld1q_u8(row + x - 1);
+      uint8x16_t right = vld1q_u8(row + x + 1);
+      uint8x16_t above = vld1q_u8(up + x);
+      uint8x16_t below = vld1q_u8(down + x);
+
+      // The 16 bit differences wrap, as signed values they are exact
+      uint16x8_t neighbours = vaddq_u16(vaddl_u8(vget_low_u8(left), vget_low_u8(right)),
+                                        vaddl_u8(vget_low_u8(above), vget_low_u8(below)));
+      int16x8_t low = vreinterpretq_s16_u16(vsubq_u16(vshll_n_u8(vget_low_u8(center), 2), neighbours));
+
+      neighbours = vaddq_u16(vaddl_u8(vget_high_u8(left), vget_high_u8(right)),
+                             vaddl_u8(vget_high_u8(above), vget_high_u8(below)));
+      int16x8_t high = vreinterpretq_s16_u16(vsubq_u16(vshll_n_u8(vget_high_u8(center), 2), neighbours));
+
+      sum32 = vpadalq_s16(vpadalq_s16(sum32, low), high);
+      squares32 = vmlal_s16(squares32, vget_low_s16(low), vget_low_s16(low));
+      squares32 = vmlal_s16(squares32, vget_high_s16(low), vget_high_s16(low));
+      squares32 = vmlal_s16(squares32, vget_low_s16(high), vget_low_s16(high));
+      squares32 = vmlal_s16(squares32, vget_high_s16(high), vget_high_s16(high));
+    }
+
+    int32_t sums[4], square[4];
+    vst1q_s32(sums, sum32);
+    vst1q_s32(square, squares32);
+    for (int i = 0; i < 4; i++) {
+      sum += sums[i];
+      squares += square[i];
+    }
+  }
+#endif
+  (void)row;
+  (void)up;
+  (void)down;
+  (void)end;
+  (void)sum;
+  (void)squares;
+  return x;
+}
+
+// Laplacian of the luminance channel at every sampled pixel that has all four
+// neighbours inside the frame. Bayer mosaics use the neighbours of the same
+// color, two pixels away.
+template <typename T>
+static void laplacianRows(const Region& region, const Layout& layout, uint32_t first, uint32_t last,
+                          Partial& partial) {
+  const uint32_t spacing = layout.spacing;
+  if (region.width <= 2 * spacing || region.height <= 2 * spacing) return;
+
+  const size_t step = layout.step * spacing;
+  const size_t rowValues = region.rowBytes / sizeof(T) * spacing;
+  const uint32_t start = (std::max)(region.x0, spacing);
+  const uint32_t end = (std::min)(region.x1, region.width - spacing);
+  if (start >= end) return;
+
+  // First column of the sampling grid with a left neighbour
+  const uint32_t column = region.x0 + (start - region.x0 + region.stride - 1) / region.stride * region.stride;
+  const bool vector = sizeof(T) == 1 && step == 1 && region.stride == 1;
+
+  for (uint32_t i = first; i < last; i++) {
+    uint32_t y = region.y0 + i * region.stride;
+    if (y < spacing || y + spacing >= region.height) continue;
+
+    const T* row = reinterpret_cast<const T*>(region.data + y * region.rowBytes) + layout.offset[layout.luminance];
+    const T* up = row - rowValues;
+    const T* down = row + rowValues;
+
+    int64_t sum = 0;
+    int64_t squares = 0;
+    uint32_t x = column;
+    if (vector) {
+      x = laplacianMono8(reinterpret_cast<const unsigned char*>(row), reinterpret_cast<const unsigned char*>(up),
+                         reinterpret_cast<const unsigned char*>(down), x, end, sum, squares);
+    }
+    uint64_t count = x < end ? (end - x + region.stride - 1) / region.stride : 0;
+    count += (x - column) / region.stride;
+
+    for (; x < end; x += region.stride) {
+      size_t o = size_t(x) * layout.step;
+      int64_t laplacian = 4 * int64_t(row[o]) - row[o - step] - row[o + step] - up[o] - down[o];
+      sum += laplacian;
+      squares += laplacian * laplacian;
+    }
+
+    partial.laplacianSum += double(sum);
+    partial.laplacianSquares += double(squares);
+    partial.laplacianCount += count;
+  }
+}
+
+// -- ENGINE -------------------------------------------------------------------
+
+StatisticsEngine::StatisticsEngine(const StatisticsSettings& _settings) { setSettings(_settings); }
+
+void StatisticsEngine::setSettings(const StatisticsSettings& _settings) {
+  size_t threads = (std::max)(_settings.threads, size_t(1));
+  if (!pool || pool->getSize() != threads) pool.reset(new WorkerPool(threads));
+
+  settings = _settings;
+  settings.threads = threads;
+  settings.stride = (std::max)(settings.stride, 1u);
+}
+
+bool StatisticsEngine::compute(const Frame& frame, FrameStatistics& statistics) {
+  Layout layout;
+  uint32_t bitDepth;
+  if (!getLayout(frame.getImageFormat(), layout, bitDepth)) return false;
+
+  size_t required = size_t(frame.getWidth()) * frame.getHeight() * layout.step * layout.bytes;
+  if (frame.getImageData() == nullptr || frame.getImageSize() < required) return false;
+
+  if (!compute(frame.getImageData(), frame.getWidth(), frame.getHeight(), frame.getImageFormat(), statistics))
+    return false;
+  statistics.frameId = frame.getId();
+  return true;
+}
+
+bool StatisticsEngine::compute(const unsigned char* data, uint32_t width, uint32_t height,
+                               VmbPixelFormatType format, FrameStatistics& statistics) {
+  Layout layout;
+  uint32_t bitDepth;
+  if (data == nullptr || !getLayout(format, layout, bitDepth)) return false;
+
+  Region region;
+  region.data = data;
+  region.width = width;
+  region.height = height;
+  region.rowBytes = size_t(width) * layout.step * layout.bytes;
+  region.stride = settings.stride;
+  region.x0 = (std::min)(settings.x, width);
+  region.y0 = (std::min)(settings.y, height);
+  region.x1 = settings.width > 0 ? (std::min)(region.x0 + settings.width, width) : width;
+  region.y1 = settings.height > 0 ? (std::min)(region.y0 + settings.height, height) : height;
+  if (region.x0 >= region.x1 || region.y0 >= region.y1) return false;
+
+  // Split the sampled rows into one band per thread
+  const uint32_t rows = (region.y1 - region.y0 + region.stride - 1) / region.stride;
+  const size_t bands = (std::min)(pool->getSize(), size_t(rows));
+  if (partials.size() < bands) partials.resize(bands);
+
+  const bool mono8 = layout.bytes == 1 && layout.step == 1 && region.stride == 1;
+  const bool sharpness = settings.sharpness;
+  pool->run(bands, [&](size_t band) {
+    Partial& partial = partials[band];
+    std::memset(&partial, 0, sizeof(Partial));
+    uint32_t first = static_cast<uint32_t>(rows * band / bands);
+    uint32_t last = static_cast<uint32_t>(rows * (band + 1) / bands);
+
+    if (layout.bytes == 1) {
+      if (mono8) histogramMono8(region, first, last, partial);
+      else histogramRows<uint8_t>(region, layout, first, last, partial);
+      if (sharpness) laplacianRows<uint8_t>(region, layout, first, last, partial);
+    } else {
+      histogramRows<uint16_t>(region, layout, first, last, partial);
+      if (sharpness) laplacianRows<uint16_t>(region, layout, first, last, partial);
+    }
+  });
+
+  // Merge the bands
+  const double maxValue = double((uint32_t(1) << bitDepth) - 1);
+  double laplacianSum = 0;
+  double laplacianSquares = 0;
+  uint64_t laplacianCount = 0;
+
+  statistics.frameId = 0;
+  statistics.channels = layout.channels;
+  statistics.bitDepth = bitDepth;
+  for (uint32_t c = 0; c < layout.channels; c++) {
+    ChannelStatistics& channel = statistics.channel[c];
+    channel.histogram.fill(0);
+    uint64_t sum = 0;
+    for (size_t band = 0; band < bands; band++) {
+      for (uint32_t bin = 0; bin < STATISTICS_BINS; bin++) channel.histogram[bin] += partials[band].histogram[c][bin];
+      sum += partials[band].sum[c];
+    }
+
+    channel.count = 0;
+    for (uint32_t bin = 0; bin < STATISTICS_BINS; bin++) {
+      channel.count += channel.histogram[bin];
+      if (layout.bytes == 1) sum += uint64_t(bin) * channel.histogram[bin];
+    }
+
+    double count = double((std::max)(channel.count, uint64_t(1)));
+    channel.mean = sum / count / maxValue;
+    channel.clippedLow = channel.histogram[0] / count;
+    channel.clippedHigh = channel.histogram[STATISTICS_BINS - 1] / count;
+  }
+  for (uint32_t c = layout.channels; c < STATISTICS_MAX_CHANNELS; c++) statistics.channel[c] = ChannelStatistics();
+
+  for (size_t band = 0; band < bands; band++) {
+    laplacianSum += partials[band].laplacianSum;
+    laplacianSquares += partials[band].laplacianSquares;
+    laplacianCount += partials[band].laplacianCount;
+  }
+
+  statistics.sharpness = 0;
+  if (laplacianCount > 0) {
+    double mean = laplacianSum / laplacianCount;
+    double variance = (std::max)(laplacianSquares / laplacianCount - mean * mean, 0.0);
+    statistics.sharpness = variance / (maxValue * maxValue);
+  }
+  return true;
+}
@@ -2,12 +2,39 @@
 
 #include "OosVim/Stream.h"
 
+#include <limits>
+
+#include "OosVim/Trace.h"
+
 using namespace OosVim;
 
 Stream::Stream(const std::shared_ptr<Device> device,
-               const unsigned int bufferSize)
+               const unsigned int bufferSize,
+               const size_t historySize)
     : logger("Stream"),
       device(device),
+      provider(std::make_shared<BufferProvider>()),
+      pool(device, bufferSize),
+      history(std::make_shared<History>(historySize)),
+      latency(std::make_shared<Latency>()),
+      tickFrequency(0),
+      clockOffset(0),
+      clockSynchronized(false),
+      clockSynchronizedAt(0),
+      dropStale(false),
+      stale(0),
+      ageBaseline(std::numeric_limits<int64_t>::max()),
+      lastTimestamp(0),
+      decimation(1),
+      minInterval(0),
+      decimated(0),
+      decimationCount(0),
+      nextDeliveryAt(0),
+      decimationOnHost(false),
+      correctionFailed(false),
+      unchanged(0),
+      streamThread("Stream"),
+      deliveryThread("Delivery"),
       running(false),
       capturing(false),
       connectedAt(0),
@@ -15,6 +42,7 @@ Stream::Stream(const std::shared_ptr<Device> device,
       frameAt(0) {
   logger.setScope(device->getId());
   frames.resize(bufferSize);
+  buffers.resize(bufferSize, nullptr);
 
   SP_SET(observer, new StreamObserver(*this));
   startTime = std::chrono::steady_clock::now();
@@ -67,12 +95,14 @@ void Stream::stop() {
 }
 
 void Stream::run() {
+  OOSVIM_TRACE_THREAD("Stream");
   std::unique_lock<std::mutex> lock(mutex);
   std::chrono::milliseconds timeout(CAMERA_HEALTH_TIMEOUT);
 
   logger.verbose("Setting up stream");
 
   while (isRunning()) {
+    streamThread.apply();
     if (isCapturing()) {
       if (isResized()) {
         logger.notice("Detected resized stream, restarting stream");
@@ -89,6 +119,9 @@ void Stream::run() {
 
         close();
       }
+      else if (getElapsedTime() - clockSynchronizedAt > CAMERA_CLOCK_SYNC_INTERVAL) {
+        synchronizeClock();
+      }
     } else if (open()) {
       // Whenever we open a stream, monitor it's health ever 100ms
       timeout = std::chrono::milliseconds(CAMERA_HEALTH_TIMEOUT);
@@ -111,11 +144,21 @@ void Stream::run() {
 }
 
 bool Stream::open() {
+  OOSVIM_TRACE_SCOPE("Stream::open");
   if (!isAvailable()) {
     logger.warning("No stream available for device");
     return false;
   }
 
+  long long frequency;
+  if (device->get("GevTimestampTickFrequency", frequency)) tickFrequency = frequency;
+  synchronizeClock();
+  ageBaseline = std::numeric_limits<int64_t>::max();
+  lastTimestamp = 0;
+  decimationCount = 0;
+  nextDeliveryAt = 0;
+  decimationOnHost = false;
+
   if (prepare()) {
     logger.verbose("started capture");
 
@@ -138,19 +181,68 @@ bool Stream::close() {
   return teardown();
 }
 
-bool Stream::receive(AVT::VmbAPI::FramePtr framePtr) {
+bool Stream::receive(AVT::VmbAPI::FramePtr framePtr, VmbFrameStatusType status) {
+  OOSVIM_TRACE_SCOPE("Stream::receive");
   if (!device) {
     return false;
   }
-  auto frame = std::make_shared<Frame>(device);
+  uint64_t hostTime = getHostTime();
+
+  VmbUint64_t timestamp = 0;
+  framePtr->GetTimestamp(timestamp);
+
+  // Incomplete, stale and decimated frames are only recorded in the history
+  bool complete = status == VmbFrameStatusComplete;
+  bool skip = !complete;
+  if (complete && isStale(framePtr, timestamp, hostTime)) {
+    stale++;
+    skip = true;
+  } else if (complete && isDecimated(timestamp, hostTime)) {
+    decimated++;
+    skip = true;
+  }
+
+  // Unchanged frames are compared in the announced buffer, before they are loaded
+  float score = -1;
+  std::shared_ptr<ChangeDetector> detector = skip ? nullptr : getChangeDetector();
+  if (detector) {
+    VmbUchar_t* data = nullptr;
+    VmbUint32_t width = 0;
+    VmbUint32_t height = 0;
+    VmbPixelFormatType format = 0;
+    framePtr->GetImage(data);
+    framePtr->GetWidth(width);
+    framePtr->GetHeight(height);
+    framePtr->GetPixelFormat(format);
+    if (isUnchanged(*detector, data, width, height, format, score)) {
+      unchanged++;
+      skip = true;
+    }
+  }
 
-  if (frame->load(framePtr)) {
-    // Keep track of our frame rate
-    frameAt = getElapsedTime();
+  if (skip) {
+    VmbUint64_t id = 0;
+    VmbUint32_t size = 0;
+    framePtr->GetFrameID(id);
+    framePtr->GetImageSize(size);
+    history->append(id, timestamp, hostTime, status, size, Chunk());
+    return false;
+  }
 
-    // Notify of new frame
-    if (frameCallbackFunction) frameCallbackFunction(frame);
-//    ofNotifyEvent(onFrame, frame, this);
+  // The consumers hold on to every frame of the pool, drop this one
+  auto frame = pool.acquire();
+  if (!frame) {
+    VmbUint64_t id = 0;
+    VmbUint32_t size = 0;
+    framePtr->GetFrameID(id);
+    framePtr->GetImageSize(size);
+    history->append(id, timestamp, hostTime, status, size, Chunk());
+    return false;
+  }
+
+  if (frame->load(framePtr, decoder)) {
+    frame->changeScore = score;
+    deliver(frame, hostTime);
     return true;
   } else {
     logger.error("Failed to extract frame data");
@@ -159,8 +251,204 @@ bool Stream::receive(AVT::VmbAPI::FramePtr framePtr) {
   return false;
 }
 
+bool Stream::inject(unsigned char* data, uint32_t width, uint32_t height, VmbPixelFormatType format,
+                    uint32_t size, uint64_t id, uint64_t timestamp, const Chunk& chunk) {
+  uint64_t hostTime = getHostTime();
+  if (isDecimated(0, hostTime)) {
+    decimated++;
+    history->append(id, timestamp, hostTime, VmbFrameStatusComplete, size, chunk);
+    return false;
+  }
+
+  float score = -1;
+  std::shared_ptr<ChangeDetector> detector = getChangeDetector();
+  if (detector && isUnchanged(*detector, data, width, height, format, score)) {
+    unchanged++;
+    history->append(id, timestamp, hostTime, VmbFrameStatusComplete, size, chunk);
+    return false;
+  }
+
+  auto frame = pool.acquire();
+  if (!frame) {
+    history->append(id, timestamp, hostTime, VmbFrameStatusComplete, size, chunk);
+    return false;
+  }
+
+  if (frame->load(data, width, height, format, size, id, timestamp, chunk)) {
+    frame->changeScore = score;
+    deliver(frame, hostTime);
+    return true;
+  }
+
+  return false;
+}
+
+void Stream::deliver(const std::shared_ptr<Frame>& frame, uint64_t hostTime) {
+  history->append(frame->getId(), frame->getTimestamp(), hostTime, VmbFrameStatusComplete,
+                  frame->getImageSize(), frame->getChunk());
+
+  // Keep track of our frame rate
+  frameAt = getElapsedTime();
+
+  frame->exposureTime = toHostTime(frame->getTimestamp());
+  frame->arrivalTime = hostTime;
+
+  std::shared_ptr<const Correction> calibration = getCorrection();
+  if (calibration) {
+    OOSVIM_TRACE_SCOPE("correction");
+    bool corrected = calibration->apply(frame->data, frame->getWidth(), frame->getHeight(), frame->getImageFormat(),
+                                        frame->getImageSize());
+    if (!corrected && !correctionFailed) logger.warning("Correction does not match the frames, delivered uncorrected");
+    correctionFailed = !corrected;
+  }
+
+  // Notify of new frame
+  if (frameCallbackFunction) {
+    OOSVIM_TRACE_SCOPE("frame callback");
+    frameCallbackFunction(frame);
+  }
+//    ofNotifyEvent(onFrame, frame, this);
+  latency->recordDelivery(frame->exposureTime, hostTime, getHostTime());
+  frame->unload();
+}
+
+void Stream::setCorrection(std::shared_ptr<const Correction> value) {
+  std::lock_guard<std::mutex> lock(correctionMutex);
+  correction = value;
+}
+
+std::shared_ptr<const Correction> Stream::getCorrection() const {
+  std::lock_guard<std::mutex> lock(correctionMutex);
+  return correction;
+}
+
+void Stream::setChangeDetector(std::shared_ptr<ChangeDetector> value) {
+  std::lock_guard<std::mutex> lock(changeMutex);
+  changeDetector = value;
+}
+
+std::shared_ptr<ChangeDetector> Stream::getChangeDetector() const {
+  std::lock_guard<std::mutex> lock(changeMutex);
+  return changeDetector;
+}
+
+void Stream::setThreadPolicy(ThreadRole role, const ThreadPolicy& policy) {
+  if (role == ThreadRole::Stream) streamThread.setPolicy(policy);
+  if (role == ThreadRole::Delivery) deliveryThread.setPolicy(policy);
+}
+
+std::vector<ThreadPlacement> Stream::getThreadPlacements() {
+  return {streamThread.getPlacement(), deliveryThread.getPlacement()};
+}
+
+bool Stream::isUnchanged(ChangeDetector& detector, const unsigned char* data, uint32_t width, uint32_t height,
+                         VmbPixelFormatType format, float& score) {
+  OOSVIM_TRACE_SCOPE("change detection");
+  bool isChanged = detector.compare(data, width, height, format, score);
+  return !isChanged && detector.isSkipUnchanged();
+}
+
+bool Stream::isStale(const AVT::VmbAPI::FramePtr& framePtr, uint64_t timestamp, uint64_t hostTime) {
+  uint64_t frequency = tickFrequency.load();
+  if (frequency == 0 || timestamp == 0) return false;
+
+  // The age includes the unknown clock offset, only the difference with the
+  // youngest age is used. The baseline follows the drift of the camera clock.
+  uint64_t time = ticksToNanoseconds(timestamp, frequency);
+  int64_t age = static_cast<int64_t>(hostTime) - static_cast<int64_t>(time);
+  if (age < ageBaseline) ageBaseline = age;
+  else ageBaseline += (age - ageBaseline) / 1024;
+
+  uint64_t interval = timestamp > lastTimestamp && lastTimestamp > 0 ? time - ticksToNanoseconds(lastTimestamp, frequency) : 0;
+  lastTimestamp = timestamp;
+
+  // When a frame is older than the youngest age plus one frame interval, the
+  // next frame should have arrived. Only drop it when that frame is complete.
+  if (!dropStale || interval == 0 || age - ageBaseline <= static_cast<int64_t>(interval)) return false;
+  return hasNewerFrame(framePtr, timestamp);
+}
+
+bool Stream::hasNewerFrame(const AVT::VmbAPI::FramePtr& framePtr, uint64_t timestamp) const {
+  // The frames that wait for the observer are complete and keep their
+  // timestamp, the frames that were delivered before are older
+  for (auto& other : frames) {
+    if (SP_ISEQUAL(other, framePtr)) continue;
+    VmbFrameStatusType status = VmbFrameStatusInvalid;
+    VmbUint64_t otherTimestamp = 0;
+    if (other->GetReceiveStatus(status) != VmbErrorSuccess || status != VmbFrameStatusComplete) continue;
+    if (other->GetTimestamp(otherTimestamp) == VmbErrorSuccess && otherTimestamp > timestamp) return true;
+  }
+  return false;
+}
+
+bool Stream::isDecimated(uint64_t timestamp, uint64_t hostTime) {
+  unsigned int n = decimation.load();
+  if (n > 1 && decimationCount++ % n != 0) return true;
+
+  uint64_t interval = minInterval.load();
+  if (interval == 0) return false;
+
+  // The camera clock has no transfer jitter, the host clock is only used for
+  // injected frames and cameras without a tick frequency
+  uint64_t frequency = tickFrequency.load();
+  bool host = frequency == 0 || timestamp == 0;
+  uint64_t time = host ? hostTime : ticksToNanoseconds(timestamp, frequency);
+  if (host != decimationOnHost) {
+    decimationOnHost = host;
+    nextDeliveryAt = 0;
+  }
+
+  // Allow an eighth of the interval of jitter, and keep the schedule so the
+  // mean rate matches the target when the camera rate is not a multiple of it
+  if (time + interval / 8 < nextDeliveryAt) return true;
+  nextDeliveryAt = time > nextDeliveryAt + interval ? time + interval : nextDeliveryAt + interval;
+  return false;
+}
+
+bool Stream::synchronizeClock() {
+  clockSynchronizedAt = getElapsedTime();
+  uint64_t frequency = tickFrequency.load();
+  if (frequency == 0) return false;
+
+  // Latching writes to the camera, which a read only or multicast connection
+  // may not do
+  if (!device->isMaster()) return false;
+
+  // The camera latches its clock halfway the round trip of the command
+  uint64_t before = getHostTime();
+  if (!device->run("GevTimestampControlLatch")) {
+    logger.verbose("Failed to latch the camera clock, exposure times are unknown");
+    return false;
+  }
+  uint64_t after = getHostTime();
+
+  long long value = 0;
+  if (!device->get("GevTimestampValue", value)) return false;
+
+  uint64_t cameraTime = ticksToNanoseconds(static_cast<uint64_t>(value), frequency);
+  clockOffset = static_cast<int64_t>(before + (after - before) / 2) - static_cast<int64_t>(cameraTime);
+  clockSynchronized = true;
+  return true;
+}
+
+uint64_t Stream::toHostTime(uint64_t timestamp) const {
+  uint64_t frequency = tickFrequency.load();
+  if (!clockSynchronized || frequency == 0) return 0;
+
+  int64_t time = static_cast<int64_t>(ticksToNanoseconds(timestamp, frequency)) + clockOffset.load();
+  return time > 0 ? static_cast<uint64_t>(time) : 0;
+}
+
 bool Stream::prepare() {
+  // The raw chunk layout is only known for Allied Vision GigE cameras
+  VmbInterfaceType type = VmbInterfaceUnknown;
+  AVT::VmbAPI::FeaturePtr feature;
+  std::string vendor;
+  device->getHandle()->GetInterfaceType(type);
+  if (device->locate("DeviceVendorName", feature)) getFeature(feature, vendor);
+
   if (allocate()) {
+    decoder.prepare(frames, ChunkDecoder::hasRawLayout(vendor, type));
     auto error = device->getHandle()->StartCapture();
 
     if (error == VmbErrorSuccess) {
@@ -235,9 +523,18 @@ bool Stream::allocate() {
 
   // If the payload size changed, reallocate
   if (!isAllocated(size)) {
-    for (auto& frame : frames) {
+    for (size_t i = 0; i < frames.size(); i++) {
+      auto& frame = frames[i];
       if (!SP_ISNULL(frame)) frame->UnregisterObserver();
-      SP_SET(frame, new AVT::VmbAPI::Frame(size));
+
+      auto buffer = provider->allocate(static_cast<size_t>(size));
+      if (buffer == nullptr) {
+        logger.error("Failed to allocate frame buffer");
+        return false;
+      }
+      SP_SET(frame, new AVT::VmbAPI::Frame(buffer, size));
+      provider->release(buffers[i]);
+      buffers[i] = buffer;
 
       error = frame->RegisterObserver(observer);
       if (error != VmbErrorSuccess) {
@@ -259,7 +556,24 @@ bool Stream::allocate() {
   return true;
 }
 
+void Stream::setBufferPolicy(const BufferPolicy& policy) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (isCapturing()) {
+    logger.warning("Cannot change the buffer policy while capturing");
+    return;
+  }
+
+  // Release the frames before the provider that owns their memory
+  for (auto& frame : frames) {
+    if (!SP_ISNULL(frame)) frame->UnregisterObserver();
+    SP_RESET(frame);
+  }
+  std::fill(buffers.begin(), buffers.end(), nullptr);
+  provider = std::make_shared<BufferProvider>(policy);
+}
+
 bool Stream::deallocate() {
+  decoder.release();
   auto error = device->getHandle()->RevokeAllFrames();
 
   if (error != VmbErrorSuccess) {
@@ -331,13 +645,16 @@ void StreamObserver::stop() {
 }
 
 void StreamObserver::FrameReceived(AVT::VmbAPI::FramePtr frame) {
+  OOSVIM_TRACE_THREAD("Vimba");
+  OOSVIM_TRACE_SCOPE("StreamObserver::FrameReceived");
   std::lock_guard<std::mutex> lock(mutex);
   if (!running) return;
+  stream.deliveryThread.apply();
 
   VmbFrameStatusType statusType = VmbFrameStatusInvalid;
   auto error = frame->GetReceiveStatus(statusType);
-  if (error == VmbErrorSuccess && statusType == VmbFrameStatusComplete) {
-    stream.receive(frame);
+  if (error == VmbErrorSuccess) {
+    stream.receive(frame, statusType);
   }
 
   m_pCamera->QueueFrame(frame);
@@ -2,6 +2,9 @@
 
 #include "OosVim/System.h"
 
+#include <algorithm>
+#include <utility>
+
 using namespace OosVim;
 
 System::System() : logger("System") { initialize(); }
@@ -40,6 +43,56 @@ bool System::shutdown() {
   }
 }
 
+bool System::prepareAction(ActionCommand& action, uint32_t deviceKey, uint32_t groupKey, uint32_t groupMask) {
+  action = ActionCommand();
+  if (api == nullptr) return false;
+
+  const std::pair<const char*, AVT::VmbAPI::FeaturePtr*> features[] = {
+      {"ActionDeviceKey", &action.deviceKeyFeature},
+      {"ActionGroupKey", &action.groupKeyFeature},
+      {"ActionGroupMask", &action.groupMaskFeature},
+      {"ActionCommand", &action.command}};
+  for (auto& feature : features) {
+    auto error = api->GetFeatureByName(feature.first, *feature.second);
+    if (error != VmbErrorSuccess) {
+      logger.error(std::string("Failed to locate ") + feature.first, error);
+      action = ActionCommand();
+      return false;
+    }
+  }
+
+  action.deviceKey = deviceKey;
+  action.groupKey = groupKey;
+  action.groupMask = groupMask;
+  return true;
+}
+
+bool System::sendAction(const ActionCommand& action) {
+  if (SP_ISNULL(action.command)) return false;
+
+  std::lock_guard<std::mutex> lock(actionMutex);
+  const uint32_t keys[3] = {action.deviceKey, action.groupKey, action.groupMask};
+  if (!actionKeysValid || !std::equal(keys, keys + 3, actionKeys)) {
+    actionKeysValid = false;
+    auto error = action.deviceKeyFeature->SetValue(static_cast<VmbInt64_t>(action.deviceKey));
+    if (error == VmbErrorSuccess) error = action.groupKeyFeature->SetValue(static_cast<VmbInt64_t>(action.groupKey));
+    if (error == VmbErrorSuccess) error = action.groupMaskFeature->SetValue(static_cast<VmbInt64_t>(action.groupMask));
+    if (error != VmbErrorSuccess) {
+      logger.error("Failed to set the action keys", error);
+      return false;
+    }
+    std::copy(keys, keys + 3, actionKeys);
+    actionKeysValid = true;
+  }
+
+  auto error = action.command->RunCommand();
+  if (error != VmbErrorSuccess) {
+    logger.error("Failed to send action command", error);
+    return false;
+  }
+  return true;
+}
+
 bool System::isVersionValid() {
   if (version.valid) return true;
   return queryVersion() && version.valid;
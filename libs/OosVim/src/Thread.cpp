@@ -0,0 +1,243 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Thread.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+using namespace OosVim;
+
+static size_t getThreadHash() { return std::hash<std::thread::id>()(std::this_thread::get_id()); }
+
+#if defined(__linux__)
+// The cores of the process, read when the library is loaded and before any
+// thread is placed. Later the affinity of the process id is the one of the
+// main thread, which may have been placed itself. All online cores when it
+// can not be read.
+static cpu_set_t readProcessCores() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0 || CPU_COUNT(&set) == 0) {
+    CPU_ZERO(&set);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long core = 0; core < online && core < CPU_SETSIZE; core++) CPU_SET(core, &set);
+  }
+  return set;
+}
+
+static const cpu_set_t PROCESS_CORES = readProcessCores();
+#endif
+
+std::string OosVim::toString(const ThreadPlacement& placement) {
+  std::string result = placement.name + " thread";
+  if (!placement.applied) return result + " not placed";
+  switch (placement.scheduling) {
+    case ThreadScheduling::Fifo:
+      result += " fifo " + std::to_string(placement.priority);
+      break;
+    case ThreadScheduling::RoundRobin:
+      result += " round robin " + std::to_string(placement.priority);
+      break;
+    default:
+      result += " nice " + std::to_string(placement.nice);
+      break;
+  }
+  if (!placement.cores.empty()) {
+    result += " on cores";
+    for (size_t i = 0; i < placement.cores.size(); i++) result += (i ? "," : " ") + std::to_string(placement.cores[i]);
+  }
+  if (placement.degraded) result += " (degraded)";
+  return result;
+}
+
+ThreadBinding::ThreadBinding(const std::string& name)
+    : logger("Thread"), name(name), version(0), appliedVersion(0), appliedThread(0) {
+  placement.name = name;
+}
+
+void ThreadBinding::setPolicy(const ThreadPolicy& value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  policy = value;
+  version++;
+}
+
+ThreadPolicy ThreadBinding::getPolicy() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return policy;
+}
+
+ThreadPlacement ThreadBinding::getPlacement() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return placement;
+}
+
+void ThreadBinding::apply() {
+  uint64_t current = version.load();
+  if (current == 0) return;
+  size_t thread = getThreadHash();
+  if (current == appliedVersion.load() && thread == appliedThread.load()) return;
+
+  // The system calls run outside the lock, the policy is copied
+  ThreadPolicy target = getPolicy();
+  ThreadPlacement result;
+  result.name = name;
+  applyPolicy(target, result);
+  queryPlacement(result);
+  result.applied = true;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    placement = result;
+  }
+  appliedVersion = current;
+  appliedThread = thread;
+  if (result.degraded) logger.notice(toString(result));
+  else logger.verbose(toString(result));
+}
+
+#if defined(_WIN32)
+
+void ThreadBinding::applyPolicy(const ThreadPolicy& target, ThreadPlacement& result) {
+  // Windows has no per thread real-time policy, the priority class of the
+  // process limits what the thread priorities reach
+  HANDLE thread = GetCurrentThread();
+  int priority = THREAD_PRIORITY_NORMAL;
+  if (target.scheduling != ThreadScheduling::Other) {
+    priority = target.priority >= 50 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+  } else if (target.nice < 0) {
+    priority = target.nice <= -10 ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_ABOVE_NORMAL;
+  } else if (target.nice > 0) {
+    priority = target.nice >= 10 ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL;
+  }
+  if (!SetThreadPriority(thread, priority)) {
+    logger.warning("Failed to set the priority of the " + name + " thread");
+    result.degraded = true;
+  } else if (target.scheduling != ThreadScheduling::Other) {
+    result.priority = target.priority;
+  }
+
+  DWORD_PTR mask = 0;
+  for (int core : target.cores) {
+    if (core >= 0 && core < static_cast<int>(sizeof(DWORD_PTR) * 8)) mask |= DWORD_PTR(1) << core;
+  }
+  if (target.cores.empty()) {
+    DWORD_PTR system = 0;
+    GetProcessAffinityMask(GetCurrentProcess(), &mask, &system);
+  }
+  if (mask == 0 || SetThreadAffinityMask(thread, mask) == 0) {
+    logger.warning("Failed to set the cores of the " + name + " thread");
+    result.degraded = true;
+  } else if (!target.cores.empty()) {
+    result.cores = target.cores;
+  }
+}
+
+void ThreadBinding::queryPlacement(ThreadPlacement& result) {
+  // The thread priorities below highest map back to nice values in steps of 5
+  int priority = GetThreadPriority(GetCurrentThread());
+  if (priority >= THREAD_PRIORITY_HIGHEST) {
+    result.scheduling = ThreadScheduling::Fifo;
+  } else {
+    result.scheduling = ThreadScheduling::Other;
+    result.priority = 0;
+    result.nice = -priority * 5;
+  }
+}
+
+#else
+
+void ThreadBinding::applyPolicy(const ThreadPolicy& target, ThreadPlacement& result) {
+  pthread_t thread = pthread_self();
+  bool realtime = target.scheduling != ThreadScheduling::Other;
+
+  if (realtime) {
+    int type = target.scheduling == ThreadScheduling::Fifo ? SCHED_FIFO : SCHED_RR;
+    sched_param parameter = {};
+    parameter.sched_priority =
+        (std::max)(sched_get_priority_min(type), (std::min)(target.priority, sched_get_priority_max(type)));
+    int error = pthread_setschedparam(thread, type, &parameter);
+    if (error != 0) {
+      std::string reason = error == EPERM ? "no privilege" : "error " + std::to_string(error);
+      logger.warning("Real-time scheduling of the " + name + " thread refused (" + reason + "), using nice " +
+                     std::to_string(target.nice));
+      result.degraded = true;
+      realtime = false;
+    }
+  }
+  if (!realtime) {
+    sched_param parameter = {};
+    pthread_setschedparam(thread, SCHED_OTHER, &parameter);
+#if defined(__linux__)
+    // Linux keeps a nice value per thread
+    pid_t id = static_cast<pid_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(id), target.nice) != 0) {
+      logger.warning("Nice " + std::to_string(target.nice) + " of the " + name + " thread refused");
+      result.degraded = true;
+    }
+#else
+    if (target.nice != 0) result.degraded = true;
+#endif
+  }
+
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (target.cores.empty()) {
+    // Any core of the process, so an earlier placement is undone
+    set = PROCESS_CORES;
+  } else {
+    for (int core : target.cores) {
+      if (core >= 0 && core < CPU_SETSIZE) CPU_SET(core, &set);
+    }
+  }
+  if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(thread, sizeof(set), &set) != 0) {
+    logger.warning("Failed to set the cores of the " + name + " thread");
+    result.degraded = true;
+  }
+#else
+  // macOS only takes affinity hints, the cores are not enforced
+  if (!target.cores.empty()) result.degraded = true;
+#endif
+}
+
+void ThreadBinding::queryPlacement(ThreadPlacement& result) {
+  int type = SCHED_OTHER;
+  sched_param parameter = {};
+  if (pthread_getschedparam(pthread_self(), &type, &parameter) == 0) {
+    result.scheduling = type == SCHED_FIFO ? ThreadScheduling::Fifo
+                        : type == SCHED_RR ? ThreadScheduling::RoundRobin
+                                           : ThreadScheduling::Other;
+    result.priority = result.scheduling == ThreadScheduling::Other ? 0 : parameter.sched_priority;
+  }
+
+#if defined(__linux__)
+  pid_t id = static_cast<pid_t>(syscall(SYS_gettid));
+  errno = 0;
+  int nice = getpriority(PRIO_PROCESS, static_cast<id_t>(id));
+  if (errno == 0) result.nice = nice;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+    for (int core = 0; core < CPU_SETSIZE; core++) {
+      if (CPU_ISSET(core, &set)) result.cores.push_back(core);
+    }
+  }
+#endif
+}
+
+#endif
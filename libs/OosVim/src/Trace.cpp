@@ -0,0 +1,151 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Trace.h"
+
+#include <chrono>
+
+#ifdef OOSVIM_TRACE
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+using namespace OosVim;
+
+uint64_t Trace::now() {
+  auto time = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+#ifdef OOSVIM_TRACE
+
+struct TraceEvent {
+  const char* name;
+  uint64_t start;
+  uint64_t end;
+};
+
+// Written by its own thread only, read by write()
+struct TraceBuffer {
+  std::vector<TraceEvent> events;
+  std::atomic<uint64_t> count;
+  std::atomic<const char*> name;
+  std::atomic<bool> finished;
+  uint64_t threadId;
+
+  TraceBuffer(uint64_t threadId)
+      : events(TRACE_BUFFER_SIZE), count(0), name(nullptr), finished(false), threadId(threadId) {}
+};
+
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  uint64_t nextThreadId = 1;
+};
+
+// Marks the buffer as finished when its thread exits
+struct TraceThread {
+  std::shared_ptr<TraceBuffer> buffer;
+  ~TraceThread() {
+    if (buffer) buffer->finished = true;
+  }
+};
+
+static TraceRegistry& getRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+static TraceBuffer& getBuffer() {
+  thread_local TraceThread thread;
+  if (!thread.buffer) {
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    thread.buffer = std::make_shared<TraceBuffer>(registry.nextThreadId++);
+    registry.buffers.push_back(thread.buffer);
+  }
+  return *thread.buffer;
+}
+
+static std::string escape(const char* text) {
+  std::string result;
+  for (const char* c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') result += '\\';
+    result += *c;
+  }
+  return result;
+}
+
+bool Trace::isEnabled() { return true; }
+
+void Trace::setThreadName(const char* name) {
+  auto& buffer = getBuffer();
+  if (buffer.name.load(std::memory_order_relaxed) != name) buffer.name.store(name, std::memory_order_release);
+}
+
+void Trace::record(const char* name, uint64_t start, uint64_t end) {
+  auto& buffer = getBuffer();
+  uint64_t index = buffer.count.load(std::memory_order_relaxed);
+  buffer.events[index % TRACE_BUFFER_SIZE] = {name, start, end};
+  buffer.count.store(index + 1, std::memory_order_release);
+}
+
+bool Trace::write(const std::string& path) {
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  {
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffers = registry.buffers;
+  }
+
+  std::ofstream file(path);
+  if (!file.good()) return false;
+
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\": [" << std::endl;
+  bool first = true;
+  for (auto& buffer : buffers) {
+    const char* threadName = buffer->name.load(std::memory_order_acquire);
+    if (threadName != nullptr) {
+      file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+           << buffer->threadId << ", \"args\": {\"name\": \"" << escape(threadName) << "\"}}";
+      first = false;
+    }
+
+    // Skip the oldest spans of a full buffer, the thread may overwrite them
+    uint64_t count = buffer->count.load(std::memory_order_acquire);
+    uint64_t margin = TRACE_BUFFER_SIZE / 8;
+    uint64_t begin = count > TRACE_BUFFER_SIZE - margin ? count - (TRACE_BUFFER_SIZE - margin) : 0;
+    for (uint64_t i = begin; i < count; i++) {
+      const TraceEvent& event = buffer->events[i % TRACE_BUFFER_SIZE];
+      file << (first ? "" : ",\n") << "{\"name\": \"" << escape(event.name)
+           << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId << ", \"ts\": " << event.start / 1e3
+           << ", \"dur\": " << (event.end - event.start) / 1e3 << "}";
+      first = false;
+    }
+  }
+  file << std::endl << "]}" << std::endl;
+  return file.good();
+}
+
+void Trace::clear() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto& buffers = registry.buffers;
+  buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                               [](const std::shared_ptr<TraceBuffer>& buffer) { return buffer->finished.load(); }),
+                buffers.end());
+}
+
+#else
+
+bool Trace::isEnabled() { return false; }
+void Trace::setThreadName(const char*) {}
+void Trace::record(const char*, uint64_t, uint64_t) {}
+bool Trace::write(const std::string&) { return false; }
+void Trace::clear() {}
+
+#endif
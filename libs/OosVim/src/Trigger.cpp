@@ -0,0 +1,193 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Trigger.h"
+
+#include <algorithm>
+
+#include "OosVim/Frame.h"
+#include "OosVim/Stream.h"
+#include "OosVim/Trace.h"
+
+using namespace OosVim;
+
+TriggerScheduler::TriggerScheduler(const TriggerSettings& _settings)
+    : logger("Trigger"),
+      settings(_settings),
+      system(System::getInstance()),
+      running(false),
+      interval(static_cast<uint64_t>(1e9 / TRIGGER_DEFAULT_RATE)),
+      binding("Trigger"),
+      issued(0),
+      missed(0),
+      failed(0),
+      targets(std::make_shared<const Target_List_t>()) {
+  setRate(settings.rate);
+}
+
+TriggerScheduler::~TriggerScheduler() { stop(); }
+
+bool TriggerScheduler::addDevice(std::shared_ptr<Device> device) {
+  if (!device || !device->isOpen() || !device->isMaster()) {
+    logger.warning("Triggering needs an open connection that is not read only");
+    return false;
+  }
+
+  // Writing the features blocks, the timer keeps running meanwhile
+  bool action = settings.mode == TriggerMode::Action;
+  bool valid = device->set("TriggerSelector", std::string("FrameStart")) &&
+               device->set("TriggerSource", std::string(action ? "Action0" : "Software")) &&
+               device->set("TriggerMode", std::string("On"));
+  if (valid && action) {
+    valid = device->set("ActionDeviceKey", static_cast<long long>(settings.deviceKey)) &&
+            device->set("ActionSelector", 0LL) &&
+            device->set("ActionGroupKey", static_cast<long long>(settings.groupKey)) &&
+            device->set("ActionGroupMask", static_cast<long long>(settings.groupMask));
+  }
+
+  auto target = std::make_shared<Target>();
+  target->device = device;
+  target->count = 0;
+  target->latency = std::make_shared<LatencyHistogram>();
+  for (auto& time : target->times) time = 0;
+  if (valid && !action && !device->locate("TriggerSoftware", target->command)) valid = false;
+  if (!valid) {
+    logger.error("Failed to configure the trigger of " + device->getId());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(targetsMutex);
+  auto next = std::make_shared<Target_List_t>();
+  for (auto& other : *targets) {
+    if (other->device != device) next->push_back(other);
+  }
+  next->push_back(target);
+  targets = next;
+  return true;
+}
+
+void TriggerScheduler::removeDevice(std::shared_ptr<Device> device) {
+  {
+    std::lock_guard<std::mutex> lock(targetsMutex);
+    auto next = std::make_shared<Target_List_t>();
+    for (auto& target : *targets) {
+      if (target->device != device) next->push_back(target);
+    }
+    if (next->size() == targets->size()) return;
+    targets = next;
+  }
+  if (device && device->isOpen() && device->isMaster()) device->set("TriggerMode", std::string("Off"));
+}
+
+void TriggerScheduler::start() {
+  if (running.exchange(true)) return;
+  if (settings.mode == TriggerMode::Action &&
+      !system->prepareAction(action, settings.deviceKey, settings.groupKey, settings.groupMask)) {
+    logger.error("Action commands are not available, no triggers are sent");
+  }
+  thread = std::thread([this]() { run(); });
+}
+
+void TriggerScheduler::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running.exchange(false)) return;
+  }
+  signal.notify_all();
+  if (thread.joinable()) thread.join();
+}
+
+void TriggerScheduler::setRate(double rate) {
+  if (rate <= 0) {
+    logger.warning("The trigger rate should be above 0, rate set to " + std::to_string(TRIGGER_DEFAULT_RATE));
+    rate = TRIGGER_DEFAULT_RATE;
+  }
+  interval.store(static_cast<uint64_t>(1e9 / rate));
+}
+
+void TriggerScheduler::run() {
+  OOSVIM_TRACE_THREAD("Trigger");
+  uint64_t next = Stream::getHostTime() + interval.load();
+  while (running) {
+    binding.apply();
+
+    // Sleep until shortly before the trigger, then spin to the trigger time
+    uint64_t now = Stream::getHostTime();
+    if (next > now + settings.spin) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (running) signal.wait_for(lock, std::chrono::nanoseconds(next - now - settings.spin));
+      continue;
+    }
+    while ((now = Stream::getHostTime()) < next) {}
+    jitter.record(now - next);
+
+    // Sending blocks on the cameras, the list is copied so adding or removing
+    // a camera does not wait for it
+    fire(*getTargets());
+
+    // Keep the cadence, triggers that are already too late are skipped
+    uint64_t step = interval.load();
+    next += step;
+    now = Stream::getHostTime();
+    if (now > next) {
+      uint64_t late = (now - next) / step + 1;
+      missed += late;
+      next += late * step;
+    }
+  }
+}
+
+void TriggerScheduler::fire(const Target_List_t& current) {
+  OOSVIM_TRACE_SCOPE("TriggerScheduler::fire");
+  bool valid = true;
+  if (settings.mode == TriggerMode::Action) {
+    uint64_t time = Stream::getHostTime();
+    valid = system->sendAction(action);
+    for (auto& target : current) {
+      uint64_t count = target->count.load();
+      target->times[count % TRIGGER_HISTORY_SIZE] = time;
+      target->count = count + 1;
+    }
+  } else {
+    for (auto& target : current) {
+      uint64_t time = Stream::getHostTime();
+      valid = target->device->run(target->command) && valid;
+      uint64_t count = target->count.load();
+      target->times[count % TRIGGER_HISTORY_SIZE] = time;
+      target->count = count + 1;
+    }
+  }
+  if (valid) issued++;
+  else failed++;
+}
+
+std::shared_ptr<const TriggerScheduler::Target_List_t> TriggerScheduler::getTargets() const {
+  std::lock_guard<std::mutex> lock(targetsMutex);
+  return targets;
+}
+
+void TriggerScheduler::recordFrame(const Frame& frame) {
+  std::shared_ptr<Target> target;
+  for (auto& candidate : *getTargets()) {
+    if (candidate->device == frame.getDevice()) target = candidate;
+  }
+  if (!target) return;
+
+  // The latest trigger before the frame, the triggers are in order
+  uint64_t reference = frame.getExposureTime() > 0 ? frame.getExposureTime() : frame.getArrivalTime();
+  uint64_t count = target->count.load();
+  size_t depth = static_cast<size_t>((std::min)(count, static_cast<uint64_t>(TRIGGER_HISTORY_SIZE)));
+  for (size_t i = 1; i <= depth; i++) {
+    uint64_t time = target->times[(count - i) % TRIGGER_HISTORY_SIZE].load();
+    if (time > 0 && time <= reference) {
+      if (frame.getArrivalTime() >= time) target->latency->record(frame.getArrivalTime() - time);
+      return;
+    }
+  }
+}
+
+std::shared_ptr<const LatencyHistogram> TriggerScheduler::getLatency(const std::string& deviceId) {
+  for (auto& target : *getTargets()) {
+    if (target->device->getId() == deviceId) return target->latency;
+  }
+  return nullptr;
+}
@@ -0,0 +1,213 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/Unpack.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define OOSVIM_UNPACK_SSSE3
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OOSVIM_UNPACK_NEON
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OOSVIM_UNPACK_SSE2
+#endif
+
+using namespace OosVim;
+
+uint32_t OosVim::getUnpackBitDepth(VmbPixelFormatType format) {
+  switch (format) {
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono10p:
+      return 10;
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono12p:
+    case VmbPixelFormatMono12Packed:
+    case VmbPixelFormatRgb12:
+      return 12;
+    case VmbPixelFormatMono14:
+      return 14;
+    case VmbPixelFormatMono16:
+    case VmbPixelFormatRgb16:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+uint32_t OosVim::getUnpackChannels(VmbPixelFormatType format) {
+  switch (format) {
+    case VmbPixelFormatRgb12:
+    case VmbPixelFormatRgb16:
+      return 3;
+    default:
+      return getUnpackBitDepth(format) > 0 ? 1 : 0;
+  }
+}
+
+// -- 16 BIT CONTAINERS --------------------------------------------------------
+
+static void unpack16(const unsigned char* source, size_t count, uint32_t shift, uint16_t* destination) {
+  size_t i = 0;
+#if defined(OOSVIM_UNPACK_SSE2)
+  const __m128i count128 = _mm_cvtsi32_si128(static_cast<int>(shift));
+  for (; i + 8 <= count; i += 8) {
+    __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_sll_epi16(values, count128));
+  }
+#endif
+  for (; i < count; i++) {
+    uint16_t value = static_cast<uint16_t>(source[i * 2] | source[i * 2 + 1] << 8);
+    destination[i] = static_cast<uint16_t>(value << shift);
+  }
+}
+
+// -- 12 BIT PACKED ------------------------------------------------------------
+// Mono12p (PFNC):       P0 = B0 | (B1 & 0xF) << 8,  P1 = B1 >> 4 | B2 << 4
+// Mono12Packed (GigE):  P0 = B0 << 4 | (B1 & 0xF),  P1 = B2 << 4 | B1 >> 4
+
+template <bool gige>
+static void unpack12(const unsigned char* source, size_t count, uint32_t shift, uint16_t* destination) {
+  size_t i = 0;
+#if defined(OOSVIM_UNPACK_SSSE3)
+  // 8 values from 12 bytes, the load reads 16
+  const size_t bytes = (count * 3 + 1) / 2;
+  const __m128i shuffle = gige ? _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11)
+                               : _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+  const __m128i even = _mm_set1_epi32(0x0000FFFF);
+  const __m128i count128 = _mm_cvtsi32_si128(static_cast<int>(shift));
+  for (; i + 8 <= count && i / 2 * 3 + 16 <= bytes; i += 8) {
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i / 2 * 3));
+    __m128i values = _mm_shuffle_epi8(packed, shuffle);
+    __m128i first, second;
+    if (gige) {
+      first = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(values, 4), _mm_set1_epi16(0x0FF0)),
+                           _mm_and_si128(values, _mm_set1_epi16(0x000F)));
+    } else {
+      first = _mm_and_si128(values, _mm_set1_epi16(0x0FFF));
+    }
+    second = _mm_srli_epi16(values, 4);
+    values = _mm_or_si128(_mm_and_si128(first, even), _mm_andnot_si128(even, second));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_sll_epi16(values, count128));
+  }
+#elif defined(OOSVIM_UNPACK_NEON)
+  // 16 values from 24 bytes, deinterleaved per byte of a pair
+  const int16x8_t shift16 = vdupq_n_s16(static_cast<int16_t>(shift));
+  for (; i + 16 <= count; i += 16) {
+    uint8x8x3_t packed = vld3_u8(source + i / 2 * 3);
+    uint16x8_t b0 = vmovl_u8(packed.val[0]);
+    uint16x8_t b1 = vmovl_u8(packed.val[1]);
+    uint16x8_t b2 = vmovl_u8(packed.val[2]);
+    uint16x8x2_t values;
+    if (gige) {
+      values.val[0] = vorrq_u16(vshlq_n_u16(b0, 4), vandq_u16(b1, vdupq_n_u16(0x000F)));
+      values.val[1] = vorrq_u16(vshlq_n_u16(b2, 4), vshrq_n_u16(b1, 4));
+    } else {
+      values.val[0] = vorrq_u16(b0, vshlq_n_u16(vandq_u16(b1, vdupq_n_u16(0x000F)), 8));
+      values.val[1] = vorrq_u16(vshrq_n_u16(b1, 4), vshlq_n_u16(b2, 4));
+    }
+    values.val[0] = vshlq_u16(values.val[0], shift16);
+    values.val[1] = vshlq_u16(values.val[1], shift16);
+    vst2q_u16(destination + i, values);
+  }
+#endif
+  for (; i < count; i++) {
+    const unsigned char* pair = source + i / 2 * 3;
+    uint16_t value;
+    if (i % 2 == 0) {
+      value = gige ? static_cast<uint16_t>(pair[0] << 4 | (pair[1] & 0x0F))
+                   : static_cast<uint16_t>(pair[0] | (pair[1] & 0x0F) << 8);
+    } else {
+      value = gige ? static_cast<uint16_t>(pair[2] << 4 | pair[1] >> 4)
+                   : static_cast<uint16_t>(pair[1] >> 4 | pair[2] << 4);
+    }
+    destination[i] = static_cast<uint16_t>(value << shift);
+  }
+}
+
+// -- 10 BIT PACKED ------------------------------------------------------------
+// Mono10p (PFNC), 4 values in 5 bytes, least significant bits first
+
+static void unpack10p(const unsigned char* source, size_t count, uint32_t shift, uint16_t* destination) {
+  size_t i = 0;
+#if defined(OOSVIM_UNPACK_SSSE3)
+  const size_t bytes = (count * 10 + 7) / 8;
+  // 8 values from 10 bytes. Every lane holds the two bytes of its value, the
+  // multiply shifts the value to the top bits, so one shift right aligns it.
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+  const __m128i multiply = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+  const __m128i count128 = _mm_cvtsi32_si128(static_cast<int>(6 - (shift < 6 ? shift : 6)));
+  for (; i + 8 <= count && i / 4 * 5 + 16 <= bytes; i += 8) {
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i / 4 * 5));
+    __m128i values = _mm_mullo_epi16(_mm_shuffle_epi8(packed, shuffle), multiply);
+    values = _mm_srl_epi16(values, count128);
+    if (shift > 0) values = _mm_andnot_si128(_mm_set1_epi16(static_cast<short>((1 << shift) - 1)), values);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), values);
+  }
+#endif
+  for (; i < count; i++) {
+    size_t bit = i * 10;
+    const unsigned char* pair = source + bit / 8;
+    uint16_t value = static_cast<uint16_t>(((pair[0] | pair[1] << 8) >> (bit % 8)) & 0x03FF);
+    destination[i] = static_cast<uint16_t>(value << shift);
+  }
+}
+
+bool OosVim::unpack(const unsigned char* source, uint32_t width, uint32_t height, VmbPixelFormatType format,
+                    bool scale, uint16_t* destination) {
+  uint32_t bits = getUnpackBitDepth(format);
+  if (source == nullptr || destination == nullptr || bits == 0) return false;
+
+  const size_t count = static_cast<size_t>(width) * height * getUnpackChannels(format);
+  const uint32_t shift = scale ? 16 - bits : 0;
+
+  switch (format) {
+    case VmbPixelFormatMono10p:
+      unpack10p(source, count, shift, destination);
+      break;
+    case VmbPixelFormatMono12p:
+      unpack12<false>(source, count, shift, destination);
+      break;
+    case VmbPixelFormatMono12Packed:
+      unpack12<true>(source, count, shift, destination);
+      break;
+    default:
+      unpack16(source, count, shift, destination);
+      break;
+  }
+  return true;
+}
+
+void OosVim::narrow(const uint16_t* source, size_t count, uint32_t shift, unsigned char* destination) {
+  size_t i = 0;
+#if defined(OOSVIM_UNPACK_SSE2)
+  // The pack saturates signed values, so the values are clamped to 255 first
+  const __m128i count128 = _mm_cvtsi32_si128(static_cast<int>(shift));
+  const __m128i maximum = _mm_set1_epi16(255);
+  for (; i + 16 <= count; i += 16) {
+    __m128i low = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)), count128);
+    __m128i high = _mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8)), count128);
+    low = _mm_subs_epu16(low, _mm_subs_epu16(low, maximum));
+    high = _mm_subs_epu16(high, _mm_subs_epu16(high, maximum));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(low, high));
+  }
+#elif defined(OOSVIM_UNPACK_NEON)
+  const int16x8_t count128 = vdupq_n_s16(-static_cast<int16_t>(shift));
+  for (; i + 16 <= count; i += 16) {
+    uint16x8_t low = vshlq_u16(vld1q_u16(source + i), count128);
+    uint16x8_t high = vshlq_u16(vld1q_u16(source + i + 8), count128);
+    vst1q_u8(destination + i, vcombine_u8(vqmovn_u16(low), vqmovn_u16(high)));
+  }
+#endif
+  for (; i < count; i++) {
+    uint32_t value = source[i] >> shift;
+    destination[i] = static_cast<unsigned char>(value > 255 ? 255 : value);
+  }
+}
+
+void OosVim::normalize(const uint16_t* source, size_t count, uint16_t maximum, float* destination) {
+  const float scale = maximum > 0 ? 1.0f / maximum : 0.0f;
+  for (size_t i = 0; i < count; i++) destination[i] = source[i] * scale;
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2022 Matthias Oostrik
+
+#include "OosVim/WorkerPool.h"
+
+using namespace OosVim;
+
+WorkerPool::WorkerPool(size_t size)
+    : running(true), generation(0), active(0), task(nullptr), count(0), next(0) {
+  for (size_t i = 1; i < size; i++) workers.emplace_back(&WorkerPool::worker, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  startSignal.notify_all();
+  for (auto& thread : workers) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+void WorkerPool::run(size_t _count, const std::function<void(size_t)>& _task) {
+  if (_count == 0) return;
+  if (workers.empty() || _count == 1) {
+    for (size_t i = 0; i < _count; i++) _task(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &_task;
+    count = _count;
+    next.store(0);
+    active = workers.size();
+    generation++;
+  }
+  startSignal.notify_all();
+
+  process();
+
+  // The task is owned by the caller, wait until no worker references it
+  std::unique_lock<std::mutex> lock(mutex);
+  doneSignal.wait(lock, [&] { return active == 0; });
+  task = nullptr;
+}
+
+void WorkerPool::worker() {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    startSignal.wait(lock, [&] { return !running || generation != seen; });
+    if (!running) return;
+    seen = generation;
+
+    lock.unlock();
+    process();
+    lock.lock();
+
+    if (--active == 0) doneSignal.notify_one();
+  }
+}
+
+void WorkerPool::process() {
+  for (size_t index = next.fetch_add(1); index < count; index = next.fetch_add(1)) (*task)(index);
+}
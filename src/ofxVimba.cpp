@@ -2,32 +2,95 @@
 
 #include "ofxVimba.h"
 
+#include "OosVim/Trace.h"
+
 using namespace ofxVimba;
 
 bool Grabber::updateFrame() {
-  std::shared_ptr<ofPixels> newPixels = nullptr;
-  {
-    std::lock_guard<std::mutex> lock(frameMutex);
-    newPixels.swap(receivedPixels);
-  }
-  if (newPixels) {
-    pixels.swap(newPixels);
-    return true;
-  }
-  return false;
+  OOSVIM_TRACE_SCOPE("ofxVimba::Grabber::update");
+  if (!handoff.take(image)) return false;
+  recordPickup(image->exposureTime, image->arrivalTime);
+  return true;
 }
 
 void Grabber::streamFrameCallBack(const std::shared_ptr<OosVim::Frame> frame) {
-  auto newPixels = std::make_shared<ofPixels>();
+  OOSVIM_TRACE_SCOPE("ofxVimba::Grabber::streamFrameCallBack");
+  auto colorPipeline = getColorPipeline();
+  if (colorPipeline && !OosVim::ColorPipeline::isSupported(frame->getImageFormat())) colorPipeline = nullptr;
   auto format = getOfPixelFormat(frame->getImageFormat());
-  if (format == OF_PIXELS_UNKNOWN) return;
+  if (format == OF_PIXELS_UNKNOWN && !colorPipeline) return;
 
   // The data from the frame should NOT be used outside the scope of this function.
-  // The setFromPixels method copies the pixel data.
-  newPixels->setFromPixels(frame->getImageData(), frame->getWidth(), frame->getHeight(), format);
+  // The setFromPixels method copies the pixel data into recycled pixels.
+  // Downsampling and unpacking write into the recycled pixels, which are only reallocated when the size changes
+  auto newImage = handoff.acquire();
+  auto bitDepth = OosVim::getUnpackBitDepth(frame->getImageFormat());
+  auto remapper = OosVim::getDownsampleChannels(frame->getImageFormat()) > 0 ? getRemapper() : nullptr;
+  newImage->bitDepth = bitDepth > 0 ? bitDepth : 8;
+
+  // The color pipeline converts into the recycled pixels and takes precedence
+  // over remapping. When either fails the frame is copied as it arrived.
+  bool processed = false;
+  if (colorPipeline) {
+    newImage->pixels.allocate(frame->getWidth(), frame->getHeight(), OF_PIXELS_RGB);
+    processed = colorPipeline->convert(*frame, newImage->pixels.getData());
+    if (!processed && !bConvertFailed) logger->warning("Color conversion failed, delivering the frames unconverted");
+    bConvertFailed = !processed;
+    if (!processed && format == OF_PIXELS_UNKNOWN) return;
+  }
+  if (!processed && remapper) {
+    // Remapping writes into the recycled pixels, downsampling is not applied
+    newImage->pixels.allocate(frame->getWidth(), frame->getHeight(), format);
+    processed = remapper->remap(*frame, newImage->pixels.getData());
+    if (!processed && !bRemapFailed) logger->warning("Remapping failed, delivering the frames unremapped");
+    bRemapFailed = !processed;
+  }
+  if (!processed) copyPixels(*frame, format, *newImage);
+
+  newImage->exposureTime = frame->getExposureTime();
+  newImage->arrivalTime = frame->getArrivalTime();
+  newImage->changeScore = frame->getChangeScore();
+  handoff.publish(newImage);
+}
 
-  std::lock_guard<std::mutex> lock(frameMutex);
-  receivedPixels.swap(newPixels);
+void Grabber::copyPixels(const OosVim::Frame& frame, ofPixelFormat format, Image& newImage) {
+  auto factor = getDownsample();
+  auto channels = OosVim::getDownsampleChannels(frame.getImageFormat());
+  auto bitDepth = OosVim::getUnpackBitDepth(frame.getImageFormat());
+  if (bitDepth > 0) {
+    bool scale = bScaleShortPixels.load();
+    auto& shortPixels = newImage.shortPixels;
+    shortPixels.allocate(frame.getWidth(), frame.getHeight(), format);
+    OosVim::unpack(frame.getImageData(), frame.getWidth(), frame.getHeight(), frame.getImageFormat(), scale,
+                   shortPixels.getData());
+    if (bFloatPixels) {
+      uint16_t maximum = static_cast<uint16_t>(((1 << bitDepth) - 1) << (scale ? 16 - bitDepth : 0));
+      newImage.floatPixels.allocate(frame.getWidth(), frame.getHeight(), format);
+      OosVim::normalize(shortPixels.getData(), shortPixels.getTotalBytes() / sizeof(uint16_t), maximum,
+                        newImage.floatPixels.getData());
+    }
+
+    // The 8 bit pixels keep ofVideoGrabber and getPixels working
+    size_t count = shortPixels.getTotalBytes() / sizeof(uint16_t);
+    uint32_t shift = scale ? 8 : bitDepth - 8;
+    auto unpackChannels = OosVim::getUnpackChannels(frame.getImageFormat());
+    if (factor > 1) {
+      newImage.narrowed.resize(count);
+      OosVim::narrow(shortPixels.getData(), count, shift, newImage.narrowed.data());
+      newImage.pixels.allocate(frame.getWidth() / factor, frame.getHeight() / factor, format);
+      OosVim::downsample(newImage.narrowed.data(), frame.getWidth(), frame.getHeight(), unpackChannels, factor,
+                         newImage.pixels.getData());
+    } else {
+      newImage.pixels.allocate(frame.getWidth(), frame.getHeight(), format);
+      OosVim::narrow(shortPixels.getData(), count, shift, newImage.pixels.getData());
+    }
+  } else if (factor > 1 && channels > 0) {
+    newImage.pixels.allocate(frame.getWidth() / factor, frame.getHeight() / factor, format);
+    OosVim::downsample(frame.getImageData(), frame.getWidth(), frame.getHeight(), channels, factor,
+                       newImage.pixels.getData());
+  } else {
+    newImage.pixels.setFromPixels(frame.getImageData(), frame.getWidth(), frame.getHeight(), format);
+  }
 }
 
 void Grabber::setDesiredPixelFormat(ofPixelFormat format) {
@@ -44,6 +107,7 @@ ofPixelFormat Grabber::getDesiredPixelFormat() {
 }
 
 std::vector<ofVideoDevice> Grabber::listDevices() const {
+  auto deviceList = getDeviceList();
   printDeviceList(deviceList);
   std::vector<ofVideoDevice> deviceListOF;
   for (auto& device : deviceList) {
@@ -1,18 +1,32 @@
 // Copyright (C) 2022 Matthias Oostrik
 //
 // OpenFrameworks implementation of the OosVim Grabber
-// Note that only 3 pixelformats are supported, others can be added
+// Mono8, RGB8 and BGR8 are delivered as ofPixels. Mono10, Mono12, Mono14,
+// Mono16, their packed variants, RGB12 and RGB16 are delivered as ofShortPixels
+// and optionally as normalized ofFloatPixels, the ofPixels hold them shifted
+// to 8 bit.
+// With a color pipeline Bayer 8 bit and 8 bit color frames are delivered as
+// RGB ofPixels.
 
 #pragma once
 
 #include "ofMain.h"
+#include "OosVim/Downsample.h"
 #include "OosVim/Grabber.h"
+#include "OosVim/Handoff.h"
+#include "OosVim/Unpack.h"
 
 namespace ofxVimba {
 
 class Grabber : public OosVim::Grabber {
 public:
-  Grabber() : pixels(std::make_shared<ofPixels>()), bNewFrame(false) { }
+  Grabber()
+      : bNewFrame(false),
+        bScaleShortPixels(true),
+        bFloatPixels(false),
+        bConvertFailed(false),
+        bRemapFailed(false),
+        image(std::make_shared<Image>()) {}
   virtual ~Grabber() { OosVim::Grabber::stop(); }
 
   void setup() { OosVim::Grabber::start(); }
@@ -21,9 +35,32 @@ public:
 
   bool isFrameNew() const { return bNewFrame; }
 
-  const ofPixels& getPixels() const { return *pixels; }
-  ofPixels& getPixels() { return *pixels; }
+  const ofPixels& getPixels() const { return image->pixels; }
+  ofPixels& getPixels() { return image->pixels; }
 
+  // High bit depth formats, see isHighBitDepth. Downsampling only applies to
+  // the 8 bit pixels.
+  const ofShortPixels& getShortPixels() const { return image->shortPixels; }
+  ofShortPixels& getShortPixels() { return image->shortPixels; }
+  const ofFloatPixels& getFloatPixels() const { return image->floatPixels; }
+  ofFloatPixels& getFloatPixels() { return image->floatPixels; }
+
+  bool isHighBitDepth() const { return image->bitDepth > 8; }
+  uint32_t getBitDepth() const { return image->bitDepth; }
+
+  // Score of the change detector, -1 without a detector
+  float getChangeScore() const { return image->changeScore; }
+
+  // Shift the short pixels to the full 16 bit range, otherwise they hold the camera counts
+  void setScaleShortPixels(bool value) { bScaleShortPixels = value; }
+  bool isScaleShortPixels() const { return bScaleShortPixels.load(); }
+
+  // Also convert high bit depth frames to float pixels between 0 and 1
+  void setFloatPixels(bool value) { bFloatPixels = value; }
+  bool isFloatPixels() const { return bFloatPixels.load(); }
+
+  // Formats such as "Mono12" have no ofPixelFormat, set them by name
+  using OosVim::Grabber::setDesiredPixelFormat;
   void setDesiredPixelFormat(ofPixelFormat format);
   ofPixelFormat getDesiredPixelFormat();
   std::vector<ofVideoDevice> listDevices() const;
@@ -41,10 +78,27 @@ private:
   bool updateFrame() override;
   void streamFrameCallBack(const std::shared_ptr<OosVim::Frame> frame) override;
 
+  struct Image {
+    ofPixels pixels;
+    ofShortPixels shortPixels;
+    ofFloatPixels floatPixels;
+    std::vector<unsigned char> narrowed;  // full size 8 bit values before downsampling
+    uint32_t bitDepth = 8;
+    uint64_t exposureTime = 0;
+    uint64_t arrivalTime = 0;
+    float changeScore = -1;
+  };
+
+  // Unpack, downsample or copy the frame as it arrived
+  void copyPixels(const OosVim::Frame& frame, ofPixelFormat format, Image& newImage);
+
   bool bNewFrame;
-  std::mutex frameMutex;
-  std::shared_ptr<ofPixels> pixels;
-  std::shared_ptr<ofPixels> receivedPixels;
+  std::atomic<bool> bScaleShortPixels;
+  std::atomic<bool> bFloatPixels;
+  bool bConvertFailed;  // only used from the frame delivery thread
+  bool bRemapFailed;
+  std::shared_ptr<Image> image;
+  OosVim::Handoff<Image> handoff;
 };
 
 static inline string getVimbaPixelFormat(ofPixelFormat format) {
@@ -63,8 +117,17 @@ static inline string getVimbaPixelFormat(ofPixelFormat format) {
 static inline ofPixelFormat getOfPixelFormat(VmbPixelFormatType format) {
   switch (format) {
     case VmbPixelFormatMono8:
+    case VmbPixelFormatMono10:
+    case VmbPixelFormatMono10p:
+    case VmbPixelFormatMono12:
+    case VmbPixelFormatMono12p:
+    case VmbPixelFormatMono12Packed:
+    case VmbPixelFormatMono14:
+    case VmbPixelFormatMono16:
       return OF_PIXELS_GRAY;
     case VmbPixelFormatRgb8:
+    case VmbPixelFormatRgb12:
+    case VmbPixelFormatRgb16:
       return OF_PIXELS_RGB;
     case VmbPixelFormatBgr8:
       return OF_PIXELS_BGR;
@@ -74,9 +137,10 @@ static inline ofPixelFormat getOfPixelFormat(VmbPixelFormatType format) {
 }
 
 static inline ofPixelFormat getOfPixelFormat(string format) {
-  if (format == "Mono8") {
+  if (format == "Mono8" || format == "Mono10" || format == "Mono10p" || format == "Mono12" ||
+      format == "Mono12p" || format == "Mono12Packed" || format == "Mono14" || format == "Mono16") {
     return OF_PIXELS_GRAY;
-  } else if (format == "RGB8Packed") {
+  } else if (format == "RGB8Packed" || format == "RGB12" || format == "RGB16") {
     return OF_PIXELS_RGB;
   } else if (format == "BGR8Packed") {
     return OF_PIXELS_BGR;
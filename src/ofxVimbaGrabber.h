@@ -28,10 +28,10 @@ public:
  void update() override {
    grabber->update();
    if (grabber->isFrameNew()) {
-     auto pixels = grabber->getPixels();
-     auto w = pixels.getWidth();
-     auto h = pixels.getHeight();
-     auto f = pixels.getPixelFormat();
+     bool high = grabber->isHighBitDepth();
+     auto w = high ? grabber->getShortPixels().getWidth() : grabber->getPixels().getWidth();
+     auto h = high ? grabber->getShortPixels().getHeight() : grabber->getPixels().getHeight();
+     auto f = high ? grabber->getShortPixels().getPixelFormat() : grabber->getPixels().getPixelFormat();
      if (w != width || h != height) bResolutionChanged = true;
      if (f != pixelFormat) bFormatChanged = true;
      width = w;
@@ -52,7 +52,34 @@ public:
   void setDeviceID(string Id)                         { grabber->setDeviceID(Id); }
   void setMulticast(bool value)                       { grabber->setMulticast(value); }
   void setReadOnly(bool value)                        { grabber->setReadOnly(value); }
+  void setChunkMode(bool value)                       { grabber->setChunkMode(value); }
+  void setLatencyMode(bool value)                     { grabber->setLatencyMode(value); }
   void setLoadUserSet(int setToLoad = 1)              { grabber->setLoadUserSet(setToLoad); }
+  void setDecimation(unsigned int n)                  { grabber->setDecimation(n); }
+  void setMaxDeliveryRate(double rate)                { grabber->setMaxDeliveryRate(rate); }
+  void setDownsample(unsigned int factor)             { grabber->setDownsample(factor); }
+  void setScaleShortPixels(bool value)                { grabber->setScaleShortPixels(value); }
+  void setFloatPixels(bool value)                     { grabber->setFloatPixels(value); }
+  void setImageStatistics(bool value, const OosVim::StatisticsSettings& settings = OosVim::StatisticsSettings())
+                                                      { grabber->setImageStatistics(value, settings); }
+  void setHostAutoExposure(bool value, const OosVim::ExposureSettings& settings = OosVim::ExposureSettings())
+                                                      { grabber->setHostAutoExposure(value, settings); }
+  void setRemapper(std::shared_ptr<OosVim::Remapper> remapper)
+                                                      { grabber->setRemapper(remapper); }
+  void setColorPipeline(std::shared_ptr<OosVim::ColorPipeline> pipeline)
+                                                      { grabber->setColorPipeline(pipeline); }
+  void setChangeDetector(std::shared_ptr<OosVim::ChangeDetector> detector)
+                                                      { grabber->setChangeDetector(detector); }
+  void setBracketing(const std::vector<double>& exposures)
+                                                      { grabber->setBracketing(exposures); }
+  void setHdrMerger(std::shared_ptr<OosVim::HdrMerger> merger)
+                                                      { grabber->setHdrMerger(merger); }
+  void setTriggerScheduler(std::shared_ptr<OosVim::TriggerScheduler> scheduler)
+                                                      { grabber->setTriggerScheduler(scheduler); }
+  void setEventChannel(std::shared_ptr<OosVim::EventChannel> channel)
+                                                      { grabber->setEventChannel(channel); }
+  void setThreadPolicy(OosVim::ThreadRole role, const OosVim::ThreadPolicy& policy)
+                                                      { grabber->setThreadPolicy(role, policy); }
 
   void setExposure(int exposure)                      { grabber->setExposure(exposure); }
   void setGain(int gain)                              { grabber->setGain(gain); }
@@ -67,16 +94,27 @@ public:
 
   bool isMultiCast()                                  { return grabber->isMultiCast(); }
   bool isReadOnly()                                   { return grabber->isReadOnly(); }
+  bool isChunkMode()                                  { return grabber->isChunkMode(); }
+  bool isLatencyMode()                                { return grabber->isLatencyMode(); }
+  bool isImageStatistics()                            { return grabber->isImageStatistics(); }
+  bool isHostAutoExposure()                           { return grabber->isHostAutoExposure(); }
+  bool isBracketing()                                 { return grabber->isBracketing(); }
   int  getUserSet()                                   { return grabber->getUserSet(); }
 
   float getWidth() const override                     { return width; }
   float getHeight() const override                    { return height; }
   float getFrameRate() const                          { return grabber->getFrameRate(); }
   string getDeviceId()                                { return grabber->getDeviceId(); };
+  std::vector<OosVim::ThreadPlacement> getThreadPlacements() { return grabber->getThreadPlacements(); }
 
   ofPixelFormat getPixelFormat() const override       { return pixelFormat; }
   const ofPixels& getPixels() const override          { return grabber->getPixels(); }
   ofPixels &getPixels() override                      { return grabber->getPixels(); }
+  const ofShortPixels& getShortPixels() const         { return grabber->getShortPixels(); }
+  const ofFloatPixels& getFloatPixels() const         { return grabber->getFloatPixels(); }
+  bool isHighBitDepth() const                         { return grabber->isHighBitDepth(); }
+  float getChangeScore() const                        { return grabber->getChangeScore(); }
+  OosVim::FrameStatistics getImageStatistics()        { return grabber->getImageStatistics(); }
 
   vector<ofVideoDevice> listDevices() const override  { return grabber->listDevices(); }
 